@@ -0,0 +1,49 @@
+//
+//  autotuner.h
+//  Non Euclidean
+//
+//  Picks the work-group size and the pixel traversal order of the kernels per device.
+//
+
+#ifndef autotuner_h
+#define autotuner_h
+
+#include <string>
+#include <map>
+#include <functional>
+
+// include the OpenCL library (C++ binding)
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include "cl2.hpp"
+
+enum TraversalOrder { o_rows, o_morton }; // has to match ORDER_ROWS, ORDER_MORTON in the kernel
+
+struct LaunchConfig {
+    TraversalOrder order;
+    size_t local_x, local_y; // 0 lets the driver pick the work-group size
+    
+    LaunchConfig(TraversalOrder order = o_rows, size_t local_x = 0, size_t local_y = 0) : order(order), local_x(local_x), local_y(local_y) {}
+    
+    cl::NDRange getGlobal(int width, int height) const;
+    cl::NDRange getLocal() const;
+    std::string describe() const;
+};
+
+class Autotuner {
+private:
+    std::string cache_path;
+    std::map<std::string, LaunchConfig> cache;
+    
+    void loadCache();
+    void saveCache() const;
+    
+public:
+    Autotuner(const std::string& cache_path);
+    
+    // benchmark returns the time of a launch in seconds
+    LaunchConfig tune(const cl::Device& device, const cl::Kernel& kernel, const std::string& kernel_name, int width, int height, const std::function<double(const LaunchConfig&)>& benchmark);
+};
+
+#endif /* autotuner_h */
@@ -43,12 +43,16 @@ public:
     void setFasterSpeed(bool speed_up);
     void setSlowerSpeed(bool speed_down);
     void setSize(float new_aspect);
+    void setView(const glm::vec3& pos, float new_yaw, float new_pitch, float new_fov);
     
     /*inline glm::vec3 getLLC() const { return lower_left_corner; }
     inline glm::vec3 getPos() const { return position; }
     inline glm::vec3 getHor() const { return horizontal; }
     inline glm::vec3 getVer() const { return vertical; }*/
     
+    inline glm::vec3 getPos() const { return position; }
+    glm::vec3 getRayDir(float s, float t) const;
+    
     float* transferData() const;
 };
 
@@ -0,0 +1,49 @@
+//
+//  camerapath.h
+//  Non Euclidean
+//
+//  Keyframed camera path, interpolated with a Catmull-Rom spline.
+//
+
+#ifndef camerapath_h
+#define camerapath_h
+
+#include <string>
+#include <vector>
+
+#include "glm.hpp"
+#include "camera.h"
+#include "framewriter.h"
+
+struct Keyframe {
+    float time;
+    glm::vec3 pos;
+    float yaw, pitch, fov; // in degrees, as used by the camera
+    
+    Keyframe(float time, const glm::vec3& pos, float yaw, float pitch, float fov) : time(time), pos(pos), yaw(yaw), pitch(pitch), fov(fov) {}
+};
+
+class CameraPath {
+private:
+    std::vector<Keyframe> keyframes;
+    
+    float fps = 30.0f;
+    unsigned int samples = 64; // per frame
+    float error = 0.0f; // relative RMS change between two checks which ends a frame early, 0 renders all the samples
+    int formats = f_png;
+    
+public:
+    void load(const std::string& path);
+    
+    Keyframe sample(float time) const;
+    void apply(float time, Camera* camera) const;
+    
+    unsigned int getFrameCount() const;
+    inline float getDuration() const { return keyframes.back().time - keyframes.front().time; }
+    inline float getFrameTime(unsigned int frame) const { return keyframes.front().time + frame / fps; }
+    inline unsigned int getSamples() const { return samples; }
+    inline float getError() const { return error; }
+    inline int getFormats() const { return formats; }
+};
+
+#endif /* camerapath_h */
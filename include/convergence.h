@@ -0,0 +1,59 @@
+//
+//  convergence.h
+//  Non Euclidean
+//
+//  Measures the error against cached reference images at fixed wall-clock checkpoints.
+//
+
+#ifndef convergence_h
+#define convergence_h
+
+#include <string>
+#include <vector>
+
+#include "glm.hpp"
+#include "raytracer.h"
+
+struct BenchView {
+    std::string scene_path;
+    glm::vec3 pos;
+    float yaw, pitch, fov;
+};
+
+struct ErrorSample {
+    double time; // seconds of rendering, without the read backs
+    unsigned int samples;
+    double rmse, rel_mse;
+};
+
+class ConvergenceBench {
+private:
+    std::vector<BenchView> views;
+    std::vector<double> checkpoints; // seconds
+    unsigned int reference_samples = 4096;
+    float tolerance = 1.1f; // allowed ratio of the time to quality to the one of the baseline
+    int width = 640, height = 400;
+    std::string output_dir;
+    
+    std::string getReferencePath(const BenchView& view) const;
+    std::string getCurvePath(const std::string& label, size_t view_ID) const;
+    
+    void renderReference(const char* kernel_path, const BenchView& view, std::vector<float>& reference) const;
+    std::vector<ErrorSample> measure(RayTracer* ray_tracer, Camera* camera, const std::vector<float>& reference) const;
+    
+    static void computeError(const std::vector<float>& image, const std::vector<float>& reference, double& rmse, double& rel_mse);
+    static double getTimeToQuality(const std::vector<ErrorSample>& curve, double rel_mse);
+    static bool readPFM(const std::string& path, int width, int height, std::vector<float>& pixels);
+    static bool readCurve(const std::string& path, std::vector<ErrorSample>& curve);
+    static void writeCurve(const std::string& path, const std::vector<ErrorSample>& curve);
+    
+public:
+    ConvergenceBench(const std::string& output_dir = "convergence");
+    
+    void load(const std::string& path);
+    
+    // writes the curves under the label, false when the time to quality regressed against the baseline
+    bool run(const char* kernel_path, bool compact_storage, const std::string& label, const std::string& baseline_label = "");
+};
+
+#endif /* convergence_h */
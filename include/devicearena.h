@@ -0,0 +1,67 @@
+//
+//  devicearena.h
+//  Non Euclidean
+//
+//  One device buffer suballocated into aligned blocks, which are addressed by their offsets.
+//
+
+#ifndef devicearena_h
+#define devicearena_h
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// include the OpenCL library (C++ binding)
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include "cl2.hpp"
+
+#define ARENA_MIN_ALIGNMENT 128 // bytes, enough for any vector type
+#define ARENA_HEADROOM_FRACTION 8 // part of the size reserved on top of it, so that small changes do not move anything
+#define ARENA_GROWTH 2
+
+struct ArenaBlock {
+    std::string name;
+    size_t offset = 0;
+    size_t size = 0; // in use
+    size_t capacity = 0; // reserved
+};
+
+class DeviceArena {
+private:
+    cl::Context context;
+    cl::Buffer buffer;
+    size_t capacity = 0;
+    size_t top = 0; // end of the last block
+    size_t alignment = ARENA_MIN_ALIGNMENT;
+    cl_ulong device_memory = 0, max_alloc = 0;
+    
+    std::vector<ArenaBlock> blocks;
+    std::vector<std::pair<size_t, size_t>> free_ranges; // offset and size of the space left by the moved blocks
+    
+    size_t findRange(size_t size);
+    bool grow(cl::CommandQueue& queue, size_t min_capacity);
+    
+public:
+    DeviceArena(const std::vector<std::string>& block_names);
+    
+    void init(cl::Context& context, cl::Device& device);
+    
+    // the functions below return true when the buffer was created again and has to be bound to the kernels
+    bool layout(const std::vector<size_t>& sizes); // places all the blocks one after another, the contents are lost
+    bool resize(cl::CommandQueue& queue, cl_uint block_ID, size_t size, bool keep_contents = true);
+    
+    void write(cl::CommandQueue& queue, cl_uint block_ID, size_t offset, size_t size, const void* data, bool blocking = true);
+    void report() const;
+    
+    inline size_t align(size_t size) const { return (size + alignment - 1) / alignment * alignment; }
+    inline size_t getOffset(cl_uint block_ID) const { return blocks[block_ID].offset; }
+    inline size_t getUsedSize() const { return top; }
+    inline cl_ulong getMaxSize() const { return max_alloc; }
+    inline cl_ulong getDeviceMemory() const { return device_memory; }
+    inline cl::Buffer& getBuffer() { return buffer; }
+};
+
+#endif /* devicearena_h */
@@ -0,0 +1,55 @@
+//
+//  framewriter.h
+//  Non Euclidean
+//
+//  Encodes captured frames and writes them to disk on a background thread.
+//
+
+#ifndef framewriter_h
+#define framewriter_h
+
+#include <string>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+enum FrameFormat { f_pfm = 1, f_png = 2, f_hdr = 4 }; // can be combined
+
+struct FrameJob {
+    std::string path; // without the extension
+    int width, height;
+    const float* pixels; // RGBA as stored by the kernels (sqrt gamma), the bottom row first
+    int formats;
+    std::function<void()> on_done; // called on the writer thread once the pixels are no longer needed
+};
+
+class FrameWriter {
+private:
+    std::thread worker;
+    std::queue<FrameJob> jobs;
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_condition;
+    size_t max_queued;
+    size_t writing;
+    bool stopping;
+    
+    void work();
+    void encode(const FrameJob& job) const;
+    
+    static bool writePNG(const std::string& path, int width, int height, const float* pixels);
+    static bool writeHDR(const std::string& path, int width, int height, const float* pixels);
+    
+public:
+    FrameWriter(size_t max_queued = 0); // 0 does not limit the queue
+    ~FrameWriter(); // writes out the queued frames first
+    
+    void write(const FrameJob& job); // blocks while the queue is full
+    void flush();
+    
+    static bool writePFM(const std::string& path, int width, int height, const float* pixels);
+    static bool writeGreyPFM(const std::string& path, int width, int height, const float* values, int stride); // every stride-th float, unchanged
+};
+
+#endif /* framewriter_h */
@@ -16,6 +16,8 @@
 #include "cl2.hpp"
 #include "opencl_error.h"
 
+#define GL_SHARING_EXTENSION "cl_khr_gl_sharing"
+
 // include project libraries
 #include "camera.h"
 
@@ -23,19 +25,24 @@ class KernelGL {
 private:
     std::string loadSource(const char* kernel_path);
     void initialiseOpenCL();
-    void buildProgram(const char* kernel_path);
+    void buildProgram(const char* kernel_path, const char* build_options);
     
 protected:
     cl::Device device;
     cl::Context context;
     cl::Program program;
+    bool gl_sharing; // the context shares the OpenGL objects, otherwise the images are copied through the host
+    
+    static bool fatal_errors; // false rethrows the errors, the render service fails only the job
     
     void processError(cl::Error& e);
     
 public:
-    KernelGL(const char* kernel_path);
+    KernelGL(const char* kernel_path, const char* build_options = nullptr);
     virtual ~KernelGL() {}
     
+    static inline void setFatalErrors(bool fatal) { fatal_errors = fatal; }
+    
     //virtual void iterate(int steps = 1) = 0;
     //virtual void draw(const Camera* const) = 0;
 };
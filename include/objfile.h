@@ -0,0 +1,65 @@
+//
+//  objfile.h
+//  Non Euclidean
+//
+//  Parses Wavefront OBJ files mapped into memory, in chunks split at the line boundaries and read on the pool.
+//
+
+#ifndef objfile_h
+#define objfile_h
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "glm.hpp"
+#include "threadpool.h"
+
+#define OBJ_MIN_CHUNK_SIZE (1 << 20) // bytes, smaller files are not split
+#define OBJ_CHUNKS_PER_THREAD 4 // the lines differ in cost, more chunks even out the load
+#define OBJ_NO_INDEX 0xffffffff
+
+struct ObjCorner {
+    unsigned int position;
+    unsigned int uv; // OBJ_NO_INDEX when the face has no texture coords
+};
+
+// consecutive faces of one material, in the file order
+struct ObjRun {
+    unsigned int material; // index of the name, 0 before the first usemtl
+    size_t first_face, face_count;
+};
+
+// a part of the file, counted in the first pass and written at its offsets in the second
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    size_t position_count = 0, uv_count = 0, face_count = 0;
+    size_t first_position = 0, first_uv = 0, first_face = 0;
+    std::vector<std::pair<size_t, std::string>> materials; // usemtl at a face of the chunk
+    std::vector<std::string> libraries;
+    std::string error;
+};
+
+class ObjFile {
+private:
+    std::string error;
+    
+    void countChunk(ObjChunk& chunk) const;
+    void readChunk(ObjChunk& chunk);
+    void readLibrary(const std::string& path);
+    
+public:
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs; // as in the file, not flipped
+    std::vector<ObjCorner> corners; // three per face, the polygons are split into fans
+    std::vector<ObjRun> runs;
+    std::vector<std::string> material_names; // the first one is the default ""
+    std::map<std::string, std::string> textures; // the diffuse map of every material of the libraries
+    
+    bool load(const std::string& path, ThreadPool& pool); // false when the file cannot be read or is malformed
+    
+    inline const std::string& getError() const { return error; }
+};
+
+#endif /* objfile_h */
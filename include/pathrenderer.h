@@ -0,0 +1,37 @@
+//
+//  pathrenderer.h
+//  Non Euclidean
+//
+//  Renders the frames of a camera path to disk, resuming an interrupted run.
+//
+
+#ifndef pathrenderer_h
+#define pathrenderer_h
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+
+#include "camerapath.h"
+#include "raytracer.h"
+
+class PathRenderer {
+private:
+    const CameraPath& path;
+    std::string output_dir;
+    std::string stats_path;
+    std::mutex stats_mutex;
+    
+    unsigned int findFirstFrame() const;
+    
+public:
+    PathRenderer(const CameraPath& path, const std::string& output_dir);
+    
+    // present is called after every sample, rendering stops when it returns false
+    void render(RayTracer* ray_tracer, Camera* camera, const std::function<bool()>& present);
+    
+    static float getChange(const std::vector<float>& a, const std::vector<float>& b); // relative RMS difference of two read back images
+};
+
+#endif /* pathrenderer_h */
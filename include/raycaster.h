@@ -0,0 +1,91 @@
+//
+//  raycaster.h
+//  Non Euclidean
+//
+//  Host-side ray queries over the scene data, used for picking and tooling.
+//
+
+#ifndef raycaster_h
+#define raycaster_h
+
+#include <vector>
+
+#include "glm.hpp"
+#include "scene.h"
+
+enum HitType { h_none, h_sphere, h_plane, h_lens, h_triangle, h_box, h_cylinder, h_disc, h_quadric };
+
+struct HostRay {
+    glm::vec3 origin;
+    glm::vec3 dir; // has to be normalized
+    
+    HostRay() {}
+    HostRay(const glm::vec3& origin, const glm::vec3& dir) : origin(origin), dir(dir) {}
+};
+
+struct HostHit {
+    float t;
+    glm::vec3 p;
+    glm::vec3 normal;
+    cl_uint mat_ID;
+    HitType type;
+    cl_uint object_ID; // index of the sphere, plane, lens, analytic primitive or model
+    cl_uint primitive_ID; // index of the triangle (triangles only)
+};
+
+class RayCaster {
+private:
+    // SoA copies of the scene, padded to a multiple of the SIMD width
+    size_t sphere_count = 0, plane_count = 0, lens_count = 0, triangle_count = 0;
+    
+    std::vector<float> sphere_x, sphere_y, sphere_z, sphere_r;
+    std::vector<cl_uint> sphere_mat;
+    
+    std::vector<float> plane_x, plane_y, plane_z, plane_nx, plane_ny, plane_nz;
+    std::vector<cl_uint> plane_mat;
+    
+    std::vector<float> lens_p1x, lens_p1y, lens_p1z, lens_p2x, lens_p2y, lens_p2z, lens_r1, lens_r2;
+    std::vector<cl_uint> lens_mat;
+    
+    std::vector<float> tri_ax, tri_ay, tri_az, tri_e1x, tri_e1y, tri_e1z, tri_e2x, tri_e2y, tri_e2z;
+    std::vector<cl_uint> tri_mat, tri_model;
+    
+    // the analytic primitives are few and costly per test, they stay scalar
+    std::vector<Box> boxes;
+    std::vector<Cylinder> cylinders;
+    std::vector<Disc> discs;
+    std::vector<Quadric> quadrics;
+    
+    bool hitSphere(size_t i, const HostRay& r, float& t) const;
+    bool hitPlane(size_t i, const HostRay& r, float& t) const;
+    bool hitLens(size_t i, const HostRay& r, float& t, bool& first_sphere) const;
+    bool hitTriangle(size_t i, const HostRay& r, float& t) const;
+    bool hitBox(size_t i, const HostRay& r, float& t, glm::vec3& normal) const;
+    bool hitCylinder(size_t i, const HostRay& r, float& t, glm::vec3& normal) const;
+    bool hitDisc(size_t i, const HostRay& r, float& t, glm::vec3& normal) const;
+    bool hitQuadric(size_t i, const HostRay& r, float& t, glm::vec3& normal) const;
+    
+    void closestAnalytic(const HostRay& r, HostHit& hit) const;
+    bool anyAnalytic(const HostRay& r, float max_t) const;
+    
+    void finaliseHit(const HostRay& r, HostHit& hit) const;
+    
+public:
+    void build(const SceneCreator& scene);
+    
+    // SIMD (SSE / AVX2) queries, falling back to the scalar ones if no vector unit is available
+    bool closestHit(const HostRay& r, HostHit& hit) const;
+    bool anyHit(const HostRay& r, float max_t) const;
+    void closestHits(const HostRay* rays, HostHit* hits, bool* results, size_t count) const;
+    void anyHits(const HostRay* rays, const float* max_t, bool* results, size_t count) const;
+    
+    // reference implementation, a direct port of the kernel intersection routines
+    bool closestHitScalar(const HostRay& r, HostHit& hit) const;
+    bool anyHitScalar(const HostRay& r, float max_t) const;
+    
+    void benchmark(size_t ray_count, unsigned int seed = 0) const;
+    
+    static int getSIMDWidth();
+};
+
+#endif /* raycaster_h */
@@ -13,37 +13,152 @@
 #include "glm.hpp"
 #include "screen.h"
 #include "scene.h"
+#include "raycaster.h"
+#include "autotuner.h"
+#include "framewriter.h"
+#include "scenewatcher.h"
+#include "triplebuffer.h"
+
+#include <atomic>
+
+#define CAPTURE_SLOTS 2
+#define DEFAULT_SCENE_PATH "assets/scenes/scene.scene"
+#define COST_CHANNELS 8 // time, bounces, sphere, plane, lens, triangle, analytic and chunk tests, keep in sync with kernels/raytracer.cl
+#define COST_TRIANGLES 5
+#define COST_CHUNKS 7
+#define BIN_TILE_SIZE 16 // keep in sync with kernels/raytracer.cl
+#define BIN_CAPACITY 255
+#define JITTER_POSITIONS 4 // keep in sync with kernels/raytracer.cl
+#define PRIMARY_HIT_SIZE 32 // sizeof(PrimaryHit) in kernels/raytracer.cl
+#define HIT_CACHE_MEMORY_FRACTION 8 // part of the device memory the cached hits may use, fewer jitter positions are cached above it
+
+enum ResolutionScale { r_full, r_checkerboard, r_half, r_quarter }; // traced fraction: 1, 1/2, 1/4, 1/16
+
+struct CaptureSlot {
+    cl::Image2D image; // device copy of the frame, the GL image can be rendered to while it is read
+    cl::Buffer staging; // pinned host memory, mapped for the lifetime of the slot
+    float* data = nullptr;
+    cl::Event event;
+    FrameJob job;
+    std::function<void(bool)> on_written; // false when the frame could not be read back
+    bool reading = false;
+    std::atomic<bool> busy{false}; // until the writer is done with the data
+};
+
+struct DisplaySlot {
+    cl_GLuint texture_ID;
+    cl::ImageGL image; // a copy of a finished frame, drawn while the next one is traced
+    
+    // without GL sharing the frame is read into a pixel buffer mapped for the lifetime of the slot and the texture copies from it,
+    // drivers without buffer storage read it into pinned memory which is copied into the pixel buffer
+    cl::Buffer staging;
+    float* data = nullptr;
+    cl_GLuint pbo;
+};
 
 class RayTracer : KernelGL {
 private:
     int width, height;
+    std::string scene_path;
     
     cl_uint sample_counter;
     
-    cl_GLuint texture_ID;
+    TripleBuffer<DisplaySlot> display_slots; // the renderer publishes frames, the display draws the newest one
+    bool persistent_pbo = false; // the display slots are mapped pixel buffers
+    
+    cl::Kernel trace_kernel, retrace_kernel, resolve_kernel, reproject_kernel, heatmap_kernel, binning_kernel;
+    cl::CommandQueue queue;
+    cl::Image2D image; // accumulated samples
+    cl::Image2D sample_image; // samples traced at a reduced resolution, upscaled into image
+    cl::Image2D history_image; // accumulated image of the previous view
+    cl::Image2D gbuffers[2]; // first hit normal and distance of the previous and the current view
+    cl::Buffer bin_buffer; // the primitives which may be hit by the primary rays of every screen tile
+    cl_uint tile_count;
     
-    cl::Kernel trace_kernel, retrace_kernel;
-    cl::ImageGL image;
-    cl::Buffer scene_buffer, random_buffer, camera_buffer;
+    // the first hit of every pixel and sub-pixel position, valid while its generation is the current one
+    cl::Buffer hit_cache;
+    cl_uint hit_generation;
+    cl_uint jitter_count; // 1 traces every sample through the same point of the pixel
+    cl_uint jitter_positions; // requested, jitter_count is how many fit in the hit cache
+    
+    // the heatmap build keeps the mean cost of every pixel and shows one of the counters instead of the colour
+    bool heatmap;
+    cl_uint heatmap_channel;
+    cl::Buffer cost_buffer, cost_max_buffer;
+    cl::Buffer scene_buffer, random_buffer, camera_buffer, prev_camera_buffer;
     size_t image_size, buff_size;
     
     SceneCreator scene;
+    RayCaster caster;
+    SceneWatcher watcher;
+    
+    Autotuner autotuner;
+    LaunchConfig trace_config, retrace_config;
+    bool tuned;
+    
+    // the resolution is lowered while the camera moves to meet the target frame time
+    ResolutionScale resolution;
+    float target_frame_time;
+    float full_frame_time; // estimated time of a frame at the full resolution
+    cl_uint frame_counter;
+    
+    cl_uint gbuffer_index;
+    bool history_valid;
+    
+    // cost of moving the frames to the display, the device side is timed on the render thread and the upload on the display thread
+    double present_time, upload_time;
+    cl_uint present_count, upload_count;
+    
+    cl::CommandQueue capture_queue;
+    CaptureSlot capture_slots[CAPTURE_SLOTS];
+    FrameWriter frame_writer;
     
     void createGLTextures();
+    void releaseImages();
     void createGLBuffers();
     void createCLBuffers();
     void createKernels();
     void setKernelArgs();
+    void tuneKernels(const Camera* camera);
+    void binTiles(cl::CommandQueue& queue); // after the camera was written
+    void createHitCache();
+    void invalidateHits(); // the camera or the scene changed
+    double timeKernel(cl::CommandQueue& queue, cl::Kernel& kernel, cl_uint order_arg, const LaunchConfig& config);
+    void trace(const Camera* camera, ResolutionScale scale, bool keep_history = true);
+    void updateResolution(ResolutionScale scale, float frame_time);
+    void present();
+    void watchScene();
     
 public:
-    RayTracer(int w, int h, const char* kernel_path);
+    RayTracer(int w, int h, const char* kernel_path, bool compact_storage = false, const std::string& scene_path = DEFAULT_SCENE_PATH, bool heatmap = false); // compact: quantized geometry, half float texture coords and textures
     ~RayTracer();
 
     void render(const Camera* camera);
     void renderAgain(const Camera* camera);
-    void transferImage(Screen* screen, const char* shader_tex_id);
+    void restart(const Camera* camera); // full resolution, no history
+    void transferImage(Screen* screen, const char* shader_tex_id); // display thread, binds the newest finished frame
     void setTime(float time);
-    void resize(int w, int h);
+    void resize(int w, int h); // keeps the program and the scene
+    void setTargetFrameTime(float frame_time);
+    void setJitter(bool jitter); // the samples of a pixel cycle through JITTER_POSITIONS sub-pixel positions
+    bool updateScene(); // reloads the scene if its files changed, true when the image has to be restarted
+    
+    // the frame is copied on the device, read back and written to disk in the background
+    bool capture(const std::string& path, int formats = f_pfm | f_png, bool wait = false, const std::function<void(bool)>& on_written = nullptr);
+    void pollCaptures();
+    void readImage(std::vector<float>& pixels); // blocking
+    
+    void setHeatmapChannel(cl_uint channel);
+    void captureCosts(const std::string& path); // blocking, one greyscale PFM per counter
+    void readCosts(std::vector<double>& means); // blocking, every counter averaged over the pixels
+    inline bool isHeatmap() const { return heatmap; }
+    inline cl_uint getHeatmapChannel() const { return heatmap_channel; }
+    
+    inline int getWidth() const { return width; }
+    inline int getHeight() const { return height; }
+    inline size_t getSceneMemory() const { return scene.getDeviceMemory(); }
+    
+    bool pick(const Camera* camera, float s, float t, HostHit& hit) const;
 };
 
 #endif /* raytracer_h */
@@ -0,0 +1,94 @@
+//
+//  renderservice.h
+//  Non Euclidean
+//
+//  Renders the jobs sent to a Unix socket, keeping the programs and the scenes loaded between them.
+//
+
+#ifndef renderservice_h
+#define renderservice_h
+
+#include "raytracer.h"
+#include "glm.hpp"
+
+#include <string>
+#include <list>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#define SERVICE_SOCKET_PATH "/tmp/raytracer.sock"
+#define SERVICE_KERNEL_PATH "kernels/raytracer.cl"
+#define SERVICE_CACHE_SIZE 4 // scenes kept on the device, the least recently used one is dropped
+#define SERVICE_DEFAULT_SAMPLES 64
+#define SERVICE_DEFAULT_WIDTH 1200
+#define SERVICE_DEFAULT_HEIGHT 800
+#define SERVICE_PROGRESS_INTERVAL 0.5 // seconds between the progress messages of a job
+#define SERVICE_POLL_TIMEOUT 100 // milliseconds, how often the listener checks if it should stop
+
+struct ServiceClient {
+    int fd;
+    std::mutex send_mutex;
+    
+    ServiceClient(int fd) : fd(fd) {}
+    ~ServiceClient(); // the socket stays open while the jobs of the client are queued
+    
+    void send(const std::string& message);
+};
+
+struct ServiceJob {
+    cl_uint ID;
+    int priority; // the higher ones first, then in the order they came
+    std::string scene_path, output_path; // the output without the extension
+    int width, height;
+    glm::vec3 position;
+    float yaw, pitch, fov;
+    cl_uint samples; // 0 traces until the time budget runs out
+    float time_budget; // seconds, 0 has no limit
+    bool compact;
+    std::shared_ptr<ServiceClient> client;
+};
+
+struct ServiceJobOrder {
+    bool operator()(const ServiceJob& a, const ServiceJob& b) const {
+        return a.priority != b.priority ? a.priority < b.priority : a.ID > b.ID;
+    }
+};
+
+struct CachedScene {
+    size_t hash; // of the scene file
+    bool compact;
+    RayTracer* ray_tracer;
+};
+
+class RenderService {
+private:
+    std::string socket_path;
+    int listen_fd;
+    std::thread listener;
+    std::atomic<bool> stopping;
+    
+    std::priority_queue<ServiceJob, std::vector<ServiceJob>, ServiceJobOrder> jobs;
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_condition;
+    cl_uint job_counter;
+    bool compact_storage; // of the jobs which do not choose
+    
+    std::list<CachedScene> cache; // the most recently used first, only the rendering thread touches it
+    
+    void acceptClients();
+    void parseLine(const std::string& line, const std::shared_ptr<ServiceClient>& client);
+    void execute(const ServiceJob& job);
+    RayTracer* getRayTracer(const ServiceJob& job);
+    
+public:
+    RenderService(const std::string& socket_path = SERVICE_SOCKET_PATH, bool compact_storage = false);
+    ~RenderService();
+    
+    void run(); // renders on the calling thread, it has to own the OpenGL context, returns after QUIT
+};
+
+#endif /* renderservice_h */
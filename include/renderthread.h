@@ -0,0 +1,57 @@
+//
+//  renderthread.h
+//  Non Euclidean
+//
+//  Traces the frames on its own thread, the window thread only sends the camera and draws the results.
+//
+
+#ifndef renderthread_h
+#define renderthread_h
+
+#include "raytracer.h"
+#include "camera.h"
+#include "triplebuffer.h"
+
+#include <thread>
+#include <atomic>
+
+#define RENDER_IDLE_SLEEP 5 // milliseconds between the checks while the rendering is stopped
+
+struct RenderRequest {
+    Camera camera{60, 1.0f};
+    bool run = true;
+    unsigned int heatmap_channel = 0;
+    
+    // the counters only grow, so no event is lost when a newer request replaces an unread one
+    unsigned int motion_count = 0;
+    unsigned int screenshot_count = 0;
+    unsigned int pick_count = 0;
+    float pick_s = 0.5f, pick_t = 0.5f;
+};
+
+class RenderThread {
+private:
+    RayTracer* ray_tracer;
+    
+    RenderRequest pending; // owned by the window thread
+    TripleBuffer<RenderRequest> requests;
+    
+    std::atomic<bool> stopping;
+    std::thread thread;
+    
+    void work();
+    void takeScreenshot();
+    void pick(const RenderRequest& request);
+    
+public:
+    RenderThread(RayTracer* ray_tracer, const Camera& camera); // the ray tracer must not be used by the caller until this is destroyed
+    ~RenderThread();
+    
+    // window thread, the requests reach the renderer at submit
+    void submit(const Camera& camera, bool moved, bool run);
+    void requestScreenshot();
+    void requestPick(float s, float t);
+    void setHeatmapChannel(unsigned int channel); // shown by the --heatmap build
+};
+
+#endif /* renderthread_h */
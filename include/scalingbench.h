@@ -0,0 +1,50 @@
+//
+//  scalingbench.h
+//  Non Euclidean
+//
+//  Sweeps the size of a generated scene and plots the time per frame against the primitive count.
+//
+
+#ifndef scalingbench_h
+#define scalingbench_h
+
+#include <string>
+#include <vector>
+
+#include "raytracer.h"
+#include "scenegenerator.h"
+
+#define SCALING_FRAMES 16 // timed per scene size, after one untimed frame tuning the kernels
+#define SCALING_FIRST_COUNT 16 // the counts grow four times each step up to the largest one
+#define SCALING_MAX_COUNT 16384
+#define SCALING_MAX_MODELS 256 // every instance is imported, so fewer by default
+
+struct ScalingSample {
+    unsigned int count;
+    size_t primitives;
+    double load_time; // seconds, the scene import and upload
+    double frame_time, sample_time; // milliseconds, a restarted frame and a progressive sample
+    size_t memory; // of the scene on the device
+};
+
+class ScalingBench {
+private:
+    StressParams params;
+    std::vector<unsigned int> counts;
+    int width = 640, height = 400;
+    std::string output_dir;
+    
+    std::string getName() const;
+    bool measure(const char* kernel_path, bool compact_storage, unsigned int count, ScalingSample& sample);
+    
+    void writeCurve(const std::string& path, const std::vector<ScalingSample>& curve) const;
+    void writePlot(const std::string& path, const std::vector<ScalingSample>& curve) const; // log-log SVG
+    
+public:
+    ScalingBench(const StressParams& params, unsigned int max_count, const std::string& output_dir = "scaling");
+    
+    // writes the scenes, the CSV and the plot under the output directory, false when a scene failed
+    bool run(const char* kernel_path, bool compact_storage);
+};
+
+#endif /* scalingbench_h */
@@ -11,7 +11,10 @@
 
 #include <string>
 #include <vector>
+#include <list>
 #include <iostream>
+#include <stdexcept>
+#include <filesystem>
 
 #include "glm.hpp"
 
@@ -27,6 +30,34 @@
 #include "cl2.hpp"
 #include "opencl_error.h"
 
+#include "threadpool.h"
+#include "objfile.h"
+#include "devicearena.h"
+
+// keep in sync with kernels/raytracer.cl
+#define CHUNK_FACE_COUNT 256
+#define CHUNK_VERTEX_COUNT 256 // per slot, a chunk ends early when its faces use more, so the local indices fit in a byte
+#define CHUNK_NOT_RESIDENT 0xffffffff
+#define CHUNK_USED 1
+#define CHUNK_MISSING 2
+
+#define TEXTURE_TILE_SIZE 64 // texels per side, the tiles are stored with a border copied from their neighbours
+#define TEXTURE_TILE_BORDER 1
+#define TILE_NOT_RESIDENT 0xffffffff
+#define TILE_USED 1
+#define TILE_MISSING 2
+
+#define QUANTIZATION_STEPS 65535 // per axis of the mesh bounds in the compact storage
+
+#define MAX_LOD_LEVELS 4 // the full detail model and up to 3 simplified ones
+#define LOD_DEFAULT_LEVELS 3
+#define LOD_PRIMARY_DISTANCE 16.0f // in model radii
+#define LOD_SECONDARY_DISTANCE 4.0f
+
+struct SceneError : public std::runtime_error {
+    SceneError(const std::string& what) : std::runtime_error(what) {}
+};
+
 enum MatType { t_refractive, t_reflective, t_dielectric, t_diffuse, t_textured, t_light };
 
 struct Material {
@@ -63,40 +94,189 @@ struct Lens {
     cl_uint mat_ID;
 };
 
+struct Box {
+    cl_float3 pos; // pos of the centre
+    cl_float3 half_size;
+    cl_float3 axis_x; // orientation, unit vectors
+    cl_float3 axis_y;
+    cl_float3 axis_z;
+    cl_uint mat_ID;
+};
+
+struct Cylinder {
+    cl_float3 p1; // centres of both caps
+    cl_float3 p2;
+    cl_float3 bounds_min;
+    cl_float3 bounds_max;
+    cl_float r;
+    cl_uint mat_ID;
+};
+
+struct Disc {
+    cl_float3 pos;
+    cl_float3 normal;
+    cl_float r;
+    cl_uint mat_ID;
+};
+
+// A x^2 + B y^2 + C z^2 + 2 (D xy + E xz + F yz) + 2 (G x + H y + I z) + J = 0 around pos, clipped to the bounds
+struct Quadric {
+    cl_float3 pos;
+    cl_float3 diag; // A, B, C
+    cl_float3 cross; // D, E, F
+    cl_float3 linear; // G, H, I
+    cl_float3 bounds_min;
+    cl_float3 bounds_max;
+    cl_float constant; // J
+    cl_uint mat_ID;
+};
+
 struct Mesh {
     cl_uint vertex_anchor;
     cl_uint index_anchor;
     cl_uint face_count;
     cl_uint texture_ID;
+    cl_uint chunk_anchor;
+    cl_uint chunk_count;
+    cl_float3 quant_min; // the compact storage keeps the positions relative to the mesh bounds
+    cl_float3 quant_scale;
     
-    Mesh(cl_uint vertex_anchor, cl_uint index_anchor, cl_uint face_count, cl_uint texture_ID) : vertex_anchor(vertex_anchor), index_anchor(index_anchor), face_count(face_count), texture_ID(texture_ID) {}
+    Mesh(cl_uint vertex_anchor, cl_uint index_anchor, cl_uint face_count, cl_uint texture_ID) : vertex_anchor(vertex_anchor), index_anchor(index_anchor), face_count(face_count), texture_ID(texture_ID), chunk_anchor(0), chunk_count(0), quant_min({{0.0f, 0.0f, 0.0f}}), quant_scale({{0.0f, 0.0f, 0.0f}}) {}
+};
+
+struct Chunk {
+    cl_float3 bounds_min;
+    cl_float3 bounds_max;
+    cl_uint face_count;
+};
+
+struct ChunkSource {
+    cl_uint mesh_ID;
+    cl_uint first_face;
+    cl_uint vertex_anchor; // into the chunk vertex IDs
+    cl_uint vertex_count;
+};
+
+struct TextureInfo {
+    cl_uint level_anchor;
+    cl_uint level_count; // the last level fits in a single tile
+};
+
+struct TextureLevel {
+    cl_uint tile_anchor;
+    cl_uint tiles_x;
+    cl_uint tiles_y;
+    cl_uint width;
+    cl_uint height;
+};
+
+struct TileSource {
+    cl_uint texture_ID;
+    cl_uint level;
+    cl_uint x, y; // in tiles
 };
 
 struct Model {
+    cl_float4 bounds; // centre and radius, the levels of detail are chosen by the distance in radii
     cl_uint mesh_anchor;
-    cl_uint mesh_count;
+    cl_uint mesh_count; // of all the levels
     cl_uint mat_ID;
+    cl_uint lod_count;
+    cl_uint lod_anchors[MAX_LOD_LEVELS]; // first mesh of every level relative to the anchor, the full detail one first
+    
+    Model(cl_uint mesh_anchor, cl_uint mesh_count, cl_uint mat_ID) : bounds({{0.0f, 0.0f, 0.0f, 0.0f}}), mesh_anchor(mesh_anchor), mesh_count(mesh_count), mat_ID(mat_ID), lod_count(1), lod_anchors{0} {}
     
-    Model(cl_uint mesh_anchor, cl_uint mesh_count, cl_uint mat_ID) : mesh_anchor(mesh_anchor), mesh_count(mesh_count), mat_ID(mat_ID) {}
+    inline cl_uint getLevelEnd(cl_uint level) const { return level + 1 < lod_count ? lod_anchors[level + 1] : mesh_count; }
 };
 
-class SceneCreator {
-private:
-    cl::Kernel scene_kernel;
+// blocks of the scene arena, the header is at the start
+enum SceneBlock { b_header, b_materials, b_spheres, b_planes, b_lenses, b_boxes, b_cylinders, b_discs, b_quadrics, b_models, b_meshes, b_chunks, b_page_table, b_chunk_vertices, b_chunk_uvs, b_chunk_indices, b_feedback, b_textures, b_texture_levels, b_tile_table, b_tile_feedback, b_environment, b_environment_cdf, SCENE_BLOCK_COUNT };
+
+// keep in sync with kernels/raytracer.cl
+struct SceneHeader {
+    // byte offsets of the blocks in the arena
+    cl_ulong materials;
+    cl_ulong spheres, planes, lenses, models;
+    cl_ulong boxes, cylinders, discs, quadrics;
+    cl_ulong meshes, chunks, page_table, chunk_vertices, chunk_uvs, chunk_indices, feedback;
+    cl_ulong textures, texture_levels, tile_table, tile_feedback;
+    cl_ulong environment, environment_cdf;
     
-    //cl_uint texture_count = 0;
+    cl_uint sphere_count;
+    cl_uint plane_count;
+    cl_uint lens_count;
+    cl_uint box_count;
+    cl_uint cylinder_count;
+    cl_uint disc_count;
+    cl_uint quadric_count;
+    cl_uint model_count;
+    cl_uint streaming;
+    
+    cl_uint environment_width; // 0 without an environment map
+    cl_uint environment_height;
+    cl_float environment_intensity;
+    cl_float environment_rotation; // radians around the vertical axis
+    cl_float environment_weight_sum; // of the luminance weights the CDF was built from
+    
+    cl_float lod_primary_distance; // in model radii, where the first simplified level starts, 0 keeps the full detail
+    cl_float lod_secondary_distance; // the same for the diffuse bounces and the light samples
+};
+
+struct ModelRequest {
+    std::string path;
+    cl_uint mat_ID;
+    glm::mat4 transform;
+    std::vector<std::string> lod_paths; // simplified by the author, coarser one after another
+    cl_uint simplify_levels = LOD_DEFAULT_LEVELS; // generated when there are no LOD files
     
-    cl::Buffer scene_buffer;
-    cl::Buffer material_buffer;
-    cl::Buffer sphere_buffer, plane_buffer, lens_buffer;
-    cl::Buffer vertex_buffer, texture_uv_buffer, index_buffer, mesh_buffer, model_buffer;
-    cl::Image2DArray textures;
+    ModelRequest(const std::string& path, cl_uint mat_ID, const glm::mat4& transform) : path(path), mat_ID(mat_ID), transform(transform) {}
+};
+
+// geometry of a single model imported on a worker thread, anchors and texture IDs are local to the model
+struct ModelStaging {
+    std::vector<cl_float3> vertices;
+    std::vector<cl_float2> texture_uv;
+    std::vector<cl_uint> indices;
+    std::vector<Mesh> meshes;
+    std::vector<cl_uint> lod_anchors = {0};
+    std::vector<std::string> texture_paths;
+    std::string path;
+    cl_uint mat_ID;
+    bool reused = false; // taken from the live scene on a reload
+    bool reorder = true; // the mesh optimization sorts the faces, false keeps the file order
+    
+    // statistics of the mesh optimization, the chunks buildChunks would cut in the file order [0] and after it [1]
+    cl_uint merged_vertex_count = 0;
+    size_t chunk_counts[2] = {0, 0}, chunk_vertex_counts[2] = {0, 0};
+    double chunk_extents[2] = {0.0, 0.0}; // summed diagonals of the chunk bounds
+};
+
+// the mip chain of a texture, decoded on the pool the first time one of its tiles is needed
+struct DecodedTexture {
+    std::vector<std::vector<cl_uchar4>> levels; // 8 bits like the files, made linear as the tiles are filled
+    
+    inline size_t getSize() const {
+        size_t size = 0;
+        for(const std::vector<cl_uchar4>& level : levels) size += sizeof(cl_uchar4) * level.size();
+        return size;
+    }
+};
+
+// what a scene file describes and the geometry merged from its models, a reload builds the next one aside and swaps it in
+class SceneData {
+protected:
+    friend class SceneCreator;
+    friend class RayCaster;
     
     std::vector<Material> materials;
     
     std::vector<Sphere> spheres;
     std::vector<Plane> planes;
     std::vector<Lens> lenses;
+    std::vector<Box> boxes;
+    std::vector<Cylinder> cylinders;
+    std::vector<Disc> discs;
+    std::vector<Quadric> quadrics;
     std::vector<Model> models;
     
     std::vector<cl_float3> vertices;
@@ -106,49 +286,178 @@ private:
     
     std::vector<std::string> texture_paths;
     
-    Assimp::Importer importer;
+    // HDR latitude-longitude map lighting the rays which leave the scene, sampled proportionally to its luminance
+    std::string environment_path;
+    cl_float environment_intensity = 1.0f;
+    cl_float environment_rotation = 0.0f; // degrees
+    std::filesystem::file_time_type environment_time;
+    cl_uint environment_width = 0, environment_height = 0;
+    std::vector<cl_float4> environment_texels;
+    std::vector<cl_float> environment_cdf; // marginal over the rows, then the conditional of every row
+    cl_float environment_weight_sum = 0.0f;
+    
+    cl_float lod_primary_distance = LOD_PRIMARY_DISTANCE;
+    cl_float lod_secondary_distance = LOD_SECONDARY_DISTANCE;
+    
+    // what the models were loaded from, to find the ones which need importing again on a reload
+    std::vector<ModelRequest> model_requests;
+    std::vector<std::vector<std::filesystem::file_time_type>> model_times; // of the model file, then of its LOD files
+    
+    void parseScene(const std::string& path, std::vector<ModelRequest>& requests);
+    ModelStaging extractModel(cl_uint model_ID) const;
+    void mergeModel(const ModelStaging& staging);
+    
+    void loadEnvironment();
+    void swapEnvironmentMap(SceneData& other); // the decoded texels, not the path or the settings
     
-    cl_uint processNode(aiNode* node, const aiScene* scene, cl_uint mat_ID, const glm::mat4& transform);
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene, cl_uint mat_ID, const glm::mat4& transform);
+public:
+    void addMaterial(MatType type, const cl_float3& color, cl_float extra_data);
+    
+    void addSphere(const cl_float3& pos, cl_float r, cl_uint mat_ID);
+    void addPlane(const cl_float3& pos, const cl_float3& normal, cl_uint mat_ID);
+    void addLens(const cl_float3& pos, const cl_float3& normal, cl_float r1, cl_float r2, cl_float h, uint mat_ID);
+    void addBox(const cl_float3& pos, const cl_float3& size, const cl_float3& rotation, cl_uint mat_ID); // rotation in degrees around x, y, z
+    void addCylinder(const cl_float3& p1, const cl_float3& p2, cl_float r, cl_uint mat_ID);
+    void addDisc(const cl_float3& pos, const cl_float3& normal, cl_float r, cl_uint mat_ID);
+    void addQuadric(const cl_float3& pos, const cl_float3& diag, const cl_float3& cross, const cl_float3& linear, cl_float constant, const cl_float3& half_size, cl_uint mat_ID);
+};
+
+class SceneCreator : public SceneData {
+private:
+    friend class RayCaster;
+    
+    //cl_uint texture_count = 0;
+    
+    DeviceArena arena; // all the scene data, addressed by the offsets in the header
+    cl::Image2DArray textures; // pool of texture tiles, one per layer
+    
+    // geometry is streamed to the device in chunks, the least recently used ones are evicted when the pool is full
+    std::vector<Chunk> chunks;
+    std::vector<ChunkSource> chunk_sources;
+    std::vector<cl_uint> chunk_vertex_IDs; // the vertices of every chunk in the order of their first use
+    std::vector<cl_uchar> local_indices; // parallel to the indices, relative to the vertices of the chunk
+    std::vector<cl_uint> page_table;
+    std::vector<cl_uchar> feedback;
+    cl::Event feedback_event; // the read back of the last frame's feedback
+    bool feedback_pending = false;
+    std::list<cl_uint> lru;
+    std::vector<std::list<cl_uint>::iterator> lru_pos;
+    std::vector<cl_float3> staging_vertices;
+    std::vector<cl_float2> staging_uvs;
+    std::vector<cl_ushort4> compact_vertices;
+    std::vector<cl_half> compact_uvs;
+    cl_uint slot_count;
+    bool streaming;
+    
+    // positions quantized to 16 bits, texture coords and textures in half floats, the kernels have to be built with -D COMPACT_STORAGE
+    bool compact_storage = false;
+    size_t texture_memory = 0;
+    size_t reserved_memory = 0; // device memory of the renderer, left out of the geometry and texture budgets
+    
+    // textures are split into tiles on every mip level, a tile is decoded and uploaded once the kernel asks for it
+    std::vector<TextureInfo> texture_infos;
+    std::vector<TextureLevel> texture_levels;
+    std::vector<TileSource> tile_sources;
+    std::vector<cl_uint> tile_table;
+    std::vector<cl_uchar> tile_feedback;
+    cl::Event tile_feedback_event; // read back while the next frame renders, like the chunk feedback
+    bool tile_feedback_pending = false;
+    std::list<cl_uint> tile_lru; // the coarsest tile of every texture is pinned and never in the list
+    std::vector<std::list<cl_uint>::iterator> tile_lru_pos;
+    std::vector<cl_uint> free_tile_slots;
+    std::vector<std::filesystem::file_time_type> texture_times; // an edited texture is read again on a reload
+    std::vector<DecodedTexture> decoded_textures;
+    std::list<cl_uint> decoded_lru; // the least recently uploaded are dropped over the budget and decoded again on demand
+    std::vector<std::list<cl_uint>::iterator> decoded_lru_pos;
+    size_t decoded_size = 0;
+    std::vector<std::future<DecodedTexture>> texture_decodes;
+    std::vector<cl_float4> tile_staging;
+    std::vector<cl_half> compact_tile_staging;
+    cl_uint tile_slot_count = 0;
+    
+    ThreadPool& pool = ThreadPool::getShared(); // imports the models and decodes the textures
+    bool obj_loader = true; // false imports the OBJ files through Assimp too
+    static bool mesh_reorder; // false keeps the faces in the file order, to compare the reorder against
+    
+    ModelStaging importModel(const ModelRequest& request) const;
+    void importFile(const std::string& path, ModelStaging& staging, const glm::mat4& transform) const;
+    void processNode(aiNode* node, const aiScene* scene, ModelStaging& staging, const glm::mat4& transform) const;
+    Mesh processMesh(aiMesh* mesh, const aiScene* scene, ModelStaging& staging, const glm::mat4& transform) const;
+    void processOBJ(const ObjFile& file, ModelStaging& staging, const glm::mat4& transform) const; // one mesh per material
+    
+    inline void swapData(SceneData& other) { std::swap(static_cast<SceneData&>(*this), other); }
+    
+    void buildChunks();
+    void fillChunk(cl_uint chunk_ID, cl_float3* vertex_dst, cl_float2* uv_dst) const;
+    void compressChunk(cl_uint chunk_ID, size_t offset);
+    void uploadChunks(cl::CommandQueue& queue, const std::vector<cl_uint>& chunk_IDs);
+    void writeHeader(cl::CommandQueue& queue);
+    
+    bool updateChunks(cl::CommandQueue& queue);
+    void selectChunks(std::vector<cl_uint>& uploads); // from the feedback read back
+    bool updateTiles(cl::CommandQueue& queue);
+    void selectTiles(std::vector<cl_uint>& uploads); // from the feedback read back
+    void evictTextures(const std::vector<cl_uint>& uploads); // keeps the decoded textures within the budget
+    void fillTile(cl_uint tile_ID, cl_float4* dst) const;
+    void uploadTiles(cl::CommandQueue& queue, const std::vector<cl_uint>& tile_IDs);
+    bool assignTileSlot(cl_uint tile_ID, bool pinned);
     
     inline Material* getMaterials() { return &(materials[0]); }
     inline Sphere* getSpheres() { return &(spheres[0]); }
     inline Plane* getPlanes() { return &(planes[0]); }
     inline Lens* getLenses() { return &(lenses[0]); }
-    inline cl_float3* getVertices() { return &(vertices[0]); }
-    inline cl_float2* getTexUV() { return &(texture_uv[0]); }
-    inline cl_uint* getIndices() { return &(indices[0]); }
     inline Mesh* getMeshes() { return &(meshes[0]); }
     inline Model* getModels() { return &(models[0]); }
+    inline Chunk* getChunks() { return &(chunks[0]); }
+    inline cl_uint* getPageTable() { return &(page_table[0]); }
     
     inline size_t getMaterialSize() const { return sizeof(Material) * materials.size(); }
     inline size_t getSphereSize() const { return sizeof(Sphere) * spheres.size(); }
     inline size_t getPlaneSize() const { return sizeof(Plane) * planes.size(); }
     inline size_t getLensSize() const { return sizeof(Lens) * lenses.size(); }
-    inline size_t getVertexSize() const { return sizeof(cl_float3) * vertices.size(); }
-    inline size_t getTexUVSize() const { return sizeof(cl_float2) * texture_uv.size(); }
-    inline size_t getIndexSize() const { return sizeof(cl_uint) * indices.size(); }
+    inline size_t getBoxSize() const { return sizeof(Box) * boxes.size(); }
+    inline size_t getCylinderSize() const { return sizeof(Cylinder) * cylinders.size(); }
+    inline size_t getDiscSize() const { return sizeof(Disc) * discs.size(); }
+    inline size_t getQuadricSize() const { return sizeof(Quadric) * quadrics.size(); }
     inline size_t getMeshSize() const { return sizeof(Mesh) * meshes.size(); }
     inline size_t getModelSize() const { return sizeof(Model) * models.size(); }
+    inline size_t getChunkSize() const { return sizeof(Chunk) * chunks.size(); }
+    inline size_t getPageTableSize() const { return sizeof(cl_uint) * page_table.size(); }
+    inline size_t getTextureInfoSize() const { return sizeof(TextureInfo) * texture_infos.size(); }
+    inline size_t getTextureLevelSize() const { return sizeof(TextureLevel) * texture_levels.size(); }
+    inline size_t getTileTableSize() const { return sizeof(cl_uint) * tile_table.size(); }
+    inline size_t getEnvironmentSize() const { return sizeof(cl_float4) * environment_texels.size(); }
+    inline size_t getEnvironmentCDFSize() const { return sizeof(cl_float) * environment_cdf.size(); }
+    inline size_t getVertexStride() const { return compact_storage ? sizeof(cl_ushort4) : sizeof(cl_float3); }
+    inline size_t getUVStride() const { return compact_storage ? 2 * sizeof(cl_half) : sizeof(cl_float2); }
     
 public:
-    void createKernel(cl::Program& program, const char* name);
-    void setupBuffers(cl::Context& context);
-    void setKernelArgs();
-    void createScene(cl::Context& context, cl::Device& device);
+    SceneCreator();
     
-    void addMaterial(MatType type, const cl_float3& color, cl_float extra_data);
+    bool setupBuffers(cl::Context& context, cl::Device& device); // true when the arena was created again
+    void createScene(cl::Context& context, cl::Device& device);
     
-    void addSphere(const cl_float3& pos, cl_float r, cl_uint mat_ID);
-    void addPlane(const cl_float3& pos, const cl_float3& normal, cl_uint mat_ID);
-    void addLens(const cl_float3& pos, const cl_float3& normal, cl_float r1, cl_float r2, cl_float h, uint mat_ID);
     void loadModel(const std::string& path, cl_uint mat_ID, const glm::mat4& transform = glm::mat4(1.0f));
+    void loadModels(const std::vector<ModelRequest>& requests); // imports in parallel, merges in the request order
     
-    void loadTextures(cl::Context& context, cl::Device& device);
+    void loadTextures(cl::Context& context, cl::Device& device); // reads only the sizes, the tiles are decoded on demand
     
     void loadScene(const std::string& path);
+    bool reloadScene(const std::string& path, cl::Context& context, cl::Device& device, bool& rebind); // rebind: the buffers were recreated
+    
+    inline const std::vector<ModelRequest>& getModelRequests() const { return model_requests; }
+    inline const std::string& getEnvironmentPath() const { return environment_path; }
+    inline const std::vector<std::string>& getTexturePaths() const { return texture_paths; }
+    
+    inline void setCompactStorage(bool compact) { compact_storage = compact; } // before the buffers are set up
+    inline void setReservedMemory(size_t size) { reserved_memory = size; } // counted at the next setup of the buffers and the textures
+    inline void setOBJLoader(bool enabled) { obj_loader = enabled; } // before the models are loaded
+    static inline void setMeshReorder(bool enabled) { mesh_reorder = enabled; } // for every scene loaded afterwards
+    inline size_t getDeviceMemory() const { return arena.getUsedSize() + texture_memory; }
+    
+    bool updateResidency(cl::CommandQueue& queue); // uploads the chunks and texture tiles the last frame missed
     
-    inline cl::Buffer& getBuffer() { return scene_buffer; }
+    inline cl::Buffer& getBuffer() { return arena.getBuffer(); }
     inline cl::Image2DArray& getTextures() { return textures; }
 };
 
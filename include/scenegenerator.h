@@ -0,0 +1,57 @@
+//
+//  scenegenerator.h
+//  Non Euclidean
+//
+//  Writes procedural scene files of a chosen size for the scaling tests, the same seed gives the same file.
+//
+
+#ifndef scenegenerator_h
+#define scenegenerator_h
+
+#include <string>
+#include <random>
+
+#include "glm.hpp"
+
+#define STRESS_FIELD_SIZE 16.0f // side of the cube holding the objects, centred at the origin, whatever their count
+#define STRESS_FILL 0.35f // object radius in the cell spacing
+#define STRESS_PALETTE_SIZE 16 // materials drawn from the mix, the ground and the light come after them
+#define STRESS_DEFAULT_MODEL "assets/cube/cube2.obj"
+
+enum StressLayout { s_grid, s_cloud, s_lenses, s_models };
+enum MaterialMix { m_diffuse, m_specular, m_glass, m_mixed };
+
+struct StressParams {
+    StressLayout layout = s_grid;
+    MaterialMix materials = m_mixed;
+    unsigned int count = 1024; // objects, the instanced models count as their triangles in the primitive count
+    unsigned int seed = 1;
+    std::string model_path = STRESS_DEFAULT_MODEL;
+};
+
+class SceneGenerator {
+private:
+    std::mt19937 random;
+    
+    float getUniform(float min, float max);
+    glm::vec3 getCellCentre(unsigned int i, unsigned int side) const;
+    
+    void writeSetting(std::ostream& out, MaterialMix materials); // the palette, the ground and the light
+    size_t writeGrid(std::ostream& out, const StressParams& params);
+    size_t writeCloud(std::ostream& out, const StressParams& params);
+    size_t writeLenses(std::ostream& out, const StressParams& params);
+    size_t writeModels(std::ostream& out, const StressParams& params);
+    
+    static bool readModelInfo(const std::string& path, glm::vec3& centre, float& radius, size_t& triangle_count);
+    
+public:
+    // writes the scene, returns the primitive count, 0 when the file could not be written
+    size_t generate(const StressParams& params, const std::string& path);
+    
+    static bool parseLayout(const std::string& name, StressLayout& layout);
+    static bool parseMix(const std::string& name, MaterialMix& materials);
+    static const char* getLayoutName(StressLayout layout);
+    static const char* getMixName(MaterialMix materials);
+};
+
+#endif /* scenegenerator_h */
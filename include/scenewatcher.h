@@ -0,0 +1,44 @@
+//
+//  scenewatcher.h
+//  Non Euclidean
+//
+//  Reports changes of the scene file and of the model files it loads.
+//
+
+#ifndef scenewatcher_h
+#define scenewatcher_h
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <chrono>
+
+#define WATCH_POLL_INTERVAL 0.5 // seconds between the modification time checks, used without inotify
+
+class SceneWatcher {
+private:
+    struct WatchedFile {
+        std::string path;
+        std::filesystem::file_time_type time;
+    };
+    
+    std::vector<WatchedFile> files;
+    std::chrono::steady_clock::time_point last_poll;
+    
+    int inotify_fd = -1;
+    std::vector<int> watch_descriptors;
+    std::vector<std::string> watch_dirs;
+    
+    bool pollTimes();
+    bool pollEvents();
+    
+public:
+    SceneWatcher();
+    ~SceneWatcher();
+    
+    void watch(const std::string& path);
+    void clear();
+    bool poll(); // non-blocking, true when a watched file changed since the last call
+};
+
+#endif /* scenewatcher_h */
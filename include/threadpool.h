@@ -0,0 +1,61 @@
+//
+//  threadpool.h
+//  Non Euclidean
+//
+//  A fixed set of worker threads executing queued tasks.
+//
+
+#ifndef threadpool_h
+#define threadpool_h
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <chrono>
+
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex tasks_mutex;
+    std::condition_variable tasks_condition;
+    bool stopping;
+    
+    void work();
+    
+public:
+    ThreadPool(unsigned int thread_count = 0); // 0 uses one thread per core
+    ~ThreadPool();
+    
+    template <typename F>
+    auto submit(F&& f) -> std::future<decltype(f())> {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+        {
+            std::lock_guard<std::mutex> lock(tasks_mutex);
+            tasks.push([task]() { (*task)(); });
+        }
+        tasks_condition.notify_one();
+        return task->get_future();
+    }
+    
+    // a task waiting for the tasks it submitted runs the queued ones meanwhile, so the workers cannot all block
+    template <typename T>
+    T wait(std::future<T>& future) {
+        while(future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if(!runPending()) future.wait(); // the rest is running on the other threads
+        }
+        return future.get();
+    }
+    bool runPending(); // runs one queued task on the calling thread, false when there was none
+    
+    inline unsigned int getThreadCount() const { return (unsigned int)workers.size(); }
+    
+    static ThreadPool& getShared(); // one per process, created on the first use
+};
+
+#endif /* threadpool_h */
@@ -0,0 +1,43 @@
+//
+//  triplebuffer.h
+//  Non Euclidean
+//
+//  Lock-free handoff of the latest value from one producer thread to one consumer thread.
+//
+
+#ifndef triplebuffer_h
+#define triplebuffer_h
+
+#include <atomic>
+
+#define TRIPLE_BUFFER_FRESH 4 // set in the shared index when it was written since the last read
+#define TRIPLE_BUFFER_INDEX 3
+
+template <typename T>
+class TripleBuffer {
+private:
+    // the producer owns back, the consumer owns front, they swap through middle
+    T buffers[3];
+    std::atomic<unsigned int> middle;
+    unsigned int back, front;
+    
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+    
+    // producer: write the back buffer, then publish it, older unread values are dropped
+    inline T& getBack() { return buffers[back]; }
+    inline void publish() { back = middle.exchange(back | TRIPLE_BUFFER_FRESH, std::memory_order_acq_rel) & TRIPLE_BUFFER_INDEX; }
+    
+    // consumer: take the newest published value, false when nothing new arrived
+    inline bool update() {
+        if(!(middle.load(std::memory_order_relaxed) & TRIPLE_BUFFER_FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & TRIPLE_BUFFER_INDEX;
+        return true;
+    }
+    inline T& getFront() { return buffers[front]; }
+    
+    // only before the threads start or after they stop
+    inline T& getBuffer(unsigned int i) { return buffers[i]; }
+};
+
+#endif /* triplebuffer_h */
@@ -6,11 +6,63 @@
 
 #define RANDOM_BUFFER_SIZE 100000
 
+#define CHUNK_FACE_COUNT 256
+#define CHUNK_VERTEX_COUNT 256
+#define CHUNK_NOT_RESIDENT 0xffffffff
+#define CHUNK_USED 1
+#define CHUNK_MISSING 2
+
+#define TEXTURE_TILE_SIZE 64 // texels per side, the tiles are stored with a border copied from their neighbours
+#define TEXTURE_TILE_BORDER 1
+#define TILE_NOT_RESIDENT 0xffffffff
+#define TILE_USED 1
+#define TILE_MISSING 2
+#define MAX_LOD_LEVELS 4 // keep in sync with include/scene.h
+#define LOD_MIN_COSINE 0.1f // keeps grazing hits from picking the coarsest levels
+
+#define ENVIRONMENT_SEED 7919 // offsets the seeds of the light samples from the ones of the bounces
+
+#define ORDER_ROWS 0
+#define ORDER_MORTON 1
+#define MORTON_TILE_SIZE 8
+
+#define EDGE_SHARPNESS 16.0f // how strongly the upscaling avoids mixing samples of different colour
+
+#define MAX_HISTORY 16.0f // samples kept across camera moves, more would leave trails behind moving edges
+#define DEPTH_TOLERANCE 0.02f // relative
+#define NORMAL_TOLERANCE 0.9f
+
+#define BIN_TILE_SIZE 16 // pixels per side of the screen tiles the primary rays are binned in, keep in sync with include/raytracer.h
+#define BIN_CAPACITY 255 // candidates of a tile, one with more tests the whole scene
+#define BIN_TYPE_SHIFT 28 // the candidates hold the type in the high bits and the index in the rest
+#define BIN_INDEX_MASK 0x0fffffff
+
+#define JITTER_POSITIONS 4 // sub-pixel positions of the primary rays, every one has its cached first hit, keep in sync with include/raytracer.h
+#define PRIMARY_MISS 0xffffffff
+
 typedef float4 vec4;
 typedef float3 vec3;
 typedef float2 vec2;
 typedef float3 col;
 
+#ifdef COST_HEATMAP
+#define COST_CHANNELS 8 // keep in sync with include/raytracer.h
+enum CostChannel { c_time, c_bounces, c_spheres, c_planes, c_lenses, c_triangles, c_analytic, c_chunks };
+
+// rough cycles of a bounce and of every test, the time is estimated from them when the device has no clock
+__constant uint cost_weights[COST_CHANNELS] = {0, 40, 20, 10, 60, 30, 40, 10};
+
+typedef struct {
+    uint counters[COST_CHANNELS];
+} Cost; // work done for one sample of a pixel
+
+#define COUNT_COST(scene, channel, n) do { if((scene)->cost) (scene)->cost->counters[channel] += (n); } while(0)
+#define COST_ARGS , __global float* cost_buffer, __global uint* cost_max
+#else
+#define COUNT_COST(scene, channel, n)
+#define COST_ARGS
+#endif
+
 __constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
 __constant sampler_t texture_sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_NONE | CLK_FILTER_LINEAR;
 
@@ -22,6 +74,10 @@ typedef struct {
 
 typedef enum { t_refractive, t_reflective, t_dielectric, t_diffuse, t_textured, t_light } MatType;
 
+typedef enum { bin_sphere, bin_lens, bin_box, bin_cylinder, bin_disc, bin_quadric, bin_model } BinType;
+
+__constant float2 jitter_offsets[JITTER_POSITIONS] = {(float2)(0.0f, 0.0f), (float2)(0.5f, 0.5f), (float2)(0.25f, 0.75f), (float2)(0.75f, 0.25f)}; // the first one is the unjittered ray
+
 typedef struct {
     MatType type;
     col color;
@@ -34,9 +90,20 @@ typedef struct {
     vec3 normal;
     vec2 uv;
     uint texture_ID;
+    float texture_lod; // half the log2 of the texture coords area per world area of the triangle
     uint mat_ID;
 } HPI; //HitPointInfo
 
+typedef struct {
+    vec2 uv; // full precision, the coords of a repeated texture grow past 1
+    float t;
+    uint texture_ID;
+    uint mat_ID; // PRIMARY_MISS if the ray left the scene
+    uint generation; // of the view and the scene it was traced in, 0 is never valid
+    ushort normal[3]; // half floats, without cl_khr_fp16 they are only read and written through the vload_half functions
+    ushort texture_lod;
+} PrimaryHit; // first hit of a primary ray, reused by the samples of a pixel until the camera or the scene changes, 32 bytes like PRIMARY_HIT_SIZE in include/raytracer.h
+
 typedef struct {
     vec3 pos;
     float r;
@@ -58,52 +125,288 @@ typedef struct {
     uint mat_ID;
 } Lens;
 
+typedef struct {
+    vec3 pos; // pos of the centre
+    vec3 half_size;
+    vec3 axis_x; // orientation, unit vectors
+    vec3 axis_y;
+    vec3 axis_z;
+    uint mat_ID;
+} Box;
+
+typedef struct {
+    vec3 p1; // centres of both caps
+    vec3 p2;
+    vec3 bounds_min;
+    vec3 bounds_max;
+    float r;
+    uint mat_ID;
+} Cylinder;
+
+typedef struct {
+    vec3 pos;
+    vec3 normal;
+    float r;
+    uint mat_ID;
+} Disc;
+
+typedef struct {
+    vec3 pos;
+    vec3 diag; // x^2, y^2, z^2
+    vec3 cross; // xy, xz, yz (halved)
+    vec3 linear; // x, y, z (halved)
+    vec3 bounds_min; // the surface is clipped to the bounds
+    vec3 bounds_max;
+    float constant;
+    uint mat_ID;
+} Quadric;
+
 typedef struct {
     uint vertex_anchor;
     uint index_anchor;
     uint face_count;
     uint texture_ID;
+    uint chunk_anchor;
+    uint chunk_count;
+    vec3 quant_min; // the compact storage keeps the positions relative to the mesh bounds
+    vec3 quant_scale;
 } Mesh;
 
 typedef struct {
+    vec3 bounds_min;
+    vec3 bounds_max;
+    uint face_count;
+} Chunk; // up to CHUNK_FACE_COUNT faces of a mesh, streamed to the device on demand
+
+typedef struct {
+    uint level_anchor;
+    uint level_count; // the last level fits in a single tile
+} TextureInfo;
+
+typedef struct {
+    uint tile_anchor;
+    uint tiles_x;
+    uint tiles_y;
+    uint width;
+    uint height;
+} TextureLevel; // a mip level of a texture, its tiles are streamed to the device on demand
+
+typedef struct {
+    vec4 bounds; // centre and radius
     uint mesh_anchor;
-    uint mesh_count;
+    uint mesh_count; // of all the levels
     uint mat_ID;
+    uint lod_count;
+    uint lod_anchors[MAX_LOD_LEVELS]; // first mesh of every level relative to the anchor, the full detail one first
 } Model;
 
+typedef struct {
+    // byte offsets of the blocks in the scene arena
+    ulong materials;
+    ulong spheres, planes, lenses, models;
+    ulong boxes, cylinders, discs, quadrics;
+    ulong meshes, chunks, page_table, chunk_vertices, chunk_uvs, chunk_indices, feedback;
+    ulong textures, texture_levels, tile_table, tile_feedback;
+    ulong environment, environment_cdf;
+    
+    uint sphere_count;
+    uint plane_count;
+    uint lens_count;
+    uint box_count;
+    uint cylinder_count;
+    uint disc_count;
+    uint quadric_count;
+    uint model_count;
+    uint streaming;
+    
+    uint environment_width; // 0 without an environment map
+    uint environment_height;
+    float environment_intensity;
+    float environment_rotation; // radians around the vertical axis
+    float environment_weight_sum; // of the luminance weights the CDF was built from
+    
+    float lod_primary_distance; // in model radii, where the first simplified level starts, 0 keeps the full detail
+    float lod_secondary_distance; // the same for the diffuse bounces and the light samples
+} SceneHeader; // at the start of the arena, keep in sync with include/scene.h
+
 typedef struct {
     __global const Material* materials;
     
     __global const Sphere* spheres;
     __global const Plane* planes;
     __global const Lens* lenses;
+    __global const Box* boxes;
+    __global const Cylinder* cylinders;
+    __global const Disc* discs;
+    __global const Quadric* quadrics;
     
-    __global const vec3* vertex_buffer;
-    __global const vec2* texture_uv_buffer;
-    __global const uint* index_buffer;
+    __global const Chunk* chunks;
+    __global const uint* page_table; // chunk -> slot of the chunk pool
+#ifdef COMPACT_STORAGE
+    __global const ushort4* chunk_vertices; // CHUNK_VERTEX_COUNT vertices per slot, quantized to the mesh bounds
+    __global const half* chunk_uvs; // read with vload_half2
+#else
+    __global const vec3* chunk_vertices; // CHUNK_VERTEX_COUNT vertices per slot
+    __global const vec2* chunk_uvs;
+#endif
+    __global const uchar* chunk_indices; // 3 * CHUNK_FACE_COUNT per slot, into the vertices of the slot
+    __global uchar* feedback; // chunks used or missing in the current frame
     __global const Mesh* mesh_buffer;
     __global const Model* models;
+    
+    __global const TextureInfo* textures;
+    __global const TextureLevel* texture_levels;
+    __global const uint* tile_table; // tile -> layer of the tile pool
+    __global uchar* tile_feedback; // tiles used or missing in the current frame
+    
+    __global const vec4* environment; // latitude-longitude, the first row looks up
+    __global const float* environment_cdf; // marginal over the rows, then the conditional of every row
 
     uint sphere_count;
     uint plane_count;
     uint lens_count;
+    uint box_count;
+    uint cylinder_count;
+    uint disc_count;
+    uint quadric_count;
     uint model_count;
-} Scene;
+    uint streaming;
+    
+    uint environment_width;
+    uint environment_height;
+    float environment_intensity;
+    float environment_rotation;
+    float environment_weight_sum;
+    
+    float lod_primary_distance;
+    float lod_secondary_distance;
+    
+#ifdef COST_HEATMAP
+    Cost* cost; // counters of the current sample, null when they are not kept
+#endif
+} Scene; // pointers into the arena, resolved once per work item
 
-inline __global const vec3* getMeshVertex(__global const Scene* scene, __global const Mesh* mesh, uint i) {
-    return mesh->vertex_anchor + scene->vertex_buffer + scene->index_buffer[mesh->index_anchor + i];
+Scene getScene(__global uchar* arena) {
+    __global const SceneHeader* header = (__global const SceneHeader*)arena;
+    Scene scene;
+    
+    scene.materials = (__global const Material*)(arena + header->materials);
+    
+    scene.spheres = (__global const Sphere*)(arena + header->spheres);
+    scene.planes = (__global const Plane*)(arena + header->planes);
+    scene.lenses = (__global const Lens*)(arena + header->lenses);
+    scene.boxes = (__global const Box*)(arena + header->boxes);
+    scene.cylinders = (__global const Cylinder*)(arena + header->cylinders);
+    scene.discs = (__global const Disc*)(arena + header->discs);
+    scene.quadrics = (__global const Quadric*)(arena + header->quadrics);
+    
+    scene.chunks = (__global const Chunk*)(arena + header->chunks);
+    scene.page_table = (__global const uint*)(arena + header->page_table);
+#ifdef COMPACT_STORAGE
+    scene.chunk_vertices = (__global const ushort4*)(arena + header->chunk_vertices);
+    scene.chunk_uvs = (__global const half*)(arena + header->chunk_uvs);
+#else
+    scene.chunk_vertices = (__global const vec3*)(arena + header->chunk_vertices);
+    scene.chunk_uvs = (__global const vec2*)(arena + header->chunk_uvs);
+#endif
+    scene.chunk_indices = arena + header->chunk_indices;
+    scene.feedback = arena + header->feedback;
+    scene.mesh_buffer = (__global const Mesh*)(arena + header->meshes);
+    scene.models = (__global const Model*)(arena + header->models);
+    
+    scene.textures = (__global const TextureInfo*)(arena + header->textures);
+    scene.texture_levels = (__global const TextureLevel*)(arena + header->texture_levels);
+    scene.tile_table = (__global const uint*)(arena + header->tile_table);
+    scene.tile_feedback = arena + header->tile_feedback;
+    
+    scene.environment = (__global const vec4*)(arena + header->environment);
+    scene.environment_cdf = (__global const float*)(arena + header->environment_cdf);
+    
+    scene.sphere_count = header->sphere_count;
+    scene.plane_count = header->plane_count;
+    scene.lens_count = header->lens_count;
+    scene.box_count = header->box_count;
+    scene.cylinder_count = header->cylinder_count;
+    scene.disc_count = header->disc_count;
+    scene.quadric_count = header->quadric_count;
+    scene.model_count = header->model_count;
+    scene.streaming = header->streaming;
+    
+    scene.environment_width = header->environment_width;
+    scene.environment_height = header->environment_height;
+    scene.environment_intensity = header->environment_intensity;
+    scene.environment_rotation = header->environment_rotation;
+    scene.environment_weight_sum = header->environment_weight_sum;
+    
+    scene.lod_primary_distance = header->lod_primary_distance;
+    scene.lod_secondary_distance = header->lod_secondary_distance;
+    
+#ifdef COST_HEATMAP
+    scene.cost = 0;
+#endif
+    
+    return scene;
+}
+
+inline vec3 loadVertex(const Scene* scene, __global const Mesh* mesh, uint id) {
+#ifdef COMPACT_STORAGE
+    return mesh->quant_min + convert_float3(scene->chunk_vertices[id].xyz) * mesh->quant_scale;
+#else
+    return scene->chunk_vertices[id];
+#endif
+}
+
+inline vec2 loadUV(const Scene* scene, uint id) {
+#ifdef COMPACT_STORAGE
+    return vload_half2(id, scene->chunk_uvs);
+#else
+    return scene->chunk_uvs[id];
+#endif
 }
 
-inline __global const vec2* getMeshUV(__global const Scene* scene, __global const Mesh* mesh, uint i) {
-    return mesh->vertex_anchor + scene->texture_uv_buffer + scene->index_buffer[mesh->index_anchor + i]; //FIXME: CHECK IF IT MAKES SENSE (sln: use a separate texture index buffer)
+inline vec2 getTextureUV(const Scene* scene, const uint* ids, vec2 bary) {
+    return loadUV(scene, ids[0]) * (1.0f - bary.x - bary.y) + loadUV(scene, ids[1]) * bary.x + loadUV(scene, ids[2]) * bary.y;
 }
 
-inline vec2 getTextureUV(__global const Scene* scene, __global const Mesh* mesh, uint idx_A, uint idx_B, uint idx_C, float u, float v) {
-    return (*getMeshUV(scene, mesh, idx_A)) * (1.0f - u - v) + (*getMeshUV(scene, mesh, idx_B)) * u + (*getMeshUV(scene, mesh, idx_C)) * v;
+inline float getTriangleLOD(const Scene* scene, const vec3* vertices, const uint* ids) {
+    // the texture size and the footprint of the ray are added when sampling
+    vec2 e1 = loadUV(scene, ids[1]) - loadUV(scene, ids[0]);
+    vec2 e2 = loadUV(scene, ids[2]) - loadUV(scene, ids[0]);
+    float uv_area = fmax(fabs(e1.x * e2.y - e1.y * e2.x), 1e-12f);
+    float world_area = length(cross(vertices[1] - vertices[0], vertices[2] - vertices[0]));
+    return 0.5f * log2(uv_area / world_area);
 }
 
-inline const col getTextureCol(__read_only image2d_array_t texture, const vec2* loc, uint texture_ID) {
-    return read_imagef(texture, texture_sampler, (vec4)(*loc, texture_ID, 0)).xyz;
+col sampleTexture(const Scene* scene, __read_only image2d_array_t tiles, const HPI* hpi, float footprint, bool* deferred) {
+    // footprint: world size of the pixel at the hit point
+    TextureInfo info = scene->textures[hpi->texture_ID];
+    __global const TextureLevel* levels = scene->texture_levels + info.level_anchor;
+    vec2 uv = hpi->uv - floor(hpi->uv);
+    
+    float lod = hpi->texture_lod + log2(footprint) + 0.5f * log2((float)levels[0].width * (float)levels[0].height);
+    uint level = (uint)clamp(lod, 0.0f, (float)(info.level_count - 1));
+    
+    // the wanted level is requested from the host, until it arrives the finest resident one is sampled
+    for(uint l = level; l < info.level_count; l++) {
+        __global const TextureLevel* lv = levels + l;
+        vec2 texel = uv * (vec2)((float)lv->width, (float)lv->height);
+        uint tile_x = min((uint)texel.x / TEXTURE_TILE_SIZE, lv->tiles_x - 1);
+        uint tile_y = min((uint)texel.y / TEXTURE_TILE_SIZE, lv->tiles_y - 1);
+        uint tile_ID = lv->tile_anchor + tile_y * lv->tiles_x + tile_x;
+        
+        uint slot = scene->tile_table[tile_ID];
+        if(slot == TILE_NOT_RESIDENT) {
+            if(l == level) scene->tile_feedback[tile_ID] = TILE_MISSING;
+            continue;
+        }
+        scene->tile_feedback[tile_ID] = TILE_USED;
+        
+        vec2 local = texel - (vec2)((float)tile_x, (float)tile_y) * TEXTURE_TILE_SIZE + TEXTURE_TILE_BORDER;
+        return read_imagef(tiles, texture_sampler, (vec4)(local / (TEXTURE_TILE_SIZE + 2 * TEXTURE_TILE_BORDER), slot, 0)).xyz;
+    }
+    
+    *deferred = true; // the texture is still being decoded
+    return (col)(0.0f);
 }
 
 inline vec3 getVec(__global const float* buff, uint id) {
@@ -142,7 +445,7 @@ vec3 rayPointAtParam(const Ray* r, float t) {
     return r->origin + r->dir * t;
 }
 
-inline __global const Material* getMaterial(__global const Scene* scene, uint id) {
+inline __global const Material* getMaterial(const Scene* scene, uint id) {
     return scene->materials + id;
 }
 
@@ -254,12 +557,165 @@ bool hitLens(const Ray* r, __global const Lens* lens, HPI* hpi) {
     return false;
 }
 
-bool hitTriangle(const Ray* r, __global const Scene* scene, __global const Mesh* mesh, uint idx_A, uint idx_B, uint idx_C, HPI* hpi) {
+bool hitAABB(const Ray* r, vec3 bounds_min, vec3 bounds_max, float* t_enter, float* t_exit) {
+    vec3 inv_dir = 1.0f / r->dir;
+    vec3 t0 = (bounds_min - r->origin) * inv_dir;
+    vec3 t1 = (bounds_max - r->origin) * inv_dir;
+    vec3 t_small = fmin(t0, t1);
+    vec3 t_big = fmax(t0, t1);
+    
+    *t_enter = fmax(fmax(t_small.x, t_small.y), fmax(t_small.z, MIN_DISTANCE));
+    *t_exit = fmin(fmin(t_big.x, t_big.y), fmin(t_big.z, MAX_DISTANCE));
+    return *t_enter <= *t_exit;
+}
+
+bool hitBox(const Ray* r, __global const Box* b, HPI* hpi) {
+    // slab test in the frame of the box
+    vec3 oc = r->origin - b->pos;
+    vec3 o = (vec3)(dot(oc, b->axis_x), dot(oc, b->axis_y), dot(oc, b->axis_z));
+    vec3 d = (vec3)(dot(r->dir, b->axis_x), dot(r->dir, b->axis_y), dot(r->dir, b->axis_z));
+    vec3 inv_dir = 1.0f / d;
+    
+    vec3 t0 = (-b->half_size - o) * inv_dir;
+    vec3 t1 = (b->half_size - o) * inv_dir;
+    vec3 t_small = fmin(t0, t1);
+    vec3 t_big = fmax(t0, t1);
+    float t_enter = fmax(fmax(t_small.x, t_small.y), t_small.z);
+    float t_exit = fmin(fmin(t_big.x, t_big.y), t_big.z);
+    if(t_enter > t_exit) return false;
+    
+    float temp = t_enter >= MIN_DISTANCE ? t_enter : t_exit; // inside the box
+    if(!inRayRange(temp)) return false;
+    
+    // the face is on the axis on which the hit point is the furthest out
+    vec3 local = (o + d * temp) / b->half_size;
+    vec3 a = fabs(local);
+    vec3 n;
+    if(a.x >= a.y && a.x >= a.z) n = (vec3)(sign(local.x), 0.0f, 0.0f);
+    else if(a.y >= a.z) n = (vec3)(0.0f, sign(local.y), 0.0f);
+    else n = (vec3)(0.0f, 0.0f, sign(local.z));
+    
+    hpi->t = temp;
+    hpi->p = rayPointAtParam(r, temp);
+    hpi->normal = n.x * b->axis_x + n.y * b->axis_y + n.z * b->axis_z;
+    hpi->mat_ID = b->mat_ID;
+    return true;
+}
+
+bool hitCylinder(const Ray* r, __global const Cylinder* c, HPI* hpi) {
+    float t_enter, t_exit;
+    if(!hitAABB(r, c->bounds_min, c->bounds_max, &t_enter, &t_exit)) return false;
+    
+    vec3 ba = c->p2 - c->p1;
+    vec3 oc = r->origin - c->p1;
+    float baba = dot(ba, ba);
+    float bard = dot(ba, r->dir);
+    float baoc = dot(ba, oc);
+    
+    float temp = MAX_DISTANCE * 2.0f;
+    vec3 normal;
+    
+    // side, the distance from the axis equals r
+    float k2 = baba - bard * bard;
+    float k1 = baba * dot(oc, r->dir) - baoc * bard;
+    float k0 = baba * dot(oc, oc) - baoc * baoc - c->r * c->r * baba;
+    float dis = k1 * k1 - k2 * k0;
+    if(k2 > TRIANGLE_EPSILON && dis > 0.0f) {
+        float d = sqrt(dis);
+        float t = (-k1 - d) / k2;
+        float y = baoc + t * bard;
+        if(!inRayRange(t) || y < 0.0f || y > baba) {
+            t = (-k1 + d) / k2;
+            y = baoc + t * bard;
+        }
+        if(inRayRange(t) && y >= 0.0f && y <= baba) {
+            temp = t;
+            normal = (oc + r->dir * t - ba * (y / baba)) / c->r;
+        }
+    }
+    
+    // caps
+    if(fabs(bard) > TRIANGLE_EPSILON) {
+        for(int cap = 0; cap < 2; cap++) {
+            float side = (float)cap; // 0 at p1, 1 at p2
+            float t = (side * baba - baoc) / bard;
+            vec3 q = oc + r->dir * t - ba * side;
+            if(inRayRange(t) && t < temp && dot(q, q) <= c->r * c->r) {
+                temp = t;
+                normal = ba * (side * 2.0f - 1.0f) / sqrt(baba);
+            }
+        }
+    }
+    
+    if(temp > MAX_DISTANCE) return false;
+    
+    hpi->t = temp;
+    hpi->p = rayPointAtParam(r, temp);
+    hpi->normal = normal;
+    hpi->mat_ID = c->mat_ID;
+    return true;
+}
+
+bool hitDisc(const Ray* r, __global const Disc* disc, HPI* hpi) {
+    float a = dot(r->dir, disc->normal);
+    float temp = dot(disc->pos - r->origin, disc->normal) / a;
+    if(!inRayRange(temp)) return false;
+    
+    vec3 p = rayPointAtParam(r, temp);
+    vec3 q = p - disc->pos;
+    if(dot(q, q) > disc->r * disc->r) return false;
+    
+    hpi->t = temp;
+    hpi->p = p;
+    hpi->normal = -disc->normal * sign(a); // two-sided like the planes
+    hpi->mat_ID = disc->mat_ID;
+    return true;
+}
+
+inline vec3 quadricProduct(__global const Quadric* q, vec3 v) {
+    // symmetric matrix with diag on the diagonal and cross off it
+    return q->diag * v + (vec3)(q->cross.x * v.y + q->cross.y * v.z, q->cross.x * v.x + q->cross.z * v.z, q->cross.y * v.x + q->cross.z * v.y);
+}
+
+bool hitQuadric(const Ray* r, __global const Quadric* q, HPI* hpi) {
+    float t_enter, t_exit;
+    if(!hitAABB(r, q->bounds_min, q->bounds_max, &t_enter, &t_exit)) return false;
+    
+    // a t^2 + 2 b t + c = 0
+    vec3 o = r->origin - q->pos;
+    vec3 qd = quadricProduct(q, r->dir);
+    float a = dot(r->dir, qd);
+    float b = dot(o, qd) + dot(q->linear, r->dir);
+    float c = dot(o, quadricProduct(q, o)) + 2.0f * dot(q->linear, o) + q->constant;
+    
+    float t1, t2;
+    if(fabs(a) < TRIANGLE_EPSILON) {
+        if(fabs(b) < TRIANGLE_EPSILON) return false;
+        t1 = t2 = -c / (2.0f * b);
+    } else {
+        float dis = b * b - a * c;
+        if(dis < 0.0f) return false;
+        float d = sqrt(dis);
+        t1 = fmin((-b - d) / a, (-b + d) / a);
+        t2 = fmax((-b - d) / a, (-b + d) / a);
+    }
+    
+    float temp = t1 >= t_enter ? t1 : t2;
+    if(temp < t_enter || temp > t_exit) return false;
+    
+    hpi->t = temp;
+    hpi->p = rayPointAtParam(r, temp);
+    hpi->normal = normalize(quadricProduct(q, hpi->p - q->pos) + q->linear); // gradient, towards the positive side
+    hpi->mat_ID = q->mat_ID;
+    return true;
+}
+
+bool hitTriangle(const Ray* r, const vec3* vertices, HPI* hpi) {
     // Moller-Trumbore algorithm
     
-    __global const vec3* A = getMeshVertex(scene, mesh, idx_A);
-    __global const vec3* B = getMeshVertex(scene, mesh, idx_B);
-    __global const vec3* C = getMeshVertex(scene, mesh, idx_C);
+    const vec3* A = vertices;
+    const vec3* B = vertices + 1;
+    const vec3* C = vertices + 2;
     
     vec3 edge1 = (*B) - (*A);
     vec3 edge2 = (*C) - (*A);
@@ -278,7 +734,7 @@ bool hitTriangle(const Ray* r, __global const Scene* scene, __global const Mesh*
     
     float temp = f * dot(edge2, q);
     if(inRayRange(temp)) {
-        hpi->uv = getTextureUV(scene, mesh, idx_A, idx_B, idx_C, u, v);
+        hpi->uv = (vec2)(u, v); // barycentric, the mesh turns them into the texture coords
         hpi->t = temp;
         hpi->p = rayPointAtParam(r, temp);
         // ASSUME COUNTER-CLOCKWISE WINDING ORDER
@@ -288,13 +744,48 @@ bool hitTriangle(const Ray* r, __global const Scene* scene, __global const Mesh*
     } else return false;
 }
 
-bool hitMeshOut(const Ray* r, __global const Scene* scene, __global const Model* model, __global const Mesh* mesh, HPI* hpi) {
+bool hitBounds(const Ray* r, const vec3* inv_dir, __global const Chunk* chunk, float t_max) {
+    vec3 t0 = (chunk->bounds_min - r->origin) * (*inv_dir);
+    vec3 t1 = (chunk->bounds_max - r->origin) * (*inv_dir);
+    vec3 t_small = fmin(t0, t1);
+    vec3 t_big = fmax(t0, t1);
+    
+    float t_enter = fmax(fmax(t_small.x, t_small.y), fmax(t_small.z, MIN_DISTANCE));
+    float t_exit = fmin(fmin(t_big.x, t_big.y), fmin(t_big.z, t_max));
+    return t_enter <= t_exit;
+}
+
+bool hitMeshOut(const Ray* r, const vec3* inv_dir, const Scene* scene, __global const Mesh* mesh, HPI* hpi, float t_max, bool* deferred) {
     // ASSUME THAT THE MESH IS CONVEX
-    for(uint i = 0; i < mesh->face_count; i++) {
-        if(hitTriangle(r, scene, mesh, (3 * i), (3 * i + 1), (3 * i + 2), hpi)) {
-            if(dot(hpi->normal, r->dir) < 0.0f) {
-                hpi->texture_ID = mesh->texture_ID;
-                return true;
+    COUNT_COST(scene, c_chunks, mesh->chunk_count);
+    for(uint c = mesh->chunk_anchor; c < mesh->chunk_anchor + mesh->chunk_count; c++) {
+        __global const Chunk* chunk = scene->chunks + c;
+        if(!hitBounds(r, inv_dir, chunk, t_max)) continue;
+        
+        uint slot = scene->page_table[c];
+        if(slot == CHUNK_NOT_RESIDENT) {
+            // the chunk is not on the device yet, the host uploads it before the next frame
+            scene->feedback[c] = CHUNK_MISSING;
+            *deferred = true;
+            continue;
+        }
+        if(scene->streaming) scene->feedback[c] = CHUNK_USED;
+        
+        uint first_vertex = slot * CHUNK_VERTEX_COUNT;
+        __global const uchar* face_indices = scene->chunk_indices + slot * 3 * CHUNK_FACE_COUNT;
+        
+        for(uint i = 0; i < chunk->face_count; i++) {
+            uint ids[3] = {first_vertex + face_indices[3 * i], first_vertex + face_indices[3 * i + 1], first_vertex + face_indices[3 * i + 2]};
+            vec3 vertices[3] = {loadVertex(scene, mesh, ids[0]), loadVertex(scene, mesh, ids[1]), loadVertex(scene, mesh, ids[2])};
+            COUNT_COST(scene, c_triangles, 1);
+            
+            if(hitTriangle(r, vertices, hpi)) {
+                if(dot(hpi->normal, r->dir) < 0.0f) {
+                    hpi->uv = getTextureUV(scene, ids, hpi->uv);
+                    hpi->texture_ID = mesh->texture_ID;
+                    hpi->texture_lod = getTriangleLOD(scene, vertices, ids);
+                    return true;
+                }
             }
         }
     }
@@ -302,13 +793,26 @@ bool hitMeshOut(const Ray* r, __global const Scene* scene, __global const Model*
     return false;
 }
 
-bool hitModel(const Ray* r, __global const Scene* scene, __global const Model* model, HPI* hpi) {
+uint getModelLOD(const Ray* r, __global const Model* model, float lod_distance) {
+    // the first simplified level starts lod_distance radii from the centre, every next one at twice the distance
+    if(lod_distance <= 0.0f || model->lod_count < 2) return 0;
+    
+    float d = distance(r->origin, model->bounds.xyz) / (model->bounds.w * lod_distance);
+    if(d < 1.0f) return 0; // also the rays leaving the model itself
+    return min((uint)log2(d) + 1, model->lod_count - 1);
+}
+
+bool hitModel(const Ray* r, const Scene* scene, __global const Model* model, HPI* hpi, float t_max, float lod_distance, bool* deferred) {
     bool hit_any = false;
-    float hit_min = MAX_DISTANCE;
+    float hit_min = t_max;
     HPI hpi_result;
+    vec3 inv_dir = 1.0f / r->dir;
     
-    for(uint i = 0; i < model->mesh_count; i++) {
-        if(hitMeshOut(r, scene, model, scene->mesh_buffer + model->mesh_anchor + i, &hpi_result) && hpi_result.t < hit_min) {
+    uint level = getModelLOD(r, model, lod_distance);
+    uint mesh_end = level + 1 < model->lod_count ? model->lod_anchors[level + 1] : model->mesh_count;
+    
+    for(uint i = model->lod_anchors[level]; i < mesh_end; i++) {
+        if(hitMeshOut(r, &inv_dir, scene, scene->mesh_buffer + model->mesh_anchor + i, &hpi_result, hit_min, deferred) && hpi_result.t < hit_min) {
             hit_any = true;
             *hpi = hpi_result;
             hpi->mat_ID = model->mat_ID;
@@ -319,11 +823,12 @@ bool hitModel(const Ray* r, __global const Scene* scene, __global const Model* m
     return hit_any;
 }
 
-bool hitScene(const Ray* r, __global const Scene* scene, HPI* hpi) {
+bool hitScene(const Ray* r, const Scene* scene, HPI* hpi, float lod_distance, bool* deferred) {
     bool hit_any = false;
     float hit_min = MAX_DISTANCE;
     HPI hpi_result;
     
+    COUNT_COST(scene, c_spheres, scene->sphere_count);
     for(uint i = 0; i < scene->sphere_count; i++) {
         if(hitSphere(r, scene->spheres + i, &hpi_result) && hpi_result.t < hit_min) {
             hit_any = true;
@@ -332,6 +837,7 @@ bool hitScene(const Ray* r, __global const Scene* scene, HPI* hpi) {
         }
     }
     
+    COUNT_COST(scene, c_planes, scene->plane_count);
     for(uint i = 0; i < scene->plane_count; i++) {
         if(hitPlane(r, scene->planes + i, &hpi_result) && hpi_result.t < hit_min) {
             hit_any = true;
@@ -340,6 +846,7 @@ bool hitScene(const Ray* r, __global const Scene* scene, HPI* hpi) {
         }
     }
     
+    COUNT_COST(scene, c_lenses, scene->lens_count);
     for(uint i = 0; i < scene->lens_count; i++) {
         if(hitLens(r, scene->lenses + i, &hpi_result) && hpi_result.t < hit_min) {
             hit_any = true;
@@ -348,8 +855,44 @@ bool hitScene(const Ray* r, __global const Scene* scene, HPI* hpi) {
         }
     }
     
+    COUNT_COST(scene, c_analytic, scene->box_count);
+    for(uint i = 0; i < scene->box_count; i++) {
+        if(hitBox(r, scene->boxes + i, &hpi_result) && hpi_result.t < hit_min) {
+            hit_any = true;
+            *hpi = hpi_result;
+            hit_min = hpi_result.t;
+        }
+    }
+    
+    COUNT_COST(scene, c_analytic, scene->cylinder_count);
+    for(uint i = 0; i < scene->cylinder_count; i++) {
+        if(hitCylinder(r, scene->cylinders + i, &hpi_result) && hpi_result.t < hit_min) {
+            hit_any = true;
+            *hpi = hpi_result;
+            hit_min = hpi_result.t;
+        }
+    }
+    
+    COUNT_COST(scene, c_analytic, scene->disc_count);
+    for(uint i = 0; i < scene->disc_count; i++) {
+        if(hitDisc(r, scene->discs + i, &hpi_result) && hpi_result.t < hit_min) {
+            hit_any = true;
+            *hpi = hpi_result;
+            hit_min = hpi_result.t;
+        }
+    }
+    
+    COUNT_COST(scene, c_analytic, scene->quadric_count);
+    for(uint i = 0; i < scene->quadric_count; i++) {
+        if(hitQuadric(r, scene->quadrics + i, &hpi_result) && hpi_result.t < hit_min) {
+            hit_any = true;
+            *hpi = hpi_result;
+            hit_min = hpi_result.t;
+        }
+    }
+    
     for(uint i = 0; i < scene->model_count; i++) {
-        if(hitModel(r, scene, scene->models + i, &hpi_result) && hpi_result.t < hit_min) {
+        if(hitModel(r, scene, scene->models + i, &hpi_result, hit_min, lod_distance, deferred) && hpi_result.t < hit_min) {
             hit_any = true;
             *hpi = hpi_result;
             hit_min = hpi_result.t;
@@ -359,14 +902,76 @@ bool hitScene(const Ray* r, __global const Scene* scene, HPI* hpi) {
     return hit_any;
 }
 
-void rayReflect(Ray* r, col* c, const HPI* hpi, __global const Scene* scene) {
+// the primary rays test only the candidates of their screen tile and the planes, which are not bounded
+bool hitBinned(const Ray* r, const Scene* scene, __global const uint* bin, HPI* hpi, float lod_distance, bool* deferred) {
+    uint count = bin[0];
+    if(count > BIN_CAPACITY) return hitScene(r, scene, hpi, lod_distance, deferred);
+    
+    bool hit_any = false;
+    float hit_min = MAX_DISTANCE;
+    HPI hpi_result;
+    
+    COUNT_COST(scene, c_planes, scene->plane_count);
+    for(uint i = 0; i < scene->plane_count; i++) {
+        if(hitPlane(r, scene->planes + i, &hpi_result) && hpi_result.t < hit_min) {
+            hit_any = true;
+            *hpi = hpi_result;
+            hit_min = hpi_result.t;
+        }
+    }
+    
+    for(uint i = 1; i <= count; i++) {
+        uint id = bin[i] & BIN_INDEX_MASK;
+        bool hit = false;
+        
+        switch(bin[i] >> BIN_TYPE_SHIFT) {
+            case bin_sphere:
+                COUNT_COST(scene, c_spheres, 1);
+                hit = hitSphere(r, scene->spheres + id, &hpi_result);
+                break;
+            case bin_lens:
+                COUNT_COST(scene, c_lenses, 1);
+                hit = hitLens(r, scene->lenses + id, &hpi_result);
+                break;
+            case bin_box:
+                COUNT_COST(scene, c_analytic, 1);
+                hit = hitBox(r, scene->boxes + id, &hpi_result);
+                break;
+            case bin_cylinder:
+                COUNT_COST(scene, c_analytic, 1);
+                hit = hitCylinder(r, scene->cylinders + id, &hpi_result);
+                break;
+            case bin_disc:
+                COUNT_COST(scene, c_analytic, 1);
+                hit = hitDisc(r, scene->discs + id, &hpi_result);
+                break;
+            case bin_quadric:
+                COUNT_COST(scene, c_analytic, 1);
+                hit = hitQuadric(r, scene->quadrics + id, &hpi_result);
+                break;
+            case bin_model:
+                hit = hitModel(r, scene, scene->models + id, &hpi_result, hit_min, lod_distance, deferred);
+                break;
+        }
+        
+        if(hit && hpi_result.t < hit_min) {
+            hit_any = true;
+            *hpi = hpi_result;
+            hit_min = hpi_result.t;
+        }
+    }
+    
+    return hit_any;
+}
+
+void rayReflect(Ray* r, col* c, const HPI* hpi, const Scene* scene) {
     r->origin = hpi->p;
     r->dir = normalize(r->dir - 2.0f * dot(r->dir, hpi->normal) * hpi->normal);
     
     if(getMaterial(scene, hpi->mat_ID)->type == t_reflective) (*c) *= getMaterial(scene, hpi->mat_ID)->extra_data;
 }
 
-void rayRefract(Ray* r, col* c, HPI* hpi, __global const Scene* scene) {
+void rayRefract(Ray* r, col* c, HPI* hpi, const Scene* scene) {
     vec3 normal;
     float idx_ratio;
     float cai = dot(r->dir, hpi->normal); //cos_angle_incident
@@ -390,9 +995,10 @@ void rayRefract(Ray* r, col* c, HPI* hpi, __global const Scene* scene) {
     }
 }
 
-void rayScatter(Ray* r, col* c, const HPI* hpi, __global const float* random_buffer, uint s_seed, __global const Scene* scene) {
-    vec3 random_in_sphere = randomVec(random_buffer, r, s_seed);
-    r->dir = normalize(hpi->normal + random_in_sphere);
+void rayScatter(Ray* r, col* c, const HPI* hpi, __global const float* random_buffer, uint s_seed, const Scene* scene) {
+    // a point on the unit sphere around the tip of the normal gives the pdf cos/pi the MIS weights assume
+    vec3 dir = hpi->normal + randomVec(random_buffer, r, s_seed);
+    r->dir = dot(dir, dir) > 1e-8f ? normalize(dir) : hpi->normal;
     r->origin = hpi->p;
     
     (*c) *= getMaterial(scene, hpi->mat_ID)->extra_data;
@@ -404,7 +1010,7 @@ float schlick(float cai, float idx_ratio) {
     return r0 + (1.0f - r0) * pow((1.0f - cai), 5);
 }
 
-void rayRefractDielectric(Ray* r, col* c, HPI* hpi, __global const float* random_buffer, uint s_seed, __global const Scene* scene) {
+void rayRefractDielectric(Ray* r, col* c, HPI* hpi, __global const float* random_buffer, uint s_seed, const Scene* scene) {
     vec3 normal;
     float idx_ratio;
     float cai = dot(r->dir, hpi->normal); //cos_angle_incident
@@ -441,20 +1047,122 @@ inline col bkgCol(const Ray *r) {
     return (col)(y * 0.6f + 0.1f, y, 1.0f);
 }
 
-col getCol(Ray* r, __global const float* random_buffer, __global const Scene* scene, __read_only image2d_array_t texture, uint sample) {
+inline uint lowerBound(__global const float* cdf, uint count, float value) {
+    uint first = 0;
+    while(count > 0) {
+        uint step = count / 2;
+        if(cdf[first + step] < value) {
+            first += step + 1;
+            count -= step + 1;
+        } else count = step;
+    }
+    return first;
+}
+
+inline float getEnvironmentWeight(vec4 texel, uint y, uint height) {
+    // luminance times the solid angle of the row, keep in sync with src/scene.cpp
+    return dot(texel.xyz, (vec3)(0.2126f, 0.7152f, 0.0722f)) * sinpi(((float)y + 0.5f) / (float)height);
+}
+
+inline uint getEnvironmentTexel(const Scene* scene, vec3 dir) {
+    float u = (atan2(dir.z, dir.x) + scene->environment_rotation) / (2.0f * M_PI_F);
+    float v = acos(clamp(-dir.y, -1.0f, 1.0f)) / M_PI_F;
+    u -= floor(u);
+    
+    uint x = min((uint)(u * scene->environment_width), scene->environment_width - 1);
+    uint y = min((uint)(v * scene->environment_height), scene->environment_height - 1);
+    return y * scene->environment_width + x;
+}
+
+inline col getEnvironment(const Scene* scene, vec3 dir) {
+    if(scene->environment_width == 0) return (col)(0.0f);
+    return scene->environment[getEnvironmentTexel(scene, dir)].xyz * scene->environment_intensity;
+}
+
+float getEnvironmentPdf(const Scene* scene, vec3 dir) {
+    // per solid angle, the texels are sampled proportionally to their weight
+    float sin_theta = sqrt(fmax(1.0f - dir.y * dir.y, 0.0f));
+    if(sin_theta == 0.0f) return 0.0f;
+    
+    uint texel = getEnvironmentTexel(scene, dir);
+    float weight = getEnvironmentWeight(scene->environment[texel], texel / scene->environment_width, scene->environment_height);
+    float texel_count = (float)scene->environment_width * (float)scene->environment_height;
+    return weight / scene->environment_weight_sum * texel_count / (2.0f * M_PI_F * M_PI_F * sin_theta);
+}
+
+vec3 sampleEnvironment(const Scene* scene, float rand_u, float rand_v) {
+    uint width = scene->environment_width, height = scene->environment_height;
+    __global const float* marginal = scene->environment_cdf;
+    uint y = min(lowerBound(marginal, height, rand_v), height - 1);
+    __global const float* conditional = marginal + height + y * width;
+    uint x = min(lowerBound(conditional, width, rand_u), width - 1);
+    
+    // the rest of the random numbers places the direction inside the texel
+    float v_low = y > 0 ? marginal[y - 1] : 0.0f;
+    float u_low = x > 0 ? conditional[x - 1] : 0.0f;
+    float v = ((float)y + clamp((rand_v - v_low) / fmax(marginal[y] - v_low, 1e-12f), 0.0f, 1.0f)) / (float)height;
+    float u = ((float)x + clamp((rand_u - u_low) / fmax(conditional[x] - u_low, 1e-12f), 0.0f, 1.0f)) / (float)width;
+    
+    float theta = v * M_PI_F;
+    float phi = u * 2.0f * M_PI_F - scene->environment_rotation;
+    return (vec3)(sin(theta) * cos(phi), -cos(theta), sin(theta) * sin(phi));
+}
+
+inline float powerHeuristic(float pdf, float other_pdf) {
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+void sampleEnvironmentLight(col* radiance, col throughput, const HPI* hpi, const Ray* r, __global const float* random_buffer, uint s_seed, const Scene* scene, bool* deferred) {
+    // next event estimation at a diffuse hit, weighted against the cosine sampled bounce
+    vec3 dir = sampleEnvironment(scene, random(random_buffer, r, s_seed + ENVIRONMENT_SEED), random(random_buffer, r, s_seed + 2 * ENVIRONMENT_SEED));
+    float cos_theta = dot(dir, hpi->normal);
+    if(cos_theta <= 0.0f) return;
+    
+    float light_pdf = getEnvironmentPdf(scene, dir);
+    if(light_pdf <= 0.0f) return;
+    
+    Ray shadow;
+    shadow.origin = hpi->p;
+    shadow.dir = dir;
+    shadow.param = 0.0f;
+    HPI blocker;
+    if(hitScene(&shadow, scene, &blocker, scene->lod_secondary_distance, deferred)) return;
+    
+    float bsdf_pdf = cos_theta / M_PI_F;
+    *radiance += throughput * getEnvironment(scene, dir) * (bsdf_pdf * powerHeuristic(light_pdf, bsdf_pdf) / light_pdf);
+}
+
+col getCol(Ray* r, __global const float* random_buffer, const Scene* scene, __read_only image2d_array_t texture, float pixel_spread, uint sample, bool first_hit, const HPI* first_hpi, bool* deferred) {
     col out = (col)(1.0f);
+    col radiance = (col)(0.0f); // from the environment, the emitters end the path with out
+    float path_length = 0.0f; // the footprint of the ray grows along the whole path
+    float bsdf_pdf = 0.0f; // of the last bounce, 0 after a specular one
+    bool sample_environment = scene->environment_width > 0 && scene->environment_weight_sum > 0.0f;
+    float lod_distance = scene->lod_primary_distance; // the specular bounces keep the levels of the primary rays
     
     for(uint i = 0; i < DEPTH; i++) {
+        COUNT_COST(scene, c_bounces, 1);
         HPI hpi;
-        bool hit = hitScene(r, scene, &hpi);
+        bool hit;
+        if(i == 0) {
+            // the caller traced or cached the primary hit
+            hit = first_hit;
+            hpi = *first_hpi;
+        } else hit = hitScene(r, scene, &hpi, lod_distance, deferred);
         if(!hit) {
+            float weight = sample_environment && bsdf_pdf > 0.0f ? powerHeuristic(bsdf_pdf, getEnvironmentPdf(scene, r->dir)) : 1.0f;
+            radiance += out * getEnvironment(scene, r->dir) * weight;
             out = (col)(0.0f);//min(out, bkgCol(r));
             break;
         } else {
+            path_length += hpi.t;
+            bsdf_pdf = 0.0f;
+            
             switch(getMaterial(scene, hpi.mat_ID)->type) {
                 case t_diffuse:
                     rayScatter(r, &out, &hpi, random_buffer, i + sample, scene);
                     mixCol(out, getMaterial(scene, hpi.mat_ID)->color);
+                    bsdf_pdf = fmax(dot(r->dir, hpi.normal), 0.0f) / M_PI_F;
                     break;
                 case t_light:
                     i = DEPTH;
@@ -472,17 +1180,57 @@ col getCol(Ray* r, __global const float* random_buffer, __global const Scene* sc
                     rayRefractDielectric(r, &out, &hpi, random_buffer, i + sample, scene);
                     mixCol(out, getMaterial(scene, hpi.mat_ID)->color);
                     break;
-                case t_textured:
+                case t_textured: {
+                    float footprint = path_length * pixel_spread / fmax(fabs(dot(r->dir, hpi.normal)), LOD_MIN_COSINE);
+                    col texture_col = sampleTexture(scene, texture, &hpi, footprint, deferred);
                     rayScatter(r, &out, &hpi, random_buffer, i + sample, scene);
-                    mixCol(out, getTextureCol(texture, &(hpi.uv), hpi.texture_ID));
+                    mixCol(out, texture_col);
+                    bsdf_pdf = fmax(dot(r->dir, hpi.normal), 0.0f) / M_PI_F;
                     break;
+                }
             }
             
+            if(bsdf_pdf > 0.0f) lod_distance = scene->lod_secondary_distance; // a diffuse bounce blurs the detail away
+            if(sample_environment && bsdf_pdf > 0.0f) sampleEnvironmentLight(&radiance, out, &hpi, r, random_buffer, i + sample, scene, deferred);
+            
             //out = min(out, getMaterial(scene, hpi.mat_ID)->color); // mix colors
         }
     }
     
-    return out;
+    return radiance + out; // out is 0 if the path escaped
+}
+
+inline uint compactBits(uint x) {
+    // keep every other bit of x
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0f0f0f0f;
+    x = (x | (x >> 4)) & 0x00ff00ff;
+    x = (x | (x >> 8)) & 0x0000ffff;
+    return x;
+}
+
+bool getPixel(uint order, int width, int height, int2* loc) {
+    if(order == ORDER_MORTON) {
+        // 1D launch, every MORTON_TILE_SIZE^2 work-items cover a tile, traversed along a Z-curve
+        uint id = get_global_id(0);
+        uint tile = id / (MORTON_TILE_SIZE * MORTON_TILE_SIZE);
+        uint i = id % (MORTON_TILE_SIZE * MORTON_TILE_SIZE);
+        uint tiles_x = (width + MORTON_TILE_SIZE - 1) / MORTON_TILE_SIZE;
+        loc->x = (tile % tiles_x) * MORTON_TILE_SIZE + compactBits(i);
+        loc->y = (tile / tiles_x) * MORTON_TILE_SIZE + compactBits(i >> 1);
+    } else {
+        loc->x = get_global_id(0);
+        loc->y = get_global_id(1);
+    }
+    
+    return loc->x < width && loc->y < height; // the launch range may be padded to the work-group size
+}
+
+inline float getPixelSpread(__global const float* camera_buffer, int height) {
+    // angle covered by a pixel, for the texture level of detail
+    vec3 centre = getVec(camera_buffer, 3) + 0.5f * (getVec(camera_buffer, 6) + getVec(camera_buffer, 9));
+    return length(getVec(camera_buffer, 9)) / ((float)height * length(centre));
 }
 
 inline col gamma_corr(const col* color) {
@@ -493,66 +1241,403 @@ inline col gamma_corr_inv(const col* color) {
     return (*color) * (*color); // for anny other GAMMA value, use: pow(*color, GAMMA);
 }
 
-__kernel void trace(__write_only image2d_t image, __global const float* camera_buffer, __global const float* random_buffer, __global const Scene* scene, __read_only image2d_array_t texture) {
-    int x = get_global_id(0);
-    int y = get_global_id(1);
+inline int2 getGridSize(int width, int height, uint scale, uint checker) {
+    if(checker) return (int2)((width + 1) / 2, height);
+    return (int2)((width + scale - 1) / scale, (height + scale - 1) / scale);
+}
+
+inline bool isTraced(int2 pixel, uint parity) {
+    return ((pixel.x + pixel.y + parity) & 1) == 0;
+}
+
+bool loadPrimaryHit(__global const PrimaryHit* cached, uint generation, const Ray* r, bool* hit, HPI* hpi) {
+    if(cached->generation != generation) return false;
+    
+    *hit = cached->mat_ID != PRIMARY_MISS;
+    hpi->t = cached->t;
+    hpi->p = rayPointAtParam(r, hpi->t);
+    hpi->normal = normalize(vload_half3(0, (__global const half*)cached->normal));
+    hpi->uv = cached->uv;
+    hpi->texture_lod = vload_half(0, (__global const half*)&cached->texture_lod);
+    hpi->texture_ID = cached->texture_ID;
+    hpi->mat_ID = cached->mat_ID;
+    return true;
+}
+
+void storePrimaryHit(__global PrimaryHit* cached, uint generation, bool hit, const HPI* hpi) {
+    cached->mat_ID = hit ? hpi->mat_ID : PRIMARY_MISS;
+    if(hit) {
+        cached->t = hpi->t;
+        vstore_half3(hpi->normal, 0, (__global half*)cached->normal);
+        cached->uv = hpi->uv;
+        vstore_half(hpi->texture_lod, 0, (__global half*)&cached->texture_lod);
+        cached->texture_ID = hpi->texture_ID;
+    }
+    cached->generation = generation;
+}
+
+inline __global const uint* getBin(__global const uint* bins, int2 pixel, int width) {
+    int tiles_x = (width + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE;
+    return bins + ((pixel.y / BIN_TILE_SIZE) * tiles_x + pixel.x / BIN_TILE_SIZE) * (BIN_CAPACITY + 1);
+}
+
+inline void addToBin(__global uint* bin, uint* count, uint type, uint id, vec3 centre, float radius, vec3 origin, const vec3* planes) {
+    // a bounding sphere outside any side of the tile frustum is never hit by its primary rays
+    vec3 d = centre - origin;
+    for(int i = 0; i < 4; i++) {
+        if(dot(planes[i], d) < -radius) return;
+    }
+    
+    (*count)++;
+    if(*count <= BIN_CAPACITY) bin[*count] = (type << BIN_TYPE_SHIFT) | id;
+}
+
+// candidate lists of the screen tiles for the primary rays, one work-item per tile, the count is first and exceeds BIN_CAPACITY if the list overflowed
+__kernel void binning(__global uint* bins, __global const float* camera_buffer, __global uchar* scene_arena, const uint width, const uint height) {
+    uint tiles_x = (width + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE;
+    uint tiles_y = (height + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE;
+    uint tile = get_global_id(0);
+    if(tile >= tiles_x * tiles_y) return;
+    
+    // the corners of the tile, a whole pixel past the last one
+    float s0 = (float)((tile % tiles_x) * BIN_TILE_SIZE) / (float)width;
+    float s1 = (float)((tile % tiles_x + 1) * BIN_TILE_SIZE) / (float)width;
+    float t0 = (float)((tile / tiles_x) * BIN_TILE_SIZE) / (float)height;
+    float t1 = (float)((tile / tiles_x + 1) * BIN_TILE_SIZE) / (float)height;
+    
+    vec3 origin = getVec(camera_buffer, 0);
+    vec3 camera_llc = getVec(camera_buffer, 3);
+    vec3 horizontal = getVec(camera_buffer, 6);
+    vec3 vertical = getVec(camera_buffer, 9);
+    vec3 c00 = camera_llc + s0 * horizontal + t0 * vertical;
+    vec3 c10 = camera_llc + s1 * horizontal + t0 * vertical;
+    vec3 c01 = camera_llc + s0 * horizontal + t1 * vertical;
+    vec3 c11 = camera_llc + s1 * horizontal + t1 * vertical;
+    
+    // the side planes through the camera, the normals point into the frustum
+    vec3 planes[4] = {normalize(cross(c00, c01)), normalize(cross(c01, c11)), normalize(cross(c11, c10)), normalize(cross(c10, c00))};
+    for(int i = 0; i < 4; i++) {
+        if(dot(planes[i], c00 + c11) < 0.0f) planes[i] = -planes[i];
+    }
+    
+    Scene scene = getScene(scene_arena);
+    __global uint* bin = bins + tile * (BIN_CAPACITY + 1);
+    uint count = 0;
+    
+    for(uint i = 0; i < scene.sphere_count; i++) addToBin(bin, &count, bin_sphere, i, scene.spheres[i].pos, fabs(scene.spheres[i].r), origin, planes);
+    
+    for(uint i = 0; i < scene.lens_count; i++) {
+        // the lens is inside both of its spheres
+        __global const Lens* lens = scene.lenses + i;
+        if(lens->r1 <= lens->r2) addToBin(bin, &count, bin_lens, i, lens->p1, lens->r1, origin, planes);
+        else addToBin(bin, &count, bin_lens, i, lens->p2, lens->r2, origin, planes);
+    }
+    
+    for(uint i = 0; i < scene.box_count; i++) addToBin(bin, &count, bin_box, i, scene.boxes[i].pos, length(scene.boxes[i].half_size), origin, planes);
+    
+    for(uint i = 0; i < scene.cylinder_count; i++) {
+        __global const Cylinder* c = scene.cylinders + i;
+        addToBin(bin, &count, bin_cylinder, i, 0.5f * (c->bounds_min + c->bounds_max), 0.5f * distance(c->bounds_min, c->bounds_max), origin, planes);
+    }
+    
+    for(uint i = 0; i < scene.disc_count; i++) addToBin(bin, &count, bin_disc, i, scene.discs[i].pos, scene.discs[i].r, origin, planes);
+    
+    for(uint i = 0; i < scene.quadric_count; i++) {
+        __global const Quadric* q = scene.quadrics + i;
+        addToBin(bin, &count, bin_quadric, i, 0.5f * (q->bounds_min + q->bounds_max), 0.5f * distance(q->bounds_min, q->bounds_max), origin, planes);
+    }
+    
+    for(uint i = 0; i < scene.model_count; i++) addToBin(bin, &count, bin_model, i, scene.models[i].bounds.xyz, scene.models[i].bounds.w, origin, planes);
+    
+    bin[0] = count;
+}
+
+#ifdef COST_HEATMAP
+inline ulong readClock() {
+#ifdef cl_nv_pragma_unroll
+    ulong clock;
+    asm volatile("mov.u64 %0, %%clock64;" : "=l"(clock));
+    return clock;
+#else
+    return 0;
+#endif
+}
+
+void storeCost(__global float* cost_buffer, __global uint* cost_max, int2 loc, int width, Cost* cost, ulong clock_start, float mixing_param) {
+    ulong clock = readClock() - clock_start;
+    if(clock == 0) {
+        for(uint c = c_bounces; c < COST_CHANNELS; c++) clock += cost->counters[c] * cost_weights[c];
+    }
+    cost->counters[c_time] = (uint)min(clock, (ulong)UINT_MAX);
+    
+    // the mean over the samples of the pixel, the maximum over the image scales the heatmap
+    __global float* pixel = cost_buffer + (loc.y * width + loc.x) * COST_CHANNELS;
+    for(uint c = 0; c < COST_CHANNELS; c++) {
+        pixel[c] = mixing_param > 0.0f ? mix((float)cost->counters[c], pixel[c], mixing_param) : (float)cost->counters[c];
+        atomic_max(cost_max + c, as_uint(pixel[c])); // positive floats are ordered like their bits
+    }
+}
+#endif
+
+// only every scale-th pixel (or every other one in a checkerboard) is traced, the resolve kernel fills in the rest
+__kernel void trace(__write_only image2d_t image, __global const float* camera_buffer, __global const float* random_buffer, __global uchar* scene_arena, __read_only image2d_array_t texture, const uint order, const uint scale, const uint checker, const uint parity, const uint sample, __global const uint* bins COST_ARGS) {
+    int width = get_image_width(image), height = get_image_height(image);
+    int2 grid_size = getGridSize(width, height, scale, checker);
+    
+    int2 loc;
+    if(!getPixel(order, grid_size.x, grid_size.y, &loc)) return;
     
-    float s = (float)x / (float)get_image_width(image);
-    float t = (float)y / (float)get_image_height(image);
+    int2 pixel = checker ? (int2)(2 * loc.x + ((loc.y + parity) & 1), loc.y) : loc * (int)scale;
+    if(pixel.x >= width) return;
+    
+    float s = (float)pixel.x / (float)width;
+    float t = (float)pixel.y / (float)height;
     
     vec3 camera_pos = getVec(camera_buffer, 0);
     
     Ray r_main = genInitRay(camera_buffer, &camera_pos, s, t);
     
-    col out = getCol(&r_main, random_buffer, scene, texture, 0);
+    Scene scene = getScene(scene_arena);
+#ifdef COST_HEATMAP
+    Cost cost = {{0}};
+    scene.cost = &cost;
+    ulong clock_start = readClock();
+#endif
+    bool deferred = false;
+    HPI first_hpi;
+    bool first_hit = hitBinned(&r_main, &scene, getBin(bins, pixel, width), &first_hpi, scene.lod_primary_distance, &deferred);
+    col out = getCol(&r_main, random_buffer, &scene, texture, getPixelSpread(camera_buffer, height), sample, first_hit, &first_hpi, &deferred);
+#ifdef COST_HEATMAP
+    storeCost(cost_buffer, cost_max, pixel, width, &cost, clock_start, 0.0f);
+#endif
     
-    write_imagef(image, (int2)(x, y), (float4)(gamma_corr(&out), 1.0f));
+    // the alpha channel holds the number of samples accumulated in the pixel
+    if(checker) loc = pixel;
+    if(deferred) write_imagef(image, loc, (float4)(0.0f));
+    else write_imagef(image, loc, (float4)(gamma_corr(&out), 1.0f));
 }
 
-__kernel void retrace(__read_only image2d_t image_in, __write_only image2d_t image_out, __global const float* camera_buffer, __global const float* random_buffer, __global const Scene* scene, __read_only image2d_array_t texture, const uint sample) {
-    int x = get_global_id(0);
-    int y = get_global_id(1);
-    int2 loc = (int2)(x, y);
+inline float getLuminance(vec4 c) {
+    return dot(c.xyz, (vec3)(0.2126f, 0.7152f, 0.0722f));
+}
+
+inline float getEdgeWeight(vec4 c, vec4 ref) {
+    vec3 d = c.xyz - ref.xyz;
+    return c.w > 0.0f ? exp(-dot(d, d) * EDGE_SHARPNESS) : 0.0f; // deferred samples have no weight
+}
+
+// edge-aware upscaling of the samples written by trace at a reduced resolution, mixed into the reprojected history
+__kernel void resolve(__read_only image2d_t samples, __read_only image2d_t history, __write_only image2d_t image, const uint scale, const uint checker, const uint parity) {
+    int width = get_image_width(image), height = get_image_height(image);
+    int2 pixel = (int2)(get_global_id(0), get_global_id(1));
+    if(pixel.x >= width || pixel.y >= height) return;
+    
+    vec4 out;
+    
+    if(checker) {
+        out = read_imagef(samples, sampler, pixel);
+        
+        if(!isTraced(pixel, parity)) {
+            // interpolate along the direction with the smaller gradient, across an edge the other pair differs more
+            vec4 left = read_imagef(samples, sampler, (int2)(max(pixel.x - 1, 0), pixel.y));
+            vec4 right = read_imagef(samples, sampler, (int2)(min(pixel.x + 1, width - 1), pixel.y));
+            vec4 down = read_imagef(samples, sampler, (int2)(pixel.x, max(pixel.y - 1, 0)));
+            vec4 up = read_imagef(samples, sampler, (int2)(pixel.x, min(pixel.y + 1, height - 1)));
+            
+            // the clamped neighbours at the border may not be traced
+            if(!isTraced((int2)(max(pixel.x - 1, 0), pixel.y), parity)) left.w = 0.0f;
+            if(!isTraced((int2)(min(pixel.x + 1, width - 1), pixel.y), parity)) right.w = 0.0f;
+            if(!isTraced((int2)(pixel.x, max(pixel.y - 1, 0)), parity)) down.w = 0.0f;
+            if(!isTraced((int2)(pixel.x, min(pixel.y + 1, height - 1)), parity)) up.w = 0.0f;
+            
+            float gradient_h = (left.w > 0.0f && right.w > 0.0f) ? fabs(getLuminance(left) - getLuminance(right)) : MAX_DISTANCE;
+            float gradient_v = (down.w > 0.0f && up.w > 0.0f) ? fabs(getLuminance(down) - getLuminance(up)) : MAX_DISTANCE;
+            
+            float weight_h = gradient_h <= gradient_v ? 1.0f : 0.0f;
+            float weight_v = gradient_v <= gradient_h ? 1.0f : 0.0f;
+            
+            float w_l = weight_h * (left.w > 0.0f), w_r = weight_h * (right.w > 0.0f), w_d = weight_v * (down.w > 0.0f), w_u = weight_v * (up.w > 0.0f);
+            if(w_l + w_r + w_d + w_u == 0.0f) {
+                w_l = left.w > 0.0f;
+                w_r = right.w > 0.0f;
+                w_d = down.w > 0.0f;
+                w_u = up.w > 0.0f;
+            }
+            
+            float weight_sum = w_l + w_r + w_d + w_u;
+            if(weight_sum > 0.0f) out = (vec4)((left.xyz * w_l + right.xyz * w_r + down.xyz * w_d + up.xyz * w_u) / weight_sum, 1.0f);
+            else out = (vec4)(0.0f);
+        }
+    } else {
+        int2 grid_size = getGridSize(width, height, scale, checker);
+        
+        // bilinear weights of the 4 nearest samples, lowered for the ones that differ from the closest sample
+        vec2 grid_pos = convert_float2(pixel) / (float)scale;
+        int2 base = convert_int2(floor(grid_pos));
+        vec2 f = grid_pos - floor(grid_pos);
+        int2 next = min(base + (int2)(1), grid_size - (int2)(1));
+        
+        vec4 c00 = read_imagef(samples, sampler, base);
+        vec4 c10 = read_imagef(samples, sampler, (int2)(next.x, base.y));
+        vec4 c01 = read_imagef(samples, sampler, (int2)(base.x, next.y));
+        vec4 c11 = read_imagef(samples, sampler, next);
+        
+        vec4 ref = f.x < 0.5f ? (f.y < 0.5f ? c00 : c01) : (f.y < 0.5f ? c10 : c11);
+        
+        float w00 = (1.0f - f.x) * (1.0f - f.y) * getEdgeWeight(c00, ref);
+        float w10 = f.x * (1.0f - f.y) * getEdgeWeight(c10, ref);
+        float w01 = (1.0f - f.x) * f.y * getEdgeWeight(c01, ref);
+        float w11 = f.x * f.y * getEdgeWeight(c11, ref);
+        
+        float weight_sum = w00 + w10 + w01 + w11;
+        if(weight_sum > 0.0001f) out = (vec4)((c00.xyz * w00 + c10.xyz * w10 + c01.xyz * w01 + c11.xyz * w11) / weight_sum, 1.0f);
+        else out = ref;
+    }
     
-    float s = (float)x / (float)get_image_width(image_in);
-    float t = (float)y / (float)get_image_height(image_in);
+    vec4 prev = read_imagef(history, sampler, pixel);
+    bool traced = checker ? isTraced(pixel, parity) : (pixel.x % (int)scale == 0 && pixel.y % (int)scale == 0);
+    
+    if(out.w == 0.0f) out = prev;
+    else if(!traced) {
+        // a filled in pixel is no sample of its own, it is only shown until the history or the first full resolution sample replaces it
+        out = prev.w > 0.0f ? prev : (vec4)(out.xyz, 0.0f);
+    } else if(prev.w > 0.0f) {
+        col prev_col = prev.xyz;
+        col out_col = out.xyz;
+        col mixed = mix(gamma_corr_inv(&out_col), gamma_corr_inv(&prev_col), prev.w / (prev.w + 1.0f));
+        out = (vec4)(gamma_corr(&mixed), prev.w + 1.0f);
+    }
+    
+    write_imagef(image, pixel, out);
+}
+
+// projects a point onto the screen of a camera, false if it is behind the camera
+bool projectPoint(__global const float* camera_buffer, vec3 p, vec2* st) {
+    vec3 camera_llc = getVec(camera_buffer, 3);
+    vec3 horizontal = getVec(camera_buffer, 6);
+    vec3 vertical = getVec(camera_buffer, 9);
+    vec3 forward = camera_llc + 0.5f * horizontal + 0.5f * vertical;
+    
+    vec3 d = p - getVec(camera_buffer, 0);
+    float d_forward = dot(d, forward);
+    if(d_forward <= 0.0f) return false;
+    
+    vec3 screen = d * (dot(forward, forward) / d_forward) - camera_llc;
+    st->x = dot(screen, horizontal) / dot(horizontal, horizontal);
+    st->y = dot(screen, vertical) / dot(vertical, vertical);
+    return true;
+}
+
+// moves the accumulated image of the previous view into the current one, the G-buffer holds the first hit normal and distance
+__kernel void reproject(__read_only image2d_t history, __write_only image2d_t image, __read_only image2d_t gbuffer_in, __write_only image2d_t gbuffer_out, __global const float* camera_buffer, __global const float* prev_camera_buffer, __global uchar* scene_arena, const uint history_valid, __global const uint* bins, __global PrimaryHit* hit_cache, const uint generation) {
+    int width = get_image_width(image), height = get_image_height(image);
+    int2 loc = (int2)(get_global_id(0), get_global_id(1));
+    if(loc.x >= width || loc.y >= height) return;
+    
+    float s = (float)loc.x / (float)width;
+    float t = (float)loc.y / (float)height;
+    
+    vec3 camera_pos = getVec(camera_buffer, 0);
+    
+    Ray r_main = genInitRay(camera_buffer, &camera_pos, s, t);
+    
+    HPI hpi;
+    bool deferred = false;
+    vec4 out = (vec4)(0.0f); // no history, the next sample replaces the pixel
+    
+    Scene scene = getScene(scene_arena);
+    bool hit = hitBinned(&r_main, &scene, getBin(bins, loc, width), &hpi, scene.lod_primary_distance, &deferred);
+    if(!deferred) storePrimaryHit(hit_cache + loc.y * width + loc.x, generation, hit, &hpi); // the unjittered position of the first sample
+    
+    if(hit && !deferred) {
+        write_imagef(gbuffer_out, loc, (vec4)(hpi.normal, hpi.t));
+        
+        vec2 prev_st;
+        if(history_valid && projectPoint(prev_camera_buffer, hpi.p, &prev_st)) {
+            int2 prev_loc = convert_int2(round(prev_st * (vec2)(width, height)));
+            
+            if(prev_loc.x >= 0 && prev_loc.y >= 0 && prev_loc.x < width && prev_loc.y < height) {
+                // accept the history only if the previous view saw the same surface there
+                vec4 prev_g = read_imagef(gbuffer_in, sampler, prev_loc);
+                float prev_dist = distance(hpi.p, getVec(prev_camera_buffer, 0));
+                
+                if(fabs(prev_g.w - prev_dist) <= DEPTH_TOLERANCE * prev_dist && dot(prev_g.xyz, hpi.normal) >= NORMAL_TOLERANCE) {
+                    vec4 prev = read_imagef(history, sampler, prev_loc);
+                    out = (vec4)(prev.xyz, min(prev.w, MAX_HISTORY));
+                }
+            }
+        }
+    } else write_imagef(gbuffer_out, loc, (vec4)(0.0f, 0.0f, 0.0f, MAX_DISTANCE)); // a zero normal never matches
+    
+    write_imagef(image, loc, out);
+}
+
+__kernel void retrace(__read_only image2d_t image_in, __write_only image2d_t image_out, __global const float* camera_buffer, __global const float* random_buffer, __global uchar* scene_arena, __read_only image2d_array_t texture, const uint sample, const uint order, __global const uint* bins, __global PrimaryHit* hit_cache, const uint generation, const uint jitter_count COST_ARGS) {
+    int width = get_image_width(image_in), height = get_image_height(image_in);
+    
+    int2 loc;
+    if(!getPixel(order, width, height, &loc)) return;
+    
+    // the samples cycle through the sub-pixel positions
+    uint jitter = sample % jitter_count;
+    float s = ((float)loc.x + jitter_offsets[jitter].x) / (float)width;
+    float t = ((float)loc.y + jitter_offsets[jitter].y) / (float)height;
     
     vec3 camera_pos = getVec(camera_buffer, 0);
     
     Ray r_main = genInitRay(camera_buffer, &camera_pos, s, t);
     
-    col prev_col = read_imagef(image_in, sampler, loc).xyz;
+    vec4 prev = read_imagef(image_in, sampler, loc);
+    col prev_col = prev.xyz;
+    
+    Scene scene = getScene(scene_arena);
+#ifdef COST_HEATMAP
+    Cost cost = {{0}};
+    scene.cost = &cost;
+    ulong clock_start = readClock();
+#endif
+    bool deferred = false;
+    HPI first_hpi;
+    bool first_hit;
+    __global PrimaryHit* cached = hit_cache + (jitter * height + loc.y) * width + loc.x;
+    if(!loadPrimaryHit(cached, generation, &r_main, &first_hit, &first_hpi)) {
+        first_hit = hitBinned(&r_main, &scene, getBin(bins, loc, width), &first_hpi, scene.lod_primary_distance, &deferred);
+        if(!deferred) storePrimaryHit(cached, generation, first_hit, &first_hpi);
+    }
+    col sample_col = getCol(&r_main, random_buffer, &scene, texture, getPixelSpread(camera_buffer, height), sample, first_hit, &first_hpi, &deferred);
+    
+    if(deferred) {
+        write_imagef(image_out, loc, prev); // drop the sample, the pixel catches up once its geometry is resident
+        return;
+    }
     
-    float mixing_param = (float)(sample)/(float)(sample + 1);
+    float mixing_param = prev.w / (prev.w + 1.0f);
+#ifdef COST_HEATMAP
+    storeCost(cost_buffer, cost_max, loc, width, &cost, clock_start, mixing_param);
+#endif
     
-    col out = mix(getCol(&r_main, random_buffer, scene, texture, sample), gamma_corr_inv(&prev_col), mixing_param);
+    col out = mix(sample_col, gamma_corr_inv(&prev_col), mixing_param);
     
     // use sqrt for gamma_corr correction
-    write_imagef(image_out, loc, (float4)(gamma_corr(&out), 1.0f));
+    write_imagef(image_out, loc, (float4)(gamma_corr(&out), prev.w + 1.0f));
 }
 
-typedef struct {
-    uint sphere_count;
-    uint plane_count;
-    uint lens_count;
-    uint model_count;
-} ObjectCounter;
+#ifdef COST_HEATMAP
+inline col falseColour(float t) {
+    // blue, cyan, green, yellow, red
+    return clamp((col)(1.5f - fabs(4.0f * t - 3.0f), 1.5f - fabs(4.0f * t - 2.0f), 1.5f - fabs(4.0f * t - 1.0f)), 0.0f, 1.0f);
+}
 
-__kernel void createScene(__global Scene* scene, __global const Material* materials, __global const Sphere* sphere_buffer, __global const Plane* plane_buffer, __global const Lens* lens_buffer, __global const vec3* vertex_buffer, __global const vec2* texture_uv_buffer, __global const uint* index_buffer, __global const Mesh* mesh_buffer, __global const Model* model_buffer, const ObjectCounter obj_counter) {
-    scene->materials = materials;
-    
-    scene->spheres = sphere_buffer;
-    scene->planes = plane_buffer;
-    scene->lenses = lens_buffer;
-    scene->models = model_buffer;
+// replaces the colour with a counter of the traced samples, the sample count in the alpha channel is kept
+__kernel void heatmap(__read_only image2d_t image_in, __write_only image2d_t image_out, __global const float* cost_buffer, __global const uint* cost_max, const uint channel) {
+    int width = get_image_width(image_in), height = get_image_height(image_in);
+    int2 loc = (int2)(get_global_id(0), get_global_id(1));
+    if(loc.x >= width || loc.y >= height) return;
     
-    scene->vertex_buffer = vertex_buffer;
-    scene->texture_uv_buffer = texture_uv_buffer;
-    scene->index_buffer = index_buffer;
-    scene->mesh_buffer = mesh_buffer;
+    // logarithmic, relative to the most expensive pixel
+    float value = cost_buffer[(loc.y * width + loc.x) * COST_CHANNELS + channel];
+    float t = log2(1.0f + value) / log2(1.0f + fmax(as_float(cost_max[channel]), 1.0f));
     
-    scene->sphere_count = obj_counter.sphere_count;
-    scene->plane_count = obj_counter.plane_count;
-    scene->lens_count = obj_counter.lens_count;
-    scene->model_count = obj_counter.model_count;
+    write_imagef(image_out, loc, (vec4)(falseColour(t), read_imagef(image_in, sampler, loc).w));
 }
+#endif
@@ -11,13 +11,19 @@
 #define SCR_WIDTH 1200
 #define SCR_HEIGHT 800
 
-#define MIN_FRAME_TIME 0.003f
-#define MAX_FRAME_COUNT 6
 #define FPS_STEPS 5
 
+#define RAYCAST_BENCHMARK_RAYS 100000
+#define STORAGE_BENCHMARK_SAMPLES 64
+
 
 #include <iostream>
 #include <fstream>
+#include <chrono>
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 // include the OpenGL libraries
 #include <GL/glew.h>
@@ -27,6 +33,13 @@
 #include "screen.h"
 #include "camera.h"
 #include "raytracer.h"
+#include "camerapath.h"
+#include "pathrenderer.h"
+#include "convergence.h"
+#include "renderthread.h"
+#include "renderservice.h"
+#include "scenegenerator.h"
+#include "scalingbench.h"
 
 
 // function declarations
@@ -36,8 +49,12 @@ void mouseCallback(GLFWwindow*, double, double);
 void mouseButtonCallback(GLFWwindow*, int, int, int);
 void scrollCallback(GLFWwindow*, double, double);
 void processInput(GLFWwindow*, float);
-void takeScreenshot(const std::string& name = "screenshot", bool show_image = false);
+void takeScreenshot();
 void countFPS(float);
+void pickObject(GLFWwindow*);
+void runStorageBenchmark(bool heatmap);
+void runImportBenchmark(const char* path);
+bool parseStressParams(int argc, const char* argv[], StressParams& params);
 
 #ifdef RETINA
 // dimensions of the viewport (they have to be multiplied by 2 at the retina displays)
@@ -58,56 +75,175 @@ bool mouse_hidden = true;
 // camera pointer
 Camera* camera;
 Screen* screen;
+RayTracer* ray_tracer;
+RenderThread* render_thread;
 
 int main(int argc, const char * argv[]) {
+    // the compact storage, the cost heatmap, the sub-pixel jitter and the face order are chosen before the other arguments
+    bool compact_storage = false;
+    bool heatmap = false;
+    bool jitter = false;
+    while(argc > 1) {
+        if(std::string(argv[1]).compare("--compact") == 0) compact_storage = true;
+        else if(std::string(argv[1]).compare("--heatmap") == 0) heatmap = true;
+        else if(std::string(argv[1]).compare("--jitter") == 0) jitter = true;
+        else if(std::string(argv[1]).compare("--file-order") == 0) SceneCreator::setMeshReorder(false);
+        else break;
+        argc--;
+        argv++;
+    }
+    
+    if(argc > 1 && std::string(argv[1]).compare("--raycast-benchmark") == 0) {
+        // run the host ray queries only, no OpenGL or OpenCL context is needed
+        SceneCreator scene;
+        try {
+            scene.loadScene(argc > 2 ? argv[2] : "assets/scenes/scene.scene");
+        } catch(SceneError& e) {
+            std::cerr << e.what() << std::endl;
+            return -1;
+        }
+        RayCaster caster;
+        caster.build(scene);
+        caster.benchmark(RAYCAST_BENCHMARK_RAYS);
+        return 0;
+    }
+    
+    if(argc > 2 && std::string(argv[1]).compare("--import-benchmark") == 0) {
+        // the OBJ loader against Assimp, no OpenGL or OpenCL context is needed
+        runImportBenchmark(argv[2]);
+        return 0;
+    }
+    
+    if(argc > 6 && std::string(argv[1]).compare("--generate-scene") == 0) {
+        // layout, materials, count, seed, output and an optional model, only the file is written
+        StressParams params;
+        if(!parseStressParams(argc - 2, argv + 2, params)) return -1;
+        if(argc > 7) params.model_path = argv[7];
+        
+        SceneGenerator generator;
+        size_t primitive_count = generator.generate(params, argv[6]);
+        if(primitive_count == 0) return -1;
+        
+        std::cout << "SUCCESS: SCENE GENERATOR: WRITTEN " << argv[6] << " WITH " << primitive_count << " PRIMITIVES" << std::endl;
+        return 0;
+    }
+    
     GLFWwindow* window = initialiseOpenGL();
     
     camera = new Camera(60.0f, (float)scr_width / (float)scr_height, glm::vec3(0.0f), 0, 0);
     screen = new Screen("shaders/screen.vs", "shaders/screen.fs");
-    RayTracer* ray_tracer = new RayTracer(SCR_WIDTH, SCR_HEIGHT, "kernels/raytracer.cl"); // FIXME: change to scr_width, scr_height to get the full resolution
+    
+    if(argc > 2 && std::string(argv[1]).compare("--convergence") == 0) {
+        // error against the references over time, the window is not needed
+        glfwHideWindow(window);
+        
+        ConvergenceBench bench;
+        bench.load(argv[2]);
+        bool passed = bench.run("kernels/raytracer.cl", compact_storage, argc > 3 ? argv[3] : "current", argc > 4 ? argv[4] : "");
+        
+        delete camera;
+        
+        glfwTerminate();
+        return passed ? 0 : 1;
+    }
+    
+    if(argc > 1 && std::string(argv[1]).compare("--serve") == 0) {
+        // render the jobs sent to the socket until QUIT, the window is not needed
+        glfwHideWindow(window);
+        
+        {
+            RenderService service(argc > 2 ? argv[2] : SERVICE_SOCKET_PATH, compact_storage);
+            service.run();
+        }
+        
+        delete camera;
+        
+        glfwTerminate();
+        return 0;
+    }
+    
+    if(argc > 1 && std::string(argv[1]).compare("--scaling-benchmark") == 0) {
+        // layout, materials, the largest count and seed, the window is not needed
+        glfwHideWindow(window);
+        
+        StressParams params;
+        if(!parseStressParams(argc - 2, argv + 2, params)) return -1;
+        
+        unsigned int max_count = params.layout == s_models ? SCALING_MAX_MODELS : SCALING_MAX_COUNT;
+        if(argc > 4) max_count = params.count;
+        
+        ScalingBench bench(params, max_count);
+        bool finished = bench.run("kernels/raytracer.cl", compact_storage);
+        
+        delete camera;
+        
+        glfwTerminate();
+        return finished ? 0 : 1;
+    }
+    
+    if(argc > 1 && std::string(argv[1]).compare("--storage-benchmark") == 0) {
+        runStorageBenchmark(heatmap);
+        
+        delete camera;
+        
+        glfwTerminate();
+        return 0;
+    }
+    
+    ray_tracer = new RayTracer(scr_width, scr_height, "kernels/raytracer.cl", compact_storage, DEFAULT_SCENE_PATH, heatmap); // the resolution drops while the camera moves
+    ray_tracer->setJitter(jitter);
+    
+    if(argc > 2 && std::string(argv[1]).compare("--render-path") == 0) {
+        // render a camera path to disk, the window shows the progress
+        CameraPath path;
+        path.load(argv[2]);
+        
+        PathRenderer path_renderer(path, argc > 3 ? argv[3] : "frames");
+        path_renderer.render(ray_tracer, camera, [window]() {
+            ray_tracer->pollCaptures();
+            ray_tracer->transferImage(screen, "image");
+            screen->draw();
+            
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            return !glfwWindowShouldClose(window) && glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS;
+        });
+        
+        delete ray_tracer;
+        delete camera;
+        
+        glfwTerminate();
+        return 0;
+    }
+    
+    // the frames are traced on the render thread, this loop only handles the input and draws the newest one
+    render_thread = new RenderThread(ray_tracer, *camera);
     
     float last_frame_time = 0.0f;
     float delta_time = 0.0f;
-    float lag = 0.0f;
     
     while(!glfwWindowShouldClose(window)) {
         float current_time = glfwGetTime();
         delta_time = current_time - last_frame_time;
         last_frame_time = current_time;
-        lag += delta_time;
         
         glClearColor(0.7f, 0.8f, 1.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         processInput(window, delta_time);
-        //ray_tracer->setTime(current_time);
         
-        if(run) {
-            if(lag >= MIN_FRAME_TIME) {
-                int steps = (int)(lag / MIN_FRAME_TIME);
-                lag -= steps * MIN_FRAME_TIME;
-                if(steps > MAX_FRAME_COUNT) steps = MAX_FRAME_COUNT;
-                
-                if(camera_in_motion) {
-                    ray_tracer->render(camera);
-                    
-                    camera_in_motion = false;
-                } else ray_tracer->renderAgain(camera);
-                
-                //scene->iterate(steps); TODO
-            }
-        } else {
-            lag = 0.0f;
-        }
+        render_thread->submit(*camera, camera_in_motion, run);
+        camera_in_motion = false;
         
         ray_tracer->transferImage(screen, "image");
         screen->draw();
         
         glfwSwapBuffers(window);
         glfwPollEvents();
-        glFinish();
+        glFinish(); // the drawn frame can be handed back to the render thread
     }
     
+    delete render_thread;
     delete ray_tracer;
     delete camera;
     
@@ -164,6 +300,15 @@ void processInput(GLFWwindow* window, float delta_time) {
         stopping = true;
     } else if(glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_RELEASE)
         stopping = false;
+    
+    static bool switching_heatmap = false;
+    static unsigned int heatmap_channel = 0;
+    
+    if(glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) {
+        if(!switching_heatmap) render_thread->setHeatmapChannel(++heatmap_channel % COST_CHANNELS);
+        switching_heatmap = true;
+    } else if(glfwGetKey(window, GLFW_KEY_H) == GLFW_RELEASE)
+        switching_heatmap = false;
 }
 
 void mouseCallback(GLFWwindow* window, double pos_x, double pos_y) {
@@ -202,7 +347,24 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
         else glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
         
         mouse_hidden = !mouse_hidden;
+    } else if(button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
+        pickObject(window);
+    }
+}
+
+void pickObject(GLFWwindow* window) {
+    // pick the object under the cursor, or in the middle of the screen if the cursor is hidden
+    float s = 0.5f, t = 0.5f;
+    if(!mouse_hidden) {
+        double pos_x, pos_y;
+        int window_width, window_height;
+        glfwGetCursorPos(window, &pos_x, &pos_y);
+        glfwGetWindowSize(window, &window_width, &window_height);
+        s = (float)pos_x / (float)window_width;
+        t = 1.0f - (float)pos_y / (float)window_height;
     }
+    
+    render_thread->requestPick(s, t); // the scene may be reloaded on the render thread, the query runs there
 }
 
 void countFPS(float delta_time) {
@@ -259,31 +421,131 @@ GLFWwindow* initialiseOpenGL() {
     return window;
 }
 
-void takeScreenshot(const std::string& name, bool show_image) {
-    static int photo_count = 0;
-    std::string name_count = name + std::to_string(photo_count);
-    std::cout << "Taking screenshot: " << name_count << ".tga" << ", dimensions: " << scr_width << ", " << scr_height << std::endl;
-    short TGA_header[] = {0, 2, 0, 0, 0, 0, (short)scr_width, (short)scr_height, 24};
-    char* pixel_data = new char[3 * scr_width * scr_height]; //there are 3 colors (RGB) for each pixel
-    std::ofstream file("screenshots/" + name_count + ".tga", std::ios::out | std::ios::binary);
-    if(!pixel_data || !file) {
-        std::cerr << "ERROR: COULD NOT TAKE THE SCREENSHOT" << std::endl;
-        exit(-1);
+void takeScreenshot() {
+    render_thread->requestScreenshot();
+}
+
+void runStorageBenchmark(bool heatmap) {
+    // the full precision runs twice, their difference is the noise the error of the compact storage is compared to
+    // with --heatmap the device counters give the triangle tests, the counting itself slows the samples down a little
+    const char* run_names[] = {"FP32", "FP32", "COMPACT"};
+    std::vector<float> images[3];
+    double sample_times[3];
+    size_t memory[3];
+    
+    for(int run = 0; run < 3; run++) {
+        RayTracer* tracer = new RayTracer(scr_width, scr_height, "kernels/raytracer.cl", run == 2, DEFAULT_SCENE_PATH, heatmap);
+        tracer->restart(camera);
+        tracer->readImage(images[run]); // the first sample also tunes the kernels
+        
+        auto time_start = std::chrono::high_resolution_clock::now();
+        for(int i = 1; i < STORAGE_BENCHMARK_SAMPLES; i++) tracer->renderAgain(camera);
+        tracer->readImage(images[run]);
+        auto time_end = std::chrono::high_resolution_clock::now();
+        
+        sample_times[run] = std::chrono::duration<double, std::milli>(time_end - time_start).count() / (STORAGE_BENCHMARK_SAMPLES - 1);
+        memory[run] = tracer->getSceneMemory();
+        std::cout << "STORAGE BENCHMARK: " << run_names[run] << ": " << sample_times[run] << " ms PER SAMPLE, " << memory[run] / (1024.0 * 1024.0) << " MiB" << std::endl;
+        
+        if(heatmap) {
+            std::vector<double> costs;
+            tracer->readCosts(costs);
+            double triangle_tests = costs[COST_TRIANGLES] * scr_width * scr_height;
+            std::cout << "STORAGE BENCHMARK: " << run_names[run] << ": " << costs[COST_TRIANGLES] << " TRIANGLE AND " << costs[COST_CHUNKS] << " CHUNK TESTS PER PIXEL, " << triangle_tests / (sample_times[run] * 1e3) << " M TRIANGLE TESTS PER SECOND" << std::endl;
+            
+            // a triangle test reads three chunk-local indices and three positions, a chunk test its bounds, the uvs and the texels only at the hits are left out
+            size_t vertex_size = run == 2 ? sizeof(cl_ushort4) : sizeof(cl_float3);
+            double geometry_bytes = costs[COST_TRIANGLES] * 3 * (sizeof(cl_uchar) + vertex_size) + costs[COST_CHUNKS] * sizeof(Chunk);
+            std::cout << "STORAGE BENCHMARK: " << run_names[run] << ": GEOMETRY FETCHED " << geometry_bytes << " BYTES PER PIXEL, " << geometry_bytes * scr_width * scr_height / (sample_times[run] * 1e6) << " GB/s" << std::endl;
+        }
+        
+        delete tracer;
     }
     
-    glFinish();
-    glReadBuffer(GL_FRONT);
-    glReadPixels(0, 0, scr_width, scr_height, GL_BGR, GL_UNSIGNED_BYTE, pixel_data);
-    glFinish();
+    float noise = PathRenderer::getChange(images[1], images[0]);
+    float error = PathRenderer::getChange(images[2], images[0]);
     
-    file.write((char*)TGA_header, 9 * sizeof(short));
-    file.write(pixel_data, 3 * scr_width * scr_height);
-    file.close();
-    delete [] pixel_data;
+    if(!heatmap) std::cout << "STORAGE BENCHMARK: RELATIVE RMS ERROR " << error << " (FP32 NOISE " << noise << ") AFTER " << STORAGE_BENCHMARK_SAMPLES << " SAMPLES" << std::endl; // the images show the counters
+    std::cout << "STORAGE BENCHMARK: SCENE MEMORY SAVED " << (1.0 - (double)memory[2] / memory[0]) * 100.0 << "%, SAMPLE TIME SAVED " << (1.0 - sample_times[2] / sample_times[0]) * 100.0 << "%" << std::endl;
+    std::cout << "STORAGE BENCHMARK: STORED PER VERTEX " << sizeof(cl_float3) + sizeof(cl_float2) << " -> " << sizeof(cl_ushort4) + 2 * sizeof(cl_half) << " BYTES, PER TEXEL " << 4 * sizeof(float) << " -> " << 4 * sizeof(cl_half) << " BYTES" << std::endl;
+}
+
+bool parseStressParams(int argc, const char* argv[], StressParams& params) {
+    // the trailing arguments may be left out
+    if(argc > 0 && !SceneGenerator::parseLayout(argv[0], params.layout)) {
+        std::cerr << "ERROR: SCENE GENERATOR: LAYOUT " << argv[0] << " DOES NOT EXIST, USE grid, cloud, lenses OR models" << std::endl;
+        return false;
+    }
+    if(argc > 1 && !SceneGenerator::parseMix(argv[1], params.materials)) {
+        std::cerr << "ERROR: SCENE GENERATOR: MATERIALS " << argv[1] << " DO NOT EXIST, USE diffuse, specular, glass OR mixed" << std::endl;
+        return false;
+    }
+    if(argc > 2) params.count = (unsigned int)std::strtoul(argv[2], nullptr, 10);
+    if(argc > 3) params.seed = (unsigned int)std::strtoul(argv[3], nullptr, 10);
     
-    if(show_image) {
-        std::cout << "Opening the screenshot" << std::endl;
-        std::system(("open " + name_count + ".tga").c_str());
+    if(params.count == 0) {
+        std::cerr << "ERROR: SCENE GENERATOR: THE COUNT HAS TO BE POSITIVE" << std::endl;
+        return false;
     }
-    photo_count++;
+    return true;
+}
+
+void runImportBenchmark(const char* path) {
+    // every loader runs in its own process, so the peak memory of one does not hide the other
+    const char* loader_names[] = {"ASSIMP", "OBJ"};
+    double import_times[2] = {-1.0, -1.0};
+    double peak_memory[2];
+    
+    for(int loader = 0; loader < 2; loader++) {
+        int fds[2];
+        if(pipe(fds) != 0) {
+            std::cerr << "ERROR: IMPORT BENCHMARK: CANNOT CREATE A PIPE" << std::endl;
+            return;
+        }
+        
+        pid_t pid = fork();
+        if(pid == 0) {
+            close(fds[0]);
+            double time = -1.0;
+            try {
+                SceneCreator scene;
+                scene.setOBJLoader(loader == 1);
+                scene.addMaterial(t_diffuse, {{1.0f, 1.0f, 1.0f}}, 1.0f);
+                
+                // the levels would take the same time with both loaders
+                ModelRequest request(path, 0, glm::mat4(1.0f));
+                request.simplify_levels = 0;
+                
+                auto time_start = std::chrono::high_resolution_clock::now();
+                scene.loadModels({request});
+                time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - time_start).count();
+            } catch(SceneError& e) {
+                std::cerr << e.what() << std::endl;
+            }
+            
+            if(write(fds[1], &time, sizeof(time)) != sizeof(time)) _exit(1);
+            _exit(0);
+        }
+        close(fds[1]);
+        
+        if(pid < 0 || read(fds[0], &import_times[loader], sizeof(double)) != sizeof(double)) import_times[loader] = -1.0;
+        close(fds[0]);
+        
+        int status;
+        rusage usage = {};
+        if(pid > 0) wait4(pid, &status, 0, &usage);
+#ifdef __APPLE__
+        peak_memory[loader] = usage.ru_maxrss / (1024.0 * 1024.0); // bytes
+#else
+        peak_memory[loader] = usage.ru_maxrss / 1024.0; // KiB
+#endif
+        
+        if(import_times[loader] < 0.0) {
+            std::cerr << "ERROR: IMPORT BENCHMARK: " << loader_names[loader] << " FAILED TO IMPORT " << path << std::endl;
+            return;
+        }
+        std::cout << "IMPORT BENCHMARK: " << loader_names[loader] << ": " << import_times[loader] << " ms, PEAK RSS " << peak_memory[loader] << " MiB" << std::endl;
+    }
+    
+    std::cout << "IMPORT BENCHMARK: THE OBJ LOADER IS " << import_times[0] / import_times[1] << "x FASTER, PEAK RSS " << (1.0 - peak_memory[1] / peak_memory[0]) * 100.0 << "% LOWER" << std::endl;
 }
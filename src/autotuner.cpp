@@ -0,0 +1,116 @@
+//
+//  autotuner.cpp
+//  Non Euclidean
+//
+//  Picks the work-group size and the pixel traversal order of the kernels per device.
+//
+
+#include "autotuner.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#define MORTON_TILE_SIZE 8 // keep in sync with kernels/raytracer.cl
+
+inline size_t roundUp(size_t x, size_t multiple) {
+    return multiple ? (x + multiple - 1) / multiple * multiple : x;
+}
+
+cl::NDRange LaunchConfig::getGlobal(int width, int height) const {
+    if(order == o_morton) {
+        size_t tiles = roundUp(width, MORTON_TILE_SIZE) / MORTON_TILE_SIZE * (roundUp(height, MORTON_TILE_SIZE) / MORTON_TILE_SIZE);
+        return cl::NDRange(roundUp(tiles * MORTON_TILE_SIZE * MORTON_TILE_SIZE, local_x));
+    }
+    return cl::NDRange(roundUp(width, local_x), roundUp(height, local_y));
+}
+
+cl::NDRange LaunchConfig::getLocal() const {
+    if(local_x == 0) return cl::NullRange;
+    if(order == o_morton) return cl::NDRange(local_x);
+    return cl::NDRange(local_x, local_y);
+}
+
+std::string LaunchConfig::describe() const {
+    std::string local = local_x ? (order == o_morton ? std::to_string(local_x) : std::to_string(local_x) + "x" + std::to_string(local_y)) : "default";
+    return (order == o_morton ? "morton, local " : "rows, local ") + local;
+}
+
+Autotuner::Autotuner(const std::string& cache_path) : cache_path(cache_path) {
+    loadCache();
+}
+
+void Autotuner::loadCache() {
+    // every line holds: key \t order local_x local_y
+    std::ifstream file(cache_path);
+    std::string line;
+    
+    while(std::getline(file, line)) {
+        size_t pos = line.rfind('\t');
+        if(pos == std::string::npos) continue;
+        
+        std::istringstream values(line.substr(pos + 1));
+        int order;
+        size_t local_x, local_y;
+        if(values >> order >> local_x >> local_y) cache[line.substr(0, pos)] = LaunchConfig((TraversalOrder)order, local_x, local_y);
+    }
+}
+
+void Autotuner::saveCache() const {
+    std::ofstream file(cache_path, std::ios::out | std::ios::trunc);
+    if(!file) {
+        std::cerr << "ERROR: AUTOTUNER: CANNOT WRITE " << cache_path << std::endl;
+        return;
+    }
+    
+    for(const auto& entry : cache) file << entry.first << '\t' << (int)entry.second.order << ' ' << entry.second.local_x << ' ' << entry.second.local_y << '\n';
+}
+
+LaunchConfig Autotuner::tune(const cl::Device& device, const cl::Kernel& kernel, const std::string& kernel_name, int width, int height, const std::function<double(const LaunchConfig&)>& benchmark) {
+    std::string device_name = device.getInfo<CL_DEVICE_NAME>();
+    std::string driver_version = device.getInfo<CL_DRIVER_VERSION>();
+    std::string key = device_name + "|" + driver_version + "|" + kernel_name + "|" + std::to_string(width) + "x" + std::to_string(height);
+    
+    auto cached = cache.find(key);
+    if(cached != cache.end()) {
+        std::cout << "SUCCESS: AUTOTUNER: " << kernel_name << ": USING " << cached->second.describe() << std::endl;
+        return cached->second;
+    }
+    
+    size_t max_group_size = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    
+    std::vector<LaunchConfig> candidates = {
+        LaunchConfig(o_rows),
+        LaunchConfig(o_rows, 8, 8), LaunchConfig(o_rows, 16, 4), LaunchConfig(o_rows, 4, 16), LaunchConfig(o_rows, 32, 2),
+        LaunchConfig(o_rows, 16, 8), LaunchConfig(o_rows, 8, 16), LaunchConfig(o_rows, 32, 4), LaunchConfig(o_rows, 16, 16),
+        LaunchConfig(o_morton), LaunchConfig(o_morton, 32, 1), LaunchConfig(o_morton, 64, 1), LaunchConfig(o_morton, 128, 1), LaunchConfig(o_morton, 256, 1)
+    };
+    
+    LaunchConfig best;
+    double best_time = -1.0;
+    
+    for(const LaunchConfig& config : candidates) {
+        if(config.local_x * (config.local_y ? config.local_y : 1) > max_group_size) continue;
+        
+        double time;
+        try {
+            time = benchmark(config);
+        } catch(cl::Error& e) {
+            continue; // the device rejected this work-group size
+        }
+        
+        std::cout << "AUTOTUNER: " << kernel_name << ": " << config.describe() << ": " << time * 1000.0 << " ms" << std::endl;
+        if(best_time < 0.0 || time < best_time) {
+            best_time = time;
+            best = config;
+        }
+    }
+    
+    std::cout << "SUCCESS: AUTOTUNER: " << kernel_name << ": USING " << best.describe() << std::endl;
+    
+    cache[key] = best;
+    saveCache();
+    
+    return best;
+}
@@ -91,6 +91,18 @@ void Camera::setSize(float new_aspect) {
     setFov();
 }
 
+void Camera::setView(const glm::vec3& pos, float new_yaw, float new_pitch, float new_fov) {
+    position = pos;
+    yaw = fmod(new_yaw, 360.0f);
+    pitch = glm::clamp(new_pitch, -89.0f, 89.0f);
+    fov = new_fov;
+    setFov();
+}
+
+glm::vec3 Camera::getRayDir(float s, float t) const {
+    return normalize(lower_left_corner + s * horizontal + t * vertical);
+}
+
 float* Camera::transferData() const {
     static float data[12];
     
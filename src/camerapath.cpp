@@ -0,0 +1,116 @@
+//
+//  camerapath.cpp
+//  Non Euclidean
+//
+//  Keyframed camera path, interpolated with a Catmull-Rom spline.
+//
+
+#include "camerapath.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+void CameraPath::load(const std::string& path) {
+    std::ifstream file(path);
+    if(!file) {
+        std::cerr << "ERROR: CAMERA PATH: CANNOT READ " << path << std::endl;
+        exit(-1);
+    }
+    
+    std::string line;
+    bool reading_keyframes = false;
+    unsigned int line_number = 0;
+    
+    while(std::getline(file, line)) {
+        line_number++;
+        
+        size_t pos = line.find('#');
+        if(pos != std::string::npos) line = line.substr(0, pos);
+        if(line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        
+        // the values are separated just like in the scene files
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::replace(line.begin(), line.end(), '(', ' ');
+        std::replace(line.begin(), line.end(), ')', ' ');
+        
+        std::istringstream values(line);
+        std::string word;
+        values >> word;
+        
+        if(word.compare("KEYFRAMES:") == 0) reading_keyframes = true;
+        else if(word.compare("FPS:") == 0) values >> fps;
+        else if(word.compare("SAMPLES:") == 0) values >> samples;
+        else if(word.compare("ERROR:") == 0) values >> error;
+        else if(word.compare("FORMATS:") == 0) {
+            formats = 0;
+            while(values >> word) {
+                if(word.compare("png") == 0) formats |= f_png;
+                else if(word.compare("pfm") == 0) formats |= f_pfm;
+                else if(word.compare("hdr") == 0) formats |= f_hdr;
+            }
+        } else if(reading_keyframes) {
+            std::istringstream keyframe_values(line);
+            float time, x, y, z, yaw, pitch, fov;
+            if(!(keyframe_values >> time >> x >> y >> z >> yaw >> pitch >> fov)) {
+                std::cerr << "ERROR: CAMERA PATH: WRONG KEYFRAME IN LINE " << line_number << std::endl;
+                exit(-1);
+            }
+            
+            // keep the yaw continuous, the camera wraps it at 360 degrees
+            if(keyframes.size() > 0) yaw = keyframes.back().yaw + std::remainder(yaw - keyframes.back().yaw, 360.0f);
+            
+            keyframes.push_back(Keyframe(time, glm::vec3(x, y, z), yaw, pitch, fov));
+        }
+    }
+    
+    if(keyframes.size() < 2) {
+        std::cerr << "ERROR: CAMERA PATH: AT LEAST 2 KEYFRAMES ARE NEEDED" << std::endl;
+        exit(-1);
+    }
+    
+    std::stable_sort(keyframes.begin(), keyframes.end(), [](const Keyframe& a, const Keyframe& b) { return a.time < b.time; });
+    
+    std::cout << "SUCCESS: CAMERA PATH: " << keyframes.size() << " KEYFRAMES, " << getFrameCount() << " FRAMES" << std::endl;
+}
+
+unsigned int CameraPath::getFrameCount() const {
+    return (unsigned int)std::floor(getDuration() * fps) + 1;
+}
+
+Keyframe CameraPath::sample(float time) const {
+    time = std::min(std::max(time, keyframes.front().time), keyframes.back().time);
+    
+    size_t i = 0;
+    while(i + 2 < keyframes.size() && keyframes[i + 1].time <= time) i++;
+    
+    const Keyframe& k1 = keyframes[i];
+    const Keyframe& k2 = keyframes[i + 1];
+    const Keyframe& k0 = i > 0 ? keyframes[i - 1] : k1;
+    const Keyframe& k3 = i + 2 < keyframes.size() ? keyframes[i + 2] : k2;
+    
+    float dt = k2.time - k1.time;
+    float s = dt > 0.0f ? (time - k1.time) / dt : 0.0f;
+    
+    // cubic Hermite basis, the tangents are the Catmull-Rom ones scaled to the uneven keyframe spacing
+    float s2 = s * s, s3 = s2 * s;
+    float h00 = 2.0f * s3 - 3.0f * s2 + 1.0f, h10 = s3 - 2.0f * s2 + s, h01 = -2.0f * s3 + 3.0f * s2, h11 = s3 - s2;
+    float scale1 = k2.time - k0.time > 0.0f ? dt / (k2.time - k0.time) : 0.0f;
+    float scale2 = k3.time - k1.time > 0.0f ? dt / (k3.time - k1.time) : 0.0f;
+    
+    auto interpolate = [&](float p0, float p1, float p2, float p3) {
+        return h00 * p1 + h10 * (p2 - p0) * scale1 + h01 * p2 + h11 * (p3 - p1) * scale2;
+    };
+    
+    glm::vec3 pos;
+    for(int j = 0; j < 3; j++) pos[j] = interpolate(k0.pos[j], k1.pos[j], k2.pos[j], k3.pos[j]);
+    
+    return Keyframe(time, pos, interpolate(k0.yaw, k1.yaw, k2.yaw, k3.yaw), interpolate(k0.pitch, k1.pitch, k2.pitch, k3.pitch), interpolate(k0.fov, k1.fov, k2.fov, k3.fov));
+}
+
+void CameraPath::apply(float time, Camera* camera) const {
+    Keyframe k = sample(time);
+    camera->setView(k.pos, k.yaw, k.pitch, k.fov);
+}
@@ -0,0 +1,296 @@
+//
+//  convergence.cpp
+//  Non Euclidean
+//
+//  Measures the error against cached reference images at fixed wall-clock checkpoints.
+//
+
+#include "convergence.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <filesystem>
+
+#define REL_MSE_EPSILON 0.01 // keeps the relative error of black pixels finite
+#define REFERENCE_PROGRESS_STEP 256
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+inline double getSeconds(const BenchClock::time_point& start, const BenchClock::time_point& end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+ConvergenceBench::ConvergenceBench(const std::string& output_dir) : output_dir(output_dir) {}
+
+void ConvergenceBench::load(const std::string& path) {
+    std::ifstream file(path);
+    if(!file) {
+        std::cerr << "ERROR: CONVERGENCE: CANNOT READ " << path << std::endl;
+        exit(-1);
+    }
+    
+    std::string line;
+    bool reading_views = false;
+    unsigned int line_number = 0;
+    
+    while(std::getline(file, line)) {
+        line_number++;
+        
+        size_t pos = line.find('#');
+        if(pos != std::string::npos) line = line.substr(0, pos);
+        if(line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        
+        // the values are separated just like in the scene files
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::replace(line.begin(), line.end(), '(', ' ');
+        std::replace(line.begin(), line.end(), ')', ' ');
+        
+        std::istringstream values(line);
+        std::string word;
+        values >> word;
+        
+        if(word.compare("VIEWS:") == 0) reading_views = true;
+        else if(word.compare("SAMPLES:") == 0) values >> reference_samples;
+        else if(word.compare("TOLERANCE:") == 0) values >> tolerance;
+        else if(word.compare("RESOLUTION:") == 0) values >> width >> height;
+        else if(word.compare("CHECKPOINTS:") == 0) {
+            double checkpoint;
+            while(values >> checkpoint) checkpoints.push_back(checkpoint);
+        } else if(reading_views) {
+            BenchView view;
+            std::istringstream view_values(line);
+            if(!(view_values >> view.scene_path >> view.pos.x >> view.pos.y >> view.pos.z >> view.yaw >> view.pitch >> view.fov)) {
+                std::cerr << "ERROR: CONVERGENCE: WRONG VIEW IN LINE " << line_number << std::endl;
+                exit(-1);
+            }
+            views.push_back(view);
+        }
+    }
+    
+    if(views.size() == 0 || checkpoints.size() == 0) {
+        std::cerr << "ERROR: CONVERGENCE: AT LEAST ONE VIEW AND ONE CHECKPOINT ARE NEEDED" << std::endl;
+        exit(-1);
+    }
+    
+    std::sort(checkpoints.begin(), checkpoints.end());
+    
+    std::cout << "SUCCESS: CONVERGENCE: " << views.size() << " VIEWS, " << checkpoints.size() << " CHECKPOINTS UP TO " << checkpoints.back() << " s" << std::endl;
+}
+
+std::string ConvergenceBench::getReferencePath(const BenchView& view) const {
+    // the reference is rendered again when the scene file, the view or the settings change
+    std::ifstream scene_file(view.scene_path);
+    std::stringstream key;
+    key << scene_file.rdbuf() << "|" << view.pos.x << " " << view.pos.y << " " << view.pos.z << " " << view.yaw << " " << view.pitch << " " << view.fov << "|" << width << "x" << height << "|" << reference_samples;
+    
+    std::ostringstream name;
+    name << output_dir << "/references/" << std::filesystem::path(view.scene_path).stem().string() << "_" << std::hex << std::hash<std::string>()(key.str()) << ".pfm";
+    return name.str();
+}
+
+std::string ConvergenceBench::getCurvePath(const std::string& label, size_t view_ID) const {
+    return output_dir + "/" + label + "/view" + std::to_string(view_ID) + ".csv";
+}
+
+void ConvergenceBench::renderReference(const char* kernel_path, const BenchView& view, std::vector<float>& reference) const {
+    // always in full precision, whatever is being measured
+    RayTracer ray_tracer(width, height, kernel_path, false, view.scene_path);
+    Camera camera(view.fov, (float)width / (float)height);
+    camera.setView(view.pos, view.yaw, view.pitch, view.fov);
+    
+    ray_tracer.restart(&camera);
+    for(unsigned int sample = 1; sample < reference_samples; sample++) {
+        ray_tracer.renderAgain(&camera);
+        if(sample % REFERENCE_PROGRESS_STEP == 0) {
+            std::vector<float> image;
+            ray_tracer.readImage(image); // keeps the queue from running too far ahead
+            std::cout << "CONVERGENCE: REFERENCE " << sample << "/" << reference_samples << " SAMPLES" << std::endl;
+        }
+    }
+    
+    std::vector<float> image;
+    ray_tracer.readImage(image);
+    
+    std::string path = getReferencePath(view);
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    if(!FrameWriter::writePFM(path, width, height, &image[0])) std::cerr << "ERROR: CONVERGENCE: CANNOT WRITE " << path << std::endl;
+    
+    // linear RGB, as read from the file
+    reference.resize(3 * (size_t)width * height);
+    for(size_t i = 0; i < (size_t)width * height; i++) {
+        for(int c = 0; c < 3; c++) reference[3 * i + c] = image[4 * i + c] * image[4 * i + c];
+    }
+}
+
+std::vector<ErrorSample> ConvergenceBench::measure(RayTracer* ray_tracer, Camera* camera, const std::vector<float>& reference) const {
+    std::vector<float> image;
+    
+    // warm up (the first frame tunes the kernels) and time a read back of a finished image, which is left out of the curve
+    ray_tracer->restart(camera);
+    ray_tracer->readImage(image);
+    auto read_start = BenchClock::now();
+    ray_tracer->readImage(image);
+    double read_time = getSeconds(read_start, BenchClock::now());
+    
+    std::vector<ErrorSample> curve;
+    double paused = 0.0;
+    unsigned int samples = 1;
+    size_t next = 0;
+    
+    auto start = BenchClock::now();
+    ray_tracer->restart(camera);
+    
+    while(next < checkpoints.size()) {
+        if(getSeconds(start, BenchClock::now()) - paused < checkpoints[next]) {
+            ray_tracer->renderAgain(camera);
+            samples++;
+            continue;
+        }
+        
+        // the read back waits for the queued samples, so the time is taken after it
+        auto pause_start = BenchClock::now();
+        ray_tracer->readImage(image);
+        auto pause_end = BenchClock::now();
+        
+        ErrorSample sample;
+        sample.time = getSeconds(start, pause_end) - paused - read_time;
+        sample.samples = samples;
+        computeError(image, reference, sample.rmse, sample.rel_mse);
+        curve.push_back(sample);
+        
+        paused += getSeconds(pause_start, BenchClock::now());
+        next++;
+    }
+    
+    return curve;
+}
+
+void ConvergenceBench::computeError(const std::vector<float>& image, const std::vector<float>& reference, double& rmse, double& rel_mse) {
+    // the image holds the sqrt gamma colour and the sample count, the reference is linear RGB
+    double squared_sum = 0.0, relative_sum = 0.0;
+    size_t pixel_count = reference.size() / 3;
+    
+    for(size_t i = 0; i < pixel_count; i++) {
+        for(int c = 0; c < 3; c++) {
+            double value = (double)image[4 * i + c] * image[4 * i + c];
+            double ref = reference[3 * i + c];
+            double diff = value - ref;
+            squared_sum += diff * diff;
+            relative_sum += diff * diff / (ref * ref + REL_MSE_EPSILON);
+        }
+    }
+    
+    rmse = std::sqrt(squared_sum / (3 * pixel_count));
+    rel_mse = relative_sum / (3 * pixel_count);
+}
+
+double ConvergenceBench::getTimeToQuality(const std::vector<ErrorSample>& curve, double rel_mse) {
+    for(size_t i = 0; i < curve.size(); i++) {
+        if(curve[i].rel_mse > rel_mse) continue;
+        if(i == 0) return curve[0].time;
+        
+        // the error falls roughly as a power of the time, so interpolate on the log-log scale
+        const ErrorSample& a = curve[i - 1];
+        const ErrorSample& b = curve[i];
+        double s = (std::log(rel_mse) - std::log(a.rel_mse)) / (std::log(b.rel_mse) - std::log(a.rel_mse));
+        return std::exp(std::log(a.time) + s * (std::log(b.time) - std::log(a.time)));
+    }
+    
+    return std::numeric_limits<double>::infinity();
+}
+
+bool ConvergenceBench::readPFM(const std::string& path, int width, int height, std::vector<float>& pixels) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if(!file) return false;
+    
+    std::string type;
+    int file_width, file_height;
+    float scale;
+    file >> type >> file_width >> file_height >> scale;
+    file.get(); // the single whitespace before the data
+    
+    if(type.compare("PF") != 0 || file_width != width || file_height != height || scale >= 0.0f) return false; // little endian RGB only
+    
+    pixels.resize(3 * (size_t)width * height);
+    file.read((char*)&pixels[0], pixels.size() * sizeof(float));
+    
+    return (bool)file;
+}
+
+bool ConvergenceBench::readCurve(const std::string& path, std::vector<ErrorSample>& curve) {
+    std::ifstream file(path);
+    if(!file) return false;
+    
+    std::string line;
+    std::getline(file, line); // header
+    while(std::getline(file, line)) {
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream values(line);
+        ErrorSample sample;
+        if(values >> sample.time >> sample.samples >> sample.rmse >> sample.rel_mse) curve.push_back(sample);
+    }
+    
+    return curve.size() > 0;
+}
+
+void ConvergenceBench::writeCurve(const std::string& path, const std::vector<ErrorSample>& curve) {
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    file << "time,samples,rmse,relmse" << std::endl;
+    file << std::setprecision(8);
+    for(const ErrorSample& sample : curve) file << sample.time << "," << sample.samples << "," << sample.rmse << "," << sample.rel_mse << std::endl;
+}
+
+bool ConvergenceBench::run(const char* kernel_path, bool compact_storage, const std::string& label, const std::string& baseline_label) {
+    bool passed = true;
+    
+    for(size_t view_ID = 0; view_ID < views.size(); view_ID++) {
+        const BenchView& view = views[view_ID];
+        
+        std::vector<float> reference;
+        if(!readPFM(getReferencePath(view), width, height, reference)) {
+            std::cout << "CONVERGENCE: RENDERING THE REFERENCE OF VIEW " << view_ID << std::endl;
+            renderReference(kernel_path, view, reference);
+        }
+        
+        std::vector<ErrorSample> curve;
+        {
+            RayTracer ray_tracer(width, height, kernel_path, compact_storage, view.scene_path);
+            Camera camera(view.fov, (float)width / (float)height);
+            camera.setView(view.pos, view.yaw, view.pitch, view.fov);
+            curve = measure(&ray_tracer, &camera, reference);
+        }
+        writeCurve(getCurvePath(label, view_ID), curve);
+        
+        std::cout << "CONVERGENCE: VIEW " << view_ID << ":";
+        for(const ErrorSample& sample : curve) std::cout << " " << sample.time << " s: " << sample.rel_mse << " (" << sample.samples << " SAMPLES)";
+        std::cout << std::endl;
+        
+        if(baseline_label.empty()) continue;
+        
+        std::vector<ErrorSample> baseline;
+        if(!readCurve(getCurvePath(baseline_label, view_ID), baseline)) {
+            std::cerr << "ERROR: CONVERGENCE: NO BASELINE " << baseline_label << " FOR VIEW " << view_ID << std::endl;
+            passed = false;
+            continue;
+        }
+        
+        // the time both need to reach the final error of the baseline
+        double target = baseline.back().rel_mse;
+        double baseline_time = getTimeToQuality(baseline, target);
+        double time = getTimeToQuality(curve, target);
+        bool view_passed = time <= tolerance * baseline_time;
+        passed = passed && view_passed;
+        
+        std::cout << (view_passed ? "SUCCESS" : "ERROR") << ": CONVERGENCE: VIEW " << view_ID << ": RELMSE " << target << " REACHED IN " << time << " s, BASELINE " << baseline_time << " s" << std::endl;
+    }
+    
+    return passed;
+}
@@ -0,0 +1,145 @@
+//
+//  devicearena.cpp
+//  Non Euclidean
+//
+//  One device buffer suballocated into aligned blocks, which are addressed by their offsets.
+//
+
+#include "devicearena.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+inline double toMiB(size_t size) {
+    return size / (1024.0 * 1024.0);
+}
+
+DeviceArena::DeviceArena(const std::vector<std::string>& block_names) {
+    for(const std::string& name : block_names) {
+        ArenaBlock block;
+        block.name = name;
+        blocks.push_back(block);
+    }
+}
+
+void DeviceArena::init(cl::Context& context, cl::Device& device) {
+    this->context = context;
+    device_memory = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    max_alloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    alignment = std::max((size_t)ARENA_MIN_ALIGNMENT, (size_t)device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8);
+}
+
+bool DeviceArena::layout(const std::vector<size_t>& sizes) {
+    free_ranges.clear();
+    top = 0;
+    
+    for(size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].offset = top;
+        blocks[i].size = sizes[i];
+        blocks[i].capacity = align(sizes[i] + sizes[i] / ARENA_HEADROOM_FRACTION);
+        top += blocks[i].capacity;
+    }
+    
+    if(top > max_alloc) {
+        std::cerr << "ERROR: ARENA: " << toMiB(top) << " MiB DO NOT FIT IN A SINGLE ALLOCATION OF " << toMiB(max_alloc) << " MiB" << std::endl;
+        exit(-1);
+    }
+    
+    // keep the old buffer if it is large enough and not much larger than needed
+    size_t needed = std::max(top, alignment);
+    if(capacity >= needed && capacity <= ARENA_GROWTH * ARENA_GROWTH * needed) return false;
+    
+    capacity = needed;
+    buffer = cl::Buffer(context, CL_MEM_READ_WRITE, capacity);
+    
+    return true;
+}
+
+size_t DeviceArena::findRange(size_t size) {
+    for(size_t i = 0; i < free_ranges.size(); i++) {
+        if(free_ranges[i].second < size) continue;
+        
+        size_t offset = free_ranges[i].first;
+        free_ranges[i].first += size;
+        free_ranges[i].second -= size;
+        if(free_ranges[i].second == 0) free_ranges.erase(free_ranges.begin() + i);
+        
+        return offset;
+    }
+    
+    return (size_t)-1;
+}
+
+bool DeviceArena::grow(cl::CommandQueue& queue, size_t min_capacity) {
+    size_t new_capacity = std::min((size_t)max_alloc, std::max(min_capacity, capacity * ARENA_GROWTH));
+    if(new_capacity < min_capacity) {
+        std::cerr << "ERROR: ARENA: CANNOT GROW TO " << toMiB(min_capacity) << " MiB, THE LIMIT IS " << toMiB(max_alloc) << " MiB" << std::endl;
+        exit(-1);
+    }
+    
+    // the offsets stay the same, so only the buffer has to be bound again
+    cl::Buffer new_buffer(context, CL_MEM_READ_WRITE, new_capacity);
+    if(top > 0) queue.enqueueCopyBuffer(buffer, new_buffer, 0, 0, top);
+    
+    buffer = new_buffer;
+    capacity = new_capacity;
+    
+    std::cout << "SUCCESS: ARENA: GREW TO " << toMiB(capacity) << " MiB" << std::endl;
+    
+    return true;
+}
+
+bool DeviceArena::resize(cl::CommandQueue& queue, cl_uint block_ID, size_t size, bool keep_contents) {
+    ArenaBlock& block = blocks[block_ID];
+    if(size <= block.capacity) {
+        block.size = size;
+        return false;
+    }
+    
+    size_t new_capacity = align(size + size / ARENA_HEADROOM_FRACTION);
+    bool grown = false;
+    
+    if(block.offset + block.capacity == top) {
+        // the last block grows in place
+        if(block.offset + new_capacity > capacity) grown = grow(queue, block.offset + new_capacity);
+        top = block.offset + new_capacity;
+    } else {
+        size_t offset = findRange(new_capacity);
+        if(offset == (size_t)-1) {
+            offset = top;
+            if(top + new_capacity > capacity) grown = grow(queue, top + new_capacity);
+            top += new_capacity;
+        }
+        
+        if(keep_contents && block.size > 0) queue.enqueueCopyBuffer(buffer, buffer, block.offset, offset, block.size);
+        if(block.capacity > 0) free_ranges.push_back(std::make_pair(block.offset, block.capacity));
+        block.offset = offset;
+    }
+    
+    block.size = size;
+    block.capacity = new_capacity;
+    
+    return grown;
+}
+
+void DeviceArena::write(cl::CommandQueue& queue, cl_uint block_ID, size_t offset, size_t size, const void* data, bool blocking) {
+    if(size) queue.enqueueWriteBuffer(buffer, blocking ? CL_TRUE : CL_FALSE, blocks[block_ID].offset + offset, size, data);
+}
+
+void DeviceArena::report() const {
+    size_t used = 0, free = 0;
+    for(const ArenaBlock& block : blocks) used += block.size;
+    for(const std::pair<size_t, size_t>& range : free_ranges) free += range.second;
+    
+    // formatted aside, the precision of std::cout stays as the caller left it
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    out << "ARENA: " << toMiB(used) << " MiB USED, " << toMiB(capacity) << " MiB ALLOCATED, " << toMiB(free) << " MiB FREED, OF " << toMiB(device_memory) << " MiB DEVICE MEMORY\n";
+    for(const ArenaBlock& block : blocks) {
+        if(block.capacity == 0) continue;
+        out << "    " << block.name << ": " << toMiB(block.size) << " / " << toMiB(block.capacity) << " MiB (" << 100.0 * block.capacity / device_memory << "% OF THE DEVICE)\n";
+    }
+    std::cout << out.str() << std::flush;
+}
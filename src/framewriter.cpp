@@ -0,0 +1,142 @@
+//
+//  framewriter.cpp
+//  Non Euclidean
+//
+//  Encodes captured frames and writes them to disk on a background thread.
+//
+
+#include "framewriter.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+// include the STB library to write image files
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+FrameWriter::FrameWriter(size_t max_queued) : max_queued(max_queued), writing(0), stopping(false) {
+    worker = std::thread(&FrameWriter::work, this);
+}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        stopping = true;
+    }
+    jobs_condition.notify_all();
+    
+    worker.join();
+}
+
+void FrameWriter::write(const FrameJob& job) {
+    {
+        std::unique_lock<std::mutex> lock(jobs_mutex);
+        jobs_condition.wait(lock, [this]() { return max_queued == 0 || jobs.size() < max_queued; });
+        jobs.push(job);
+    }
+    jobs_condition.notify_all();
+}
+
+void FrameWriter::flush() {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    jobs_condition.wait(lock, [this]() { return jobs.empty() && writing == 0; });
+}
+
+void FrameWriter::work() {
+    while(true) {
+        FrameJob job;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+            jobs_condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if(stopping && jobs.empty()) return;
+            
+            job = jobs.front();
+            jobs.pop();
+            writing++;
+        }
+        jobs_condition.notify_all(); // there is space in the queue again
+        
+        encode(job);
+        if(job.on_done) job.on_done();
+        
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            writing--;
+        }
+        jobs_condition.notify_all();
+    }
+}
+
+void FrameWriter::encode(const FrameJob& job) const {
+    bool success = true;
+    
+    if(job.formats & f_pfm) success &= writePFM(job.path + ".pfm", job.width, job.height, job.pixels);
+    if(job.formats & f_png) success &= writePNG(job.path + ".png", job.width, job.height, job.pixels);
+    if(job.formats & f_hdr) success &= writeHDR(job.path + ".hdr", job.width, job.height, job.pixels);
+    
+    if(success) std::cout << "SUCCESS: CAPTURE: " << job.path << ", DIMENSIONS: " << job.width << ", " << job.height << std::endl;
+    else std::cerr << "ERROR: CAPTURE: COULD NOT WRITE " << job.path << std::endl;
+}
+
+bool FrameWriter::writePFM(const std::string& path, int width, int height, const float* pixels) {
+    // linear RGB, little endian, the bottom row first like the image
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if(!file) return false;
+    
+    file << "PF\n" << width << " " << height << "\n-1.0\n";
+    
+    std::vector<float> row(3 * width);
+    for(int y = 0; y < height; y++) {
+        const float* src = pixels + 4 * (size_t)y * width;
+        for(int x = 0; x < width; x++) {
+            for(int c = 0; c < 3; c++) row[3 * x + c] = src[4 * x + c] * src[4 * x + c]; // undo the sqrt gamma of the kernel
+        }
+        file.write((const char*)&row[0], row.size() * sizeof(float));
+    }
+    
+    return (bool)file;
+}
+
+bool FrameWriter::writeGreyPFM(const std::string& path, int width, int height, const float* values, int stride) {
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if(!file) return false;
+    
+    file << "Pf\n" << width << " " << height << "\n-1.0\n";
+    
+    std::vector<float> row(width);
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) row[x] = values[((size_t)y * width + x) * stride];
+        file.write((const char*)&row[0], row.size() * sizeof(float));
+    }
+    
+    return (bool)file;
+}
+
+bool FrameWriter::writePNG(const std::string& path, int width, int height, const float* pixels) {
+    // the kernel output is already gamma corrected, only clamp and quantise it
+    std::vector<unsigned char> data(3 * (size_t)width * height);
+    for(int y = 0; y < height; y++) {
+        const float* src = pixels + 4 * (size_t)(height - 1 - y) * width; // PNG starts with the top row
+        unsigned char* dst = &data[3 * (size_t)y * width];
+        for(int x = 0; x < width; x++) {
+            for(int c = 0; c < 3; c++) dst[3 * x + c] = (unsigned char)(std::min(std::max(src[4 * x + c], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+    
+    return stbi_write_png(path.c_str(), width, height, 3, &data[0], 3 * width) != 0;
+}
+
+bool FrameWriter::writeHDR(const std::string& path, int width, int height, const float* pixels) {
+    std::vector<float> data(3 * (size_t)width * height);
+    for(int y = 0; y < height; y++) {
+        const float* src = pixels + 4 * (size_t)(height - 1 - y) * width; // Radiance files start with the top row
+        float* dst = &data[3 * (size_t)y * width];
+        for(int x = 0; x < width; x++) {
+            for(int c = 0; c < 3; c++) dst[3 * x + c] = src[4 * x + c] * src[4 * x + c];
+        }
+    }
+    
+    return stbi_write_hdr(path.c_str(), width, height, 3, &data[0]) != 0;
+}
@@ -8,7 +8,12 @@
 
 #include "kernelgl.h"
 
+#ifdef __APPLE__
 #include <OpenGL/OpenGL.h>
+#else
+#include <GL/glx.h>
+#include <EGL/egl.h>
+#endif
 
 // include the standard libraries
 #include <iostream>
@@ -16,11 +21,19 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <map>
+#include <mutex>
 
-KernelGL::KernelGL(const char* kernel_path) {
+// binaries of the programs built by this process, a new context on the same device skips the compilation
+std::map<std::string, std::vector<unsigned char>> program_binaries;
+std::mutex program_binaries_mutex;
+
+bool KernelGL::fatal_errors = true;
+
+KernelGL::KernelGL(const char* kernel_path, const char* build_options) {
     try {
         initialiseOpenCL();
-        buildProgram(kernel_path);
+        buildProgram(kernel_path, build_options);
     } catch(cl::Error e) {
         processError(e);
     }
@@ -52,6 +65,7 @@ void KernelGL::processError(cl::Error& e) {
         std::cerr << oclErrorString(e.err()) << "\nUSE:\nhttps://streamhpc.com/blog/2013-04-28/opencl-error-codes\nTO VERIFY ERROR TYPE" << std::endl;
     }
     
+    if(!fatal_errors) throw e;
     exit(-1);
 }
 
@@ -73,11 +87,12 @@ void KernelGL::initialiseOpenCL() {
         std::cerr << "ERROR: OpenCL: NO DEVICES FOUND" << std::endl;
     }
     
-    device = devices[1]; //choose the graphics card
+    device = devices[devices.size() > 1 ? 1 : 0]; //choose the graphics card
     std::cout << "SUCCESS: OpenCL: USING A DEVICE: " << device.getInfo<CL_DEVICE_NAME>() << std::endl;
     
     // create shared context between OpenCL and OpenGL - therefore no communication via host needed!
     
+#ifdef __APPLE__
     CGLContextObj CGLGetCurrentContext(void);
     CGLShareGroupObj CGLGetShareGroup(CGLContextObj);
     CGLContextObj kCGLContext = CGLGetCurrentContext();
@@ -90,17 +105,68 @@ void KernelGL::initialiseOpenCL() {
     };
     
     context = cl::Context(device, properties);
+    gl_sharing = true;
+#else
+    // the current context comes from GLX or EGL, without the sharing extension the frames go through the host
+    gl_sharing = false;
+    std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+    if(extensions.find(GL_SHARING_EXTENSION) != std::string::npos) {
+        cl_context_properties properties[] = {
+            CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
+            CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
+            CL_CONTEXT_PLATFORM, (cl_context_properties)platforms[0](),
+            0
+        };
+        
+        EGLContext egl_context = eglGetCurrentContext();
+        if(egl_context != EGL_NO_CONTEXT) {
+            properties[1] = (cl_context_properties)egl_context;
+            properties[2] = CL_EGL_DISPLAY_KHR;
+            properties[3] = (cl_context_properties)eglGetCurrentDisplay();
+        }
+        
+        try {
+            context = cl::Context(device, properties);
+            gl_sharing = true;
+        } catch(cl::Error e) {
+            std::cerr << "ERROR: OpenCL: CANNOT SHARE THE OpenGL CONTEXT: " << e.err() << ", COPYING THE FRAMES THROUGH THE HOST" << std::endl;
+        }
+    }
+    if(!gl_sharing) context = cl::Context(device);
+#endif
+    
+    std::cout << "SUCCESS: OpenCL: FRAMES ARE " << (gl_sharing ? "SHARED WITH OpenGL" : "STREAMED TO OpenGL FROM PINNED MEMORY") << std::endl;
 }
 
-void KernelGL::buildProgram(const char* kernel_path) {
+void KernelGL::buildProgram(const char* kernel_path, const char* build_options) {
     // upload program source
     
     std::string kernel_code = loadSource(kernel_path);
+    std::string device_name = device.getInfo<CL_DEVICE_NAME>();
+    std::string binary_key = device_name + "\n" + (build_options ? build_options : "") + "\n" + kernel_code;
+    
+    {
+        std::lock_guard<std::mutex> lock(program_binaries_mutex);
+        auto cached = program_binaries.find(binary_key);
+        if(cached != program_binaries.end()) {
+            program = cl::Program(context, {device}, cl::Program::Binaries(1, cached->second));
+            program.build({device}, build_options);
+            return;
+        }
+    }
+    
     cl::Program::Sources sources;
     sources.push_back({kernel_code.c_str(), kernel_code.length()});
     
     // build the program
     
     program = cl::Program(context, sources);
-    program.build({device});
+    program.build({device}, build_options);
+    
+    std::vector<std::vector<unsigned char>> binaries;
+    program.getInfo(CL_PROGRAM_BINARIES, &binaries);
+    if(binaries.size() == 1) {
+        std::lock_guard<std::mutex> lock(program_binaries_mutex);
+        program_binaries[binary_key] = binaries[0];
+    }
 }
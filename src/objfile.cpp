@@ -0,0 +1,362 @@
+//
+//  objfile.cpp
+//  Non Euclidean
+//
+//  Parses Wavefront OBJ files mapped into memory, in chunks split at the line boundaries and read on the pool.
+//
+
+#include "objfile.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <filesystem>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define OBJ_MAX_MANTISSA 100000000000000000ULL // more digits only move the exponent
+
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+    bool opened = false;
+    
+    MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) return;
+        
+        struct stat info;
+        if(fstat(fd, &info) == 0) {
+            opened = true;
+            if(info.st_size > 0) {
+                void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapping != MAP_FAILED) {
+                    data = (const char*)mapping;
+                    size = (size_t)info.st_size;
+                    madvise(mapping, size, MADV_WILLNEED); // the chunks are read all at once
+                } else opened = false;
+            }
+        }
+        close(fd);
+    }
+    
+    ~MappedFile() {
+        if(data) munmap((void*)data, size);
+    }
+};
+
+inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char* skipBlanks(const char* p, const char* end) {
+    while(p < end && isBlank(*p)) p++;
+    return p;
+}
+
+inline const char* skipWord(const char* p, const char* end) {
+    while(p < end && !isBlank(*p)) p++;
+    return p;
+}
+
+inline bool isKeyword(const char* word, const char* word_end, const char* keyword) {
+    size_t length = std::strlen(keyword);
+    return (size_t)(word_end - word) == length && std::memcmp(word, keyword, length) == 0;
+}
+
+inline std::string getRest(const char* p, const char* end) {
+    // the names may hold spaces, as read by Assimp
+    p = skipBlanks(p, end);
+    while(end > p && isBlank(end[-1])) end--;
+    return std::string(p, end);
+}
+
+// no locale and no terminating zero needed, unlike strtof
+bool parseFloat(const char*& p, const char* end, float& value) {
+    p = skipBlanks(p, end);
+    
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    for(; p < end && isDigit(*p); p++, digits = true) {
+        if(mantissa < OBJ_MAX_MANTISSA) mantissa = 10 * mantissa + (*p - '0');
+        else exponent++;
+    }
+    if(p < end && *p == '.') {
+        for(p++; p < end && isDigit(*p); p++, digits = true) {
+            if(mantissa < OBJ_MAX_MANTISSA) {
+                mantissa = 10 * mantissa + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if(!digits) return false;
+    
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if(q < end && (*q == '-' || *q == '+')) negative_exponent = *q++ == '-';
+        
+        int written = 0;
+        if(q < end && isDigit(*q)) {
+            for(; q < end && isDigit(*q); q++) written = std::min(10 * written + (*q - '0'), 1000);
+            exponent += negative_exponent ? -written : written;
+            p = q;
+        }
+    }
+    
+    // the powers up to 22 are exact in double precision
+    const static double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    double result = (double)mantissa;
+    if(exponent >= 0 && exponent <= 22) result *= powers[exponent];
+    else if(exponent < 0 && exponent >= -22) result /= powers[-exponent];
+    else result *= std::pow(10.0, exponent);
+    
+    value = (float)(negative ? -result : result);
+    return true;
+}
+
+bool parseIndex(const char*& p, const char* end, long& value) {
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if(p >= end || !isDigit(*p)) return false;
+    
+    value = 0;
+    for(; p < end && isDigit(*p); p++) value = 10 * value + (*p - '0');
+    if(negative) value = -value;
+    return true;
+}
+
+// 1-based, or negative counting back from the last one read, 0 when missing
+inline bool resolveIndex(long value, size_t read_count, size_t total_count, unsigned int& index) {
+    long resolved = value > 0 ? value - 1 : (long)read_count + value;
+    if(resolved < 0 || (size_t)resolved >= total_count) return false;
+    index = (unsigned int)resolved;
+    return true;
+}
+
+void ObjFile::countChunk(ObjChunk& chunk) const {
+    for(const char* line = chunk.begin; line < chunk.end;) {
+        const char* line_end = (const char*)std::memchr(line, '\n', chunk.end - line);
+        if(!line_end) line_end = chunk.end;
+        
+        // the comment is cut off before both passes, so the counted faces are the parsed ones
+        const char* data_end = (const char*)std::memchr(line, '#', line_end - line);
+        if(!data_end) data_end = line_end;
+        
+        const char* word = skipBlanks(line, data_end);
+        const char* word_end = skipWord(word, data_end);
+        
+        if(isKeyword(word, word_end, "v")) chunk.position_count++;
+        else if(isKeyword(word, word_end, "vt")) chunk.uv_count++;
+        else if(isKeyword(word, word_end, "f")) {
+            size_t corner_count = 0;
+            for(const char* p = skipBlanks(word_end, data_end); p < data_end; p = skipBlanks(skipWord(p, data_end), data_end)) corner_count++;
+            if(corner_count >= 3) chunk.face_count += corner_count - 2;
+        } else if(isKeyword(word, word_end, "usemtl")) chunk.materials.push_back({chunk.face_count, getRest(word_end, data_end)});
+        else if(isKeyword(word, word_end, "mtllib")) chunk.libraries.push_back(getRest(word_end, data_end));
+        
+        line = line_end + 1;
+    }
+}
+
+void ObjFile::readChunk(ObjChunk& chunk) {
+    size_t position_ID = chunk.first_position, uv_ID = chunk.first_uv, face_ID = chunk.first_face;
+    std::vector<ObjCorner> polygon;
+    
+    for(const char* line = chunk.begin; line < chunk.end;) {
+        const char* line_end = (const char*)std::memchr(line, '\n', chunk.end - line);
+        if(!line_end) line_end = chunk.end;
+        
+        // the comment is cut off before both passes, so the counted faces are the parsed ones
+        const char* data_end = (const char*)std::memchr(line, '#', line_end - line);
+        if(!data_end) data_end = line_end;
+        
+        const char* word = skipBlanks(line, data_end);
+        const char* p = skipWord(word, data_end);
+        
+        if(isKeyword(word, p, "v")) {
+            glm::vec3& position = positions[position_ID++];
+            if(!parseFloat(p, data_end, position.x) || !parseFloat(p, data_end, position.y) || !parseFloat(p, data_end, position.z)) {
+                chunk.error = "WRONG VERTEX: " + std::string(line, line_end);
+                return;
+            }
+        } else if(isKeyword(word, p, "vt")) {
+            glm::vec2& uv = uvs[uv_ID++];
+            if(!parseFloat(p, data_end, uv.x)) {
+                chunk.error = "WRONG TEXTURE COORDS: " + std::string(line, line_end);
+                return;
+            }
+            if(!parseFloat(p, data_end, uv.y)) uv.y = 0.0f; // the second one is optional
+        } else if(isKeyword(word, p, "f")) {
+            // v, v/vt, v//vn or v/vt/vn, the normals are not used
+            polygon.clear();
+            for(p = skipBlanks(p, data_end); p < data_end; p = skipBlanks(p, data_end)) {
+                long position_value, uv_value = 0, normal_value;
+                bool valid = parseIndex(p, data_end, position_value);
+                if(valid && p < data_end && *p == '/') {
+                    p++;
+                    if(p < data_end && *p != '/') valid = parseIndex(p, data_end, uv_value);
+                    if(valid && p < data_end && *p == '/') {
+                        p++;
+                        valid = parseIndex(p, data_end, normal_value);
+                    }
+                }
+                
+                ObjCorner corner = {0, OBJ_NO_INDEX};
+                valid = valid && (p >= data_end || isBlank(*p)) && resolveIndex(position_value, position_ID, positions.size(), corner.position);
+                valid = valid && (uv_value == 0 || resolveIndex(uv_value, uv_ID, uvs.size(), corner.uv));
+                if(!valid) {
+                    chunk.error = "WRONG FACE: " + std::string(line, line_end);
+                    return;
+                }
+                polygon.push_back(corner);
+            }
+            
+            // points and lines are left out
+            for(size_t i = 2; i < polygon.size(); i++) {
+                ObjCorner* face = &corners[3 * face_ID++];
+                face[0] = polygon[0];
+                face[1] = polygon[i - 1];
+                face[2] = polygon[i];
+            }
+        }
+        
+        line = line_end + 1;
+    }
+}
+
+void ObjFile::readLibrary(const std::string& path) {
+    std::ifstream file(path);
+    if(!file) return; // like Assimp, a missing library only leaves the materials without textures
+    
+    std::string line, material;
+    while(std::getline(file, line)) {
+        const char* begin = line.c_str();
+        const char* end = begin + line.size();
+        const char* word = skipBlanks(begin, end);
+        const char* word_end = skipWord(word, end);
+        
+        if(isKeyword(word, word_end, "newmtl")) material = getRest(word_end, end);
+        else if(isKeyword(word, word_end, "map_Kd")) {
+            // the options come first, each with its numbers or on/off
+            std::string rest = getRest(word_end, end);
+            while(rest.size() > 1 && rest[0] == '-' && !isDigit(rest[1])) {
+                std::istringstream values(rest);
+                std::string option, value;
+                values >> option;
+                std::streampos value_pos = values.tellg();
+                while(values >> value) {
+                    char* parsed;
+                    std::strtod(value.c_str(), &parsed);
+                    if(*parsed != '\0' && value.compare("on") != 0 && value.compare("off") != 0) break;
+                    value_pos = values.tellg();
+                }
+                rest = value_pos == std::streampos(-1) ? "" : getRest(rest.c_str() + (size_t)value_pos, rest.c_str() + rest.size());
+            }
+            textures[material] = rest;
+        }
+    }
+}
+
+bool ObjFile::load(const std::string& path, ThreadPool& pool) {
+    MappedFile file(path);
+    if(!file.opened) {
+        error = "CANNOT READ " + path;
+        return false;
+    }
+    
+    // split at the line boundaries, every chunk is counted and then read by one task
+    std::vector<ObjChunk> chunks;
+    size_t chunk_count = std::max((size_t)1, std::min(file.size / OBJ_MIN_CHUNK_SIZE, (size_t)pool.getThreadCount() * OBJ_CHUNKS_PER_THREAD));
+    const char* file_end = file.data + file.size;
+    for(const char* begin = file.data; begin < file_end;) {
+        const char* end = std::max(begin, file.data + file.size * (chunks.size() + 1) / chunk_count);
+        const char* newline = end < file_end ? (const char*)std::memchr(end, '\n', file_end - end) : nullptr;
+        end = newline ? newline + 1 : file_end;
+        
+        chunks.push_back(ObjChunk());
+        chunks.back().begin = begin;
+        chunks.back().end = end;
+        begin = end;
+    }
+    
+    std::vector<std::future<void>> tasks;
+    for(ObjChunk& chunk : chunks) tasks.push_back(pool.submit([this, &chunk]() { countChunk(chunk); }));
+    for(std::future<void>& task : tasks) pool.wait(task);
+    
+    // the offsets of the chunks in the arrays, the negative indices are resolved against them
+    size_t position_count = 0, uv_count = 0, face_count = 0;
+    for(ObjChunk& chunk : chunks) {
+        chunk.first_position = position_count;
+        chunk.first_uv = uv_count;
+        chunk.first_face = face_count;
+        position_count += chunk.position_count;
+        uv_count += chunk.uv_count;
+        face_count += chunk.face_count;
+    }
+    if(face_count == 0) {
+        error = "NO FACES IN " + path;
+        return false;
+    }
+    if(position_count >= OBJ_NO_INDEX || uv_count >= OBJ_NO_INDEX) {
+        error = "TOO MANY VERTICES IN " + path;
+        return false;
+    }
+    
+    positions.resize(position_count);
+    uvs.resize(uv_count);
+    corners.resize(3 * face_count);
+    
+    tasks.clear();
+    for(ObjChunk& chunk : chunks) tasks.push_back(pool.submit([this, &chunk]() { readChunk(chunk); }));
+    for(std::future<void>& task : tasks) pool.wait(task);
+    
+    for(const ObjChunk& chunk : chunks) {
+        if(!chunk.error.empty()) {
+            error = chunk.error + " IN " + path;
+            return false;
+        }
+    }
+    
+    // the material switches of all the chunks in the file order
+    material_names = {""};
+    std::map<std::string, unsigned int> material_IDs = {{"", 0}};
+    unsigned int material = 0;
+    size_t run_start = 0;
+    for(const ObjChunk& chunk : chunks) {
+        for(const std::pair<size_t, std::string>& switch_to : chunk.materials) {
+            size_t face = chunk.first_face + switch_to.first;
+            if(face > run_start) runs.push_back({material, run_start, face - run_start});
+            
+            auto found = material_IDs.find(switch_to.second);
+            if(found == material_IDs.end()) {
+                found = material_IDs.insert({switch_to.second, (unsigned int)material_names.size()}).first;
+                material_names.push_back(switch_to.second);
+            }
+            material = found->second;
+            run_start = face;
+        }
+    }
+    if(face_count > run_start) runs.push_back({material, run_start, face_count - run_start});
+    
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    for(const ObjChunk& chunk : chunks) {
+        for(const std::string& library : chunk.libraries) readLibrary((directory / library).string());
+    }
+    
+    return true;
+}
@@ -0,0 +1,140 @@
+//
+//  pathrenderer.cpp
+//  Non Euclidean
+//
+//  Renders the frames of a camera path to disk, resuming an interrupted run.
+//
+
+#include "pathrenderer.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <cmath>
+#include <filesystem>
+
+#define ERROR_CHECK_INTERVAL 16 // samples between two convergence checks
+#define FRAME_NAME_DIGITS 5
+
+struct FrameStats {
+    unsigned int frame;
+    unsigned int samples;
+    float change;
+    double trace_ms, capture_ms;
+};
+
+PathRenderer::PathRenderer(const CameraPath& path, const std::string& output_dir) : path(path), output_dir(output_dir), stats_path(output_dir + "/stats.csv") {
+    std::error_code error;
+    std::filesystem::create_directories(output_dir, error);
+    if(error) {
+        std::cerr << "ERROR: CAMERA PATH: CANNOT CREATE " << output_dir << ": " << error.message() << std::endl;
+        exit(-1);
+    }
+}
+
+unsigned int PathRenderer::findFirstFrame() const {
+    // a frame gets its line in the stats once it is on the disk, the frames are written in order
+    std::ifstream file(stats_path);
+    std::string line;
+    unsigned int next_frame = 0;
+    
+    std::getline(file, line); // header
+    while(std::getline(file, line)) {
+        std::istringstream values(line);
+        unsigned int frame;
+        if(values >> frame && frame == next_frame) next_frame++;
+    }
+    
+    return next_frame;
+}
+
+float PathRenderer::getChange(const std::vector<float>& a, const std::vector<float>& b) {
+    // RMS of the difference relative to the RMS of the image, in linear colour
+    double diff_sum = 0.0, sum = 0.0;
+    for(size_t i = 0; i < a.size(); i += 4) {
+        for(int c = 0; c < 3; c++) {
+            double linear_a = a[i + c] * a[i + c], linear_b = b[i + c] * b[i + c];
+            diff_sum += (linear_a - linear_b) * (linear_a - linear_b);
+            sum += linear_b * linear_b;
+        }
+    }
+    
+    return sum > 0.0 ? (float)std::sqrt(diff_sum / sum) : 0.0f;
+}
+
+void PathRenderer::render(RayTracer* ray_tracer, Camera* camera, const std::function<bool()>& present) {
+    unsigned int frame_count = path.getFrameCount();
+    unsigned int first_frame = findFirstFrame();
+    
+    if(first_frame == 0) {
+        std::ofstream stats(stats_path, std::ios::out | std::ios::trunc);
+        stats << "frame,samples,change,trace_ms,capture_ms" << std::endl;
+    } else std::cout << "CAMERA PATH: RESUMING FROM FRAME " << first_frame << std::endl;
+    
+    std::vector<float> previous, current;
+    bool stopped = false;
+    auto time_start = std::chrono::high_resolution_clock::now();
+    
+    for(unsigned int frame = first_frame; frame < frame_count; frame++) {
+        auto frame_start = std::chrono::high_resolution_clock::now();
+        
+        path.apply(path.getFrameTime(frame), camera);
+        ray_tracer->restart(camera);
+        
+        unsigned int samples = 1;
+        float change = -1.0f; // not measured
+        stopped = !present();
+        previous.clear();
+        
+        while(!stopped && samples < path.getSamples()) {
+            ray_tracer->renderAgain(camera);
+            samples++;
+            stopped = !present();
+            
+            if(path.getError() > 0.0f && samples % ERROR_CHECK_INTERVAL == 0) {
+                ray_tracer->readImage(current);
+                if(previous.size()) {
+                    change = getChange(previous, current);
+                    if(change < path.getError()) break;
+                }
+                previous.swap(current);
+            }
+        }
+        
+        if(stopped) {
+            std::cout << "CAMERA PATH: STOPPED AT FRAME " << frame << ", RUN AGAIN TO RESUME" << std::endl;
+            break;
+        }
+        
+        auto trace_end = std::chrono::high_resolution_clock::now();
+        
+        std::ostringstream name;
+        name << output_dir << "/frame" << std::setw(FRAME_NAME_DIGITS) << std::setfill('0') << frame;
+        
+        // the stats are filled in before the frame reaches the writer, which happens in a later pollCaptures
+        std::shared_ptr<FrameStats> stats = std::make_shared<FrameStats>();
+        ray_tracer->capture(name.str(), path.getFormats(), true, [this, stats](bool written) {
+            if(!written) return; // the frame is rendered again when the path is resumed
+            
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            std::ofstream file(stats_path, std::ios::out | std::ios::app);
+            file << stats->frame << "," << stats->samples << "," << stats->change << "," << stats->trace_ms << "," << stats->capture_ms << std::endl;
+        });
+        
+        auto capture_end = std::chrono::high_resolution_clock::now();
+        
+        stats->frame = frame;
+        stats->samples = samples;
+        stats->change = change;
+        stats->trace_ms = std::chrono::duration<double, std::milli>(trace_end - frame_start).count();
+        stats->capture_ms = std::chrono::duration<double, std::milli>(capture_end - trace_end).count();
+        
+        std::cout << "CAMERA PATH: FRAME " << frame + 1 << "/" << frame_count << ": " << samples << " SAMPLES, " << stats->trace_ms + stats->capture_ms << " ms" << std::endl;
+    }
+    
+    auto time_end = std::chrono::high_resolution_clock::now();
+    if(!stopped) std::cout << "SUCCESS: CAMERA PATH: RENDERED IN " << std::chrono::duration<double>(time_end - time_start).count() << " s" << std::endl;
+}
@@ -0,0 +1,781 @@
+//
+//  raycaster.cpp
+//  Non Euclidean
+//
+//  Host-side ray queries over the scene data, used for picking and tooling.
+//
+
+#include "raycaster.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <cmath>
+
+// keep in sync with kernels/raytracer.cl
+#define TRIANGLE_EPSILON 0.0000001f
+#define MIN_DISTANCE 0.001f
+#define MAX_DISTANCE 1000.0f
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+
+typedef __m256 vfloat;
+
+inline vfloat vset(float a) { return _mm256_set1_ps(a); }
+inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+inline void vstore(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+inline vfloat vlt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vfloat vle(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline vfloat vand(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+inline vfloat vor(vfloat a, vfloat b) { return _mm256_or_ps(a, b); }
+inline vfloat vandnot(vfloat a, vfloat b) { return _mm256_andnot_ps(b, a); } // a & ~b
+inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+inline int vmask(vfloat mask) { return _mm256_movemask_ps(mask); }
+inline vfloat vlanes(size_t count) { return vlt(_mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f), vset((float)count)); }
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+
+typedef __m128 vfloat;
+
+inline vfloat vset(float a) { return _mm_set1_ps(a); }
+inline vfloat vload(const float* p) { return _mm_loadu_ps(p); }
+inline void vstore(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+inline vfloat vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vfloat vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+inline vfloat vand(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+inline vfloat vor(vfloat a, vfloat b) { return _mm_or_ps(a, b); }
+inline vfloat vandnot(vfloat a, vfloat b) { return _mm_andnot_ps(b, a); } // a & ~b
+inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline int vmask(vfloat mask) { return _mm_movemask_ps(mask); }
+inline vfloat vlanes(size_t count) { return vlt(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), vset((float)count)); }
+
+#else
+
+#define SIMD_WIDTH 1
+
+#endif
+
+#if SIMD_WIDTH > 1
+
+inline vfloat vdot(vfloat ax, vfloat ay, vfloat az, vfloat bx, vfloat by, vfloat bz) {
+    return vadd(vadd(vmul(ax, bx), vmul(ay, by)), vmul(az, bz));
+}
+
+inline vfloat vinRayRange(vfloat x) {
+    return vand(vle(vset(MIN_DISTANCE), x), vle(x, vset(MAX_DISTANCE)));
+}
+
+struct RayLanes {
+    vfloat ox, oy, oz;
+    vfloat dx, dy, dz;
+    
+    RayLanes(const HostRay& r) : ox(vset(r.origin.x)), oy(vset(r.origin.y)), oz(vset(r.origin.z)), dx(vset(r.dir.x)), dy(vset(r.dir.y)), dz(vset(r.dir.z)) {}
+};
+
+#endif
+
+inline bool inRayRange(float x) { return MIN_DISTANCE <= x && x <= MAX_DISTANCE; }
+
+template <typename T>
+inline void padVector(std::vector<T>& v) {
+    while(v.size() % SIMD_WIDTH) v.push_back(T(0));
+}
+
+inline glm::vec3 toVec(const cl_float3& v) {
+    return glm::vec3(v.x, v.y, v.z);
+}
+
+void RayCaster::build(const SceneCreator& scene) {
+    *this = RayCaster();
+    
+    for(const Sphere& s : scene.spheres) {
+        sphere_x.push_back(s.pos.x);
+        sphere_y.push_back(s.pos.y);
+        sphere_z.push_back(s.pos.z);
+        sphere_r.push_back(s.r);
+        sphere_mat.push_back(s.mat_ID);
+    }
+    
+    for(const Plane& p : scene.planes) {
+        plane_x.push_back(p.pos.x);
+        plane_y.push_back(p.pos.y);
+        plane_z.push_back(p.pos.z);
+        plane_nx.push_back(p.normal.x);
+        plane_ny.push_back(p.normal.y);
+        plane_nz.push_back(p.normal.z);
+        plane_mat.push_back(p.mat_ID);
+    }
+    
+    for(const Lens& l : scene.lenses) {
+        lens_p1x.push_back(l.p1.x);
+        lens_p1y.push_back(l.p1.y);
+        lens_p1z.push_back(l.p1.z);
+        lens_p2x.push_back(l.p2.x);
+        lens_p2y.push_back(l.p2.y);
+        lens_p2z.push_back(l.p2.z);
+        lens_r1.push_back(l.r1);
+        lens_r2.push_back(l.r2);
+        lens_mat.push_back(l.mat_ID);
+    }
+    
+    for(cl_uint model_ID = 0; model_ID < scene.models.size(); model_ID++) {
+        const Model& model = scene.models[model_ID];
+        
+        for(cl_uint mesh_ID = model.mesh_anchor; mesh_ID < model.mesh_anchor + model.getLevelEnd(0); mesh_ID++) { // the full detail level only
+            const Mesh& mesh = scene.meshes[mesh_ID];
+            
+            for(cl_uint i = 0; i < mesh.face_count; i++) {
+                const cl_uint* face = &scene.indices[mesh.index_anchor + 3 * i];
+                glm::vec3 A = toVec(scene.vertices[mesh.vertex_anchor + face[0]]);
+                glm::vec3 edge1 = toVec(scene.vertices[mesh.vertex_anchor + face[1]]) - A;
+                glm::vec3 edge2 = toVec(scene.vertices[mesh.vertex_anchor + face[2]]) - A;
+                
+                tri_ax.push_back(A.x);
+                tri_ay.push_back(A.y);
+                tri_az.push_back(A.z);
+                tri_e1x.push_back(edge1.x);
+                tri_e1y.push_back(edge1.y);
+                tri_e1z.push_back(edge1.z);
+                tri_e2x.push_back(edge2.x);
+                tri_e2y.push_back(edge2.y);
+                tri_e2z.push_back(edge2.z);
+                tri_mat.push_back(model.mat_ID);
+                tri_model.push_back(model_ID);
+            }
+        }
+    }
+    
+    boxes = scene.boxes;
+    cylinders = scene.cylinders;
+    discs = scene.discs;
+    quadrics = scene.quadrics;
+    
+    sphere_count = sphere_x.size();
+    plane_count = plane_x.size();
+    lens_count = lens_r1.size();
+    triangle_count = tri_ax.size();
+    
+    for(std::vector<float>* v : {&sphere_x, &sphere_y, &sphere_z, &sphere_r,
+                                 &plane_x, &plane_y, &plane_z, &plane_nx, &plane_ny, &plane_nz,
+                                 &lens_p1x, &lens_p1y, &lens_p1z, &lens_p2x, &lens_p2y, &lens_p2z, &lens_r1, &lens_r2,
+                                 &tri_ax, &tri_ay, &tri_az, &tri_e1x, &tri_e1y, &tri_e1z, &tri_e2x, &tri_e2y, &tri_e2z}) padVector(*v);
+}
+
+int RayCaster::getSIMDWidth() {
+    return SIMD_WIDTH;
+}
+
+// scalar intersection routines, these follow hitSphere, hitPlane, hitLens and hitTriangle from the kernel
+
+bool RayCaster::hitSphere(size_t i, const HostRay& r, float& t) const {
+    glm::vec3 oc = glm::vec3(sphere_x[i], sphere_y[i], sphere_z[i]) - r.origin;
+    float b = glm::dot(oc, r.dir);
+    float c = glm::dot(oc, oc) - sphere_r[i] * sphere_r[i];
+    float dis = b * b - c;
+    if(dis > 0.0f) {
+        float d = std::sqrt(dis);
+        if(inRayRange(b - d)) {
+            t = b - d;
+            return true;
+        }
+        if(inRayRange(b + d)) {
+            t = b + d;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RayCaster::hitPlane(size_t i, const HostRay& r, float& t) const {
+    glm::vec3 normal(plane_nx[i], plane_ny[i], plane_nz[i]);
+    float a = glm::dot(r.dir, normal);
+    float b = glm::dot(glm::vec3(plane_x[i], plane_y[i], plane_z[i]) - r.origin, normal);
+    float temp = b / a;
+    if(inRayRange(temp)) {
+        t = temp;
+        return true;
+    }
+    return false;
+}
+
+bool RayCaster::hitLens(size_t i, const HostRay& r, float& t, bool& first_sphere) const {
+    glm::vec3 oc = glm::vec3(lens_p1x[i], lens_p1y[i], lens_p1z[i]) - r.origin;
+    float b1 = glm::dot(oc, r.dir);
+    float dis1 = b1 * b1 - glm::dot(oc, oc) + lens_r1[i] * lens_r1[i];
+    
+    oc = glm::vec3(lens_p2x[i], lens_p2y[i], lens_p2z[i]) - r.origin;
+    float b2 = glm::dot(oc, r.dir);
+    float dis2 = b2 * b2 - glm::dot(oc, oc) + lens_r2[i] * lens_r2[i];
+    
+    if(dis1 > 0.0f && dis2 > 0.0f) {
+        float d1 = std::sqrt(dis1);
+        float d2 = std::sqrt(dis2);
+        
+        float t1A = b1 - d1, t1B = b1 + d1;
+        float t2A = b2 - d2, t2B = b2 + d2;
+        float temp;
+        
+        if((t1B < t2A) || (t2B < t1A)) return false; // missing the lens
+        else if(MIN_DISTANCE <= t1A || MIN_DISTANCE <= t2A) {
+            first_sphere = t2A <= t1A; // outside the lens
+            temp = first_sphere ? t1A : t2A;
+        } else if(MIN_DISTANCE <= t1B && MIN_DISTANCE <= t2B) {
+            first_sphere = t1B <= t2B; // inside the lens
+            temp = first_sphere ? t1B : t2B;
+        } else return false;
+        
+        if(temp <= MAX_DISTANCE) {
+            t = temp;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RayCaster::hitTriangle(size_t i, const HostRay& r, float& t) const {
+    // Moller-Trumbore algorithm, only the front faces count (as in hitMeshOut)
+    glm::vec3 edge1(tri_e1x[i], tri_e1y[i], tri_e1z[i]);
+    glm::vec3 edge2(tri_e2x[i], tri_e2y[i], tri_e2z[i]);
+    glm::vec3 h = glm::cross(r.dir, edge2);
+    float a = glm::dot(edge1, h);
+    if(a < TRIANGLE_EPSILON) return false; // parallel or back-facing
+    
+    float f = 1.0f / a;
+    glm::vec3 s = r.origin - glm::vec3(tri_ax[i], tri_ay[i], tri_az[i]);
+    float u = f * glm::dot(s, h);
+    if(u < 0.0f || u > 1.0f) return false;
+    
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = f * glm::dot(r.dir, q);
+    if(v < 0.0f || u + v > 1.0f) return false;
+    
+    float temp = f * glm::dot(edge2, q);
+    if(inRayRange(temp)) {
+        t = temp;
+        return true;
+    }
+    return false;
+}
+
+bool RayCaster::hitBox(size_t i, const HostRay& r, float& t, glm::vec3& normal) const {
+    const Box& b = boxes[i];
+    glm::vec3 axis_x = toVec(b.axis_x), axis_y = toVec(b.axis_y), axis_z = toVec(b.axis_z), half_size = toVec(b.half_size);
+    glm::vec3 oc = r.origin - toVec(b.pos);
+    glm::vec3 o(glm::dot(oc, axis_x), glm::dot(oc, axis_y), glm::dot(oc, axis_z));
+    glm::vec3 d(glm::dot(r.dir, axis_x), glm::dot(r.dir, axis_y), glm::dot(r.dir, axis_z));
+    glm::vec3 inv_dir = 1.0f / d;
+    
+    glm::vec3 t0 = (-half_size - o) * inv_dir;
+    glm::vec3 t1 = (half_size - o) * inv_dir;
+    glm::vec3 t_small = glm::min(t0, t1), t_big = glm::max(t0, t1);
+    float t_enter = std::max(std::max(t_small.x, t_small.y), t_small.z);
+    float t_exit = std::min(std::min(t_big.x, t_big.y), t_big.z);
+    if(t_enter > t_exit) return false;
+    
+    float temp = t_enter >= MIN_DISTANCE ? t_enter : t_exit;
+    if(!inRayRange(temp)) return false;
+    
+    glm::vec3 local = (o + d * temp) / half_size;
+    glm::vec3 a = glm::abs(local);
+    if(a.x >= a.y && a.x >= a.z) normal = axis_x * glm::sign(local.x);
+    else if(a.y >= a.z) normal = axis_y * glm::sign(local.y);
+    else normal = axis_z * glm::sign(local.z);
+    
+    t = temp;
+    return true;
+}
+
+bool RayCaster::hitCylinder(size_t i, const HostRay& r, float& t, glm::vec3& normal) const {
+    const Cylinder& c = cylinders[i];
+    glm::vec3 ba = toVec(c.p2) - toVec(c.p1);
+    glm::vec3 oc = r.origin - toVec(c.p1);
+    float baba = glm::dot(ba, ba);
+    float bard = glm::dot(ba, r.dir);
+    float baoc = glm::dot(ba, oc);
+    
+    float temp = MAX_DISTANCE * 2.0f;
+    
+    float k2 = baba - bard * bard;
+    float k1 = baba * glm::dot(oc, r.dir) - baoc * bard;
+    float k0 = baba * glm::dot(oc, oc) - baoc * baoc - c.r * c.r * baba;
+    float dis = k1 * k1 - k2 * k0;
+    if(k2 > TRIANGLE_EPSILON && dis > 0.0f) {
+        float d = std::sqrt(dis);
+        float t_side = (-k1 - d) / k2;
+        float y = baoc + t_side * bard;
+        if(!inRayRange(t_side) || y < 0.0f || y > baba) {
+            t_side = (-k1 + d) / k2;
+            y = baoc + t_side * bard;
+        }
+        if(inRayRange(t_side) && y >= 0.0f && y <= baba) {
+            temp = t_side;
+            normal = (oc + r.dir * t_side - ba * (y / baba)) / c.r;
+        }
+    }
+    
+    if(std::fabs(bard) > TRIANGLE_EPSILON) {
+        for(int cap = 0; cap < 2; cap++) {
+            float side = (float)cap;
+            float t_cap = (side * baba - baoc) / bard;
+            glm::vec3 q = oc + r.dir * t_cap - ba * side;
+            if(inRayRange(t_cap) && t_cap < temp && glm::dot(q, q) <= c.r * c.r) {
+                temp = t_cap;
+                normal = ba * (side * 2.0f - 1.0f) / std::sqrt(baba);
+            }
+        }
+    }
+    
+    if(temp > MAX_DISTANCE) return false;
+    
+    t = temp;
+    return true;
+}
+
+bool RayCaster::hitDisc(size_t i, const HostRay& r, float& t, glm::vec3& normal) const {
+    const Disc& disc = discs[i];
+    glm::vec3 n = toVec(disc.normal);
+    float a = glm::dot(r.dir, n);
+    float temp = glm::dot(toVec(disc.pos) - r.origin, n) / a;
+    if(!inRayRange(temp)) return false;
+    
+    glm::vec3 q = r.origin + r.dir * temp - toVec(disc.pos);
+    if(glm::dot(q, q) > disc.r * disc.r) return false;
+    
+    t = temp;
+    normal = a > 0.0f ? -n : n;
+    return true;
+}
+
+inline glm::vec3 quadricProduct(const Quadric& q, const glm::vec3& v) {
+    return toVec(q.diag) * v + glm::vec3(q.cross.x * v.y + q.cross.y * v.z, q.cross.x * v.x + q.cross.z * v.z, q.cross.y * v.x + q.cross.z * v.y);
+}
+
+bool RayCaster::hitQuadric(size_t i, const HostRay& r, float& t, glm::vec3& normal) const {
+    const Quadric& q = quadrics[i];
+    
+    glm::vec3 inv_dir = 1.0f / r.dir;
+    glm::vec3 t0 = (toVec(q.bounds_min) - r.origin) * inv_dir;
+    glm::vec3 t1 = (toVec(q.bounds_max) - r.origin) * inv_dir;
+    glm::vec3 t_small = glm::min(t0, t1), t_big = glm::max(t0, t1);
+    float t_enter = std::max(std::max(t_small.x, t_small.y), std::max(t_small.z, MIN_DISTANCE));
+    float t_exit = std::min(std::min(t_big.x, t_big.y), std::min(t_big.z, MAX_DISTANCE));
+    if(t_enter > t_exit) return false;
+    
+    glm::vec3 o = r.origin - toVec(q.pos);
+    glm::vec3 qd = quadricProduct(q, r.dir);
+    float a = glm::dot(r.dir, qd);
+    float b = glm::dot(o, qd) + glm::dot(toVec(q.linear), r.dir);
+    float c = glm::dot(o, quadricProduct(q, o)) + 2.0f * glm::dot(toVec(q.linear), o) + q.constant;
+    
+    float t1_root, t2_root;
+    if(std::fabs(a) < TRIANGLE_EPSILON) {
+        if(std::fabs(b) < TRIANGLE_EPSILON) return false;
+        t1_root = t2_root = -c / (2.0f * b);
+    } else {
+        float dis = b * b - a * c;
+        if(dis < 0.0f) return false;
+        float d = std::sqrt(dis);
+        t1_root = std::min((-b - d) / a, (-b + d) / a);
+        t2_root = std::max((-b - d) / a, (-b + d) / a);
+    }
+    
+    float temp = t1_root >= t_enter ? t1_root : t2_root;
+    if(temp < t_enter || temp > t_exit) return false;
+    
+    t = temp;
+    normal = glm::normalize(quadricProduct(q, o + r.dir * temp) + toVec(q.linear));
+    return true;
+}
+
+void RayCaster::closestAnalytic(const HostRay& r, HostHit& hit) const {
+    float t;
+    glm::vec3 normal;
+    
+    for(size_t i = 0; i < boxes.size(); i++) if(hitBox(i, r, t, normal) && t < hit.t) {
+        hit.t = t;
+        hit.type = h_box;
+        hit.primitive_ID = (cl_uint)i;
+    }
+    for(size_t i = 0; i < cylinders.size(); i++) if(hitCylinder(i, r, t, normal) && t < hit.t) {
+        hit.t = t;
+        hit.type = h_cylinder;
+        hit.primitive_ID = (cl_uint)i;
+    }
+    for(size_t i = 0; i < discs.size(); i++) if(hitDisc(i, r, t, normal) && t < hit.t) {
+        hit.t = t;
+        hit.type = h_disc;
+        hit.primitive_ID = (cl_uint)i;
+    }
+    for(size_t i = 0; i < quadrics.size(); i++) if(hitQuadric(i, r, t, normal) && t < hit.t) {
+        hit.t = t;
+        hit.type = h_quadric;
+        hit.primitive_ID = (cl_uint)i;
+    }
+}
+
+bool RayCaster::anyAnalytic(const HostRay& r, float max_t) const {
+    float t;
+    glm::vec3 normal;
+    
+    for(size_t i = 0; i < boxes.size(); i++) if(hitBox(i, r, t, normal) && t < max_t) return true;
+    for(size_t i = 0; i < cylinders.size(); i++) if(hitCylinder(i, r, t, normal) && t < max_t) return true;
+    for(size_t i = 0; i < discs.size(); i++) if(hitDisc(i, r, t, normal) && t < max_t) return true;
+    for(size_t i = 0; i < quadrics.size(); i++) if(hitQuadric(i, r, t, normal) && t < max_t) return true;
+    
+    return false;
+}
+
+void RayCaster::finaliseHit(const HostRay& r, HostHit& hit) const {
+    size_t i = hit.primitive_ID;
+    hit.p = r.origin + r.dir * hit.t;
+    
+    switch(hit.type) {
+        case h_sphere:
+            hit.normal = (hit.p - glm::vec3(sphere_x[i], sphere_y[i], sphere_z[i])) / sphere_r[i];
+            hit.mat_ID = sphere_mat[i];
+            hit.object_ID = (cl_uint)i;
+            break;
+        case h_plane: {
+            glm::vec3 normal(plane_nx[i], plane_ny[i], plane_nz[i]);
+            hit.normal = glm::dot(r.dir, normal) > 0.0f ? -normal : normal;
+            hit.mat_ID = plane_mat[i];
+            hit.object_ID = (cl_uint)i;
+            break;
+        }
+        case h_lens: {
+            float t;
+            bool first_sphere = true;
+            hitLens(i, r, t, first_sphere);
+            if(first_sphere) hit.normal = (hit.p - glm::vec3(lens_p1x[i], lens_p1y[i], lens_p1z[i])) / lens_r1[i];
+            else hit.normal = (hit.p - glm::vec3(lens_p2x[i], lens_p2y[i], lens_p2z[i])) / lens_r2[i];
+            hit.mat_ID = lens_mat[i];
+            hit.object_ID = (cl_uint)i;
+            break;
+        }
+        case h_triangle:
+            hit.normal = glm::normalize(glm::cross(glm::vec3(tri_e1x[i], tri_e1y[i], tri_e1z[i]), glm::vec3(tri_e2x[i], tri_e2y[i], tri_e2z[i])));
+            hit.mat_ID = tri_mat[i];
+            hit.object_ID = tri_model[i];
+            break;
+        case h_box:
+        case h_cylinder:
+        case h_disc:
+        case h_quadric: {
+            // the normal comes from the same test which found the hit
+            float t;
+            if(hit.type == h_box) {
+                hitBox(i, r, t, hit.normal);
+                hit.mat_ID = boxes[i].mat_ID;
+            } else if(hit.type == h_cylinder) {
+                hitCylinder(i, r, t, hit.normal);
+                hit.mat_ID = cylinders[i].mat_ID;
+            } else if(hit.type == h_disc) {
+                hitDisc(i, r, t, hit.normal);
+                hit.mat_ID = discs[i].mat_ID;
+            } else {
+                hitQuadric(i, r, t, hit.normal);
+                hit.mat_ID = quadrics[i].mat_ID;
+            }
+            hit.object_ID = (cl_uint)i;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+bool RayCaster::closestHitScalar(const HostRay& r, HostHit& hit) const {
+    float t;
+    bool first_sphere;
+    hit.t = MAX_DISTANCE;
+    hit.type = h_none;
+    
+    for(size_t i = 0; i < sphere_count; i++) if(hitSphere(i, r, t) && t < hit.t) {
+        hit.t = t;
+        hit.type = h_sphere;
+        hit.primitive_ID = (cl_uint)i;
+    }
+    for(size_t i = 0; i < plane_count; i++) if(hitPlane(i, r, t) && t < hit.t) {
+        hit.t = t;
+        hit.type = h_plane;
+        hit.primitive_ID = (cl_uint)i;
+    }
+    for(size_t i = 0; i < lens_count; i++) if(hitLens(i, r, t, first_sphere) && t < hit.t) {
+        hit.t = t;
+        hit.type = h_lens;
+        hit.primitive_ID = (cl_uint)i;
+    }
+    for(size_t i = 0; i < triangle_count; i++) if(hitTriangle(i, r, t) && t < hit.t) {
+        hit.t = t;
+        hit.type = h_triangle;
+        hit.primitive_ID = (cl_uint)i;
+    }
+    closestAnalytic(r, hit);
+    
+    if(hit.type == h_none) return false;
+    
+    finaliseHit(r, hit);
+    return true;
+}
+
+bool RayCaster::anyHitScalar(const HostRay& r, float max_t) const {
+    float t;
+    bool first_sphere;
+    
+    for(size_t i = 0; i < sphere_count; i++) if(hitSphere(i, r, t) && t < max_t) return true;
+    for(size_t i = 0; i < plane_count; i++) if(hitPlane(i, r, t) && t < max_t) return true;
+    for(size_t i = 0; i < lens_count; i++) if(hitLens(i, r, t, first_sphere) && t < max_t) return true;
+    for(size_t i = 0; i < triangle_count; i++) if(hitTriangle(i, r, t) && t < max_t) return true;
+    
+    return anyAnalytic(r, max_t);
+}
+
+#if SIMD_WIDTH > 1
+
+// the SIMD routines test SIMD_WIDTH primitives against one ray at a time, they return the mask of the hit lanes and their distances
+
+inline vfloat hitSpheres(const RayLanes& r, const float* x, const float* y, const float* z, const float* rad, vfloat& t) {
+    vfloat ocx = vsub(vload(x), r.ox), ocy = vsub(vload(y), r.oy), ocz = vsub(vload(z), r.oz);
+    vfloat radius = vload(rad);
+    vfloat b = vdot(ocx, ocy, ocz, r.dx, r.dy, r.dz);
+    vfloat c = vsub(vdot(ocx, ocy, ocz, ocx, ocy, ocz), vmul(radius, radius));
+    vfloat dis = vsub(vmul(b, b), c);
+    vfloat valid = vlt(vset(0.0f), dis);
+    if(!vmask(valid)) return valid;
+    
+    vfloat d = vsqrt(vmax(dis, vset(0.0f)));
+    vfloat tA = vsub(b, d), tB = vadd(b, d);
+    vfloat inA = vinRayRange(tA);
+    t = vselect(inA, tA, tB);
+    return vand(valid, vor(inA, vinRayRange(tB)));
+}
+
+inline vfloat hitPlanes(const RayLanes& r, const float* x, const float* y, const float* z, const float* nx, const float* ny, const float* nz, vfloat& t) {
+    vfloat normal_x = vload(nx), normal_y = vload(ny), normal_z = vload(nz);
+    vfloat a = vdot(r.dx, r.dy, r.dz, normal_x, normal_y, normal_z);
+    vfloat b = vdot(vsub(vload(x), r.ox), vsub(vload(y), r.oy), vsub(vload(z), r.oz), normal_x, normal_y, normal_z);
+    t = vdiv(b, a);
+    return vinRayRange(t);
+}
+
+inline vfloat hitLenses(const RayLanes& r, const float* p1x, const float* p1y, const float* p1z, const float* p2x, const float* p2y, const float* p2z, const float* r1, const float* r2, vfloat& t) {
+    vfloat ocx = vsub(vload(p1x), r.ox), ocy = vsub(vload(p1y), r.oy), ocz = vsub(vload(p1z), r.oz);
+    vfloat rad = vload(r1);
+    vfloat b1 = vdot(ocx, ocy, ocz, r.dx, r.dy, r.dz);
+    vfloat dis1 = vadd(vsub(vmul(b1, b1), vdot(ocx, ocy, ocz, ocx, ocy, ocz)), vmul(rad, rad));
+    
+    ocx = vsub(vload(p2x), r.ox);
+    ocy = vsub(vload(p2y), r.oy);
+    ocz = vsub(vload(p2z), r.oz);
+    rad = vload(r2);
+    vfloat b2 = vdot(ocx, ocy, ocz, r.dx, r.dy, r.dz);
+    vfloat dis2 = vadd(vsub(vmul(b2, b2), vdot(ocx, ocy, ocz, ocx, ocy, ocz)), vmul(rad, rad));
+    
+    vfloat zero = vset(0.0f), min_distance = vset(MIN_DISTANCE);
+    vfloat valid = vand(vlt(zero, dis1), vlt(zero, dis2));
+    if(!vmask(valid)) return valid;
+    
+    vfloat d1 = vsqrt(vmax(dis1, zero)), d2 = vsqrt(vmax(dis2, zero));
+    vfloat t1A = vsub(b1, d1), t1B = vadd(b1, d1);
+    vfloat t2A = vsub(b2, d2), t2B = vadd(b2, d2);
+    
+    vfloat missing = vor(vlt(t1B, t2A), vlt(t2B, t1A));
+    vfloat outside = vor(vle(min_distance, t1A), vle(min_distance, t2A));
+    vfloat inside = vand(vle(min_distance, t1B), vle(min_distance, t2B));
+    
+    vfloat t_outside = vselect(vle(t2A, t1A), t1A, t2A);
+    vfloat t_inside = vselect(vle(t1B, t2B), t1B, t2B);
+    t = vselect(outside, t_outside, t_inside);
+    
+    vfloat hit = vandnot(vand(valid, vor(outside, inside)), missing);
+    return vand(hit, vle(t, vset(MAX_DISTANCE)));
+}
+
+inline vfloat hitTriangles(const RayLanes& r, const float* ax, const float* ay, const float* az, const float* e1x, const float* e1y, const float* e1z, const float* e2x, const float* e2y, const float* e2z, vfloat& t) {
+    vfloat edge1_x = vload(e1x), edge1_y = vload(e1y), edge1_z = vload(e1z);
+    vfloat edge2_x = vload(e2x), edge2_y = vload(e2y), edge2_z = vload(e2z);
+    
+    // h = cross(dir, edge2)
+    vfloat hx = vsub(vmul(r.dy, edge2_z), vmul(r.dz, edge2_y));
+    vfloat hy = vsub(vmul(r.dz, edge2_x), vmul(r.dx, edge2_z));
+    vfloat hz = vsub(vmul(r.dx, edge2_y), vmul(r.dy, edge2_x));
+    vfloat a = vdot(edge1_x, edge1_y, edge1_z, hx, hy, hz);
+    vfloat valid = vle(vset(TRIANGLE_EPSILON), a); // parallel or back-facing
+    if(!vmask(valid)) return valid;
+    
+    vfloat f = vdiv(vset(1.0f), a);
+    vfloat sx = vsub(r.ox, vload(ax)), sy = vsub(r.oy, vload(ay)), sz = vsub(r.oz, vload(az));
+    vfloat u = vmul(f, vdot(sx, sy, sz, hx, hy, hz));
+    
+    // q = cross(s, edge1)
+    vfloat qx = vsub(vmul(sy, edge1_z), vmul(sz, edge1_y));
+    vfloat qy = vsub(vmul(sz, edge1_x), vmul(sx, edge1_z));
+    vfloat qz = vsub(vmul(sx, edge1_y), vmul(sy, edge1_x));
+    vfloat v = vmul(f, vdot(r.dx, r.dy, r.dz, qx, qy, qz));
+    
+    vfloat zero = vset(0.0f), one = vset(1.0f);
+    valid = vand(valid, vand(vle(zero, u), vle(u, one)));
+    valid = vand(valid, vand(vle(zero, v), vle(vadd(u, v), one)));
+    
+    t = vmul(f, vdot(edge2_x, edge2_y, edge2_z, qx, qy, qz));
+    return vand(valid, vinRayRange(t));
+}
+
+// pick the nearest of the hit lanes which is closer than the current hit
+inline void updateClosest(vfloat hit, vfloat t, size_t base, HitType type, HostHit& result) {
+    int mask = vmask(vand(hit, vlt(t, vset(result.t))));
+    if(!mask) return;
+    
+    float t_lanes[SIMD_WIDTH];
+    vstore(t_lanes, t);
+    for(int lane = 0; lane < SIMD_WIDTH; lane++) {
+        if((mask & (1 << lane)) && t_lanes[lane] < result.t) {
+            result.t = t_lanes[lane];
+            result.type = type;
+            result.primitive_ID = (cl_uint)(base + lane);
+        }
+    }
+}
+
+#endif
+
+bool RayCaster::closestHit(const HostRay& r, HostHit& hit) const {
+#if SIMD_WIDTH > 1
+    RayLanes lanes(r);
+    vfloat t = vset(0.0f);
+    hit.t = MAX_DISTANCE;
+    hit.type = h_none;
+    
+    for(size_t i = 0; i < sphere_count; i += SIMD_WIDTH) {
+        vfloat mask = hitSpheres(lanes, &sphere_x[i], &sphere_y[i], &sphere_z[i], &sphere_r[i], t);
+        updateClosest(vand(mask, vlanes(sphere_count - i)), t, i, h_sphere, hit);
+    }
+    for(size_t i = 0; i < plane_count; i += SIMD_WIDTH) {
+        vfloat mask = hitPlanes(lanes, &plane_x[i], &plane_y[i], &plane_z[i], &plane_nx[i], &plane_ny[i], &plane_nz[i], t);
+        updateClosest(vand(mask, vlanes(plane_count - i)), t, i, h_plane, hit);
+    }
+    for(size_t i = 0; i < lens_count; i += SIMD_WIDTH) {
+        vfloat mask = hitLenses(lanes, &lens_p1x[i], &lens_p1y[i], &lens_p1z[i], &lens_p2x[i], &lens_p2y[i], &lens_p2z[i], &lens_r1[i], &lens_r2[i], t);
+        updateClosest(vand(mask, vlanes(lens_count - i)), t, i, h_lens, hit);
+    }
+    for(size_t i = 0; i < triangle_count; i += SIMD_WIDTH) {
+        vfloat mask = hitTriangles(lanes, &tri_ax[i], &tri_ay[i], &tri_az[i], &tri_e1x[i], &tri_e1y[i], &tri_e1z[i], &tri_e2x[i], &tri_e2y[i], &tri_e2z[i], t);
+        updateClosest(vand(mask, vlanes(triangle_count - i)), t, i, h_triangle, hit);
+    }
+    closestAnalytic(r, hit);
+    
+    if(hit.type == h_none) return false;
+    
+    finaliseHit(r, hit);
+    return true;
+#else
+    return closestHitScalar(r, hit);
+#endif
+}
+
+bool RayCaster::anyHit(const HostRay& r, float max_t) const {
+#if SIMD_WIDTH > 1
+    RayLanes lanes(r);
+    vfloat t = vset(0.0f), limit = vset(max_t);
+    
+    for(size_t i = 0; i < sphere_count; i += SIMD_WIDTH) {
+        vfloat mask = hitSpheres(lanes, &sphere_x[i], &sphere_y[i], &sphere_z[i], &sphere_r[i], t);
+        if(vmask(vand(vand(mask, vlanes(sphere_count - i)), vlt(t, limit)))) return true;
+    }
+    for(size_t i = 0; i < plane_count; i += SIMD_WIDTH) {
+        vfloat mask = hitPlanes(lanes, &plane_x[i], &plane_y[i], &plane_z[i], &plane_nx[i], &plane_ny[i], &plane_nz[i], t);
+        if(vmask(vand(vand(mask, vlanes(plane_count - i)), vlt(t, limit)))) return true;
+    }
+    for(size_t i = 0; i < lens_count; i += SIMD_WIDTH) {
+        vfloat mask = hitLenses(lanes, &lens_p1x[i], &lens_p1y[i], &lens_p1z[i], &lens_p2x[i], &lens_p2y[i], &lens_p2z[i], &lens_r1[i], &lens_r2[i], t);
+        if(vmask(vand(vand(mask, vlanes(lens_count - i)), vlt(t, limit)))) return true;
+    }
+    for(size_t i = 0; i < triangle_count; i += SIMD_WIDTH) {
+        vfloat mask = hitTriangles(lanes, &tri_ax[i], &tri_ay[i], &tri_az[i], &tri_e1x[i], &tri_e1y[i], &tri_e1z[i], &tri_e2x[i], &tri_e2y[i], &tri_e2z[i], t);
+        if(vmask(vand(vand(mask, vlanes(triangle_count - i)), vlt(t, limit)))) return true;
+    }
+    
+    return anyAnalytic(r, max_t);
+#else
+    return anyHitScalar(r, max_t);
+#endif
+}
+
+void RayCaster::closestHits(const HostRay* rays, HostHit* hits, bool* results, size_t count) const {
+    for(size_t i = 0; i < count; i++) results[i] = closestHit(rays[i], hits[i]);
+}
+
+void RayCaster::anyHits(const HostRay* rays, const float* max_t, bool* results, size_t count) const {
+    for(size_t i = 0; i < count; i++) results[i] = anyHit(rays[i], max_t[i]);
+}
+
+void RayCaster::benchmark(size_t ray_count, unsigned int seed) const {
+    // random rays starting around the origin, checked against the scalar version of the queries
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dis(-5.0f, 5.0f);
+    std::normal_distribution<float> ndis(0.0f, 1.0f);
+    
+    std::vector<HostRay> rays(ray_count);
+    std::vector<float> max_t(ray_count);
+    for(size_t i = 0; i < ray_count; i++) {
+        glm::vec3 dir(ndis(rng), ndis(rng), ndis(rng));
+        rays[i] = HostRay(glm::vec3(dis(rng), dis(rng), dis(rng)), glm::normalize(dir));
+        max_t[i] = dis(rng) + 10.0f;
+    }
+    
+    std::vector<HostHit> hits(ray_count), hits_scalar(ray_count);
+    bool* results = new bool[ray_count];
+    bool* results_scalar = new bool[ray_count];
+    
+    auto time_start = std::chrono::high_resolution_clock::now();
+    closestHits(&rays[0], &hits[0], results, ray_count);
+    auto time_simd = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < ray_count; i++) results_scalar[i] = closestHitScalar(rays[i], hits_scalar[i]);
+    auto time_scalar = std::chrono::high_resolution_clock::now();
+    
+    size_t mismatch_count = 0;
+    for(size_t i = 0; i < ray_count; i++) {
+        if(results[i] != results_scalar[i]) mismatch_count++;
+        else if(results[i] && (hits[i].type != hits_scalar[i].type || std::fabs(hits[i].t - hits_scalar[i].t) > 0.0001f * hits[i].t)) mismatch_count++;
+    }
+    
+    auto time_any_start = std::chrono::high_resolution_clock::now();
+    anyHits(&rays[0], &max_t[0], results, ray_count);
+    auto time_any_simd = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < ray_count; i++) results_scalar[i] = anyHitScalar(rays[i], max_t[i]);
+    auto time_any_scalar = std::chrono::high_resolution_clock::now();
+    
+    for(size_t i = 0; i < ray_count; i++) if(results[i] != results_scalar[i]) mismatch_count++;
+    
+    delete [] results;
+    delete [] results_scalar;
+    
+    auto mrays = [ray_count](std::chrono::high_resolution_clock::time_point a, std::chrono::high_resolution_clock::time_point b) {
+        return (double)ray_count / std::chrono::duration<double, std::micro>(b - a).count();
+    };
+    
+    std::cout << "RAYCAST: " << sphere_count << " SPHERES, " << plane_count << " PLANES, " << lens_count << " LENSES, " << boxes.size() + cylinders.size() + discs.size() + quadrics.size() << " ANALYTIC, " << triangle_count << " TRIANGLES, " << ray_count << " RAYS" << std::endl;
+    std::cout << "RAYCAST: CLOSEST HIT: SIMD(" << SIMD_WIDTH << "): " << mrays(time_start, time_simd) << " Mrays/s, SCALAR: " << mrays(time_simd, time_scalar) << " Mrays/s" << std::endl;
+    std::cout << "RAYCAST: ANY HIT: SIMD(" << SIMD_WIDTH << "): " << mrays(time_any_start, time_any_simd) << " Mrays/s, SCALAR: " << mrays(time_any_simd, time_any_scalar) << " Mrays/s" << std::endl;
+    
+    if(mismatch_count) std::cerr << "ERROR: RAYCAST: " << mismatch_count << " RESULTS DIFFER FROM THE SCALAR VERSION" << std::endl;
+    else std::cout << "SUCCESS: RAYCAST: RESULTS MATCH THE SCALAR VERSION" << std::endl;
+}
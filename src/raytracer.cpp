@@ -12,16 +12,48 @@
 #include <iostream>
 #include <random>
 #include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstring>
 
 #include "gtc/matrix_transform.hpp"
 
 #define TRACE_KERNEL_NAME "trace"
 #define RETRACE_KERNEL_NAME "retrace"
-#define SCENE_KERNEL_NAME "createScene"
+#define RESOLVE_KERNEL_NAME "resolve"
+#define REPROJECT_KERNEL_NAME "reproject"
+#define HEATMAP_KERNEL_NAME "heatmap"
+#define BINNING_KERNEL_NAME "binning"
+#define COMPACT_BUILD_OPTIONS "-D COMPACT_STORAGE"
+#define HEATMAP_BUILD_OPTIONS "-D COST_HEATMAP"
 #define RANDOM_BUFFER_SIZE 100000
 #define NUM_TRIANGLES 4
 
-RayTracer::RayTracer(int w, int h, const char* kernel_path) : KernelGL(kernel_path), width(w), height(h) {
+#define TRACE_ORDER_ARG 5
+#define RETRACE_ORDER_ARG 7
+#define TRACE_COST_ARG 11
+#define RETRACE_CACHE_ARG 9
+#define RETRACE_COST_ARG 12
+#define AUTOTUNE_CACHE_PATH "autotune.cache"
+#define AUTOTUNE_RUNS 5
+
+#define TRACE_SCALE_ARG 6
+#define TARGET_FRAME_TIME 0.033f
+#define FRAME_TIME_SMOOTHING 0.3f // weight of the newest frame in the estimate
+
+const char* cost_channel_names[] = {"time", "bounces", "spheres", "planes", "lenses", "triangles", "analytic", "chunks"};
+
+inline std::string getBuildOptions(bool compact_storage, bool heatmap) {
+    std::string options;
+    if(compact_storage) options += COMPACT_BUILD_OPTIONS " ";
+    if(heatmap) options += HEATMAP_BUILD_OPTIONS;
+    return options;
+}
+
+RayTracer::RayTracer(int w, int h, const char* kernel_path, bool compact_storage, const std::string& scene_path, bool heatmap) : KernelGL(kernel_path, getBuildOptions(compact_storage, heatmap).c_str()), width(w), height(h), scene_path(scene_path), hit_generation(1), jitter_count(1), jitter_positions(1), heatmap(heatmap), heatmap_channel(0), autotuner(AUTOTUNE_CACHE_PATH), tuned(false), resolution(r_full), target_frame_time(TARGET_FRAME_TIME), full_frame_time(0.0f), frame_counter(0), gbuffer_index(0), history_valid(false), present_time(0.0), upload_time(0.0), present_count(0), upload_count(0) {
+    scene.setCompactStorage(compact_storage);
+    
     try {
         createKernels();
         createGLTextures();
@@ -32,37 +64,162 @@ RayTracer::RayTracer(int w, int h, const char* kernel_path) : KernelGL(kernel_pa
         scene.createScene(context, device);
     } catch(cl::Error e) {
         processError(e);
+    } catch(SceneError& e) {
+        std::cerr << e.what() << std::endl;
+        if(!fatal_errors) throw;
+        exit(-1);
     }
 }
 
 RayTracer::~RayTracer() {
-    glDeleteTextures(1, &texture_ID);
+    if(present_count) {
+        std::cout << "TRANSFER: " << (gl_sharing ? "GL SHARING: " : persistent_pbo ? "MAPPED PIXEL BUFFER: " : "PINNED COPY: ") << present_time * 1e3 / present_count << " ms PER FRAME ON THE DEVICE";
+        if(upload_count) std::cout << ", " << upload_time * 1e3 / upload_count << " ms PER FRAME UPLOADING";
+        std::cout << " OVER " << present_count << " FRAMES" << std::endl;
+    }
+    
+    releaseImages();
 }
 
-void RayTracer::createGLTextures() {
-    glGenTextures(1, &texture_ID);
+void RayTracer::releaseImages() {
+    // finish the captures before the staging memory is released
+    for(CaptureSlot& slot : capture_slots) {
+        if(slot.reading) slot.event.wait();
+    }
+    pollCaptures();
+    frame_writer.flush();
     
-    glBindTexture(GL_TEXTURE_2D, texture_ID);
+    for(CaptureSlot& slot : capture_slots) {
+        if(slot.data) capture_queue.enqueueUnmapMemObject(slot.staging, slot.data);
+        slot.data = nullptr; // allocated again at the next capture
+    }
+    capture_queue.finish();
     
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(int i = 0; i < 3; i++) {
+        DisplaySlot& slot = display_slots.getBuffer(i);
+        if(slot.data && !persistent_pbo) queue.enqueueUnmapMemObject(slot.staging, slot.data);
+        slot.data = nullptr;
+        if(!gl_sharing) glDeleteBuffers(1, &slot.pbo); // also unmaps it
+        glDeleteTextures(1, &slot.texture_ID);
+    }
+    queue.finish();
+}
+
+void RayTracer::resize(int w, int h) {
+    if(w == width && h == height) return;
     
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    try {
+        releaseImages();
+        
+        width = w;
+        height = h;
+        
+        createGLTextures();
+        createGLBuffers();
+        setKernelArgs();
+    } catch(cl::Error e) {
+        processError(e);
+    }
     
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+    // the launch configurations are tuned for every resolution, the autotuner cache makes it cheap
+    tuned = false;
+    history_valid = false;
+    full_frame_time = 0.0f;
+}
+
+void RayTracer::createGLTextures() {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    persistent_pbo = !gl_sharing && GLEW_ARB_buffer_storage;
+    
+    for(int i = 0; i < 3; i++) {
+        cl_GLuint& texture_ID = display_slots.getBuffer(i).texture_ID;
+        glGenTextures(1, &texture_ID);
+        
+        glBindTexture(GL_TEXTURE_2D, texture_ID);
+        
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+        
+        if(!gl_sharing) {
+            DisplaySlot& slot = display_slots.getBuffer(i);
+            size_t size = 4 * sizeof(float) * width * height;
+            glGenBuffers(1, &slot.pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            
+            if(persistent_pbo) {
+                // coherent, so the frame read in by OpenCL needs no flush, the display is done with the slot since its last glFinish
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+                slot.data = (float*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+                if(!slot.data) {
+                    std::cerr << "ERROR: OpenGL: CANNOT MAP THE PIXEL BUFFER" << std::endl;
+                    exit(-1);
+                }
+            } else glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     
     glFinish();
 }
 
 void RayTracer::createGLBuffers() {
-    image = cl::ImageGL(context, CL_MEM_READ_WRITE, GL_TEXTURE_2D, 0, texture_ID);
+    queue = cl::CommandQueue(context, device);
+    
+    for(int i = 0; i < 3; i++) {
+        DisplaySlot& slot = display_slots.getBuffer(i);
+        if(gl_sharing) slot.image = cl::ImageGL(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, slot.texture_ID);
+        else if(!persistent_pbo) {
+            // pinned host memory, mapped for the lifetime of the slot
+            size_t size = 4 * sizeof(cl_float) * width * height;
+            slot.staging = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+            slot.data = (float*)queue.enqueueMapBuffer(slot.staging, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size);
+        }
+    }
+    image = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    sample_image = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    history_image = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    for(int i = 0; i < 2; i++) gbuffers[i] = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    
+    tile_count = ((width + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE) * ((height + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE);
+    bin_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, tile_count * (BIN_CAPACITY + 1) * sizeof(cl_uint));
+    
+    createHitCache();
+    
+    if(heatmap) {
+        cost_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, COST_CHANNELS * sizeof(cl_float) * width * height);
+        cost_max_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, COST_CHANNELS * sizeof(cl_uint));
+        queue.enqueueFillBuffer(cost_max_buffer, (cl_uint)0, 0, COST_CHANNELS * sizeof(cl_uint));
+    }
+}
+
+void RayTracer::createHitCache() {
+    // every jitter position has its own hits, the positions which do not fit are dropped and the samples cycle through the rest
+    size_t position_size = (size_t)width * height * PRIMARY_HIT_SIZE;
+    cl_ulong device_memory = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    cl_ulong budget = device_memory / HIT_CACHE_MEMORY_FRACTION;
+    jitter_count = jitter_positions;
+    while(jitter_count > 1 && jitter_count * position_size > budget) jitter_count /= 2;
+    
+    // generation 0 is never current, so the cleared cache holds no hits
+    size_t size = jitter_count * position_size;
+    hit_cache = cl::Buffer(context, CL_MEM_READ_WRITE, size);
+    queue.enqueueFillBuffer(hit_cache, (cl_uint)0, 0, size);
+    scene.setReservedMemory(size);
+    
+    std::cout << "HIT CACHE: " << jitter_count << (jitter_count < jitter_positions ? " OF " + std::to_string(jitter_positions) : "") << " JITTER POSITIONS, " << size / (1024.0 * 1024.0) << " MiB" << std::endl;
 }
 
 void RayTracer::createCLBuffers() {
     buff_size = 12 * sizeof(cl_float);
     camera_buffer = cl::Buffer(context, CL_MEM_READ_ONLY, buff_size);
+    prev_camera_buffer = cl::Buffer(context, CL_MEM_READ_ONLY, buff_size);
+    
+    capture_queue = cl::CommandQueue(context, device);
     
     // create the buffer of random vectors in an unit sphere
     
@@ -76,11 +233,12 @@ void RayTracer::createCLBuffers() {
     std::normal_distribution<float> ndis(0.0f, 1.0f);
     
     for(int i = 0; i < RANDOM_BUFFER_SIZE; i++) {
-        float x = ndis(rng), y = ndis(rng), z = ndis(rng), r = std::cbrt(dis(rng)), u = dis(rng);
-        float len_inv_r = r / std::sqrt(x * x + y * y + z * z);
-        x *= len_inv_r;
-        y *= len_inv_r;
-        z *= len_inv_r;
+        // uniform on the unit sphere, the diffuse bounces add it to the normal to sample the cosine-weighted hemisphere
+        float x = ndis(rng), y = ndis(rng), z = ndis(rng), u = dis(rng);
+        float len_inv = 1.0f / std::sqrt(x * x + y * y + z * z);
+        x *= len_inv;
+        y *= len_inv;
+        z *= len_inv;
         random_data[3 * i]     = x;
         random_data[3 * i + 1] = y;
         random_data[3 * i + 2] = z;
@@ -92,17 +250,22 @@ void RayTracer::createCLBuffers() {
     
     delete [] random_data;
     
-    scene.loadScene("assets/scenes/scene.scene");
+    scene.loadScene(scene_path);
+    caster.build(scene);
+    watchScene();
     
     scene.loadTextures(context, device);
     
-    scene.setupBuffers(context);
+    scene.setupBuffers(context, device);
 }
 
 void RayTracer::createKernels() {
     trace_kernel = cl::Kernel(program, TRACE_KERNEL_NAME);
     retrace_kernel = cl::Kernel(program, RETRACE_KERNEL_NAME);
-    scene.createKernel(program, SCENE_KERNEL_NAME);
+    resolve_kernel = cl::Kernel(program, RESOLVE_KERNEL_NAME);
+    reproject_kernel = cl::Kernel(program, REPROJECT_KERNEL_NAME);
+    if(heatmap) heatmap_kernel = cl::Kernel(program, HEATMAP_KERNEL_NAME);
+    binning_kernel = cl::Kernel(program, BINNING_KERNEL_NAME);
 }
 
 void RayTracer::setKernelArgs() {
@@ -117,30 +280,196 @@ void RayTracer::setKernelArgs() {
     retrace_kernel.setArg(3, random_buffer);
     retrace_kernel.setArg(4, scene.getBuffer());
     retrace_kernel.setArg(5, scene.getTextures());
-    scene.setKernelArgs();
+    trace_kernel.setArg(TRACE_ORDER_ARG, (cl_uint)trace_config.order);
+    retrace_kernel.setArg(RETRACE_ORDER_ARG, (cl_uint)retrace_config.order);
+    trace_kernel.setArg(TRACE_SCALE_ARG, (cl_uint)1);
+    trace_kernel.setArg(TRACE_SCALE_ARG + 1, (cl_uint)0);
+    trace_kernel.setArg(TRACE_SCALE_ARG + 2, (cl_uint)0);
+    trace_kernel.setArg(TRACE_SCALE_ARG + 3, (cl_uint)0);
+    trace_kernel.setArg(TRACE_SCALE_ARG + 4, bin_buffer);
+    retrace_kernel.setArg(RETRACE_ORDER_ARG + 1, bin_buffer);
+    retrace_kernel.setArg(RETRACE_CACHE_ARG, hit_cache);
+    retrace_kernel.setArg(RETRACE_CACHE_ARG + 1, hit_generation);
+    retrace_kernel.setArg(RETRACE_CACHE_ARG + 2, jitter_count);
+    resolve_kernel.setArg(0, sample_image);
+    resolve_kernel.setArg(1, image);
+    resolve_kernel.setArg(2, image);
+    reproject_kernel.setArg(0, history_image);
+    reproject_kernel.setArg(1, image);
+    reproject_kernel.setArg(4, camera_buffer);
+    reproject_kernel.setArg(5, prev_camera_buffer);
+    reproject_kernel.setArg(6, scene.getBuffer());
+    reproject_kernel.setArg(8, bin_buffer);
+    reproject_kernel.setArg(9, hit_cache);
+    reproject_kernel.setArg(10, hit_generation);
+    binning_kernel.setArg(0, bin_buffer);
+    binning_kernel.setArg(1, camera_buffer);
+    binning_kernel.setArg(2, scene.getBuffer());
+    binning_kernel.setArg(3, (cl_uint)width);
+    binning_kernel.setArg(4, (cl_uint)height);
+    
+    if(heatmap) {
+        trace_kernel.setArg(TRACE_COST_ARG, cost_buffer);
+        trace_kernel.setArg(TRACE_COST_ARG + 1, cost_max_buffer);
+        retrace_kernel.setArg(RETRACE_COST_ARG, cost_buffer);
+        retrace_kernel.setArg(RETRACE_COST_ARG + 1, cost_max_buffer);
+        heatmap_kernel.setArg(0, image);
+        heatmap_kernel.setArg(1, image);
+        heatmap_kernel.setArg(2, cost_buffer);
+        heatmap_kernel.setArg(3, cost_max_buffer);
+        heatmap_kernel.setArg(4, heatmap_channel);
+    }
 }
 
 /*void RayTracer::setTime(float time) {
     scene_kernel.setArg(5, time);
 }*/
 
-void RayTracer::render(const Camera* camera) {
-    sample_counter = 0;
+double RayTracer::timeKernel(cl::CommandQueue& queue, cl::Kernel& kernel, cl_uint order_arg, const LaunchConfig& config) {
+    kernel.setArg(order_arg, (cl_uint)config.order);
     
-    try {
-        std::vector<cl::Memory> mem_objs;
-        mem_objs.push_back(image);
+    std::vector<double> times;
+    for(int i = 0; i <= AUTOTUNE_RUNS; i++) { // the first run is a warm-up
+        cl::Event event;
+        queue.enqueueNDRangeKernel(kernel, cl::NullRange, config.getGlobal(width, height), config.getLocal(), nullptr, &event);
+        event.wait();
         
-        cl::CommandQueue queue(context, device);
-        queue.enqueueAcquireGLObjects(&mem_objs);
+        if(i) times.push_back((event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1e-9);
+    }
+    
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+void RayTracer::tuneKernels(const Camera* camera) {
+    // benchmark the launch configurations on the current view, the results are cached per device
+    try {
+        cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
         queue.enqueueWriteBuffer(camera_buffer, CL_TRUE, 0, buff_size, camera->transferData());
-        queue.enqueueNDRangeKernel(trace_kernel, cl::NullRange, cl::NDRange(size_t(width), size_t(height)), cl::NullRange);
-        queue.enqueueReleaseGLObjects(&mem_objs);
-        queue.enqueueBarrierWithWaitList();
+        binTiles(queue);
+        
+        trace_config = autotuner.tune(device, trace_kernel, TRACE_KERNEL_NAME, width, height, [&](const LaunchConfig& config) {
+            return timeKernel(queue, trace_kernel, TRACE_ORDER_ARG, config);
+        });
+        
+        retrace_kernel.setArg(6, (cl_uint)1);
+        retrace_config = autotuner.tune(device, retrace_kernel, RETRACE_KERNEL_NAME, width, height, [&](const LaunchConfig& config) {
+            return timeKernel(queue, retrace_kernel, RETRACE_ORDER_ARG, config);
+        });
+        
         queue.finish();
+        
+        trace_kernel.setArg(TRACE_ORDER_ARG, (cl_uint)trace_config.order);
+        retrace_kernel.setArg(RETRACE_ORDER_ARG, (cl_uint)retrace_config.order);
+    } catch(cl::Error e) {
+        processError(e);
+    }
+    
+    tuned = true;
+}
+
+void RayTracer::binTiles(cl::CommandQueue& queue) {
+    // the primary rays of a tile test only the primitives whose bounding spheres reach into its frustum
+    queue.enqueueNDRangeKernel(binning_kernel, cl::NullRange, cl::NDRange(tile_count), cl::NullRange);
+}
+
+void RayTracer::invalidateHits() {
+    if(++hit_generation == 0) hit_generation = 1;
+    reproject_kernel.setArg(10, hit_generation);
+    retrace_kernel.setArg(RETRACE_CACHE_ARG + 1, hit_generation);
+}
+
+void RayTracer::trace(const Camera* camera, ResolutionScale scale, bool keep_history) {
+    sample_counter++; // the seed keeps changing, the reprojected history is mixed with the new samples
+    frame_counter++;
+    
+    cl_uint scale_factor = scale == r_half ? 2 : (scale == r_quarter ? 4 : 1);
+    cl_uint checker = scale == r_checkerboard;
+    cl_uint parity = frame_counter & 1; // alternate the traced half of the checkerboard
+    
+    int grid_width = checker ? (width + 1) / 2 : (width + scale_factor - 1) / scale_factor;
+    int grid_height = checker ? height : (height + scale_factor - 1) / scale_factor;
+    
+    auto time_start = std::chrono::high_resolution_clock::now();
+    
+    try {
+        trace_kernel.setArg(0, sample_image);
+        trace_kernel.setArg(TRACE_SCALE_ARG, scale_factor);
+        trace_kernel.setArg(TRACE_SCALE_ARG + 1, checker);
+        trace_kernel.setArg(TRACE_SCALE_ARG + 2, parity);
+        trace_kernel.setArg(TRACE_SCALE_ARG + 3, sample_counter);
+        
+        reproject_kernel.setArg(2, gbuffers[gbuffer_index]);
+        reproject_kernel.setArg(3, gbuffers[1 - gbuffer_index]);
+        reproject_kernel.setArg(7, (cl_uint)(history_valid && keep_history && !heatmap)); // the costs are not reprojected
+        invalidateHits(); // a new view, reproject caches the unjittered hits again
+        gbuffer_index = 1 - gbuffer_index;
+        
+        cl::array<cl::size_type, 3> origin = {0, 0, 0};
+        cl::array<cl::size_type, 3> region = {(cl::size_type)width, (cl::size_type)height, 1};
+        
+        // the heatmap is scaled to the costs of the new view
+        if(heatmap) queue.enqueueFillBuffer(cost_max_buffer, (cl_uint)0, 0, COST_CHANNELS * sizeof(cl_uint));
+        
+        // move the accumulated samples of the previous view into the new one
+        queue.enqueueCopyBuffer(camera_buffer, prev_camera_buffer, 0, 0, buff_size);
+        queue.enqueueWriteBuffer(camera_buffer, CL_TRUE, 0, buff_size, camera->transferData());
+        binTiles(queue);
+        queue.enqueueCopyImage(image, history_image, origin, origin, region);
+        queue.enqueueNDRangeKernel(reproject_kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+        
+        if(scale == r_full) {
+            retrace_kernel.setArg(6, sample_counter);
+            queue.enqueueNDRangeKernel(retrace_kernel, cl::NullRange, retrace_config.getGlobal(width, height), retrace_config.getLocal());
+        } else {
+            queue.enqueueNDRangeKernel(trace_kernel, cl::NullRange, trace_config.getGlobal(grid_width, grid_height), trace_config.getLocal());
+            resolve_kernel.setArg(3, scale_factor);
+            resolve_kernel.setArg(4, checker);
+            resolve_kernel.setArg(5, parity);
+            queue.enqueueNDRangeKernel(resolve_kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+        }
+        if(heatmap) queue.enqueueNDRangeKernel(heatmap_kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+        present();
+        
+        scene.updateResidency(queue);
     } catch(cl::Error e) {
         processError(e);
     }
+    
+    auto time_end = std::chrono::high_resolution_clock::now();
+    
+    history_valid = true;
+    updateResolution(scale, std::chrono::duration<float>(time_end - time_start).count());
+}
+
+void RayTracer::updateResolution(ResolutionScale scale, float frame_time) {
+    const float traced_fraction[] = {1.0f, 0.5f, 0.25f, 0.0625f};
+    
+    if(heatmap) return; // the costs are kept for the traced pixels only, so every pixel is traced
+    
+    float estimate = frame_time / traced_fraction[scale];
+    full_frame_time = full_frame_time > 0.0f ? full_frame_time + FRAME_TIME_SMOOTHING * (estimate - full_frame_time) : estimate;
+    
+    // pick the highest resolution which fits in the target frame time
+    resolution = r_quarter;
+    for(int i = r_full; i < r_quarter; i++) {
+        if(full_frame_time * traced_fraction[i] <= target_frame_time) {
+            resolution = (ResolutionScale)i;
+            break;
+        }
+    }
+}
+
+void RayTracer::render(const Camera* camera) {
+    if(!tuned) tuneKernels(camera);
+    
+    trace(camera, resolution);
+}
+
+void RayTracer::restart(const Camera* camera) {
+    if(!tuned) tuneKernels(camera);
+    
+    trace(camera, r_full, false);
 }
 
 void RayTracer::renderAgain(const Camera* camera) {
@@ -149,26 +478,272 @@ void RayTracer::renderAgain(const Camera* camera) {
     try {
         retrace_kernel.setArg(6, sample_counter);
         
+        queue.enqueueWriteBuffer(camera_buffer, CL_TRUE, 0, buff_size, camera->transferData());
+        binTiles(queue); // the scene may have changed since the last frame
+        queue.enqueueNDRangeKernel(retrace_kernel, cl::NullRange, retrace_config.getGlobal(width, height), retrace_config.getLocal());
+        if(heatmap) queue.enqueueNDRangeKernel(heatmap_kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+        present();
+        
+        scene.updateResidency(queue);
+    } catch(cl::Error e) {
+        processError(e);
+    }
+}
+
+void RayTracer::present() {
+    // copy the finished frame into the back display slot, the display thread is done with it since its last glFinish
+    DisplaySlot& slot = display_slots.getBack();
+    
+    cl::array<cl::size_type, 3> origin = {0, 0, 0};
+    cl::array<cl::size_type, 3> region = {(cl::size_type)width, (cl::size_type)height, 1};
+    
+    queue.finish(); // only the transfer is timed
+    auto time_start = std::chrono::high_resolution_clock::now();
+    
+    if(gl_sharing) {
         std::vector<cl::Memory> mem_objs;
-        mem_objs.push_back(image);
+        mem_objs.push_back(slot.image);
         
-        cl::CommandQueue queue(context, device);
         queue.enqueueAcquireGLObjects(&mem_objs);
-        queue.enqueueWriteBuffer(camera_buffer, CL_TRUE, 0, buff_size, camera->transferData());
-        queue.enqueueNDRangeKernel(retrace_kernel, cl::NullRange, cl::NDRange(size_t(width), size_t(height)), cl::NullRange);
+        queue.enqueueCopyImage(image, slot.image, origin, origin, region);
         queue.enqueueReleaseGLObjects(&mem_objs);
         queue.enqueueBarrierWithWaitList();
         queue.finish();
-    } catch(cl::Error e) {
-        processError(e);
-    }
+    } else queue.enqueueReadImage(image, CL_TRUE, origin, region, 0, 0, slot.data);
+    
+    auto time_end = std::chrono::high_resolution_clock::now();
+    present_time += std::chrono::duration<double>(time_end - time_start).count();
+    present_count++;
+    
+    display_slots.publish();
 }
 
 void RayTracer::transferImage(Screen* screen, const char* shader_tex_id) {
+    // keeps drawing the previous frame until a new one is published
+    if(display_slots.update() && !gl_sharing) {
+        const DisplaySlot& slot = display_slots.getFront();
+        size_t size = 4 * sizeof(float) * width * height;
+        
+        auto time_start = std::chrono::high_resolution_clock::now();
+        
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+        if(persistent_pbo) {
+            // the frame is already in the pixel buffer, the only copy is the one into the texture
+            glBindTexture(GL_TEXTURE_2D, slot.texture_ID);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, 0);
+        } else {
+            // the orphaned pixel buffer is filled and the texture copies from it without stalling on the previous upload
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            void* pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if(pixels) {
+                std::memcpy(pixels, slot.data, size);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                
+                glBindTexture(GL_TEXTURE_2D, slot.texture_ID);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, 0);
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        
+        auto time_end = std::chrono::high_resolution_clock::now();
+        upload_time += std::chrono::duration<double>(time_end - time_start).count();
+        upload_count++;
+    }
+    
     screen->shader.use();
     
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture_ID);
+    glBindTexture(GL_TEXTURE_2D, display_slots.getFront().texture_ID);
     
     glUniform1i(glGetUniformLocation(screen->shader.ID, shader_tex_id), 0);
 }
+
+void RayTracer::setJitter(bool jitter) {
+    cl_uint count = jitter ? JITTER_POSITIONS : 1;
+    if(count == jitter_positions) return;
+    
+    jitter_positions = count;
+    try {
+        createHitCache();
+        setKernelArgs();
+    } catch(cl::Error e) {
+        processError(e);
+    }
+}
+
+void RayTracer::setTargetFrameTime(float frame_time) {
+    target_frame_time = frame_time;
+}
+
+bool RayTracer::capture(const std::string& path, int formats, bool wait, const std::function<void(bool)>& on_written) {
+    CaptureSlot* slot = nullptr;
+    while(true) {
+        for(CaptureSlot& s : capture_slots) {
+            if(!s.busy) {
+                slot = &s;
+                break;
+            }
+        }
+        if(slot || !wait) break;
+        
+        // the staging buffers bound the number of frames in flight
+        pollCaptures();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if(!slot) {
+        std::cerr << "ERROR: CAPTURE: ALL " << CAPTURE_SLOTS << " SLOTS ARE IN USE, SKIPPING " << path << std::endl;
+        return false;
+    }
+    
+    try {
+        size_t size = 4 * sizeof(cl_float) * width * height;
+        
+        if(!slot->data) {
+            slot->image = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+            slot->staging = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+            slot->data = (float*)capture_queue.enqueueMapBuffer(slot->staging, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size);
+        }
+        
+        cl::array<cl::size_type, 3> origin = {0, 0, 0};
+        cl::array<cl::size_type, 3> region = {(cl::size_type)width, (cl::size_type)height, 1};
+        
+        // only the device copy is waited for, the next frame may overwrite the image after it
+        cl::Event copy_event;
+        capture_queue.enqueueCopyImage(image, slot->image, origin, origin, region, nullptr, &copy_event);
+        capture_queue.enqueueReadImage(slot->image, CL_FALSE, origin, region, 0, 0, slot->data, nullptr, &slot->event);
+        capture_queue.flush();
+        copy_event.wait();
+    } catch(cl::Error e) {
+        processError(e);
+    }
+    
+    slot->busy = true;
+    slot->reading = true;
+    slot->on_written = on_written;
+    slot->job = {path, width, height, slot->data, formats, [slot]() {
+        if(slot->on_written) slot->on_written(true);
+        slot->busy = false;
+    }};
+    
+    return true;
+}
+
+void RayTracer::readImage(std::vector<float>& pixels) {
+    pixels.resize(4 * width * height);
+    
+    try {
+        cl::array<cl::size_type, 3> origin = {0, 0, 0};
+        cl::array<cl::size_type, 3> region = {(cl::size_type)width, (cl::size_type)height, 1};
+        
+        queue.enqueueReadImage(image, CL_TRUE, origin, region, 0, 0, &pixels[0]);
+    } catch(cl::Error e) {
+        processError(e);
+    }
+}
+
+void RayTracer::setHeatmapChannel(cl_uint channel) {
+    if(!heatmap) return;
+    
+    heatmap_channel = channel % COST_CHANNELS;
+    heatmap_kernel.setArg(4, heatmap_channel);
+    std::cout << "HEATMAP: " << cost_channel_names[heatmap_channel] << std::endl;
+}
+
+void RayTracer::captureCosts(const std::string& path) {
+    if(!heatmap) return;
+    
+    std::vector<float> costs(COST_CHANNELS * (size_t)width * height);
+    try {
+        queue.enqueueReadBuffer(cost_buffer, CL_TRUE, 0, costs.size() * sizeof(cl_float), &costs[0]);
+    } catch(cl::Error e) {
+        processError(e);
+    }
+    
+    for(cl_uint c = 0; c < COST_CHANNELS; c++) {
+        std::string channel_path = path + "_" + cost_channel_names[c] + ".pfm";
+        if(FrameWriter::writeGreyPFM(channel_path, width, height, &costs[c], COST_CHANNELS)) std::cout << "SUCCESS: CAPTURE: " << channel_path << std::endl;
+        else std::cerr << "ERROR: CAPTURE: COULD NOT WRITE " << channel_path << std::endl;
+    }
+}
+
+void RayTracer::readCosts(std::vector<double>& means) {
+    means.assign(COST_CHANNELS, 0.0);
+    if(!heatmap) return;
+    
+    std::vector<float> costs(COST_CHANNELS * (size_t)width * height);
+    try {
+        queue.enqueueReadBuffer(cost_buffer, CL_TRUE, 0, costs.size() * sizeof(cl_float), &costs[0]);
+    } catch(cl::Error e) {
+        processError(e);
+    }
+    
+    for(size_t i = 0; i < costs.size(); i++) means[i % COST_CHANNELS] += costs[i];
+    for(double& mean : means) mean /= (double)width * height;
+}
+
+void RayTracer::pollCaptures() {
+    // hand the frames which arrived in the host memory to the writer thread
+    for(CaptureSlot& slot : capture_slots) {
+        if(!slot.reading) continue;
+        
+        cl_int status = slot.event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+        if(status == CL_COMPLETE) {
+            slot.reading = false;
+            frame_writer.write(slot.job);
+        } else if(status < 0) {
+            // the read back failed, the frame is lost but the slot can be used again
+            std::cerr << "ERROR: CAPTURE: READING " << slot.job.path << " FAILED WITH " << oclErrorString(status) << std::endl;
+            slot.reading = false;
+            if(slot.on_written) slot.on_written(false);
+            slot.busy = false;
+        }
+    }
+}
+
+void RayTracer::watchScene() {
+    watcher.clear();
+    watcher.watch(scene_path);
+    for(const ModelRequest& request : scene.getModelRequests()) {
+        watcher.watch(request.path);
+        for(const std::string& lod_path : request.lod_paths) watcher.watch(lod_path);
+    }
+    if(!scene.getEnvironmentPath().empty()) watcher.watch(scene.getEnvironmentPath());
+    for(const std::string& path : scene.getTexturePaths()) watcher.watch(path);
+}
+
+bool RayTracer::updateScene() {
+    if(!watcher.poll()) return false;
+    
+    auto time_start = std::chrono::high_resolution_clock::now();
+    
+    bool rebind;
+    bool changed;
+    try {
+        changed = scene.reloadScene(scene_path, context, device, rebind);
+        if(rebind) setKernelArgs();
+    } catch(cl::Error e) {
+        processError(e);
+        return false;
+    } catch(SceneError& e) {
+        // a failed reload keeps the previous scene, this is thrown only when that one cannot be set up again either
+        std::cerr << e.what() << std::endl;
+        if(!fatal_errors) throw;
+        exit(-1);
+    }
+    
+    watchScene(); // the scene may load other models now
+    if(!changed) return false;
+    
+    caster.build(scene);
+    history_valid = false; // the accumulated samples show the old scene
+    invalidateHits();
+    
+    auto time_end = std::chrono::high_resolution_clock::now();
+    std::cout << "SUCCESS: SCENE RELOADED IN " << std::chrono::duration<double, std::milli>(time_end - time_start).count() << " ms" << std::endl;
+    
+    return true;
+}
+
+bool RayTracer::pick(const Camera* camera, float s, float t, HostHit& hit) const {
+    return caster.closestHit(HostRay(camera->getPos(), camera->getRayDir(s, t)), hit);
+}
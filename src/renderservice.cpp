@@ -0,0 +1,294 @@
+//
+//  renderservice.cpp
+//  Non Euclidean
+//
+//  Renders the jobs sent to a Unix socket, keeping the programs and the scenes loaded between them.
+//
+
+#include "renderservice.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define SERVICE_READ_SIZE 4096
+
+inline bool hashFile(const std::string& path, size_t& hash) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if(!file) return false;
+    
+    std::ostringstream content;
+    content << file.rdbuf();
+    hash = std::hash<std::string>()(content.str());
+    return true;
+}
+
+ServiceClient::~ServiceClient() {
+    close(fd);
+}
+
+void ServiceClient::send(const std::string& message) {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    
+    // the client may be gone already, then the messages are dropped
+    std::string data = message + "\n";
+    size_t sent = 0;
+    while(sent < data.size()) {
+        ssize_t length = ::send(fd, data.c_str() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(length <= 0) return;
+        sent += length;
+    }
+}
+
+RenderService::RenderService(const std::string& socket_path, bool compact_storage) : socket_path(socket_path), stopping(false), job_counter(0), compact_storage(compact_storage) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    
+    unlink(socket_path.c_str()); // left behind by a previous run
+    
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd < 0 || socket_path.size() >= sizeof(address.sun_path) || bind(listen_fd, (const sockaddr*)&address, sizeof(address)) < 0 || ::listen(listen_fd, SOMAXCONN) < 0) {
+        std::cerr << "ERROR: SERVICE: CANNOT LISTEN ON " << socket_path << ": " << std::strerror(errno) << std::endl;
+        exit(-1);
+    }
+    std::cout << "SUCCESS: SERVICE: LISTENING ON " << socket_path << std::endl;
+    
+    KernelGL::setFatalErrors(false); // a job which fails is reported to its client, the service keeps running
+    
+    listener = std::thread(&RenderService::acceptClients, this);
+}
+
+RenderService::~RenderService() {
+    stopping = true;
+    listener.join();
+    
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    
+    for(CachedScene& cached : cache) delete cached.ray_tracer;
+}
+
+void RenderService::acceptClients() {
+    std::vector<std::shared_ptr<ServiceClient>> clients;
+    std::vector<std::string> buffers; // the received part of the next line of every client
+    
+    while(!stopping) {
+        std::vector<pollfd> fds(clients.size() + 1);
+        fds[0] = {listen_fd, POLLIN, 0};
+        for(size_t i = 0; i < clients.size(); i++) fds[i + 1] = {clients[i]->fd, POLLIN, 0};
+        
+        if(poll(&fds[0], fds.size(), SERVICE_POLL_TIMEOUT) <= 0) continue;
+        
+        for(size_t i = clients.size(); i-- > 0;) {
+            if(!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            
+            char data[SERVICE_READ_SIZE];
+            ssize_t length = recv(clients[i]->fd, data, sizeof(data), 0);
+            if(length <= 0) {
+                // the queued jobs keep the socket open to report back
+                clients.erase(clients.begin() + i);
+                buffers.erase(buffers.begin() + i);
+                continue;
+            }
+            
+            buffers[i].append(data, length);
+            size_t end;
+            while((end = buffers[i].find('\n')) != std::string::npos) {
+                std::string line = buffers[i].substr(0, end);
+                buffers[i].erase(0, end + 1);
+                parseLine(line, clients[i]);
+            }
+        }
+        
+        if(fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if(fd >= 0) {
+                clients.push_back(std::make_shared<ServiceClient>(fd));
+                buffers.push_back("");
+            }
+        }
+    }
+}
+
+void RenderService::parseLine(const std::string& line, const std::shared_ptr<ServiceClient>& client) {
+    // RENDER key=value ..., STATUS or QUIT
+    std::istringstream stream(line);
+    std::string command;
+    if(!(stream >> command)) return;
+    
+    if(command == "QUIT") {
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            stopping = true;
+        }
+        jobs_condition.notify_all();
+        client->send("BYE");
+        return;
+    }
+    if(command == "STATUS") {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        client->send("QUEUE " + std::to_string(jobs.size()) + " JOBS");
+        return;
+    }
+    if(command != "RENDER") {
+        client->send("ERROR UNKNOWN COMMAND " + command);
+        return;
+    }
+    
+    ServiceJob job = {0, 0, DEFAULT_SCENE_PATH, "", SERVICE_DEFAULT_WIDTH, SERVICE_DEFAULT_HEIGHT, glm::vec3(0.0f), 0.0f, 0.0f, 60.0f, 0, 0.0f, compact_storage, client};
+    
+    std::string token;
+    while(stream >> token) {
+        size_t separator = token.find('=');
+        std::string key = token.substr(0, separator);
+        std::string text = separator == std::string::npos ? "" : token.substr(separator + 1);
+        if(key == "size" || key == "camera") std::replace(text.begin(), text.end(), ',', ' ');
+        
+        std::istringstream value(text);
+        bool valid;
+        if(key == "scene") valid = (bool)(value >> job.scene_path);
+        else if(key == "output") valid = (bool)(value >> job.output_path);
+        else if(key == "size") valid = (value >> job.width >> job.height) && job.width > 0 && job.height > 0;
+        else if(key == "camera") valid = (bool)(value >> job.position.x >> job.position.y >> job.position.z >> job.yaw >> job.pitch >> job.fov);
+        else if(key == "samples") valid = (bool)(value >> job.samples);
+        else if(key == "time") valid = (bool)(value >> job.time_budget);
+        else if(key == "priority") valid = (bool)(value >> job.priority);
+        else if(key == "compact") valid = (bool)(value >> job.compact);
+        else valid = false;
+        
+        if(!valid) {
+            client->send("ERROR INVALID " + token);
+            return;
+        }
+    }
+    if(job.output_path.empty()) {
+        client->send("ERROR NO OUTPUT PATH");
+        return;
+    }
+    if(job.samples == 0 && job.time_budget <= 0.0f) job.samples = SERVICE_DEFAULT_SAMPLES;
+    
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        job.ID = job_counter++;
+        jobs.push(job);
+    }
+    jobs_condition.notify_one();
+    
+    client->send("QUEUED " + std::to_string(job.ID));
+}
+
+void RenderService::run() {
+    while(true) {
+        ServiceJob job;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+            jobs_condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if(stopping) return;
+            
+            job = jobs.top();
+            jobs.pop();
+        }
+        
+        try {
+            execute(job);
+        } catch(SceneError& e) {
+            job.client->send("ERROR " + std::to_string(job.ID) + " " + e.what());
+        } catch(cl::Error& e) {
+            // the state of the device is unknown, the scenes are loaded again by the next jobs
+            for(CachedScene& cached : cache) delete cached.ray_tracer;
+            cache.clear();
+            job.client->send("ERROR " + std::to_string(job.ID) + " " + e.what() + ": " + oclErrorString(e.err()));
+        }
+    }
+}
+
+void RenderService::execute(const ServiceJob& job) {
+    std::string ID = std::to_string(job.ID);
+    auto time_start = std::chrono::high_resolution_clock::now();
+    
+    RayTracer* ray_tracer = getRayTracer(job);
+    if(!ray_tracer) {
+        job.client->send("ERROR " + ID + " CANNOT READ " + job.scene_path);
+        return;
+    }
+    ray_tracer->resize(job.width, job.height);
+    ray_tracer->updateScene(); // a cached scene picks up the models changed since it was loaded
+    
+    Camera camera(60, (float)job.width / (float)job.height);
+    camera.setView(job.position, job.yaw, job.pitch, job.fov);
+    
+    auto time_trace = std::chrono::high_resolution_clock::now();
+    double setup_time = std::chrono::duration<double>(time_trace - time_start).count();
+    
+    ray_tracer->restart(&camera);
+    cl_uint samples = 1;
+    double last_progress = 0.0;
+    
+    while(job.samples == 0 || samples < job.samples) {
+        double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - time_trace).count();
+        if(job.time_budget > 0.0f && elapsed >= job.time_budget) break;
+        if(elapsed - last_progress >= SERVICE_PROGRESS_INTERVAL) {
+            job.client->send("PROGRESS " + ID + " " + std::to_string(samples) + " SAMPLES " + std::to_string((int)(elapsed * 1e3)) + " ms");
+            last_progress = elapsed;
+        }
+        
+        ray_tracer->renderAgain(&camera);
+        samples++;
+    }
+    double trace_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - time_trace).count();
+    
+    // shared with the callback, which a failed job may leave to the destructor of the tracer
+    auto finished = std::make_shared<std::atomic<bool>>(false), written = std::make_shared<std::atomic<bool>>(false);
+    ray_tracer->capture(job.output_path, f_pfm | f_png, true, [finished, written](bool success) {
+        *written = success;
+        *finished = true;
+    });
+    while(!*finished) {
+        ray_tracer->pollCaptures();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    
+    if(!*written) job.client->send("ERROR " + ID + " CANNOT READ BACK THE IMAGE");
+    else if(!std::filesystem::exists(job.output_path + ".pfm")) job.client->send("ERROR " + ID + " CANNOT WRITE " + job.output_path);
+    else job.client->send("DONE " + ID + " " + std::to_string(samples) + " SAMPLES, SETUP " + std::to_string((int)(setup_time * 1e3)) + " ms, TRACE " + std::to_string((int)(trace_time * 1e3)) + " ms, " + job.output_path);
+}
+
+RayTracer* RenderService::getRayTracer(const ServiceJob& job) {
+    size_t hash;
+    if(!hashFile(job.scene_path, hash)) return nullptr;
+    
+    for(auto cached = cache.begin(); cached != cache.end(); cached++) {
+        if(cached->hash == hash && cached->compact == job.compact) {
+            cache.splice(cache.begin(), cache, cached);
+            return cached->ray_tracer;
+        }
+    }
+    
+    // the program binary is reused from the previous builds, the scene is imported and decoded again
+    std::cout << "SERVICE: LOADING " << job.scene_path << std::endl;
+    RayTracer* ray_tracer = new RayTracer(job.width, job.height, SERVICE_KERNEL_PATH, job.compact, job.scene_path); // throws before it is cached when the scene fails
+    cache.push_front({hash, job.compact, ray_tracer});
+    
+    if(cache.size() > SERVICE_CACHE_SIZE) {
+        delete cache.back().ray_tracer;
+        cache.pop_back();
+    }
+    
+    return ray_tracer;
+}
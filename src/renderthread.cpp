@@ -0,0 +1,98 @@
+//
+//  renderthread.cpp
+//  Non Euclidean
+//
+//  Traces the frames on its own thread, the window thread only sends the camera and draws the results.
+//
+
+#include "renderthread.h"
+
+#include <iostream>
+#include <chrono>
+
+RenderThread::RenderThread(RayTracer* ray_tracer, const Camera& camera) : ray_tracer(ray_tracer), stopping(false) {
+    pending.camera = camera;
+    for(int i = 0; i < 3; i++) requests.getBuffer(i) = pending;
+    
+    thread = std::thread(&RenderThread::work, this);
+}
+
+RenderThread::~RenderThread() {
+    stopping = true;
+    thread.join();
+}
+
+void RenderThread::submit(const Camera& camera, bool moved, bool run) {
+    pending.camera = camera;
+    pending.run = run;
+    if(moved) pending.motion_count++;
+    
+    requests.getBack() = pending;
+    requests.publish();
+}
+
+void RenderThread::requestScreenshot() {
+    pending.screenshot_count++;
+}
+
+void RenderThread::requestPick(float s, float t) {
+    pending.pick_count++;
+    pending.pick_s = s;
+    pending.pick_t = t;
+}
+
+void RenderThread::setHeatmapChannel(unsigned int channel) {
+    pending.heatmap_channel = channel;
+}
+
+void RenderThread::work() {
+    unsigned int motion_count = 0, screenshot_count = 0, pick_count = 0;
+    bool restart = true;
+    
+    while(!stopping) {
+        requests.update(); // the newest camera, the older ones are skipped
+        const RenderRequest& request = requests.getFront();
+        
+        if(ray_tracer->updateScene()) restart = true;
+        
+        if(request.screenshot_count != screenshot_count) {
+            screenshot_count = request.screenshot_count;
+            takeScreenshot();
+        }
+        if(request.pick_count != pick_count) {
+            pick_count = request.pick_count;
+            pick(request);
+        }
+        if(request.heatmap_channel != ray_tracer->getHeatmapChannel()) ray_tracer->setHeatmapChannel(request.heatmap_channel);
+        if(request.motion_count != motion_count) {
+            motion_count = request.motion_count;
+            restart = true;
+        }
+        
+        if(request.run) {
+            if(restart) ray_tracer->render(&request.camera);
+            else ray_tracer->renderAgain(&request.camera);
+            restart = false;
+        } else std::this_thread::sleep_for(std::chrono::milliseconds(RENDER_IDLE_SLEEP));
+        
+        ray_tracer->pollCaptures();
+    }
+}
+
+void RenderThread::takeScreenshot() {
+    static int photo_count = 0;
+    std::string name_count = "screenshot" + std::to_string(photo_count);
+    std::cout << "Taking screenshot: " << name_count << ".pfm, " << name_count << ".png" << std::endl;
+    
+    // the linear image is written on a background thread, the rendering does not stop
+    if(ray_tracer->capture("screenshots/" + name_count, f_pfm | f_png)) photo_count++;
+    ray_tracer->captureCosts("screenshots/" + name_count + "_cost"); // the raw counters of the --heatmap build
+}
+
+void RenderThread::pick(const RenderRequest& request) {
+    HostHit hit;
+    if(ray_tracer->pick(&request.camera, request.pick_s, request.pick_t, hit)) {
+        const char* type_names[] = {"none", "sphere", "plane", "lens", "model", "box", "cylinder", "disc", "quadric"};
+        std::cout << "PICK: " << type_names[hit.type] << " " << hit.object_ID << ", MATERIAL: " << hit.mat_ID << ", DISTANCE: " << hit.t << std::endl;
+    } else std::cout << "PICK: nothing" << std::endl;
+}
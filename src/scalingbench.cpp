@@ -0,0 +1,150 @@
+//
+//  scalingbench.cpp
+//  Non Euclidean
+//
+//  Sweeps the size of a generated scene and plots the time per frame against the primitive count.
+//
+
+#include "scalingbench.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+
+#define PLOT_WIDTH 640
+#define PLOT_HEIGHT 400
+#define PLOT_MARGIN 60
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+inline double getSeconds(const BenchClock::time_point& start, const BenchClock::time_point& end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+ScalingBench::ScalingBench(const StressParams& params, unsigned int max_count, const std::string& output_dir) : params(params), output_dir(output_dir) {
+    for(unsigned int count = SCALING_FIRST_COUNT; count < max_count; count *= 4) counts.push_back(count);
+    counts.push_back(max_count);
+}
+
+std::string ScalingBench::getName() const {
+    return std::string(SceneGenerator::getLayoutName(params.layout)) + "_" + SceneGenerator::getMixName(params.materials);
+}
+
+bool ScalingBench::measure(const char* kernel_path, bool compact_storage, unsigned int count, ScalingSample& sample) {
+    StressParams scene_params = params;
+    scene_params.count = count;
+    
+    std::string scene_path = output_dir + "/scenes/" + getName() + "_" + std::to_string(count) + ".scene";
+    SceneGenerator generator;
+    sample.count = count;
+    sample.primitives = generator.generate(scene_params, scene_path);
+    if(sample.primitives == 0) return false;
+    
+    auto load_start = BenchClock::now();
+    RayTracer ray_tracer(width, height, kernel_path, compact_storage, scene_path);
+    sample.load_time = getSeconds(load_start, BenchClock::now());
+    sample.memory = ray_tracer.getSceneMemory();
+    
+    // the whole field is in view at every count
+    Camera camera(50, (float)width / (float)height);
+    camera.setView(glm::vec3(0.0f, 0.0f, -1.5f * STRESS_FIELD_SIZE), 0.0f, 0.0f, 50.0f);
+    
+    std::vector<float> image;
+    ray_tracer.restart(&camera);
+    ray_tracer.readImage(image);
+    
+    // the read back waits for the queued frames, it is paid once for all of them
+    auto frame_start = BenchClock::now();
+    for(int i = 0; i < SCALING_FRAMES; i++) ray_tracer.restart(&camera);
+    ray_tracer.readImage(image);
+    sample.frame_time = getSeconds(frame_start, BenchClock::now()) * 1e3 / SCALING_FRAMES;
+    
+    auto sample_start = BenchClock::now();
+    for(int i = 0; i < SCALING_FRAMES; i++) ray_tracer.renderAgain(&camera);
+    ray_tracer.readImage(image);
+    sample.sample_time = getSeconds(sample_start, BenchClock::now()) * 1e3 / SCALING_FRAMES;
+    
+    return true;
+}
+
+void ScalingBench::writeCurve(const std::string& path, const std::vector<ScalingSample>& curve) const {
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    file << "count,primitives,load_s,frame_ms,sample_ms,memory_bytes" << std::endl;
+    file << std::setprecision(8);
+    for(const ScalingSample& sample : curve) file << sample.count << "," << sample.primitives << "," << sample.load_time << "," << sample.frame_time << "," << sample.sample_time << "," << sample.memory << std::endl;
+}
+
+void ScalingBench::writePlot(const std::string& path, const std::vector<ScalingSample>& curve) const {
+    // whole decades on both axes
+    double x_min = HUGE_VAL, x_max = -HUGE_VAL, y_min = HUGE_VAL, y_max = -HUGE_VAL;
+    for(const ScalingSample& sample : curve) {
+        x_min = std::min(x_min, std::log10((double)sample.primitives));
+        x_max = std::max(x_max, std::log10((double)sample.primitives));
+        y_min = std::min(y_min, std::log10(std::min(sample.frame_time, sample.sample_time)));
+        y_max = std::max(y_max, std::log10(std::max(sample.frame_time, sample.sample_time)));
+    }
+    x_min = std::floor(x_min);
+    x_max = std::max(std::ceil(x_max), x_min + 1.0);
+    y_min = std::floor(y_min);
+    y_max = std::max(std::ceil(y_max), y_min + 1.0);
+    
+    auto getX = [&](double primitives) { return PLOT_MARGIN + (std::log10(primitives) - x_min) / (x_max - x_min) * (PLOT_WIDTH - 2 * PLOT_MARGIN); };
+    auto getY = [&](double time) { return PLOT_HEIGHT - PLOT_MARGIN - (std::log10(time) - y_min) / (y_max - y_min) * (PLOT_HEIGHT - 2 * PLOT_MARGIN); };
+    
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    file << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << PLOT_WIDTH << "\" height=\"" << PLOT_HEIGHT << "\" font-family=\"sans-serif\" font-size=\"12\">" << std::endl;
+    file << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>" << std::endl;
+    file << "<text x=\"" << PLOT_WIDTH / 2 << "\" y=\"24\" text-anchor=\"middle\">" << getName() << "</text>" << std::endl;
+    
+    for(int k = (int)x_min; k <= (int)x_max; k++) {
+        double x = getX(std::pow(10.0, k));
+        file << "<line x1=\"" << x << "\" y1=\"" << PLOT_MARGIN << "\" x2=\"" << x << "\" y2=\"" << PLOT_HEIGHT - PLOT_MARGIN << "\" stroke=\"#ddd\"/>" << std::endl;
+        file << "<text x=\"" << x << "\" y=\"" << PLOT_HEIGHT - PLOT_MARGIN + 16 << "\" text-anchor=\"middle\">" << std::pow(10.0, k) << "</text>" << std::endl;
+    }
+    for(int k = (int)y_min; k <= (int)y_max; k++) {
+        double y = getY(std::pow(10.0, k));
+        file << "<line x1=\"" << PLOT_MARGIN << "\" y1=\"" << y << "\" x2=\"" << PLOT_WIDTH - PLOT_MARGIN << "\" y2=\"" << y << "\" stroke=\"#ddd\"/>" << std::endl;
+        file << "<text x=\"" << PLOT_MARGIN - 6 << "\" y=\"" << y + 4 << "\" text-anchor=\"end\">" << std::pow(10.0, k) << "</text>" << std::endl;
+    }
+    file << "<text x=\"" << PLOT_WIDTH / 2 << "\" y=\"" << PLOT_HEIGHT - 16 << "\" text-anchor=\"middle\">primitives</text>" << std::endl;
+    file << "<text x=\"16\" y=\"" << PLOT_HEIGHT / 2 << "\" text-anchor=\"middle\" transform=\"rotate(-90 16 " << PLOT_HEIGHT / 2 << ")\">ms</text>" << std::endl;
+    
+    const char* names[] = {"frame", "sample"};
+    const char* colors[] = {"#d62728", "#1f77b4"};
+    for(int series = 0; series < 2; series++) {
+        file << "<polyline fill=\"none\" stroke=\"" << colors[series] << "\" stroke-width=\"2\" points=\"";
+        for(const ScalingSample& sample : curve) file << getX((double)sample.primitives) << "," << getY(series == 0 ? sample.frame_time : sample.sample_time) << " ";
+        file << "\"/>" << std::endl;
+        file << "<text x=\"" << PLOT_WIDTH - PLOT_MARGIN << "\" y=\"" << PLOT_MARGIN - 8 - 14 * series << "\" text-anchor=\"end\" fill=\"" << colors[series] << "\">" << names[series] << "</text>" << std::endl;
+    }
+    
+    file << "</svg>" << std::endl;
+}
+
+bool ScalingBench::run(const char* kernel_path, bool compact_storage) {
+    std::filesystem::create_directories(output_dir + "/scenes");
+    
+    std::vector<ScalingSample> curve;
+    for(unsigned int count : counts) {
+        ScalingSample sample;
+        if(!measure(kernel_path, compact_storage, count, sample)) return false;
+        curve.push_back(sample);
+        
+        std::cout << "SCALING BENCHMARK: " << count << " OBJECTS, " << sample.primitives << " PRIMITIVES: " << sample.frame_time << " ms PER FRAME, " << sample.sample_time << " ms PER SAMPLE, LOADED IN " << sample.load_time << " s, " << sample.memory / (1024.0 * 1024.0) << " MiB" << std::endl;
+    }
+    
+    writeCurve(output_dir + "/" + getName() + ".csv", curve);
+    writePlot(output_dir + "/" + getName() + ".svg", curve);
+    
+    // the slope of the time on the log-log scale, 1 is linear in the primitive count
+    const ScalingSample& first = curve.front();
+    const ScalingSample& last = curve.back();
+    if(curve.size() > 1) std::cout << "SCALING BENCHMARK: FRAME TIME GROWS AS PRIMITIVES^" << std::log(last.frame_time / first.frame_time) / std::log((double)last.primitives / first.primitives) << std::endl;
+    std::cout << "SUCCESS: SCALING BENCHMARK: WRITTEN " << output_dir << "/" << getName() << ".csv AND .svg" << std::endl;
+    
+    return true;
+}
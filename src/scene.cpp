@@ -10,7 +10,16 @@
 #include <fstream>
 #include <sstream>
 #include <cmath>
+#include <cstring>
 #include <regex>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <array>
+#include <queue>
 
 // include the STB library to read texture files
 #define STB_IMAGE_IMPLEMENTATION
@@ -20,106 +29,422 @@
 
 #define SIZE_EMPTY 1
 
+#define GEOMETRY_MEMORY_FRACTION 4 // part of the device memory used by the chunk pool
+#define CHUNK_UPLOADS_PER_FRAME 64
+
+#define TEXTURE_MEMORY_FRACTION 4 // part of the device memory used by the tile pool
+#define TILE_UPLOADS_PER_FRAME 64
+#define DECODED_TEXTURE_BUDGET ((size_t)256 << 20) // bytes of the mip chains kept on the host
+#define TILE_STORED_SIZE (TEXTURE_TILE_SIZE + 2 * TEXTURE_TILE_BORDER)
+
+#define HALF_MAX_EXPONENT 15
+
+#define MORTON_BITS 10 // per axis
+
+#define LOD_REDUCTION 0.25 // of the faces kept by every simplified level
+#define LOD_MIN_FACES 512 // models with fewer faces are not simplified further
+#define LOD_MIN_GAIN 0.75 // a level which keeps more of the faces is dropped
+#define LOD_BOUNDARY_WEIGHT 100.0 // keeps the open edges in place
+#define LOD_FLIP_COSINE 0.2 // collapses which turn a face further are rejected
+
 
 std::string getPath(std::sregex_token_iterator& iter, const std::sregex_token_iterator& end);
 template <typename T> T getVec(std::sregex_token_iterator& iter, const std::sregex_token_iterator& end);
 cl_float getFloat(std::sregex_token_iterator& iter, const std::sregex_token_iterator& end);
 cl_uint getUInt(std::sregex_token_iterator& iter, const std::sregex_token_iterator& end);
 
+void generateLODs(ModelStaging& staging, cl_uint level_count);
+
 void processError(const std::string& err) {
-    std::cerr << err << std::endl;
-    exit(-1);
+    throw SceneError(err); // fatal while loading, a failed reload keeps the current scene
 }
 
-struct ObjectCounter {
-    cl_uint sphere_count;
-    cl_uint plane_count;
-    cl_uint lens_count;
-    cl_uint model_count;
-};
+inline std::filesystem::file_time_type getWriteTime(const std::string& path) {
+    std::error_code error;
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+    return error ? std::filesystem::file_time_type::min() : time;
+}
 
-inline void setupBuffer(cl::Context& context, cl::Buffer& buffer, size_t size) {
-    if(size) buffer = cl::Buffer(context, CL_MEM_READ_ONLY, size);
-    else buffer = cl::Buffer(context, CL_MEM_READ_ONLY, SIZE_EMPTY);
+inline std::vector<std::filesystem::file_time_type> getWriteTimes(const ModelRequest& request) {
+    std::vector<std::filesystem::file_time_type> times = {getWriteTime(request.path)};
+    for(const std::string& lod_path : request.lod_paths) times.push_back(getWriteTime(lod_path));
+    return times;
 }
 
-void SceneCreator::setupBuffers(cl::Context& context) {
-    scene_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_mem));
+bool SceneCreator::mesh_reorder = true;
+
+SceneCreator::SceneCreator() : arena({"HEADER", "MATERIALS", "SPHERES", "PLANES", "LENSES", "BOXES", "CYLINDERS", "DISCS", "QUADRICS", "MODELS", "MESHES", "CHUNKS", "PAGE TABLE", "CHUNK VERTICES", "CHUNK UVS", "CHUNK INDICES", "FEEDBACK", "TEXTURES", "TEXTURE LEVELS", "TILE TABLE", "TILE FEEDBACK", "ENVIRONMENT", "ENVIRONMENT CDF"}) {}
+
+bool SceneCreator::setupBuffers(cl::Context& context, cl::Device& device) {
+    buildChunks();
+    arena.init(context, device);
+    
+    std::vector<size_t> sizes(SCENE_BLOCK_COUNT, 0);
+    sizes[b_header] = sizeof(SceneHeader);
+    sizes[b_materials] = getMaterialSize();
+    sizes[b_spheres] = getSphereSize();
+    sizes[b_planes] = getPlaneSize();
+    sizes[b_lenses] = getLensSize();
+    sizes[b_boxes] = getBoxSize();
+    sizes[b_cylinders] = getCylinderSize();
+    sizes[b_discs] = getDiscSize();
+    sizes[b_quadrics] = getQuadricSize();
+    sizes[b_models] = getModelSize();
+    sizes[b_meshes] = getMeshSize();
+    sizes[b_chunks] = getChunkSize();
+    sizes[b_page_table] = getPageTableSize();
+    sizes[b_feedback] = feedback.size();
+    sizes[b_textures] = getTextureInfoSize();
+    sizes[b_texture_levels] = getTextureLevelSize();
+    sizes[b_tile_table] = getTileTableSize();
+    sizes[b_tile_feedback] = tile_feedback.size();
+    sizes[b_environment] = getEnvironmentSize();
+    sizes[b_environment_cdf] = getEnvironmentCDFSize();
+    
+    size_t fixed_size = 0;
+    for(size_t size : sizes) fixed_size += arena.align(size + size / ARENA_HEADROOM_FRACTION);
     
-    setupBuffer(context, material_buffer, getMaterialSize());
+    // size the chunk pool to what the device can hold next to the rest of the scene, the rest of the chunks is streamed on demand
+    size_t slot_size = CHUNK_VERTEX_COUNT * (getVertexStride() + getUVStride()) + 3 * CHUNK_FACE_COUNT * sizeof(cl_uchar);
+    cl_ulong arena_space = arena.getMaxSize() > fixed_size ? arena.getMaxSize() - fixed_size : 0;
+    cl_ulong device_space = arena.getDeviceMemory() > reserved_memory ? arena.getDeviceMemory() - reserved_memory : 0;
+    cl_ulong budget = std::min(arena_space - arena_space / (ARENA_HEADROOM_FRACTION + 1), device_space / GEOMETRY_MEMORY_FRACTION);
+    slot_count = (cl_uint)std::min((cl_ulong)chunks.size(), budget / slot_size);
+    streaming = slot_count < chunks.size();
     
-    setupBuffer(context, sphere_buffer, getSphereSize());
-    setupBuffer(context, plane_buffer, getPlaneSize());
-    setupBuffer(context, lens_buffer, getLensSize());
-    setupBuffer(context, model_buffer, getModelSize());
+    if(chunks.size() > 0 && slot_count == 0)
+        processError("ERROR: GEOMETRY: NOT ENOUGH DEVICE MEMORY FOR A SINGLE CHUNK");
+    if(streaming)
+        std::cout << "SUCCESS: GEOMETRY: STREAMING " << chunks.size() << " CHUNKS THROUGH " << slot_count << " SLOTS" << std::endl;
     
-    setupBuffer(context, vertex_buffer, getVertexSize());
-    setupBuffer(context, texture_uv_buffer, getTexUVSize());
-    setupBuffer(context, index_buffer, getIndexSize());
-    setupBuffer(context, mesh_buffer, getMeshSize());
+    sizes[b_chunk_vertices] = slot_count * CHUNK_VERTEX_COUNT * getVertexStride();
+    sizes[b_chunk_uvs] = slot_count * CHUNK_VERTEX_COUNT * getUVStride();
+    sizes[b_chunk_indices] = slot_count * 3 * CHUNK_FACE_COUNT * sizeof(cl_uchar);
+    if(!streaming) sizes[b_feedback] = 0; // the kernel only writes it while streaming
+    
+    bool created = arena.layout(sizes);
+    arena.report();
+    
+    return created;
 }
 
-void SceneCreator::createKernel(cl::Program& program, const char* name) {
-    scene_kernel = cl::Kernel(program, name);
+void SceneCreator::buildChunks() {
+    // split every mesh into chunks of up to CHUNK_FACE_COUNT faces and CHUNK_VERTEX_COUNT vertices and compute their bounds
+    if(feedback_pending) feedback_event.wait(); // the read back still writes into the old feedback
+    feedback_pending = false;
+    
+    chunks.clear();
+    chunk_sources.clear();
+    chunk_vertex_IDs.clear();
+    local_indices.assign(indices.size(), 0);
+    
+    // the local index of a vertex, valid while its chunk is the one in the stamp
+    std::vector<cl_uint> local_ID(vertices.size());
+    std::vector<cl_uint> stamp(vertices.size(), CHUNK_NOT_RESIDENT);
+    
+    for(cl_uint mesh_ID = 0; mesh_ID < meshes.size(); mesh_ID++) {
+        Mesh& mesh = meshes[mesh_ID];
+        mesh.chunk_anchor = (cl_uint)chunks.size();
+        
+        for(cl_uint first_face = 0; first_face < mesh.face_count;) {
+            cl_uint chunk_ID = (cl_uint)chunks.size();
+            ChunkSource source = {mesh_ID, first_face, (cl_uint)chunk_vertex_IDs.size(), 0};
+            Chunk chunk;
+            chunk.face_count = 0;
+            chunk.bounds_min = vertices[mesh.vertex_anchor + indices[mesh.index_anchor + 3 * first_face]];
+            chunk.bounds_max = chunk.bounds_min;
+            
+            for(cl_uint face = first_face; face < mesh.face_count && chunk.face_count < CHUNK_FACE_COUNT; face++) {
+                cl_uint new_vertices = 0;
+                for(cl_uint i = 3 * face; i < 3 * face + 3; i++) {
+                    cl_uint vertex_ID = mesh.vertex_anchor + indices[mesh.index_anchor + i];
+                    if(stamp[vertex_ID] != chunk_ID) new_vertices++;
+                }
+                if(source.vertex_count + new_vertices > CHUNK_VERTEX_COUNT) break;
+                
+                for(cl_uint i = 3 * face; i < 3 * face + 3; i++) {
+                    cl_uint vertex_ID = mesh.vertex_anchor + indices[mesh.index_anchor + i];
+                    if(stamp[vertex_ID] != chunk_ID) {
+                        stamp[vertex_ID] = chunk_ID;
+                        local_ID[vertex_ID] = source.vertex_count++;
+                        chunk_vertex_IDs.push_back(vertex_ID);
+                        
+                        const cl_float3& vertex = vertices[vertex_ID];
+                        for(int axis = 0; axis < 3; axis++) {
+                            chunk.bounds_min.s[axis] = std::min(chunk.bounds_min.s[axis], vertex.s[axis]);
+                            chunk.bounds_max.s[axis] = std::max(chunk.bounds_max.s[axis], vertex.s[axis]);
+                        }
+                    }
+                    local_indices[mesh.index_anchor + i] = (cl_uchar)local_ID[vertex_ID];
+                }
+                chunk.face_count++;
+            }
+            
+            chunks.push_back(chunk);
+            chunk_sources.push_back(source);
+            first_face += chunk.face_count;
+        }
+        
+        mesh.chunk_count = (cl_uint)chunks.size() - mesh.chunk_anchor;
+        
+        // the quantization grid spans the whole mesh, so the vertices shared by two chunks stay in the same place
+        if(mesh.chunk_count == 0) continue;
+        cl_float3 bounds_max = chunks[mesh.chunk_anchor].bounds_max;
+        mesh.quant_min = chunks[mesh.chunk_anchor].bounds_min;
+        for(cl_uint chunk_ID = mesh.chunk_anchor + 1; chunk_ID < chunks.size(); chunk_ID++) {
+            for(int axis = 0; axis < 3; axis++) {
+                mesh.quant_min.s[axis] = std::min(mesh.quant_min.s[axis], chunks[chunk_ID].bounds_min.s[axis]);
+                bounds_max.s[axis] = std::max(bounds_max.s[axis], chunks[chunk_ID].bounds_max.s[axis]);
+            }
+        }
+        for(int axis = 0; axis < 3; axis++) mesh.quant_scale.s[axis] = (bounds_max.s[axis] - mesh.quant_min.s[axis]) / QUANTIZATION_STEPS;
+    }
+    
+    page_table.assign(chunks.size(), CHUNK_NOT_RESIDENT);
+    feedback.assign(chunks.size(), 0);
+    lru.clear();
+    lru_pos.assign(chunks.size(), lru.end());
+}
+
+void SceneCreator::fillChunk(cl_uint chunk_ID, cl_float3* vertex_dst, cl_float2* uv_dst) const {
+    // the slots are indexed, the faces of the chunk refer to its vertices with the local indices
+    const ChunkSource& source = chunk_sources[chunk_ID];
+    
+    for(cl_uint i = 0; i < source.vertex_count; i++) {
+        cl_uint vertex_ID = chunk_vertex_IDs[source.vertex_anchor + i];
+        vertex_dst[i] = vertices[vertex_ID];
+        uv_dst[i] = texture_uv[vertex_ID];
+    }
+}
+
+cl_half toHalf(float value) {
+    // round to the nearest even, the values out of range become infinite
+    cl_uint bits;
+    std::memcpy(&bits, &value, sizeof(float));
+    
+    cl_uint sign = (bits >> 16) & 0x8000;
+    cl_uint mantissa = bits & 0x7fffff;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + HALF_MAX_EXPONENT;
+    
+    if(((bits >> 23) & 0xff) == 0xff) return (cl_half)(sign | 0x7c00 | (mantissa ? 0x200 : 0)); // infinity or NaN
+    if(exponent >= 0x1f) return (cl_half)(sign | 0x7c00);
+    if(exponent <= 0) {
+        if(exponent < -10) return (cl_half)sign; // too small even for a subnormal
+        mantissa |= 0x800000;
+        cl_uint shift = 14 - exponent;
+        cl_uint half_mantissa = mantissa >> shift;
+        cl_uint rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (half_mantissa & 1))) half_mantissa++;
+        return (cl_half)(sign | half_mantissa);
+    }
+    
+    cl_uint half = sign | ((cl_uint)exponent << 10) | (mantissa >> 13);
+    cl_uint rest = mantissa & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++; // may carry into the exponent, which is still correct
+    return (cl_half)half;
+}
+
+void SceneCreator::compressChunk(cl_uint chunk_ID, size_t offset) {
+    const Mesh& mesh = meshes[chunk_sources[chunk_ID].mesh_ID];
+    
+    for(size_t i = offset; i < offset + chunk_sources[chunk_ID].vertex_count; i++) {
+        for(int axis = 0; axis < 3; axis++) {
+            float step = mesh.quant_scale.s[axis];
+            float q = step > 0.0f ? std::round((staging_vertices[i].s[axis] - mesh.quant_min.s[axis]) / step) : 0.0f;
+            compact_vertices[i].s[axis] = (cl_ushort)std::min(std::max(q, 0.0f), (float)QUANTIZATION_STEPS);
+        }
+        compact_vertices[i].s[3] = 0;
+        
+        compact_uvs[2 * i] = toHalf(staging_uvs[i].s[0]);
+        compact_uvs[2 * i + 1] = toHalf(staging_uvs[i].s[1]);
+    }
 }
 
-inline void writeBuffer(cl::CommandQueue& queue, cl::Buffer& buffer, size_t size, void* data_ptr) {
-    if(size) queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, size, data_ptr);
-    //else queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, size, data_ptr);
+void SceneCreator::uploadChunks(cl::CommandQueue& queue, const std::vector<cl_uint>& chunk_IDs) {
+    staging_vertices.resize(chunk_IDs.size() * CHUNK_VERTEX_COUNT);
+    staging_uvs.resize(chunk_IDs.size() * CHUNK_VERTEX_COUNT);
+    if(compact_storage) {
+        compact_vertices.resize(chunk_IDs.size() * CHUNK_VERTEX_COUNT);
+        compact_uvs.resize(chunk_IDs.size() * CHUNK_VERTEX_COUNT * 2);
+    }
+    
+    for(size_t i = 0; i < chunk_IDs.size(); i++) {
+        const ChunkSource& source = chunk_sources[chunk_IDs[i]];
+        const Mesh& mesh = meshes[source.mesh_ID];
+        size_t offset = i * CHUNK_VERTEX_COUNT;
+        size_t slot = page_table[chunk_IDs[i]];
+        fillChunk(chunk_IDs[i], &staging_vertices[offset], &staging_uvs[offset]);
+        
+        const void* vertex_data = &staging_vertices[offset];
+        const void* uv_data = &staging_uvs[offset];
+        if(compact_storage) {
+            compressChunk(chunk_IDs[i], offset);
+            vertex_data = &compact_vertices[offset];
+            uv_data = &compact_uvs[2 * offset];
+        }
+        
+        // only the used part of the slot, the kernel stops at the face count of the chunk
+        arena.write(queue, b_chunk_vertices, slot * CHUNK_VERTEX_COUNT * getVertexStride(), source.vertex_count * getVertexStride(), vertex_data, false);
+        arena.write(queue, b_chunk_uvs, slot * CHUNK_VERTEX_COUNT * getUVStride(), source.vertex_count * getUVStride(), uv_data, false);
+        arena.write(queue, b_chunk_indices, slot * 3 * CHUNK_FACE_COUNT, 3 * chunks[chunk_IDs[i]].face_count, &local_indices[mesh.index_anchor + 3 * source.first_face], false);
+    }
+    
+    arena.write(queue, b_page_table, 0, getPageTableSize(), getPageTable(), false);
+    queue.finish(); // the staging memory is reused on the next upload
+}
+
+bool SceneCreator::updateResidency(cl::CommandQueue& queue) {
+    bool chunks_uploaded = streaming && updateChunks(queue);
+    bool tiles_uploaded = updateTiles(queue);
+    return chunks_uploaded || tiles_uploaded;
+}
+
+bool SceneCreator::updateChunks(cl::CommandQueue& queue) {
+    // the feedback is read back while the next frame renders, so the chunks arrive a frame later but the queue never stalls
+    std::vector<cl_uint> uploads;
+    if(feedback_pending) {
+        cl_int status = feedback_event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+        if(status > CL_COMPLETE) return false; // still in flight, the kernels keep marking the same buffer
+        feedback_pending = false;
+        if(status == CL_COMPLETE) selectChunks(uploads);
+    }
+    
+    if(uploads.size() > 0) uploadChunks(queue, uploads);
+    
+    queue.enqueueReadBuffer(arena.getBuffer(), CL_FALSE, arena.getOffset(b_feedback), feedback.size(), &feedback[0], nullptr, &feedback_event);
+    queue.enqueueFillBuffer(arena.getBuffer(), (cl_uchar)0, arena.getOffset(b_feedback), feedback.size());
+    queue.flush();
+    feedback_pending = true;
+    
+    return uploads.size() > 0;
+}
+
+void SceneCreator::selectChunks(std::vector<cl_uint>& uploads) {
+    // the missing chunks replace the least recently used ones
+    std::vector<cl_uint> missing;
+    for(cl_uint chunk_ID = 0; chunk_ID < chunks.size(); chunk_ID++) {
+        if(feedback[chunk_ID] == CHUNK_USED && page_table[chunk_ID] != CHUNK_NOT_RESIDENT)
+            lru.splice(lru.begin(), lru, lru_pos[chunk_ID]);
+        else if(feedback[chunk_ID] == CHUNK_MISSING && page_table[chunk_ID] == CHUNK_NOT_RESIDENT && missing.size() < CHUNK_UPLOADS_PER_FRAME)
+            missing.push_back(chunk_ID);
+    }
+    
+    for(cl_uint chunk_ID : missing) {
+        cl_uint victim = lru.back();
+        if(feedback[victim] == CHUNK_USED) break; // every resident chunk is needed by the current frame
+        
+        lru.pop_back();
+        page_table[chunk_ID] = page_table[victim];
+        page_table[victim] = CHUNK_NOT_RESIDENT;
+        lru_pos[victim] = lru.end();
+        lru.push_front(chunk_ID);
+        lru_pos[chunk_ID] = lru.begin();
+        
+        uploads.push_back(chunk_ID);
+    }
 }
 
 void SceneCreator::createScene(cl::Context& context, cl::Device& device) {
     cl::CommandQueue queue(context, device);
-    writeBuffer(queue, material_buffer, getMaterialSize(), getMaterials());
+    arena.write(queue, b_materials, 0, getMaterialSize(), materials.data());
+    
+    arena.write(queue, b_spheres, 0, getSphereSize(), spheres.data());
+    arena.write(queue, b_planes, 0, getPlaneSize(), planes.data());
+    arena.write(queue, b_lenses, 0, getLensSize(), lenses.data());
+    arena.write(queue, b_boxes, 0, getBoxSize(), boxes.data());
+    arena.write(queue, b_cylinders, 0, getCylinderSize(), cylinders.data());
+    arena.write(queue, b_discs, 0, getDiscSize(), discs.data());
+    arena.write(queue, b_quadrics, 0, getQuadricSize(), quadrics.data());
+    arena.write(queue, b_models, 0, getModelSize(), models.data());
     
-    writeBuffer(queue, sphere_buffer, getSphereSize(), getSpheres());
-    writeBuffer(queue, plane_buffer, getPlaneSize(), getPlanes());
-    writeBuffer(queue, lens_buffer, getLensSize(), getLenses());
-    writeBuffer(queue, model_buffer, getModelSize(), getModels());
+    arena.write(queue, b_meshes, 0, getMeshSize(), meshes.data());
+    arena.write(queue, b_chunks, 0, getChunkSize(), chunks.data());
+    
+    // fill the pool with the first chunks, the rest becomes resident once the kernel asks for it
+    std::vector<cl_uint> resident;
+    for(cl_uint chunk_ID = 0; chunk_ID < slot_count; chunk_ID++) {
+        page_table[chunk_ID] = chunk_ID;
+        lru.push_back(chunk_ID);
+        lru_pos[chunk_ID] = std::prev(lru.end());
+        resident.push_back(chunk_ID);
+    }
+    if(chunks.size() > 0) uploadChunks(queue, resident);
+    if(streaming) queue.enqueueFillBuffer(arena.getBuffer(), (cl_uchar)0, arena.getOffset(b_feedback), feedback.size());
     
-    writeBuffer(queue, vertex_buffer, getVertexSize(), getVertices());
-    writeBuffer(queue, texture_uv_buffer, getTexUVSize(), getTexUV());
-    writeBuffer(queue, index_buffer, getIndexSize(), getIndices());
-    writeBuffer(queue, mesh_buffer, getMeshSize(), getMeshes());
+    // the tiles stay resident across a rebuild, the pool is only recreated with the textures
+    arena.write(queue, b_textures, 0, getTextureInfoSize(), texture_infos.data());
+    arena.write(queue, b_texture_levels, 0, getTextureLevelSize(), texture_levels.data());
+    arena.write(queue, b_tile_table, 0, getTileTableSize(), tile_table.data());
+    if(tile_feedback.size() > 0) queue.enqueueFillBuffer(arena.getBuffer(), (cl_uchar)0, arena.getOffset(b_tile_feedback), tile_feedback.size());
     
-    queue.enqueueNDRangeKernel(scene_kernel, cl::NullRange, cl::NDRange(size_t(1)), cl::NullRange);
+    arena.write(queue, b_environment, 0, getEnvironmentSize(), environment_texels.data());
+    arena.write(queue, b_environment_cdf, 0, getEnvironmentCDFSize(), environment_cdf.data());
+    
+    writeHeader(queue);
     queue.finish();
 }
 
-void SceneCreator::setKernelArgs() {
-    scene_kernel.setArg(0, scene_buffer);
-    scene_kernel.setArg(1, material_buffer);
-    scene_kernel.setArg(2, sphere_buffer);
-    scene_kernel.setArg(3, plane_buffer);
-    scene_kernel.setArg(4, lens_buffer);
-    scene_kernel.setArg(5, vertex_buffer);
-    scene_kernel.setArg(6, texture_uv_buffer);
-    scene_kernel.setArg(7, index_buffer);
-    scene_kernel.setArg(8, mesh_buffer);
-    scene_kernel.setArg(9, model_buffer);
+void SceneCreator::writeHeader(cl::CommandQueue& queue) {
+    // the kernels find the objects through these offsets, so the blocks can move without rebuilding the scene
+    SceneHeader header;
+    header.materials = arena.getOffset(b_materials);
+    header.spheres = arena.getOffset(b_spheres);
+    header.planes = arena.getOffset(b_planes);
+    header.lenses = arena.getOffset(b_lenses);
+    header.models = arena.getOffset(b_models);
+    header.boxes = arena.getOffset(b_boxes);
+    header.cylinders = arena.getOffset(b_cylinders);
+    header.discs = arena.getOffset(b_discs);
+    header.quadrics = arena.getOffset(b_quadrics);
+    header.meshes = arena.getOffset(b_meshes);
+    header.chunks = arena.getOffset(b_chunks);
+    header.page_table = arena.getOffset(b_page_table);
+    header.chunk_vertices = arena.getOffset(b_chunk_vertices);
+    header.chunk_uvs = arena.getOffset(b_chunk_uvs);
+    header.chunk_indices = arena.getOffset(b_chunk_indices);
+    header.feedback = arena.getOffset(b_feedback);
+    header.textures = arena.getOffset(b_textures);
+    header.texture_levels = arena.getOffset(b_texture_levels);
+    header.tile_table = arena.getOffset(b_tile_table);
+    header.tile_feedback = arena.getOffset(b_tile_feedback);
+    header.environment = arena.getOffset(b_environment);
+    header.environment_cdf = arena.getOffset(b_environment_cdf);
+    
+    header.sphere_count = (cl_uint)spheres.size();
+    header.plane_count = (cl_uint)planes.size();
+    header.lens_count = (cl_uint)lenses.size();
+    header.box_count = (cl_uint)boxes.size();
+    header.cylinder_count = (cl_uint)cylinders.size();
+    header.disc_count = (cl_uint)discs.size();
+    header.quadric_count = (cl_uint)quadrics.size();
+    header.model_count = (cl_uint)models.size();
+    header.streaming = streaming;
+    
+    header.environment_width = environment_width;
+    header.environment_height = environment_height;
+    header.environment_intensity = environment_intensity;
+    header.environment_rotation = glm::radians(environment_rotation);
+    header.environment_weight_sum = environment_weight_sum;
     
-    ObjectCounter obj_counter;
-    obj_counter.sphere_count = (cl_uint)spheres.size();
-    obj_counter.plane_count = (cl_uint)planes.size();
-    obj_counter.lens_count = (cl_uint)lenses.size();
-    obj_counter.model_count = (cl_uint)models.size();
+    header.lod_primary_distance = lod_primary_distance;
+    header.lod_secondary_distance = lod_secondary_distance;
     
-    scene_kernel.setArg(10, obj_counter);
+    arena.write(queue, b_header, 0, sizeof(SceneHeader), &header);
 }
 
-void SceneCreator::addMaterial(MatType type, const cl_float3& color, cl_float extra_data) {
+void SceneData::addMaterial(MatType type, const cl_float3& color, cl_float extra_data) {
     materials.push_back(Material(type, color, extra_data));
 }
 
-void SceneCreator::addSphere(const cl_float3& pos, cl_float r, cl_uint mat_ID) {
+void SceneData::addSphere(const cl_float3& pos, cl_float r, cl_uint mat_ID) {
     spheres.push_back(Sphere(pos, r, mat_ID));
 }
 
-void SceneCreator::addPlane(const cl_float3& pos, const cl_float3& normal, cl_uint mat_ID) {
+void SceneData::addPlane(const cl_float3& pos, const cl_float3& normal, cl_uint mat_ID) {
     planes.push_back(Plane(pos, normal, mat_ID));
 }
 
-void SceneCreator::addLens(const cl_float3& pos, const cl_float3& normal, cl_float r1, cl_float r2, cl_float h, uint mat_ID) {
+void SceneData::addLens(const cl_float3& pos, const cl_float3& normal, cl_float r1, cl_float r2, cl_float h, uint mat_ID) {
     assert(r1 >= h && r2 >= h);
     
     Lens lens;
@@ -142,88 +467,948 @@ void SceneCreator::addLens(const cl_float3& pos, const cl_float3& normal, cl_flo
     lenses.push_back(lens);
 }
 
-void SceneCreator::loadTextures(cl::Context& context, cl::Device& device) {
-    if(models.size() > 0) {
-        if(texture_paths.size() == 0)
-            processError("ERROR: TEXTURE COUNT = 0");
+inline cl_float3 toFloat3(const glm::vec3& v) {
+    return {{v.x, v.y, v.z}};
+}
+
+void SceneData::addBox(const cl_float3& pos, const cl_float3& size, const cl_float3& rotation, cl_uint mat_ID) {
+    glm::mat4 rotate(1.0f);
+    rotate = glm::rotate(rotate, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+    rotate = glm::rotate(rotate, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+    rotate = glm::rotate(rotate, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+    
+    Box box;
+    box.pos = pos;
+    box.half_size = {{size.x * 0.5f, size.y * 0.5f, size.z * 0.5f}};
+    box.axis_x = toFloat3(glm::vec3(rotate[0]));
+    box.axis_y = toFloat3(glm::vec3(rotate[1]));
+    box.axis_z = toFloat3(glm::vec3(rotate[2]));
+    box.mat_ID = mat_ID;
+    
+    boxes.push_back(box);
+}
+
+void SceneData::addCylinder(const cl_float3& p1, const cl_float3& p2, cl_float r, cl_uint mat_ID) {
+    glm::vec3 a(p1.x, p1.y, p1.z), b(p2.x, p2.y, p2.z);
+    if(glm::length(b - a) == 0.0f || r <= 0.0f) processError("ERROR: SCENE: CYLINDER: EMPTY");
+    
+    // the caps are discs, each spans r * sin(angle between the axis and the coordinate axis)
+    glm::vec3 axis = glm::normalize(b - a);
+    glm::vec3 extent = r * glm::sqrt(glm::max(glm::vec3(1.0f) - axis * axis, glm::vec3(0.0f)));
+    
+    Cylinder cylinder;
+    cylinder.p1 = p1;
+    cylinder.p2 = p2;
+    cylinder.bounds_min = toFloat3(glm::min(a, b) - extent);
+    cylinder.bounds_max = toFloat3(glm::max(a, b) + extent);
+    cylinder.r = r;
+    cylinder.mat_ID = mat_ID;
+    
+    cylinders.push_back(cylinder);
+}
+
+void SceneData::addDisc(const cl_float3& pos, const cl_float3& normal, cl_float r, cl_uint mat_ID) {
+    glm::vec3 n(normal.x, normal.y, normal.z);
+    if(glm::length(n) == 0.0f) processError("ERROR: SCENE: DISC: NORMAL OF LENGTH 0");
+    
+    Disc disc;
+    disc.pos = pos;
+    disc.normal = toFloat3(glm::normalize(n));
+    disc.r = r;
+    disc.mat_ID = mat_ID;
+    
+    discs.push_back(disc);
+}
+
+void SceneData::addQuadric(const cl_float3& pos, const cl_float3& diag, const cl_float3& cross, const cl_float3& linear, cl_float constant, const cl_float3& half_size, cl_uint mat_ID) {
+    // unbounded surfaces (cones, paraboloids, hyperboloids) are only traced inside the bounds
+    Quadric quadric;
+    quadric.pos = pos;
+    quadric.diag = diag;
+    quadric.cross = cross;
+    quadric.linear = linear;
+    quadric.bounds_min = {{pos.x - half_size.x, pos.y - half_size.y, pos.z - half_size.z}};
+    quadric.bounds_max = {{pos.x + half_size.x, pos.y + half_size.y, pos.z + half_size.z}};
+    quadric.constant = constant;
+    quadric.mat_ID = mat_ID;
+    
+    quadrics.push_back(quadric);
+}
+
+void SceneData::loadEnvironment() {
+    environment_texels.clear();
+    environment_cdf.clear();
+    environment_width = environment_height = 0;
+    environment_weight_sum = 0.0f;
+    if(environment_path.empty()) return;
+    
+    environment_time = getWriteTime(environment_path);
+    
+    int width, height, channel_count;
+    float* data = stbi_loadf(environment_path.c_str(), &width, &height, &channel_count, 4);
+    if(!data) processError("ERROR: STBimage: COULD NOT LOAD THE ENVIRONMENT: " + environment_path);
+    
+    environment_width = width;
+    environment_height = height;
+    environment_texels.resize((size_t)width * height);
+    std::memcpy(environment_texels.data(), data, sizeof(cl_float4) * width * height);
+    stbi_image_free(data);
+    
+    // 2D distribution of the luminance weighted by the solid angle of each row, keep the weights in sync with kernels/raytracer.cl
+    environment_cdf.assign(height + (size_t)width * height, 0.0f);
+    float* marginal = &environment_cdf[0];
+    double total = 0.0;
+    
+    for(int y = 0; y < height; y++) {
+        float* conditional = &environment_cdf[height + (size_t)y * width];
+        float sin_theta = std::sin(M_PI * (y + 0.5) / height);
+        double row_sum = 0.0;
         
-        int tex_width = 0, tex_height = 0;
+        for(int x = 0; x < width; x++) {
+            const cl_float4& texel = environment_texels[(size_t)y * width + x];
+            row_sum += (0.2126f * texel.s[0] + 0.7152f * texel.s[1] + 0.0722f * texel.s[2]) * sin_theta;
+            conditional[x] = (float)row_sum;
+        }
+        for(int x = 0; x < width; x++) conditional[x] = row_sum > 0.0 ? (float)(conditional[x] / row_sum) : (float)(x + 1) / width;
         
-        cl::CommandQueue queue(context, device);
+        total += row_sum;
+        marginal[y] = (float)total;
+    }
+    for(int y = 0; y < height; y++) marginal[y] = total > 0.0 ? (float)(marginal[y] / total) : (float)(y + 1) / height;
+    
+    environment_weight_sum = (cl_float)total;
+    
+    std::cout << "SUCCESS: ENVIRONMENT: " << width << " x " << height << " LOADED FROM " << environment_path << std::endl;
+}
+
+void SceneCreator::loadTextures(cl::Context& context, cl::Device& device) {
+    if(models.size() > 0 && texture_paths.size() == 0)
+        processError("ERROR: TEXTURE COUNT = 0");
+    
+    // only the sizes are read here, the texels are decoded once the kernel asks for one of the tiles
+    if(tile_feedback_pending) tile_feedback_event.wait(); // the read back still writes into the old feedback
+    tile_feedback_pending = false;
+    
+    texture_infos.clear();
+    texture_levels.clear();
+    tile_sources.clear();
+    texture_times.clear();
+    decoded_textures.assign(texture_paths.size(), DecodedTexture());
+    decoded_lru.clear();
+    decoded_lru_pos.assign(texture_paths.size(), decoded_lru.end());
+    decoded_size = 0;
+    texture_decodes.clear();
+    texture_decodes.resize(texture_paths.size());
+    
+    for(cl_uint texture_ID = 0; texture_ID < texture_paths.size(); texture_ID++) {
+        int width, height, channel_count;
+        if(!stbi_info(texture_paths[texture_ID].c_str(), &width, &height, &channel_count))
+            processError("ERROR: STBimage: COULD NOT FIND THE TEXTURE: " + texture_paths[texture_ID]);
+        texture_times.push_back(getWriteTime(texture_paths[texture_ID]));
         
-        for(unsigned int texture_ID = 0; texture_ID < texture_paths.size(); texture_ID++) {
-            int width, height;
-            int channel_count;
-            
-            float* texture_data = stbi_loadf(texture_paths[texture_ID].c_str(), &width, &height, &channel_count, 0);
+        TextureInfo info;
+        info.level_anchor = (cl_uint)texture_levels.size();
+        info.level_count = 0;
+        
+        // halve the size until a level fits in a single tile
+        while(true) {
+            TextureLevel level;
+            level.tile_anchor = (cl_uint)tile_sources.size();
+            level.tiles_x = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+            level.tiles_y = (height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+            level.width = width;
+            level.height = height;
+            texture_levels.push_back(level);
             
-            if(texture_ID == 0) {
-                tex_width = width;
-                tex_height = height;
-        
-                textures = cl::Image2DArray(context, CL_MEM_READ_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT), texture_paths.size(), width, height, 0, 0);
-            } else if(tex_width != width || tex_height != height) {
-                queue.finish();
-                processError("ERROR: TEXTURES HAVE DIFFERENT SIZES: TEMPLATE: " + std::to_string(tex_width) + " x " + std::to_string(tex_height) + ", TEXTURE ID(" + std::to_string(texture_ID) + "): " + std::to_string(width) + " x " + std::to_string(height));
+            for(cl_uint y = 0; y < level.tiles_y; y++) {
+                for(cl_uint x = 0; x < level.tiles_x; x++) tile_sources.push_back((TileSource){texture_ID, info.level_count, x, y});
             }
             
-            if(texture_data) {
-                if(channel_count == 4) {// RGBA only
-                    //queue.enqueueWriteImage(texture, CL_TRUE, {0, 0, 0}, {size_t(width), size_t(height), 1}, 0, 0, texture_data);
-                    queue.enqueueWriteImage(textures, CL_TRUE, {0, 0, texture_ID}, {size_t(width), size_t(height), 1}, 0, 0, texture_data);
-                    
-                    stbi_image_free(texture_data);
-                } else {
-                    queue.finish();
-                    processError("ERROR: STBimage: TEXTURE HAS A WRONG FORMAT: " + std::to_string(channel_count) + " INSTEAD OF 4 (RGBA)");
+            info.level_count++;
+            if(level.tiles_x == 1 && level.tiles_y == 1) break;
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+        
+        texture_infos.push_back(info);
+    }
+    
+    tile_table.assign(tile_sources.size(), TILE_NOT_RESIDENT);
+    tile_feedback.assign(tile_sources.size(), 0);
+    tile_lru.clear();
+    tile_lru_pos.assign(tile_sources.size(), tile_lru.end());
+    free_tile_slots.clear();
+    texture_memory = 0;
+    
+    if(texture_paths.size() == 0) {
+        tile_slot_count = 0;
+        textures = cl::Image2DArray(context, CL_MEM_READ_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT), SIZE_EMPTY, SIZE_EMPTY, SIZE_EMPTY, 0, 0);
+        return;
+    }
+    
+    // the pool holds one tile per layer, at least the coarsest level of every texture has to fit
+    size_t tile_size = TILE_STORED_SIZE * TILE_STORED_SIZE * 4 * (compact_storage ? sizeof(cl_half) : sizeof(float));
+    size_t max_layers = device.getInfo<CL_DEVICE_IMAGE_MAX_ARRAY_SIZE>();
+    cl_ulong device_memory = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    cl_ulong device_space = device_memory > reserved_memory ? device_memory - reserved_memory : 0;
+    cl_ulong budget = device_space / TEXTURE_MEMORY_FRACTION / tile_size;
+    tile_slot_count = (cl_uint)std::min(std::min((cl_ulong)tile_sources.size(), (cl_ulong)max_layers), budget);
+    if(tile_slot_count < texture_paths.size())
+        processError("ERROR: TEXTURES: NOT ENOUGH DEVICE MEMORY FOR THE COARSEST LEVELS");
+    
+    for(cl_uint slot = tile_slot_count; slot > 0; slot--) free_tile_slots.push_back(slot - 1);
+    
+    textures = cl::Image2DArray(context, CL_MEM_READ_ONLY, cl::ImageFormat(CL_RGBA, compact_storage ? CL_HALF_FLOAT : CL_FLOAT), tile_slot_count, TILE_STORED_SIZE, TILE_STORED_SIZE, 0, 0);
+    texture_memory = tile_slot_count * tile_size;
+    
+    std::cout << "SUCCESS: TEXTURES: " << texture_paths.size() << " TEXTURES IN " << tile_sources.size() << " TILES, " << tile_slot_count << " RESIDENT AT ONCE" << std::endl;
+}
+
+// stbi_loadf converted the 8-bit files with a gamma of 2.2, the tiles keep its output
+inline float getLinear(cl_uchar value) {
+    static const std::vector<float> table = []() {
+        std::vector<float> table(256);
+        for(int i = 0; i < 256; i++) table[i] = std::pow(i / 255.0f, 2.2f);
+        return table;
+    }();
+    return table[value];
+}
+
+inline cl_uchar getEncoded(float linear) {
+    return (cl_uchar)std::lround(255.0f * std::pow(std::min(std::max(linear, 0.0f), 1.0f), 1.0f / 2.2f));
+}
+
+DecodedTexture decodeTexture(const std::string& path, const std::vector<TextureLevel>& levels) {
+    DecodedTexture texture;
+    texture.levels.resize(levels.size());
+    
+    int width, height, channel_count;
+    stbi_uc* data = stbi_load(path.c_str(), &width, &height, &channel_count, 4); // always RGBA, HDR files are mapped to 8 bits
+    
+    if(!data || width != (int)levels[0].width || height != (int)levels[0].height) {
+        // the file changed since its size was read, render it black rather than stop the renderer
+        std::cerr << "ERROR: STBimage: COULD NOT DECODE THE TEXTURE: " << path << std::endl;
+        for(size_t i = 0; i < levels.size(); i++) texture.levels[i].assign((size_t)levels[i].width * levels[i].height, {{0, 0, 0, 0}});
+        if(data) stbi_image_free(data);
+        return texture;
+    }
+    
+    texture.levels[0].resize((size_t)width * height);
+    std::memcpy(texture.levels[0].data(), data, sizeof(cl_uchar4) * width * height);
+    stbi_image_free(data);
+    
+    // box filter of the linear colors, the last row and column of an odd size are repeated
+    for(size_t i = 1; i < levels.size(); i++) {
+        const std::vector<cl_uchar4>& src = texture.levels[i - 1];
+        std::vector<cl_uchar4>& dst = texture.levels[i];
+        int src_width = levels[i - 1].width, src_height = levels[i - 1].height;
+        int dst_width = levels[i].width, dst_height = levels[i].height;
+        dst.resize((size_t)dst_width * dst_height);
+        
+        for(int y = 0; y < dst_height; y++) {
+            for(int x = 0; x < dst_width; x++) {
+                float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for(int dy = 0; dy < 2; dy++) {
+                    for(int dx = 0; dx < 2; dx++) {
+                        const cl_uchar4& texel = src[std::min(2 * y + dy, src_height - 1) * src_width + std::min(2 * x + dx, src_width - 1)];
+                        for(int c = 0; c < 3; c++) sum[c] += 0.25f * getLinear(texel.s[c]);
+                        sum[3] += 0.25f * texel.s[3];
+                    }
                 }
-            } else {
-                queue.finish();
-                processError("ERROR: STBimage: COULD NOT FIND THE TEXTURE");
+                cl_uchar4& texel = dst[y * dst_width + x];
+                for(int c = 0; c < 3; c++) texel.s[c] = getEncoded(sum[c]);
+                texel.s[3] = (cl_uchar)std::lround(sum[3]);
             }
         }
+    }
+    
+    return texture;
+}
+
+void SceneCreator::fillTile(cl_uint tile_ID, cl_float4* dst) const {
+    // the border wraps around like the texture coords in the kernel
+    const TileSource& source = tile_sources[tile_ID];
+    const TextureLevel& level = texture_levels[texture_infos[source.texture_ID].level_anchor + source.level];
+    const std::vector<cl_uchar4>& texels = decoded_textures[source.texture_ID].levels[source.level];
+    int width = level.width, height = level.height;
+    int origin_x = source.x * TEXTURE_TILE_SIZE - TEXTURE_TILE_BORDER;
+    int origin_y = source.y * TEXTURE_TILE_SIZE - TEXTURE_TILE_BORDER;
+    
+    for(int y = 0; y < TILE_STORED_SIZE; y++) {
+        int src_y = ((origin_y + y) % height + height) % height;
+        for(int x = 0; x < TILE_STORED_SIZE; x++) {
+            int src_x = ((origin_x + x) % width + width) % width;
+            const cl_uchar4& texel = texels[src_y * width + src_x];
+            dst[y * TILE_STORED_SIZE + x] = {{getLinear(texel.s[0]), getLinear(texel.s[1]), getLinear(texel.s[2]), texel.s[3] / 255.0f}};
+        }
+    }
+}
+
+void SceneCreator::uploadTiles(cl::CommandQueue& queue, const std::vector<cl_uint>& tile_IDs) {
+    const size_t tile_texels = TILE_STORED_SIZE * TILE_STORED_SIZE;
+    tile_staging.resize(tile_IDs.size() * tile_texels);
+    if(compact_storage) compact_tile_staging.resize(tile_IDs.size() * tile_texels * 4);
+    
+    for(size_t i = 0; i < tile_IDs.size(); i++) {
+        cl_float4* texels = &tile_staging[i * tile_texels];
+        fillTile(tile_IDs[i], texels);
         
-        queue.finish();
+        const void* data = texels;
+        if(compact_storage) {
+            cl_half* half_texels = &compact_tile_staging[i * tile_texels * 4];
+            for(size_t j = 0; j < tile_texels * 4; j++) half_texels[j] = toHalf(texels[j / 4].s[j % 4]);
+            data = half_texels;
+        }
+        
+        queue.enqueueWriteImage(textures, CL_FALSE, {0, 0, tile_table[tile_IDs[i]]}, {TILE_STORED_SIZE, TILE_STORED_SIZE, 1}, 0, 0, data);
+    }
+    
+    arena.write(queue, b_tile_table, 0, getTileTableSize(), tile_table.data(), false);
+    queue.finish(); // the staging memory is reused on the next upload
+}
+
+bool SceneCreator::assignTileSlot(cl_uint tile_ID, bool pinned) {
+    cl_uint slot;
+    if(free_tile_slots.size() > 0) {
+        slot = free_tile_slots.back();
+        free_tile_slots.pop_back();
     } else {
-        textures = cl::Image2DArray(context, CL_MEM_READ_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT), SIZE_EMPTY, SIZE_EMPTY, SIZE_EMPTY, 0, 0);
+        if(tile_lru.empty()) return false;
+        cl_uint victim = tile_lru.back();
+        if(!pinned && tile_feedback[victim] == TILE_USED) return false; // every resident tile is needed by the current frame
+        
+        tile_lru.pop_back();
+        slot = tile_table[victim];
+        tile_table[victim] = TILE_NOT_RESIDENT;
+        tile_lru_pos[victim] = tile_lru.end();
+    }
+    
+    tile_table[tile_ID] = slot;
+    if(!pinned) {
+        tile_lru.push_front(tile_ID);
+        tile_lru_pos[tile_ID] = tile_lru.begin();
+    }
+    return true;
+}
+
+bool SceneCreator::updateTiles(cl::CommandQueue& queue) {
+    if(tile_sources.empty()) return false;
+    
+    std::vector<cl_uint> uploads;
+    
+    // the coarsest tile of a decoded texture is pinned, the kernel falls back to it while the finer tiles are missing
+    for(cl_uint texture_ID = 0; texture_ID < texture_decodes.size(); texture_ID++) {
+        std::future<DecodedTexture>& decode = texture_decodes[texture_ID];
+        if(!decode.valid() || decode.wait_for(std::chrono::seconds(0)) != std::future_status::ready) continue;
+        
+        decoded_textures[texture_ID] = decode.get();
+        decoded_size += decoded_textures[texture_ID].getSize();
+        decoded_lru.push_front(texture_ID);
+        decoded_lru_pos[texture_ID] = decoded_lru.begin();
+        
+        const TextureInfo& info = texture_infos[texture_ID];
+        cl_uint tile_ID = texture_levels[info.level_anchor + info.level_count - 1].tile_anchor;
+        if(tile_table[tile_ID] == TILE_NOT_RESIDENT && assignTileSlot(tile_ID, true)) uploads.push_back(tile_ID);
+    }
+    
+    // the feedback is read back while the next frame renders, the pinned tiles above never look at it
+    if(tile_feedback_pending) {
+        cl_int status = tile_feedback_event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+        if(status <= CL_COMPLETE) {
+            tile_feedback_pending = false;
+            if(status == CL_COMPLETE) selectTiles(uploads);
+        }
+    }
+    
+    if(uploads.size() > 0) uploadTiles(queue, uploads);
+    evictTextures(uploads);
+    
+    if(!tile_feedback_pending) {
+        queue.enqueueReadBuffer(arena.getBuffer(), CL_FALSE, arena.getOffset(b_tile_feedback), tile_feedback.size(), &tile_feedback[0], nullptr, &tile_feedback_event);
+        queue.enqueueFillBuffer(arena.getBuffer(), (cl_uchar)0, arena.getOffset(b_tile_feedback), tile_feedback.size());
+        queue.flush();
+        tile_feedback_pending = true;
+    }
+    
+    return uploads.size() > 0;
+}
+
+void SceneCreator::selectTiles(std::vector<cl_uint>& uploads) {
+    std::vector<cl_uint> missing;
+    for(cl_uint tile_ID = 0; tile_ID < tile_sources.size(); tile_ID++) {
+        if(tile_feedback[tile_ID] == TILE_USED && tile_lru_pos[tile_ID] != tile_lru.end())
+            tile_lru.splice(tile_lru.begin(), tile_lru, tile_lru_pos[tile_ID]);
+        else if(tile_feedback[tile_ID] == TILE_MISSING && tile_table[tile_ID] == TILE_NOT_RESIDENT) {
+            cl_uint texture_ID = tile_sources[tile_ID].texture_ID;
+            if(decoded_textures[texture_ID].levels.size() > 0) {
+                if(missing.size() < TILE_UPLOADS_PER_FRAME) missing.push_back(tile_ID);
+            } else if(!texture_decodes[texture_ID].valid()) {
+                // the kernel asks for the tile again until the texture is decoded
+                const TextureInfo& info = texture_infos[texture_ID];
+                std::vector<TextureLevel> levels(texture_levels.begin() + info.level_anchor, texture_levels.begin() + info.level_anchor + info.level_count);
+                std::string path = texture_paths[texture_ID];
+                texture_decodes[texture_ID] = pool.submit([path, levels]() { return decodeTexture(path, levels); });
+            }
+        }
+    }
+    
+    for(cl_uint tile_ID : missing) {
+        if(!assignTileSlot(tile_ID, false)) break;
+        uploads.push_back(tile_ID);
+    }
+}
+
+void SceneCreator::evictTextures(const std::vector<cl_uint>& uploads) {
+    for(cl_uint tile_ID : uploads) {
+        cl_uint texture_ID = tile_sources[tile_ID].texture_ID;
+        decoded_lru.splice(decoded_lru.begin(), decoded_lru, decoded_lru_pos[texture_ID]);
+    }
+    
+    // the tiles already on the device stay, the texture is decoded again once another one is missing
+    while(decoded_size > DECODED_TEXTURE_BUDGET && decoded_lru.size() > 1) {
+        cl_uint victim = decoded_lru.back();
+        decoded_lru.pop_back();
+        decoded_lru_pos[victim] = decoded_lru.end();
+        decoded_size -= decoded_textures[victim].getSize();
+        decoded_textures[victim] = DecodedTexture();
     }
 }
 
 void SceneCreator::loadModel(const std::string& path, cl_uint mat_ID, const glm::mat4& transform) {
-    static cl_uint mesh_count_total = 0;
+    loadModels({ModelRequest(path, mat_ID, transform)});
+}
+
+// every import finishes before a failed one is rethrown, none of them may outlive the scene it reads
+inline void waitImports(std::vector<std::future<ModelStaging>>& imports) {
+    for(std::future<ModelStaging>& import : imports) if(import.valid()) import.wait();
+}
+
+void SceneCreator::loadModels(const std::vector<ModelRequest>& requests) {
+    for(const ModelRequest& request : requests) {
+        if(materials.size() <= request.mat_ID)
+            processError("ERROR: MATERIAL OF ID: " + std::to_string(request.mat_ID) + " DOES NOT EXIST");
+        
+        model_requests.push_back(request);
+        model_times.push_back(getWriteTimes(request));
+    }
+    
+    // import every model into its own staging buffers on the pool, then merge them in the scene file order
+    std::vector<std::future<ModelStaging>> stagings;
+    for(const ModelRequest& request : requests) {
+        stagings.push_back(pool.submit([this, request]() { return importModel(request); }));
+    }
+    
+    waitImports(stagings);
+    for(std::future<ModelStaging>& staging : stagings) mergeModel(staging.get());
+}
+
+ModelStaging SceneCreator::importModel(const ModelRequest& request) const {
+    ModelStaging staging;
+    staging.path = request.path;
+    staging.mat_ID = request.mat_ID;
+    staging.reorder = mesh_reorder;
+    
+    importFile(request.path, staging, request.transform);
+    
+    // the author's levels replace the generated ones
+    for(const std::string& lod_path : request.lod_paths) {
+        staging.lod_anchors.push_back((cl_uint)staging.meshes.size());
+        importFile(lod_path, staging, request.transform);
+    }
+    if(request.lod_paths.empty()) generateLODs(staging, request.simplify_levels);
+    
+    return staging;
+}
+
+inline bool isOBJ(const std::string& path) {
+    std::string extension = std::filesystem::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    return extension.compare(".obj") == 0;
+}
+
+void SceneCreator::importFile(const std::string& path, ModelStaging& staging, const glm::mat4& transform) const {
+    // the OBJ files are parsed straight from the mapped file on the pool, Assimp reads the other formats
+    if(obj_loader && isOBJ(path)) {
+        ObjFile file;
+        if(!file.load(path, pool)) processError("ERROR: OBJ: " + file.getError());
+        
+        processOBJ(file, staging, transform);
+        return;
+    }
+    
+    Assimp::Importer importer; // importers are not thread-safe, use one per model
     
     const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
     
     if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         processError("ERROR: Assimp: " + std::string(importer.GetErrorString()));
     
-    if(materials.size() <= mat_ID)
-        processError("ERROR: MATERIAL OF ID: " + std::to_string(mat_ID) + " DOES NOT EXIST");
+    processNode(scene->mRootNode, scene, staging, transform);
+}
+
+void SceneData::mergeModel(const ModelStaging& staging) {
+    // the staging anchors are relative to the model, shift them to the scene buffers
+    cl_uint vertex_offset = (cl_uint)vertices.size();
+    cl_uint index_offset = (cl_uint)indices.size();
+    cl_uint mesh_anchor = (cl_uint)meshes.size();
+    
+    vertices.insert(vertices.end(), staging.vertices.begin(), staging.vertices.end());
+    texture_uv.insert(texture_uv.end(), staging.texture_uv.begin(), staging.texture_uv.end());
+    indices.insert(indices.end(), staging.indices.begin(), staging.indices.end());
+    
+    for(Mesh mesh : staging.meshes) {
+        mesh.vertex_anchor += vertex_offset;
+        mesh.index_anchor += index_offset;
+        
+        if(mesh.texture_ID != (cl_uint)-1) {
+            const std::string& texture_path = staging.texture_paths[mesh.texture_ID];
+            auto found = std::find(texture_paths.begin(), texture_paths.end(), texture_path);
+            mesh.texture_ID = (cl_uint)(found - texture_paths.begin());
+            if(found == texture_paths.end()) texture_paths.push_back(texture_path);
+        }
+        
+        meshes.push_back(mesh);
+    }
+    
+    Model model(mesh_anchor, (cl_uint)staging.meshes.size(), staging.mat_ID);
+    model.lod_count = (cl_uint)staging.lod_anchors.size();
+    std::copy(staging.lod_anchors.begin(), staging.lod_anchors.end(), model.lod_anchors);
+    
+    // the bounding sphere of the model, the distances of the LOD selection are measured from it
+    if(staging.vertices.size() > 0) {
+        glm::vec3 bounds_min(staging.vertices[0].x, staging.vertices[0].y, staging.vertices[0].z), bounds_max = bounds_min;
+        for(const cl_float3& vertex : staging.vertices) {
+            bounds_min = glm::min(bounds_min, glm::vec3(vertex.x, vertex.y, vertex.z));
+            bounds_max = glm::max(bounds_max, glm::vec3(vertex.x, vertex.y, vertex.z));
+        }
+        glm::vec3 centre = 0.5f * (bounds_min + bounds_max);
+        model.bounds = {{centre.x, centre.y, centre.z, std::max(0.5f * glm::length(bounds_max - bounds_min), 1e-6f)}};
+    }
     
-    cl_uint mesh_count = processNode(scene->mRootNode, scene, mat_ID, transform); // TODO: NOT SURE IF THE RESULT IS CORRECT
-    models.push_back((Model){mesh_count_total, mesh_count, mat_ID});
+    models.push_back(model);
     
-    mesh_count_total += mesh_count;
+    cl_uint face_count = 0;
+    for(cl_uint mesh_ID = 0; mesh_ID < model.getLevelEnd(0); mesh_ID++) face_count += staging.meshes[mesh_ID].face_count;
+    
+    if(!staging.reused) {
+        std::cout << "SUCCESS: MODEL " << staging.path << ": " << face_count << " FACES, " << staging.vertices.size() << " VERTICES (" << staging.merged_vertex_count << " MERGED), " << model.lod_count << " LOD LEVELS" << std::endl;
+        
+        // the chunks of every level, in the file order and as they are stored
+        if(staging.chunk_counts[0] > 0) {
+            std::cout << "SUCCESS: MODEL " << staging.path << ": " << (staging.reorder ? "REORDERED" : "FILE ORDER") << ": CHUNKS " << staging.chunk_counts[0] << " -> " << staging.chunk_counts[1];
+            std::cout << ", VERTICES PER CHUNK " << (double)staging.chunk_vertex_counts[0] / staging.chunk_counts[0] << " -> " << (double)staging.chunk_vertex_counts[1] / staging.chunk_counts[1];
+            std::cout << ", CHUNK DIAGONAL " << staging.chunk_extents[0] / staging.chunk_counts[0] << " -> " << staging.chunk_extents[1] / staging.chunk_counts[1] << std::endl;
+        }
+    }
 }
 
-cl_uint SceneCreator::processNode(aiNode* node, const aiScene* scene, cl_uint mat_ID, const glm::mat4& transform) {
-    cl_uint mesh_count = 0;
+ModelStaging SceneData::extractModel(cl_uint model_ID) const {
+    const Model& model = models[model_ID];
     
-    for(unsigned int i = 0; i < node->mNumMeshes; i++) {
-        mesh_count++;
+    ModelStaging staging;
+    staging.path = model_requests[model_ID].path;
+    staging.mat_ID = model.mat_ID;
+    staging.reused = true;
+    
+    if(model.mesh_count == 0) return staging;
+    
+    // the models are merged one after another, so the geometry of a model is contiguous
+    const Mesh& first_mesh = meshes[model.mesh_anchor];
+    cl_uint vertex_end = (cl_uint)vertices.size(), index_end = (cl_uint)indices.size();
+    for(cl_uint next_ID = model_ID + 1; next_ID < models.size(); next_ID++) {
+        if(models[next_ID].mesh_count > 0) {
+            vertex_end = meshes[models[next_ID].mesh_anchor].vertex_anchor;
+            index_end = meshes[models[next_ID].mesh_anchor].index_anchor;
+            break;
+        }
+    }
+    
+    staging.vertices.assign(vertices.begin() + first_mesh.vertex_anchor, vertices.begin() + vertex_end);
+    staging.texture_uv.assign(texture_uv.begin() + first_mesh.vertex_anchor, texture_uv.begin() + vertex_end);
+    staging.indices.assign(indices.begin() + first_mesh.index_anchor, indices.begin() + index_end);
+    
+    for(cl_uint mesh_ID = model.mesh_anchor; mesh_ID < model.mesh_anchor + model.mesh_count; mesh_ID++) {
+        Mesh mesh = meshes[mesh_ID];
+        mesh.vertex_anchor -= first_mesh.vertex_anchor;
+        mesh.index_anchor -= first_mesh.index_anchor;
+        
+        if(mesh.texture_ID != (cl_uint)-1) {
+            const std::string& texture_path = texture_paths[mesh.texture_ID];
+            auto found = std::find(staging.texture_paths.begin(), staging.texture_paths.end(), texture_path);
+            mesh.texture_ID = (cl_uint)(found - staging.texture_paths.begin());
+            if(found == staging.texture_paths.end()) staging.texture_paths.push_back(texture_path);
+        }
         
+        staging.meshes.push_back(mesh);
+    }
+    staging.lod_anchors.assign(model.lod_anchors, model.lod_anchors + model.lod_count);
+    
+    return staging;
+}
+
+void SceneCreator::processNode(aiNode* node, const aiScene* scene, ModelStaging& staging, const glm::mat4& transform) const {
+    for(unsigned int i = 0; i < node->mNumMeshes; i++) {
         aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene, mat_ID, transform));
+        staging.meshes.push_back(processMesh(mesh, scene, staging, transform));
     }
     
     for(unsigned int i = 0; i < node->mNumChildren; i++) {
-        mesh_count += processNode(node->mChildren[i], scene, mat_ID, transform);
+        processNode(node->mChildren[i], scene, staging, transform);
     }
+}
+
+inline cl_uint expandBits(cl_uint x) {
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// cuts the faces into chunks like buildChunks and adds up their count, their vertices and the diagonals of their bounds
+void measureChunks(const cl_float3* vertices, cl_uint vertex_count, const std::vector<cl_uint>& indices, size_t& chunk_count, size_t& chunk_vertex_count, double& chunk_extent) {
+    std::vector<cl_uint> stamp(vertex_count, CHUNK_NOT_RESIDENT);
+    cl_uint face_count = (cl_uint)indices.size() / 3;
     
-    return mesh_count;
+    for(cl_uint first_face = 0, chunk_ID = 0; first_face < face_count; chunk_ID++) {
+        cl_uint chunk_faces = 0, chunk_vertices = 0;
+        glm::vec3 bounds_min(vertices[indices[3 * first_face]].x, vertices[indices[3 * first_face]].y, vertices[indices[3 * first_face]].z), bounds_max = bounds_min;
+        
+        for(cl_uint face = first_face; face < face_count && chunk_faces < CHUNK_FACE_COUNT; face++) {
+            cl_uint new_vertices = 0;
+            for(cl_uint i = 3 * face; i < 3 * face + 3; i++) if(stamp[indices[i]] != chunk_ID) new_vertices++;
+            if(chunk_vertices + new_vertices > CHUNK_VERTEX_COUNT) break;
+            
+            for(cl_uint i = 3 * face; i < 3 * face + 3; i++) {
+                if(stamp[indices[i]] == chunk_ID) continue;
+                stamp[indices[i]] = chunk_ID;
+                chunk_vertices++;
+                
+                glm::vec3 vertex(vertices[indices[i]].x, vertices[indices[i]].y, vertices[indices[i]].z);
+                bounds_min = glm::min(bounds_min, vertex);
+                bounds_max = glm::max(bounds_max, vertex);
+            }
+            chunk_faces++;
+        }
+        
+        chunk_count++;
+        chunk_vertex_count += chunk_vertices;
+        chunk_extent += glm::length(bounds_max - bounds_min);
+        first_face += chunk_faces;
+    }
 }
 
-inline cl_float3 transformVertex(const aiVector3D& vertex, const glm::mat4& transform) {
+// sorts the faces along a Morton curve of their centroids, so the chunks cut from consecutive faces get tight bounds and share
+// their vertices, then merges the duplicate vertices and renumbers the rest in the order of first use
+void optimizeMesh(ModelStaging& staging, cl_uint vertex_anchor, cl_uint index_anchor, cl_uint face_count) {
+    cl_uint vertex_count = (cl_uint)staging.vertices.size() - vertex_anchor;
+    if(face_count == 0 || staging.indices.size() - index_anchor != 3 * face_count) return; // points and lines are left as they are
+    
+    const cl_float3* mesh_vertices = &staging.vertices[vertex_anchor];
+    const cl_float2* mesh_uvs = &staging.texture_uv[vertex_anchor];
+    cl_uint* mesh_indices = &staging.indices[index_anchor];
+    
+    // Morton codes of the face centroids
+    glm::vec3 bounds_min(mesh_vertices[0].x, mesh_vertices[0].y, mesh_vertices[0].z), bounds_max = bounds_min;
+    for(cl_uint i = 0; i < vertex_count; i++) {
+        glm::vec3 vertex(mesh_vertices[i].x, mesh_vertices[i].y, mesh_vertices[i].z);
+        bounds_min = glm::min(bounds_min, vertex);
+        bounds_max = glm::max(bounds_max, vertex);
+    }
+    glm::vec3 scale = glm::vec3((float)((1 << MORTON_BITS) - 1)) / glm::max(bounds_max - bounds_min, glm::vec3(1e-12f));
+    
+    std::vector<std::pair<cl_uint, cl_uint>> face_codes(face_count);
+    for(cl_uint i = 0; i < face_count; i++) {
+        glm::vec3 centroid(0.0f);
+        for(int j = 0; j < 3; j++) {
+            const cl_float3& vertex = mesh_vertices[mesh_indices[3 * i + j]];
+            centroid += glm::vec3(vertex.x, vertex.y, vertex.z) / 3.0f;
+        }
+        glm::vec3 cell = glm::clamp((centroid - bounds_min) * scale, glm::vec3(0.0f), glm::vec3((float)((1 << MORTON_BITS) - 1)));
+        face_codes[i] = std::make_pair((expandBits((cl_uint)cell.x) << 2) | (expandBits((cl_uint)cell.y) << 1) | expandBits((cl_uint)cell.z), i);
+    }
+    if(staging.reorder) std::sort(face_codes.begin(), face_codes.end()); // ties keep the file order
+    
+    // vertices with the same position and texture coords are merged
+    std::map<std::array<float, 5>, cl_uint> unique_vertices;
+    std::vector<cl_uint> canonical(vertex_count);
+    for(cl_uint i = 0; i < vertex_count; i++) {
+        std::array<float, 5> key = {{mesh_vertices[i].x, mesh_vertices[i].y, mesh_vertices[i].z, mesh_uvs[i].x, mesh_uvs[i].y}};
+        canonical[i] = unique_vertices.insert(std::make_pair(key, i)).first->second;
+    }
+    
+    std::vector<cl_uint> remap(vertex_count, (cl_uint)-1);
+    std::vector<cl_float3> new_vertices;
+    std::vector<cl_float2> new_uvs;
+    std::vector<cl_uint> new_indices;
+    new_vertices.reserve(unique_vertices.size());
+    new_uvs.reserve(unique_vertices.size());
+    new_indices.reserve(3 * face_count);
+    
+    for(const std::pair<cl_uint, cl_uint>& face_code : face_codes) {
+        for(int j = 0; j < 3; j++) {
+            cl_uint vertex_ID = canonical[mesh_indices[3 * face_code.second + j]];
+            if(remap[vertex_ID] == (cl_uint)-1) {
+                remap[vertex_ID] = (cl_uint)new_vertices.size();
+                new_vertices.push_back(mesh_vertices[vertex_ID]);
+                new_uvs.push_back(mesh_uvs[vertex_ID]);
+            }
+            new_indices.push_back(remap[vertex_ID]);
+        }
+    }
+    
+    staging.merged_vertex_count += vertex_count - (cl_uint)new_vertices.size();
+    
+    // the file order is measured on the merged vertices too, so only the order of the faces differs
+    std::vector<cl_uint> file_indices(3 * face_count);
+    for(cl_uint i = 0; i < 3 * face_count; i++) file_indices[i] = canonical[mesh_indices[i]];
+    measureChunks(mesh_vertices, vertex_count, file_indices, staging.chunk_counts[0], staging.chunk_vertex_counts[0], staging.chunk_extents[0]);
+    measureChunks(&new_vertices[0], (cl_uint)new_vertices.size(), new_indices, staging.chunk_counts[1], staging.chunk_vertex_counts[1], staging.chunk_extents[1]);
+    
+    staging.vertices.resize(vertex_anchor);
+    staging.vertices.insert(staging.vertices.end(), new_vertices.begin(), new_vertices.end());
+    staging.texture_uv.resize(vertex_anchor);
+    staging.texture_uv.insert(staging.texture_uv.end(), new_uvs.begin(), new_uvs.end());
+    std::copy(new_indices.begin(), new_indices.end(), staging.indices.begin() + index_anchor);
+}
+
+// plane quadric of the edge collapse simplification, the upper triangle of the symmetric 4x4 matrix
+struct ErrorQuadric {
+    double q[10] = {0.0};
+    
+    void addPlane(const glm::dvec3& n, double d, double weight) {
+        double plane[4] = {n.x, n.y, n.z, d};
+        for(int i = 0, k = 0; i < 4; i++) {
+            for(int j = i; j < 4; j++) q[k++] += weight * plane[i] * plane[j];
+        }
+    }
+    
+    void add(const ErrorQuadric& other) {
+        for(int i = 0; i < 10; i++) q[i] += other.q[i];
+    }
+    
+    double getError(const glm::dvec3& v) const {
+        return q[0] * v.x * v.x + 2.0 * q[1] * v.x * v.y + 2.0 * q[2] * v.x * v.z + 2.0 * q[3] * v.x
+            + q[4] * v.y * v.y + 2.0 * q[5] * v.y * v.z + 2.0 * q[6] * v.y
+            + q[7] * v.z * v.z + 2.0 * q[8] * v.z + q[9];
+    }
+};
+
+struct EdgeCollapse {
+    double error;
+    cl_uint a, b; // b is moved into a
+    cl_uint version_a, version_b; // the collapse is stale once either vertex changed
+    glm::dvec3 target;
+    
+    bool operator>(const EdgeCollapse& other) const { return error > other.error; }
+};
+
+// collapses the cheapest edges of a triangle mesh until it has at most target_count faces, appends the result to the staging
+Mesh simplifyMesh(ModelStaging& staging, const Mesh& source, cl_uint target_count) {
+    std::vector<cl_uint> source_indices(staging.indices.begin() + source.index_anchor, staging.indices.begin() + source.index_anchor + 3 * source.face_count); // the staging grows below
+    
+    // the collapses work on the positions, the seams of the texture coords are welded
+    std::map<std::array<float, 3>, cl_uint> unique_positions;
+    std::vector<cl_uint> weld(3 * source.face_count);
+    std::vector<glm::dvec3> positions;
+    for(cl_uint i = 0; i < 3 * source.face_count; i++) {
+        const cl_float3& vertex = staging.vertices[source.vertex_anchor + source_indices[i]];
+        auto inserted = unique_positions.insert(std::make_pair(std::array<float, 3>{{vertex.x, vertex.y, vertex.z}}, (cl_uint)positions.size()));
+        if(inserted.second) positions.push_back(glm::dvec3(vertex.x, vertex.y, vertex.z));
+        weld[i] = inserted.first->second;
+    }
+    
+    cl_uint vertex_count = (cl_uint)positions.size();
+    std::vector<std::array<cl_uint, 3>> faces(source.face_count);
+    std::vector<bool> face_removed(source.face_count, false);
+    std::vector<std::vector<cl_uint>> vertex_faces(vertex_count);
+    std::vector<ErrorQuadric> quadrics(vertex_count);
+    std::map<std::pair<cl_uint, cl_uint>, cl_uint> edge_uses;
+    
+    for(cl_uint f = 0; f < source.face_count; f++) {
+        faces[f] = {{weld[3 * f], weld[3 * f + 1], weld[3 * f + 2]}};
+        
+        glm::dvec3 normal = glm::cross(positions[faces[f][1]] - positions[faces[f][0]], positions[faces[f][2]] - positions[faces[f][0]]);
+        double area = glm::length(normal);
+        if(area > 0.0) normal /= area;
+        
+        for(int j = 0; j < 3; j++) {
+            vertex_faces[faces[f][j]].push_back(f);
+            quadrics[faces[f][j]].addPlane(normal, -glm::dot(normal, positions[faces[f][0]]), area);
+            
+            cl_uint u = faces[f][j], v = faces[f][(j + 1) % 3];
+            edge_uses[std::make_pair(std::min(u, v), std::max(u, v))]++;
+        }
+    }
+    
+    // the open edges get a plane perpendicular to their face, so the silhouette of the boundary stays
+    for(cl_uint f = 0; f < source.face_count; f++) {
+        glm::dvec3 normal = glm::cross(positions[faces[f][1]] - positions[faces[f][0]], positions[faces[f][2]] - positions[faces[f][0]]);
+        if(glm::length(normal) == 0.0) continue;
+        
+        for(int j = 0; j < 3; j++) {
+            cl_uint u = faces[f][j], v = faces[f][(j + 1) % 3];
+            if(edge_uses[std::make_pair(std::min(u, v), std::max(u, v))] != 1) continue;
+            
+            glm::dvec3 edge = positions[v] - positions[u];
+            glm::dvec3 side = glm::cross(edge, normal);
+            double length = glm::length(side);
+            if(length == 0.0) continue;
+            side /= length;
+            
+            ErrorQuadric boundary;
+            boundary.addPlane(side, -glm::dot(side, positions[u]), LOD_BOUNDARY_WEIGHT * glm::dot(edge, edge));
+            quadrics[u].add(boundary);
+            quadrics[v].add(boundary);
+        }
+    }
+    
+    std::vector<cl_uint> versions(vertex_count, 0);
+    std::vector<bool> vertex_removed(vertex_count, false);
+    std::priority_queue<EdgeCollapse, std::vector<EdgeCollapse>, std::greater<EdgeCollapse>> collapses;
+    
+    auto pushCollapse = [&](cl_uint a, cl_uint b) {
+        ErrorQuadric quadric = quadrics[a];
+        quadric.add(quadrics[b]);
+        
+        // the cheapest of the two ends and the midpoint
+        glm::dvec3 candidates[3] = {positions[a], positions[b], 0.5 * (positions[a] + positions[b])};
+        EdgeCollapse collapse = {quadric.getError(candidates[0]), a, b, versions[a], versions[b], candidates[0]};
+        for(int i = 1; i < 3; i++) {
+            double error = quadric.getError(candidates[i]);
+            if(error < collapse.error) {
+                collapse.error = error;
+                collapse.target = candidates[i];
+            }
+        }
+        collapses.push(collapse);
+    };
+    
+    for(const auto& edge_use : edge_uses) pushCollapse(edge_use.first.first, edge_use.first.second);
+    
+    cl_uint face_count = source.face_count;
+    std::vector<cl_uint> neighbours;
+    
+    while(face_count > target_count && !collapses.empty()) {
+        EdgeCollapse collapse = collapses.top();
+        collapses.pop();
+        
+        cl_uint a = collapse.a, b = collapse.b;
+        if(vertex_removed[a] || vertex_removed[b] || versions[a] != collapse.version_a || versions[b] != collapse.version_b) continue;
+        
+        // reject the collapse if a remaining face would flip or degenerate
+        bool valid = true;
+        for(cl_uint moved : {a, b}) {
+            for(cl_uint f : vertex_faces[moved]) {
+                const std::array<cl_uint, 3>& face = faces[f];
+                if(face_removed[f] || (std::find(face.begin(), face.end(), a) != face.end() && std::find(face.begin(), face.end(), b) != face.end())) continue;
+                
+                glm::dvec3 corners[3], moved_corners[3];
+                for(int j = 0; j < 3; j++) {
+                    corners[j] = positions[face[j]];
+                    moved_corners[j] = face[j] == moved ? collapse.target : corners[j];
+                }
+                glm::dvec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+                glm::dvec3 moved_normal = glm::cross(moved_corners[1] - moved_corners[0], moved_corners[2] - moved_corners[0]);
+                double lengths = glm::length(normal) * glm::length(moved_normal);
+                if(lengths == 0.0 || glm::dot(normal, moved_normal) < LOD_FLIP_COSINE * lengths) {
+                    valid = false;
+                    break;
+                }
+            }
+            if(!valid) break;
+        }
+        if(!valid) continue;
+        
+        positions[a] = collapse.target;
+        quadrics[a].add(quadrics[b]);
+        vertex_removed[b] = true;
+        versions[a]++;
+        
+        for(cl_uint f : vertex_faces[b]) {
+            if(face_removed[f]) continue;
+            std::array<cl_uint, 3>& face = faces[f];
+            if(std::find(face.begin(), face.end(), a) != face.end()) {
+                face_removed[f] = true; // the collapsed edge was one of its sides
+                face_count--;
+            } else {
+                *std::find(face.begin(), face.end(), b) = a;
+                vertex_faces[a].push_back(f);
+            }
+        }
+        vertex_faces[b].clear();
+        vertex_faces[a].erase(std::remove_if(vertex_faces[a].begin(), vertex_faces[a].end(), [&face_removed](cl_uint f) { return face_removed[f]; }), vertex_faces[a].end());
+        
+        neighbours.clear();
+        for(cl_uint f : vertex_faces[a]) {
+            for(cl_uint v : faces[f]) if(v != a) neighbours.push_back(v);
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        for(cl_uint v : neighbours) pushCollapse(a, v);
+    }
+    
+    // a corner keeps the texture coords of its source vertex and takes the position of the vertex it was collapsed into
+    cl_uint vertex_anchor = (cl_uint)staging.vertices.size();
+    cl_uint index_anchor = (cl_uint)staging.indices.size();
+    std::map<std::pair<cl_uint, cl_uint>, cl_uint> corners;
+    
+    for(cl_uint f = 0; f < source.face_count; f++) {
+        if(face_removed[f]) continue;
+        
+        for(int j = 0; j < 3; j++) {
+            cl_uint source_vertex = source_indices[3 * f + j];
+            auto inserted = corners.insert(std::make_pair(std::make_pair(faces[f][j], source_vertex), (cl_uint)corners.size()));
+            if(inserted.second) {
+                const glm::dvec3& position = positions[faces[f][j]];
+                cl_float2 uv = staging.texture_uv[source.vertex_anchor + source_vertex];
+                staging.vertices.push_back({{(float)position.x, (float)position.y, (float)position.z}});
+                staging.texture_uv.push_back(uv);
+            }
+            staging.indices.push_back(inserted.first->second);
+        }
+    }
+    
+    optimizeMesh(staging, vertex_anchor, index_anchor, face_count);
+    
+    return Mesh(vertex_anchor, index_anchor, face_count, source.texture_ID);
+}
+
+// appends up to level_count levels, every one simplified from the previous, until the model is small enough
+void generateLODs(ModelStaging& staging, cl_uint level_count) {
+    for(cl_uint level = 1; level <= level_count && staging.lod_anchors.size() < MAX_LOD_LEVELS; level++) {
+        cl_uint first_mesh = staging.lod_anchors.back(), mesh_end = (cl_uint)staging.meshes.size();
+        size_t vertex_end = staging.vertices.size(), index_end = staging.indices.size();
+        
+        cl_uint source_count = 0, simplified_count = 0;
+        for(cl_uint mesh_ID = first_mesh; mesh_ID < mesh_end; mesh_ID++) source_count += staging.meshes[mesh_ID].face_count;
+        if(source_count < LOD_MIN_FACES) break;
+        
+        staging.lod_anchors.push_back(mesh_end);
+        for(cl_uint mesh_ID = first_mesh; mesh_ID < mesh_end; mesh_ID++) {
+            Mesh source = staging.meshes[mesh_ID]; // a copy, the meshes grow
+            cl_uint source_index_end = mesh_ID + 1 < mesh_end ? staging.meshes[mesh_ID + 1].index_anchor : (cl_uint)index_end;
+            
+            // points and lines stay as they are
+            Mesh mesh = source_index_end - source.index_anchor == 3 * source.face_count ? simplifyMesh(staging, source, (cl_uint)(LOD_REDUCTION * source.face_count)) : source;
+            simplified_count += mesh.face_count;
+            staging.meshes.push_back(mesh);
+        }
+        
+        if(simplified_count > LOD_MIN_GAIN * source_count) {
+            // the collapses ran out, the level would not be worth its memory
+            staging.lod_anchors.pop_back();
+            staging.meshes.erase(staging.meshes.begin() + mesh_end, staging.meshes.end());
+            staging.vertices.resize(vertex_end);
+            staging.texture_uv.resize(vertex_end);
+            staging.indices.resize(index_end);
+            break;
+        }
+    }
+}
+
+template <typename V>
+inline cl_float3 transformVertex(const V& vertex, const glm::mat4& transform) {
     cl_float3 temp;
     temp.x = transform[0][0] * vertex.x + transform[1][0] * vertex.y + transform[2][0] * vertex.z + transform[3][0];
     temp.y = transform[0][1] * vertex.x + transform[1][1] * vertex.y + transform[2][1] * vertex.z + transform[3][1];
@@ -231,9 +1416,9 @@ inline cl_float3 transformVertex(const aiVector3D& vertex, const glm::mat4& tran
     return temp;
 }
 
-Mesh SceneCreator::processMesh(aiMesh* mesh, const aiScene* scene, cl_uint mat_ID, const glm::mat4& transform) {
-    cl_uint index_anchor = (cl_uint)indices.size();
-    cl_uint vertex_anchor = (cl_uint)vertices.size();
+Mesh SceneCreator::processMesh(aiMesh* mesh, const aiScene* scene, ModelStaging& staging, const glm::mat4& transform) const {
+    cl_uint index_anchor = (cl_uint)staging.indices.size();
+    cl_uint vertex_anchor = (cl_uint)staging.vertices.size();
     cl_uint face_count = 0;
     
     // load vertices, texture coords, indices
@@ -241,29 +1426,29 @@ Mesh SceneCreator::processMesh(aiMesh* mesh, const aiScene* scene, cl_uint mat_I
     for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
         cl_float3 vertex = transformVertex(mesh->mVertices[i], transform);
         
-        vertices.push_back(vertex);
+        staging.vertices.push_back(vertex);
         
+        cl_float2 uv = {{0.0f, 0.0f}}; // keep the texture coords aligned with the vertices
         if(mesh->mTextureCoords[0]) { // does the mesh contain texture coordinates?
-            cl_float2 uv;
             uv.x = mesh->mTextureCoords[0][i].x;
             uv.y = mesh->mTextureCoords[0][i].y;
-            
-            texture_uv.push_back(uv);
         }
+        
+        staging.texture_uv.push_back(uv);
     }
     
     for(cl_uint i = 0; i < mesh->mNumFaces; i++) {
         aiFace face = mesh->mFaces[i];
         face_count++;
         
-        for(cl_uint j = 0; j < face.mNumIndices; j++) indices.push_back((cl_uint)face.mIndices[j]);
+        for(cl_uint j = 0; j < face.mNumIndices; j++) staging.indices.push_back((cl_uint)face.mIndices[j]);
     }
     
-    // load texture
+    // load texture, the ID indexes the texture paths of the staging until the model is merged
     
     cl_uint texture_ID = -1;
     
-    if(materials[mat_ID].type == t_textured) {
+    if(materials[staging.mat_ID].type == t_textured) {
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         
         unsigned int texture_count = material->GetTextureCount(aiTextureType_DIFFUSE);
@@ -273,16 +1458,16 @@ Mesh SceneCreator::processMesh(aiMesh* mesh, const aiScene* scene, cl_uint mat_I
             material->GetTexture(aiTextureType_DIFFUSE, 0, &str);
             
             bool skip = false;
-            for(unsigned int j = 0; j < texture_paths.size(); j++) {
-                if(std::strcmp(texture_paths[j].c_str(), str.C_Str()) == 0) {
+            for(unsigned int j = 0; j < staging.texture_paths.size(); j++) {
+                if(std::strcmp(staging.texture_paths[j].c_str(), str.C_Str()) == 0) {
                     texture_ID = j;
                     skip = true;
                     break;
                 }
             }
             if(!skip) {
-                texture_ID = (cl_uint)texture_paths.size();
-                texture_paths.push_back(std::string(str.C_Str()));
+                texture_ID = (cl_uint)staging.texture_paths.size();
+                staging.texture_paths.push_back(std::string(str.C_Str()));
             }
         } else if(texture_count == 0) {
             processError("ERROR: MESH HAS NO TEXTURE APPLIED, USE A DIFFERENT MATERIAL");
@@ -291,12 +1476,98 @@ Mesh SceneCreator::processMesh(aiMesh* mesh, const aiScene* scene, cl_uint mat_I
         }
     }
     
+    optimizeMesh(staging, vertex_anchor, index_anchor, face_count);
+    
     return Mesh(vertex_anchor, index_anchor, face_count, texture_ID);
 }
 
+void SceneCreator::processOBJ(const ObjFile& file, ModelStaging& staging, const glm::mat4& transform) const {
+    std::vector<std::vector<const ObjRun*>> material_runs(file.material_names.size());
+    for(const ObjRun& run : file.runs) material_runs[run.material].push_back(&run);
+    
+    // a vertex for every pair of a position and texture coords used by the mesh, most positions have one
+    std::vector<ObjCorner> first_use(file.positions.size(), {OBJ_NO_INDEX, OBJ_NO_INDEX}); // the vertex and the texture coords it was made with
+    std::unordered_map<uint64_t, cl_uint> seams; // the vertices of the other pairs
+    std::vector<cl_uint> used_positions;
+    
+    auto addVertex = [&](const ObjCorner& corner) {
+        staging.vertices.push_back(transformVertex(file.positions[corner.position], transform));
+        
+        cl_float2 uv = {{0.0f, 0.0f}};
+        if(corner.uv != OBJ_NO_INDEX) {
+            uv.x = file.uvs[corner.uv].x;
+            uv.y = 1.0f - file.uvs[corner.uv].y; // as aiProcess_FlipUVs
+        }
+        staging.texture_uv.push_back(uv);
+        
+        return (cl_uint)staging.vertices.size() - 1;
+    };
+    
+    for(cl_uint material = 0; material < material_runs.size(); material++) {
+        if(material_runs[material].empty()) continue;
+        
+        cl_uint index_anchor = (cl_uint)staging.indices.size();
+        cl_uint vertex_anchor = (cl_uint)staging.vertices.size();
+        cl_uint face_count = 0;
+        
+        for(const ObjRun* run : material_runs[material]) {
+            for(size_t i = 3 * run->first_face; i < 3 * (run->first_face + run->face_count); i++) {
+                const ObjCorner& corner = file.corners[i];
+                ObjCorner& used = first_use[corner.position];
+                
+                cl_uint vertex_ID;
+                if(used.position == OBJ_NO_INDEX) {
+                    vertex_ID = addVertex(corner);
+                    used = {vertex_ID, corner.uv};
+                    used_positions.push_back(corner.position);
+                } else if(used.uv == corner.uv) vertex_ID = used.position;
+                else {
+                    auto found = seams.find(((uint64_t)corner.position << 32) | corner.uv);
+                    if(found == seams.end()) found = seams.insert({((uint64_t)corner.position << 32) | corner.uv, addVertex(corner)}).first;
+                    vertex_ID = found->second;
+                }
+                
+                staging.indices.push_back(vertex_ID - vertex_anchor);
+            }
+            face_count += (cl_uint)run->face_count;
+        }
+        
+        for(cl_uint position : used_positions) first_use[position] = {OBJ_NO_INDEX, OBJ_NO_INDEX};
+        used_positions.clear();
+        seams.clear();
+        
+        // the texture paths are kept as written in the library, like Assimp does
+        cl_uint texture_ID = -1;
+        
+        if(materials[staging.mat_ID].type == t_textured) {
+            auto texture = file.textures.find(file.material_names[material]);
+            if(texture == file.textures.end() || texture->second.empty()) processError("ERROR: MESH HAS NO TEXTURE APPLIED, USE A DIFFERENT MATERIAL");
+            
+            auto found = std::find(staging.texture_paths.begin(), staging.texture_paths.end(), texture->second);
+            texture_ID = (cl_uint)(found - staging.texture_paths.begin());
+            if(found == staging.texture_paths.end()) staging.texture_paths.push_back(texture->second);
+        }
+        
+        optimizeMesh(staging, vertex_anchor, index_anchor, face_count);
+        
+        staging.meshes.push_back(Mesh(vertex_anchor, index_anchor, face_count, texture_ID));
+    }
+}
+
 void SceneCreator::loadScene(const std::string& path) {
-    std::stringstream scene_data_stream;
+    std::vector<ModelRequest> requests;
+    parseScene(path, requests);
+    loadEnvironment();
     
+    auto time_start = std::chrono::high_resolution_clock::now();
+    loadModels(requests);
+    auto time_end = std::chrono::high_resolution_clock::now();
+    
+    if(requests.size() > 0)
+        std::cout << "SUCCESS: SCENE: LOADED " << requests.size() << " MODELS IN " << std::chrono::duration<double, std::milli>(time_end - time_start).count() << " ms USING " << pool.getThreadCount() << " THREADS" << std::endl;
+}
+
+void SceneData::parseScene(const std::string& path, std::vector<ModelRequest>& requests) {
     try {
         std::ifstream scene_file;
         scene_file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
@@ -313,9 +1584,11 @@ void SceneCreator::loadScene(const std::string& path) {
         const static std::sregex_token_iterator end;
         const static std::regex regex_delim(",(?![^(]*\\))");
         
-        enum LoadMode { l_none, l_materials, l_spheres, l_planes, l_lenses, l_models } lm = l_none;
+        enum LoadMode { l_none, l_materials, l_spheres, l_planes, l_lenses, l_boxes, l_cylinders, l_discs, l_quadrics, l_environment, l_lod, l_models } lm = l_none;
         MatType m_type;
         glm::mat4 model(1.0f);
+        std::vector<std::string> lod_paths;
+        cl_uint simplify_levels = LOD_DEFAULT_LEVELS;
         
         while(std::getline(scene_data_stream, line)) {
             pos = line.find('#');
@@ -338,6 +1611,24 @@ void SceneCreator::loadScene(const std::string& path) {
                 } else if(word.compare("LENSES") == 0) {
                     lm = l_lenses;
                     continue;
+                } else if(word.compare("BOXES") == 0) {
+                    lm = l_boxes;
+                    continue;
+                } else if(word.compare("CYLINDERS") == 0) {
+                    lm = l_cylinders;
+                    continue;
+                } else if(word.compare("DISCS") == 0) {
+                    lm = l_discs;
+                    continue;
+                } else if(word.compare("QUADRICS") == 0) {
+                    lm = l_quadrics;
+                    continue;
+                } else if(word.compare("ENVIRONMENT") == 0) {
+                    lm = l_environment;
+                    continue;
+                } else if(word.compare("LOD") == 0) {
+                    lm = l_lod;
+                    continue;
                 } else if(word.compare("MODELS") == 0) {
                     lm = l_models;
                     continue;
@@ -347,13 +1638,24 @@ void SceneCreator::loadScene(const std::string& path) {
                     
                     if(word.compare("translate") == 0)
                         model = glm::translate(model, getVec<glm::vec3>(iter, end));
-                    else if(word.compare("rotate") == 0)
-                        model = glm::rotate(model, glm::radians(getFloat(iter, end)), getVec<glm::vec3>(iter, end));
-                    else if(word.compare("scale") == 0)
+                    else if(word.compare("rotate") == 0) {
+                        float angle = getFloat(iter, end);
+                        model = glm::rotate(model, glm::radians(angle), getVec<glm::vec3>(iter, end));
+                    } else if(word.compare("scale") == 0)
                         model = glm::scale(model, getVec<glm::vec3>(iter, end));
+                    else if(word.compare("lod") == 0) {
+                        if(lod_paths.size() + 1 >= MAX_LOD_LEVELS) processError("ERROR: SCENE: MODELS: AT MOST " + std::to_string(MAX_LOD_LEVELS - 1) + " LOD FILES PER MODEL");
+                        lod_paths.push_back(getPath(iter, end));
+                    } else if(word.compare("simplify") == 0)
+                        simplify_levels = getUInt(iter, end);
                     else if(word.compare("load") == 0) {
-                        loadModel(getPath(iter, end), getUInt(iter, end), model);
+                        std::string model_path = getPath(iter, end);
+                        requests.push_back(ModelRequest(model_path, getUInt(iter, end), model));
+                        requests.back().lod_paths = lod_paths;
+                        requests.back().simplify_levels = simplify_levels;
                         model = glm::mat4(1.0f);
+                        lod_paths.clear();
+                        simplify_levels = LOD_DEFAULT_LEVELS;
                     }
                 } else {
                     processError("ERROR: SCENE: OPERATION " + word + " DOES NOT EXIST");
@@ -377,19 +1679,75 @@ void SceneCreator::loadScene(const std::string& path) {
                         }
                         iter++;
                         
-                        addMaterial(m_type, getVec<cl_float3>(iter, end), getFloat(iter, end));
+                        cl_float3 color = getVec<cl_float3>(iter, end);
+                        addMaterial(m_type, color, getFloat(iter, end));
                         break;
                     }
                     case l_spheres: {
-                        addSphere(getVec<cl_float3>(iter, end), getFloat(iter, end), getUInt(iter, end));
+                        // the parameters are read in order, the evaluation order of the arguments is unspecified
+                        cl_float3 pos = getVec<cl_float3>(iter, end);
+                        cl_float r = getFloat(iter, end);
+                        addSphere(pos, r, getUInt(iter, end));
                         break;
                     }
                     case l_planes: {
-                        addPlane(getVec<cl_float3>(iter, end), getVec<cl_float3>(iter, end), getUInt(iter, end));
+                        cl_float3 pos = getVec<cl_float3>(iter, end);
+                        cl_float3 normal = getVec<cl_float3>(iter, end);
+                        addPlane(pos, normal, getUInt(iter, end));
                         break;
                     }
                     case l_lenses: {
-                        addLens(getVec<cl_float3>(iter, end), getVec<cl_float3>(iter, end), getFloat(iter, end), getFloat(iter, end), getFloat(iter, end), getUInt(iter, end));
+                        cl_float3 pos = getVec<cl_float3>(iter, end);
+                        cl_float3 normal = getVec<cl_float3>(iter, end);
+                        cl_float r1 = getFloat(iter, end);
+                        cl_float r2 = getFloat(iter, end);
+                        cl_float h = getFloat(iter, end);
+                        addLens(pos, normal, r1, r2, h, getUInt(iter, end));
+                        break;
+                    }
+                    case l_boxes: {
+                        cl_float3 pos = getVec<cl_float3>(iter, end);
+                        cl_float3 size = getVec<cl_float3>(iter, end);
+                        cl_float3 rotation = getVec<cl_float3>(iter, end);
+                        addBox(pos, size, rotation, getUInt(iter, end));
+                        break;
+                    }
+                    case l_cylinders: {
+                        cl_float3 p1 = getVec<cl_float3>(iter, end);
+                        cl_float3 p2 = getVec<cl_float3>(iter, end);
+                        cl_float r = getFloat(iter, end);
+                        addCylinder(p1, p2, r, getUInt(iter, end));
+                        break;
+                    }
+                    case l_discs: {
+                        cl_float3 pos = getVec<cl_float3>(iter, end);
+                        cl_float3 normal = getVec<cl_float3>(iter, end);
+                        cl_float r = getFloat(iter, end);
+                        addDisc(pos, normal, r, getUInt(iter, end));
+                        break;
+                    }
+                    case l_quadrics: {
+                        cl_float3 pos = getVec<cl_float3>(iter, end);
+                        cl_float3 diag = getVec<cl_float3>(iter, end);
+                        cl_float3 cross = getVec<cl_float3>(iter, end);
+                        cl_float3 linear = getVec<cl_float3>(iter, end);
+                        cl_float constant = getFloat(iter, end);
+                        cl_float3 half_size = getVec<cl_float3>(iter, end);
+                        addQuadric(pos, diag, cross, linear, constant, half_size, getUInt(iter, end));
+                        break;
+                    }
+                    case l_environment: {
+                        if(!environment_path.empty()) processError("ERROR: SCENE: ENVIRONMENT: ONLY ONE MAP CAN BE SET");
+                        environment_path = getPath(iter, end);
+                        environment_intensity = getFloat(iter, end);
+                        environment_rotation = getFloat(iter, end);
+                        break;
+                    }
+                    case l_lod: {
+                        lod_primary_distance = getFloat(iter, end);
+                        lod_secondary_distance = getFloat(iter, end);
+                        if((lod_primary_distance != 0.0f && lod_primary_distance < 1.0f) || (lod_secondary_distance != 0.0f && lod_secondary_distance < 1.0f))
+                            processError("ERROR: SCENE: LOD: THE DISTANCES ARE IN MODEL RADII, 0 OR AT LEAST 1"); // closer, a ray leaving the model would test its own coarse level
                         break;
                     }
                     default:
@@ -411,7 +1769,7 @@ std::string getPath(std::sregex_token_iterator& iter, const std::sregex_token_it
     size_t pos_begin = word.find('\"'), pos_end = word.rfind('\"');
     
     iter++;
-    return word.substr(pos_begin + 1, pos_end - 2);
+    return word.substr(pos_begin + 1, pos_end - pos_begin - 1);
 }
 
 template <typename T>
@@ -452,10 +1810,215 @@ cl_float getFloat(std::sregex_token_iterator& iter, const std::sregex_token_iter
 
 cl_uint getUInt(std::sregex_token_iterator& iter, const std::sregex_token_iterator& end) {
     if(iter == end) processError("ERROR: SCENE: NOT ENOUGH PARAMETERS");
-    const static std::regex regex_uint("\\s*\\d\\s*");
+    const static std::regex regex_uint("\\s*\\d+\\s*");
     std::string word = *iter;
     if(!std::regex_match(word, regex_uint)) processError("ERROR: SCENE: IMPROPER UNSIGNED INT: " + word);
     
     iter++;
     return (cl_uint)std::stoul(word);
 }
+
+inline bool sameVec(const cl_float3& a, const cl_float3& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+inline bool sameObject(const Material& a, const Material& b) { return a.type == b.type && sameVec(a.color, b.color) && a.extra_data == b.extra_data; }
+inline bool sameObject(const Sphere& a, const Sphere& b) { return sameVec(a.pos, b.pos) && a.r == b.r && a.mat_ID == b.mat_ID; }
+inline bool sameObject(const Plane& a, const Plane& b) { return sameVec(a.pos, b.pos) && sameVec(a.normal, b.normal) && a.mat_ID == b.mat_ID; }
+inline bool sameObject(const Lens& a, const Lens& b) { return sameVec(a.pos, b.pos) && sameVec(a.p1, b.p1) && sameVec(a.p2, b.p2) && a.r1 == b.r1 && a.r2 == b.r2 && a.mat_ID == b.mat_ID; }
+inline bool sameObject(const Box& a, const Box& b) { return sameVec(a.pos, b.pos) && sameVec(a.half_size, b.half_size) && sameVec(a.axis_x, b.axis_x) && sameVec(a.axis_y, b.axis_y) && sameVec(a.axis_z, b.axis_z) && a.mat_ID == b.mat_ID; }
+inline bool sameObject(const Cylinder& a, const Cylinder& b) { return sameVec(a.p1, b.p1) && sameVec(a.p2, b.p2) && a.r == b.r && a.mat_ID == b.mat_ID; }
+inline bool sameObject(const Disc& a, const Disc& b) { return sameVec(a.pos, b.pos) && sameVec(a.normal, b.normal) && a.r == b.r && a.mat_ID == b.mat_ID; }
+inline bool sameObject(const Quadric& a, const Quadric& b) { return sameVec(a.pos, b.pos) && sameVec(a.diag, b.diag) && sameVec(a.cross, b.cross) && sameVec(a.linear, b.linear) && a.constant == b.constant && sameVec(a.bounds_min, b.bounds_min) && sameVec(a.bounds_max, b.bounds_max) && a.mat_ID == b.mat_ID; }
+inline bool sameObject(const Model& a, const Model& b) { return a.mesh_anchor == b.mesh_anchor && a.mesh_count == b.mesh_count && a.mat_ID == b.mat_ID; }
+
+inline bool sameTransform(const glm::mat4& a, const glm::mat4& b) {
+    for(int i = 0; i < 4; i++) {
+        for(int j = 0; j < 4; j++) {
+            if(a[i][j] != b[i][j]) return false;
+        }
+    }
+    return true;
+}
+
+// uploads the range between the first and the last changed object, returns the number of objects uploaded
+template <typename T>
+size_t updateRange(cl::CommandQueue& queue, DeviceArena& arena, SceneBlock block, std::vector<T>& live, const std::vector<T>& next, bool& resized, bool& grown) {
+    if(live.size() != next.size()) {
+        live = next;
+        if(arena.resize(queue, block, sizeof(T) * live.size(), false)) grown = true;
+        arena.write(queue, block, 0, sizeof(T) * live.size(), live.data());
+        resized = true;
+        return live.size();
+    }
+    
+    size_t first = live.size(), last = 0;
+    for(size_t i = 0; i < live.size(); i++) {
+        if(!sameObject(live[i], next[i])) {
+            first = std::min(first, i);
+            last = i;
+        }
+    }
+    if(first == live.size()) return 0;
+    
+    std::copy(next.begin() + first, next.begin() + last + 1, live.begin() + first);
+    arena.write(queue, block, first * sizeof(T), (last - first + 1) * sizeof(T), &live[first]);
+    
+    return last - first + 1;
+}
+
+void SceneData::swapEnvironmentMap(SceneData& other) {
+    std::swap(environment_width, other.environment_width);
+    std::swap(environment_height, other.environment_height);
+    environment_texels.swap(other.environment_texels);
+    environment_cdf.swap(other.environment_cdf);
+    std::swap(environment_weight_sum, other.environment_weight_sum);
+}
+
+bool SceneCreator::reloadScene(const std::string& path, cl::Context& context, cl::Device& device, bool& rebind) {
+    rebind = false;
+    
+    // the new scene is staged aside, the live one stays untouched until the new one is complete
+    SceneData next;
+    std::vector<ModelRequest> requests;
+    std::vector<std::vector<std::filesystem::file_time_type>> times;
+    std::vector<ModelStaging> stagings;
+    std::vector<std::future<ModelStaging>> imports;
+    bool geometry_changed, textures_edited = false;
+    
+    bool environment_changed, environment_loaded;
+    
+    try {
+        next.parseScene(path, requests);
+        
+        // the map is decoded again only if its file changed, the intensity and the rotation are in the header
+        next.environment_time = getWriteTime(next.environment_path);
+        environment_loaded = next.environment_path != environment_path || next.environment_time != environment_time;
+        if(environment_loaded) next.loadEnvironment();
+        environment_changed = environment_loaded || next.environment_intensity != environment_intensity || next.environment_rotation != environment_rotation;
+        
+        // the tiles of an edited texture are decoded again, its size may have changed too
+        for(size_t i = 0; i < texture_times.size(); i++) textures_edited |= getWriteTime(texture_paths[i]) != texture_times[i];
+        
+        // import again only the models whose file, transform or texturing changed
+        geometry_changed = requests.size() != model_requests.size() || textures_edited;
+        imports.resize(requests.size());
+        
+        for(size_t i = 0; i < requests.size(); i++) {
+            const ModelRequest& request = requests[i];
+            if(next.materials.size() <= request.mat_ID)
+                processError("ERROR: MATERIAL OF ID: " + std::to_string(request.mat_ID) + " DOES NOT EXIST");
+            
+            times.push_back(getWriteTimes(request));
+            
+            bool reuse = i < model_requests.size() && request.path == model_requests[i].path && sameTransform(request.transform, model_requests[i].transform) && times[i] == model_times[i] &&
+                request.lod_paths == model_requests[i].lod_paths && request.simplify_levels == model_requests[i].simplify_levels &&
+                (materials[model_requests[i].mat_ID].type == t_textured) == (next.materials[request.mat_ID].type == t_textured);
+            
+            if(!reuse) {
+                imports[i] = pool.submit([this, request]() { return importModel(request); });
+                geometry_changed = true;
+            }
+        }
+        
+        waitImports(imports);
+        for(size_t i = 0; i < requests.size(); i++) {
+            if(imports[i].valid()) stagings.push_back(imports[i].get());
+            else {
+                stagings.push_back(extractModel((cl_uint)i));
+                stagings.back().mat_ID = requests[i].mat_ID;
+            }
+        }
+    } catch(SceneError& e) {
+        waitImports(imports); // a request may fail after the imports of the earlier ones were queued
+        std::cerr << e.what() << std::endl;
+        std::cerr << "ERROR: SCENE: RELOAD FAILED, KEEPING THE CURRENT SCENE" << std::endl;
+        return false;
+    }
+    
+    size_t changed = 0;
+    
+    if(geometry_changed) {
+        // the chunks and the buffers are rebuilt, but only the changed models were imported
+        for(const ModelStaging& staging : stagings) next.mergeModel(staging);
+        next.model_requests = requests;
+        next.model_times = times;
+        
+        bool textures_changed = textures_edited || next.texture_paths != texture_paths;
+        if(!environment_loaded) next.swapEnvironmentMap(*this); // the same map, handed over rather than decoded again
+        
+        swapData(next); // next holds the previous scene until the new one is on the device
+        
+        try {
+            if(textures_changed) loadTextures(context, device);
+            
+            rebind = setupBuffers(context, device) || textures_changed;
+            createScene(context, device);
+        } catch(SceneError& e) {
+            std::cerr << e.what() << std::endl;
+            std::cerr << "ERROR: SCENE: RELOAD FAILED, KEEPING THE CURRENT SCENE" << std::endl;
+            
+            // the buffers may be half built, set them up again from the previous scene
+            swapData(next);
+            if(!environment_loaded) swapEnvironmentMap(next);
+            if(textures_changed) loadTextures(context, device);
+            
+            setupBuffers(context, device);
+            createScene(context, device);
+            rebind = true;
+            return false;
+        }
+        
+        changed = materials.size() + spheres.size() + planes.size() + lenses.size() + boxes.size() + cylinders.size() + discs.size() + quadrics.size() + models.size();
+    } else {
+        std::vector<Model> next_models;
+        for(size_t i = 0; i < requests.size(); i++) {
+            next_models.push_back(models[i]);
+            next_models.back().mat_ID = requests[i].mat_ID;
+        }
+        
+        cl::CommandQueue queue(context, device);
+        bool resized = false;
+        
+        changed += updateRange(queue, arena, b_materials, materials, next.materials, resized, rebind);
+        changed += updateRange(queue, arena, b_spheres, spheres, next.spheres, resized, rebind);
+        changed += updateRange(queue, arena, b_planes, planes, next.planes, resized, rebind);
+        changed += updateRange(queue, arena, b_lenses, lenses, next.lenses, resized, rebind);
+        changed += updateRange(queue, arena, b_boxes, boxes, next.boxes, resized, rebind);
+        changed += updateRange(queue, arena, b_cylinders, cylinders, next.cylinders, resized, rebind);
+        changed += updateRange(queue, arena, b_discs, discs, next.discs, resized, rebind);
+        changed += updateRange(queue, arena, b_quadrics, quadrics, next.quadrics, resized, rebind);
+        changed += updateRange(queue, arena, b_models, models, next_models, resized, rebind);
+        
+        if(environment_changed) {
+            environment_path = next.environment_path;
+            environment_intensity = next.environment_intensity;
+            environment_rotation = next.environment_rotation;
+            environment_time = next.environment_time;
+            
+            if(environment_loaded) {
+                swapEnvironmentMap(next);
+                if(arena.resize(queue, b_environment, getEnvironmentSize(), false)) rebind = true;
+                if(arena.resize(queue, b_environment_cdf, getEnvironmentCDFSize(), false)) rebind = true;
+                arena.write(queue, b_environment, 0, getEnvironmentSize(), environment_texels.data());
+                arena.write(queue, b_environment_cdf, 0, getEnvironmentCDFSize(), environment_cdf.data());
+            }
+            resized = true; // the header holds the size, the intensity and the rotation
+            changed++;
+        }
+        
+        if(next.lod_primary_distance != lod_primary_distance || next.lod_secondary_distance != lod_secondary_distance) {
+            lod_primary_distance = next.lod_primary_distance;
+            lod_secondary_distance = next.lod_secondary_distance;
+            resized = true; // the thresholds are in the header
+            changed++;
+        }
+        
+        model_requests = requests;
+        
+        if(resized) writeHeader(queue); // the blocks may have moved and the counts changed
+        queue.finish();
+    }
+    
+    return changed > 0;
+}
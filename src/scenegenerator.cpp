@@ -0,0 +1,235 @@
+//
+//  scenegenerator.cpp
+//  Non Euclidean
+//
+//  Writes procedural scene files of a chosen size for the scaling tests, the same seed gives the same file.
+//
+
+#include "scenegenerator.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <limits>
+#include <filesystem>
+
+inline unsigned int getCubeSide(unsigned int count) {
+    unsigned int side = 1;
+    while(side * side * side < count) side++;
+    return side;
+}
+
+static std::ostream& operator<<(std::ostream& out, const glm::vec3& v) {
+    return out << "(" << v.x << ", " << v.y << ", " << v.z << ")";
+}
+
+float SceneGenerator::getUniform(float min, float max) {
+    // not a std distribution, their output differs between the standard libraries
+    return min + (max - min) * (float)(random() >> 8) / 16777216.0f;
+}
+
+glm::vec3 SceneGenerator::getCellCentre(unsigned int i, unsigned int side) const {
+    float spacing = STRESS_FIELD_SIZE / side;
+    glm::vec3 cell(i % side, (i / side) % side, i / (side * side));
+    return (cell + glm::vec3(0.5f)) * spacing - glm::vec3(0.5f * STRESS_FIELD_SIZE);
+}
+
+void SceneGenerator::writeSetting(std::ostream& out, MaterialMix materials) {
+    out << "MATERIALS:" << std::endl;
+    
+    for(unsigned int i = 0; i < STRESS_PALETTE_SIZE; i++) {
+        glm::vec3 color(getUniform(0.2f, 1.0f), getUniform(0.2f, 1.0f), getUniform(0.2f, 1.0f));
+        
+        // the mixed one: half diffuse, a fifth reflective, the rest transparent
+        float choice = getUniform(0.0f, 1.0f);
+        if(materials == m_diffuse || (materials == m_mixed && choice < 0.5f)) out << "diffuse, " << color << ", 1";
+        else if(materials == m_specular || (materials == m_mixed && choice < 0.7f)) out << "reflective, " << color << ", " << getUniform(0.5f, 1.0f);
+        else if(choice < 0.85f) out << "refractive, " << glm::mix(color, glm::vec3(1.0f), 0.7f) << ", " << getUniform(1.3f, 1.8f);
+        else out << "dielectric, " << glm::mix(color, glm::vec3(1.0f), 0.7f) << ", " << getUniform(1.3f, 1.8f);
+        
+        out << "   #" << i << std::endl;
+    }
+    
+    out << "diffuse, (1, 1, 1), 1   #" << STRESS_PALETTE_SIZE << " ground" << std::endl;
+    out << "light, (1, 1, 1), 0   #" << STRESS_PALETTE_SIZE + 1 << " light" << std::endl;
+    out << std::endl;
+    
+    // the ground below and the light above the field, the y axis points down
+    out << "PLANES:" << std::endl;
+    out << glm::vec3(0.0f, 0.5f * STRESS_FIELD_SIZE + 1.0f, 0.0f) << ", (0, 1, 0), " << STRESS_PALETTE_SIZE << std::endl;
+    out << std::endl;
+    
+    out << "SPHERES:" << std::endl;
+    out << "(0, -200, 0), 100, " << STRESS_PALETTE_SIZE + 1 << std::endl;
+}
+
+size_t SceneGenerator::writeGrid(std::ostream& out, const StressParams& params) {
+    unsigned int side = getCubeSide(params.count);
+    float r = STRESS_FILL * STRESS_FIELD_SIZE / side;
+    
+    for(unsigned int i = 0; i < params.count; i++) out << getCellCentre(i, side) << ", " << r << ", " << random() % STRESS_PALETTE_SIZE << std::endl;
+    
+    return params.count;
+}
+
+size_t SceneGenerator::writeCloud(std::ostream& out, const StressParams& params) {
+    // the same mean radius as in the grid, the spheres may overlap
+    float r = STRESS_FILL * STRESS_FIELD_SIZE / std::cbrt((float)params.count);
+    float half_size = 0.5f * STRESS_FIELD_SIZE;
+    
+    for(unsigned int i = 0; i < params.count; i++) {
+        glm::vec3 pos(getUniform(-half_size, half_size), getUniform(-half_size, half_size), getUniform(-half_size, half_size));
+        float sphere_r = r * getUniform(0.5f, 1.5f);
+        out << pos << ", " << sphere_r << ", " << random() % STRESS_PALETTE_SIZE << std::endl;
+    }
+    
+    return params.count;
+}
+
+size_t SceneGenerator::writeLenses(std::ostream& out, const StressParams& params) {
+    // layers of lenses facing the camera, every ray crosses many of them
+    unsigned int side = getCubeSide(params.count);
+    float h = STRESS_FILL * STRESS_FIELD_SIZE / side;
+    
+    out << std::endl;
+    
+    out << "LENSES:" << std::endl;
+    for(unsigned int i = 0; i < params.count; i++) {
+        glm::vec3 normal = glm::normalize(glm::vec3(getUniform(-0.2f, 0.2f), getUniform(-0.2f, 0.2f), -1.0f));
+        float r1 = h * getUniform(1.2f, 3.0f);
+        float r2 = h * getUniform(1.2f, 3.0f);
+        out << getCellCentre(i, side) << ", " << normal << ", " << r1 << ", " << r2 << ", " << h << ", " << random() % STRESS_PALETTE_SIZE << std::endl;
+    }
+    
+    return params.count;
+}
+
+size_t SceneGenerator::writeModels(std::ostream& out, const StressParams& params) {
+    glm::vec3 centre;
+    float model_r;
+    size_t triangle_count;
+    if(!readModelInfo(params.model_path, centre, model_r, triangle_count)) {
+        std::cerr << "ERROR: SCENE GENERATOR: CANNOT READ THE MODEL " << params.model_path << std::endl;
+        return 0;
+    }
+    
+    unsigned int side = getCubeSide(params.count);
+    float scale = STRESS_FILL * STRESS_FIELD_SIZE / side / model_r;
+    
+    out << std::endl;
+    
+    // every instance is imported on its own, so the geometry grows with the count
+    out << "MODELS:" << std::endl;
+    for(unsigned int i = 0; i < params.count; i++) {
+        out << "translate: " << getCellCentre(i, side) << std::endl;
+        out << "rotate: " << getUniform(0.0f, 360.0f) << ", (0, 1, 0)" << std::endl;
+        out << "scale: " << glm::vec3(scale) << std::endl;
+        out << "translate: " << -centre << std::endl;
+        out << "load: \"" << params.model_path << "\", " << random() % STRESS_PALETTE_SIZE << std::endl;
+    }
+    
+    return params.count * triangle_count;
+}
+
+bool SceneGenerator::readModelInfo(const std::string& path, glm::vec3& centre, float& radius, size_t& triangle_count) {
+    // the bounds and the triangles of a Wavefront file, the faces with more vertices are split into fans
+    std::ifstream file(path);
+    if(!file) return false;
+    
+    glm::vec3 bounds_min(std::numeric_limits<float>::max()), bounds_max(-std::numeric_limits<float>::max());
+    triangle_count = 0;
+    
+    std::string line, word;
+    while(std::getline(file, line)) {
+        std::istringstream values(line);
+        if(!(values >> word)) continue;
+        
+        if(word.compare("v") == 0) {
+            glm::vec3 vertex;
+            if(!(values >> vertex.x >> vertex.y >> vertex.z)) return false;
+            bounds_min = glm::min(bounds_min, vertex);
+            bounds_max = glm::max(bounds_max, vertex);
+        } else if(word.compare("f") == 0) {
+            size_t corners = 0;
+            while(values >> word) corners++;
+            if(corners >= 3) triangle_count += corners - 2;
+        }
+    }
+    
+    if(triangle_count == 0 || bounds_min.x > bounds_max.x) return false;
+    
+    centre = 0.5f * (bounds_min + bounds_max);
+    radius = std::max(0.5f * glm::length(bounds_max - bounds_min), 1e-6f);
+    return true;
+}
+
+size_t SceneGenerator::generate(const StressParams& params, const std::string& path) {
+    random.seed(params.seed);
+    
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(4); // the scene parser takes no exponents
+    out << "# Generated: " << getLayoutName(params.layout) << ", " << params.count << " objects, " << getMixName(params.materials) << " materials, seed " << params.seed << std::endl;
+    out << std::endl;
+    
+    writeSetting(out, params.materials);
+    
+    size_t primitive_count = 0;
+    switch(params.layout) {
+        case s_grid:
+            primitive_count = writeGrid(out, params);
+            break;
+        case s_cloud:
+            primitive_count = writeCloud(out, params);
+            break;
+        case s_lenses:
+            primitive_count = writeLenses(out, params);
+            break;
+        case s_models:
+            primitive_count = writeModels(out, params);
+            break;
+    }
+    if(primitive_count == 0) return 0;
+    
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if(!parent.empty()) std::filesystem::create_directories(parent);
+    
+    std::ofstream file(path);
+    if(!(file << out.str())) {
+        std::cerr << "ERROR: SCENE GENERATOR: CANNOT WRITE " << path << std::endl;
+        return 0;
+    }
+    
+    return primitive_count;
+}
+
+bool SceneGenerator::parseLayout(const std::string& name, StressLayout& layout) {
+    for(int i = s_grid; i <= s_models; i++) {
+        if(name.compare(getLayoutName((StressLayout)i)) == 0) {
+            layout = (StressLayout)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SceneGenerator::parseMix(const std::string& name, MaterialMix& materials) {
+    for(int i = m_diffuse; i <= m_mixed; i++) {
+        if(name.compare(getMixName((MaterialMix)i)) == 0) {
+            materials = (MaterialMix)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* SceneGenerator::getLayoutName(StressLayout layout) {
+    const char* names[] = {"grid", "cloud", "lenses", "models"};
+    return names[layout];
+}
+
+const char* SceneGenerator::getMixName(MaterialMix materials) {
+    const char* names[] = {"diffuse", "specular", "glass", "mixed"};
+    return names[materials];
+}
@@ -0,0 +1,119 @@
+//
+//  scenewatcher.cpp
+//  Non Euclidean
+//
+//  Reports changes of the scene file and of the model files it loads.
+//
+
+#include "scenewatcher.h"
+
+#include <iostream>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h>
+#endif
+
+inline std::filesystem::file_time_type getModifiedTime(const std::string& path) {
+    std::error_code error;
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+    return error ? std::filesystem::file_time_type::min() : time;
+}
+
+SceneWatcher::SceneWatcher() : last_poll(std::chrono::steady_clock::now()) {
+#ifdef __linux__
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd < 0) std::cerr << "ERROR: SCENE WATCHER: INOTIFY UNAVAILABLE, POLLING THE FILES" << std::endl;
+#endif
+}
+
+SceneWatcher::~SceneWatcher() {
+#ifdef __linux__
+    if(inotify_fd >= 0) close(inotify_fd);
+#endif
+}
+
+void SceneWatcher::watch(const std::string& path) {
+    std::string full_path = std::filesystem::absolute(path).lexically_normal().string();
+    for(const WatchedFile& file : files) {
+        if(file.path == full_path) return;
+    }
+    files.push_back({full_path, getModifiedTime(full_path)});
+
+#ifdef __linux__
+    if(inotify_fd < 0) return;
+    
+    // editors often replace the file instead of writing it, so the directory is watched
+    std::string dir = std::filesystem::path(full_path).parent_path().string();
+    if(std::find(watch_dirs.begin(), watch_dirs.end(), dir) != watch_dirs.end()) return;
+    
+    int descriptor = inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(descriptor < 0) {
+        std::cerr << "ERROR: SCENE WATCHER: CANNOT WATCH " << dir << std::endl;
+        return;
+    }
+    watch_descriptors.push_back(descriptor);
+    watch_dirs.push_back(dir);
+#endif
+}
+
+void SceneWatcher::clear() {
+#ifdef __linux__
+    for(int descriptor : watch_descriptors) inotify_rm_watch(inotify_fd, descriptor);
+#endif
+    watch_descriptors.clear();
+    watch_dirs.clear();
+    files.clear();
+}
+
+bool SceneWatcher::poll() {
+    if(inotify_fd >= 0) return pollEvents();
+    
+    auto now = std::chrono::steady_clock::now();
+    if(std::chrono::duration<double>(now - last_poll).count() < WATCH_POLL_INTERVAL) return false;
+    last_poll = now;
+    
+    return pollTimes();
+}
+
+bool SceneWatcher::pollTimes() {
+    bool changed = false;
+    for(WatchedFile& file : files) {
+        std::filesystem::file_time_type time = getModifiedTime(file.path);
+        if(time != file.time) {
+            file.time = time;
+            changed = true;
+        }
+    }
+    
+    return changed;
+}
+
+bool SceneWatcher::pollEvents() {
+    bool changed = false;
+
+#ifdef __linux__
+    alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+    ssize_t length;
+    
+    while((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for(char* ptr = buffer; ptr < buffer + length; ptr += sizeof(inotify_event) + ((inotify_event*)ptr)->len) {
+            const inotify_event* event = (const inotify_event*)ptr;
+            if(event->len == 0) continue;
+            
+            size_t dir_ID = std::find(watch_descriptors.begin(), watch_descriptors.end(), event->wd) - watch_descriptors.begin();
+            if(dir_ID == watch_descriptors.size()) continue;
+            
+            std::string path = (std::filesystem::path(watch_dirs[dir_ID]) / event->name).string();
+            for(const WatchedFile& file : files) {
+                if(file.path == path) changed = true;
+            }
+        }
+    }
+#endif
+    
+    // several events arrive for one save, the times tell if the content really changed
+    return changed && pollTimes();
+}
@@ -0,0 +1,60 @@
+//
+//  threadpool.cpp
+//  Non Euclidean
+//
+//  A fixed set of worker threads executing queued tasks.
+//
+
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int thread_count) : stopping(false) {
+    if(thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+    
+    for(unsigned int i = 0; i < thread_count; i++) workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+ThreadPool& ThreadPool::getShared() {
+    // every scene and render job queues on the same workers instead of starting a thread per core each
+    static ThreadPool shared;
+    return shared;
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        stopping = true;
+    }
+    tasks_condition.notify_all();
+    
+    for(std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::work() {
+    while(true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(tasks_mutex);
+            tasks_condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if(stopping && tasks.empty()) return;
+            
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+bool ThreadPool::runPending() {
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        if(tasks.empty()) return false;
+        
+        task = std::move(tasks.front());
+        tasks.pop();
+    }
+    task();
+    return true;
+}